@@ -0,0 +1,208 @@
+#ifndef TRIAL_DATAGRAM_BENCHMARK_HPP
+#define TRIAL_DATAGRAM_BENCHMARK_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Utilities shared by the benchmark programs.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace benchmark
+{
+
+// Number of calls to the global operator new, which is replaced by
+// allocation.cpp
+
+std::atomic<std::uint64_t>& allocation_count();
+
+// Command-line arguments of the form --name value
+
+class arguments
+{
+public:
+    arguments(int argc, char *argv[])
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string name(argv[i]);
+            if ((name.size() < 3) || (name.compare(0, 2, "--") != 0))
+                throw std::invalid_argument("unexpected argument " + name);
+            name.erase(0, 2);
+            if (name == "json")
+            {
+                values[name] = "1";
+                continue;
+            }
+            if (i + 1 >= argc)
+                throw std::invalid_argument("missing value for --" + name);
+            values[name] = argv[++i];
+        }
+    }
+
+    long get(const std::string& name, long fallback)
+    {
+        used.push_back(name);
+        auto where = values.find(name);
+        return (where == values.end()) ? fallback : std::stol(where->second);
+    }
+
+    std::string get(const std::string& name, const std::string& fallback)
+    {
+        used.push_back(name);
+        auto where = values.find(name);
+        return (where == values.end()) ? fallback : where->second;
+    }
+
+    bool flag(const std::string& name)
+    {
+        used.push_back(name);
+        return values.count(name) > 0;
+    }
+
+    // Reject misspelled options
+    void check() const
+    {
+        for (const auto& value : values)
+        {
+            if (std::find(used.begin(), used.end(), value.first) == used.end())
+                throw std::invalid_argument("unknown option --" + value.first);
+        }
+    }
+
+private:
+    std::map<std::string, std::string> values;
+    std::vector<std::string> used;
+};
+
+// Results as ordered name-value pairs, written either as text or as a
+// single-line JSON object so that runs can be collected and compared.
+
+class report
+{
+public:
+    explicit report(std::string name)
+        : name(std::move(name))
+    {
+    }
+
+    void config(const std::string& key, long value)
+    {
+        configuration.emplace_back(key, std::to_string(value));
+    }
+
+    void config(const std::string& key, const std::string& value)
+    {
+        configuration.emplace_back(key, quote(value));
+    }
+
+    void result(const std::string& key, double value)
+    {
+        std::ostringstream stream;
+        stream << std::fixed << std::setprecision(3) << value;
+        results.emplace_back(key, stream.str());
+    }
+
+    void write(std::ostream& stream, bool json) const
+    {
+        if (json)
+        {
+            stream << "{\"benchmark\":" << quote(name)
+                   << ",\"config\":" << object(configuration)
+                   << ",\"results\":" << object(results)
+                   << "}" << std::endl;
+        }
+        else
+        {
+            stream << name << std::endl;
+            for (const auto& entry : configuration)
+            {
+                stream << "  " << std::left << std::setw(28) << entry.first << entry.second << std::endl;
+            }
+            for (const auto& entry : results)
+            {
+                stream << "  " << std::left << std::setw(28) << entry.first << entry.second << std::endl;
+            }
+        }
+    }
+
+private:
+    using entries = std::vector<std::pair<std::string, std::string>>;
+
+    static std::string quote(const std::string& value)
+    {
+        std::string result("\"");
+        for (auto c : value)
+        {
+            if ((c == '"') || (c == '\\'))
+            {
+                result += '\\';
+            }
+            result += c;
+        }
+        return result + "\"";
+    }
+
+    static std::string object(const entries& values)
+    {
+        std::string result("{");
+        for (const auto& entry : values)
+        {
+            if (result.size() > 1)
+            {
+                result += ",";
+            }
+            result += quote(entry.first) + ":" + entry.second;
+        }
+        return result + "}";
+    }
+
+private:
+    std::string name;
+    entries configuration;
+    entries results;
+};
+
+// Percentile of unsorted samples, which are partially sorted in place
+
+template <typename T>
+T percentile(std::vector<T>& samples, double fraction)
+{
+    if (samples.empty())
+        return T();
+    auto index = static_cast<std::size_t>(fraction * (samples.size() - 1) + 0.5);
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+// CPU time consumed by the calling thread
+
+inline std::chrono::nanoseconds thread_cpu_time()
+{
+    struct ::timespec now;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec);
+}
+
+} // namespace benchmark
+
+#endif // TRIAL_DATAGRAM_BENCHMARK_HPP
@@ -0,0 +1,144 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Demultiplexing of received datagrams without any system calls.
+//
+// Datagrams from a number of remote endpoints are passed directly to the
+// receive path of the multiplexer, which looks up the recipient and queues
+// the datagram on it. Only the receive path is timed. The queued datagrams
+// are consumed between rounds.
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <trial/net/io_context.hpp>
+#include <trial/datagram/socket.hpp>
+#include "benchmark.hpp"
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+struct multiplexer_access
+{
+    static detail::buffer allocate(multiplexer& self, std::size_t size)
+    {
+        return self.pool->allocate(size);
+    }
+
+    static void receive(multiplexer& self,
+                        detail::buffer datagram,
+                        const multiplexer::endpoint_type& remote_endpoint,
+                        completion_list& completions)
+    {
+        std::lock_guard<decltype(self.receive_mutex)> lock(self.receive_mutex);
+        // As if a receive had been armed by a socket
+        ++self.pending_receive_count;
+        self.process_receive(boost::system::error_code(),
+                             std::move(datagram),
+                             remote_endpoint,
+                             0,
+                             completions);
+    }
+};
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+int main(int argc, char *argv[])
+{
+    using trial::datagram::detail::multiplexer_access;
+    using clock_type = std::chrono::steady_clock;
+
+    long peers, size, count;
+    bool json;
+    std::string label;
+    try
+    {
+        benchmark::arguments args(argc, argv);
+        peers = std::max(1L, args.get("peers", 1000L));
+        size = std::max(1L, args.get("size", 64L));
+        count = std::max(1L, args.get("datagrams", 10000000L));
+        label = args.get("label", std::string());
+        json = args.flag("json");
+        args.check();
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << ex.what() << std::endl
+                  << "Usage: " << argv[0]
+                  << " [--peers N] [--size BYTES] [--datagrams N] [--label TEXT] [--json]" << std::endl;
+        return 1;
+    }
+
+    trial::net::io_context io;
+    const trial::datagram::endpoint local_endpoint(boost::asio::ip::address_v4::loopback(), 0);
+
+    // Sockets connected to distinct remote endpoints
+    std::vector<trial::datagram::endpoint> remotes;
+    std::vector<std::unique_ptr<trial::datagram::socket>> sockets;
+    for (long i = 0; i < peers; ++i)
+    {
+        remotes.emplace_back(boost::asio::ip::address_v4(0x7F000002 + i / 50000),
+                             static_cast<unsigned short>(10000 + i % 50000));
+        sockets.emplace_back(new trial::datagram::socket(trial::net::extension::get_executor(io), local_endpoint));
+        sockets.back()->async_connect(remotes.back(), [] (boost::system::error_code) {});
+    }
+    io.run();
+    io.restart();
+
+    auto multiplexer = boost::asio::use_service<trial::datagram::detail::service<trial::datagram::protocol>>(io).add(local_endpoint);
+
+    trial::datagram::detail::completion_list completions;
+    std::chrono::nanoseconds elapsed{0};
+    std::uint64_t allocations = 0;
+    long remaining = count;
+    while (remaining > 0)
+    {
+        const auto round = std::min(remaining, peers);
+        const auto allocations_before = benchmark::allocation_count().load();
+        const auto start = clock_type::now();
+        for (long i = 0; i < round; ++i)
+        {
+            multiplexer_access::receive(*multiplexer,
+                                        multiplexer_access::allocate(*multiplexer, size),
+                                        remotes[i],
+                                        completions);
+            completions.invoke();
+        }
+        elapsed += clock_type::now() - start;
+        allocations += benchmark::allocation_count().load() - allocations_before;
+        remaining -= round;
+
+        // Consume the queued datagrams
+        for (long i = 0; i < round; ++i)
+        {
+            sockets[i]->async_receive([] (boost::system::error_code, trial::datagram::buffer) {});
+        }
+        io.poll();
+        io.restart();
+    }
+
+    benchmark::report output("demux");
+    output.config("label", label);
+    output.config("peers", peers);
+    output.config("size", size);
+    output.config("datagrams", count);
+    output.result("datagrams_per_second", count / std::chrono::duration<double>(elapsed).count());
+    output.result("ns_per_datagram", double(elapsed.count()) / count);
+    output.result("allocations_per_datagram", double(allocations) / count);
+    output.write(std::cout, json);
+    return 0;
+}
@@ -0,0 +1,246 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Echo round-trips over the in-process fake network.
+//
+// Both the server and the peers use trial.datagram on a single io_context,
+// but the next layer is a fake_socket, so no system calls are made. This
+// isolates the per-datagram cost of the library itself: demultiplexing,
+// accept, queueing and handler dispatch.
+//
+// Every round sends a burst of datagrams from each peer and then runs the
+// io_context until the echoes have been delivered. Loss and reordering are
+// applied after the peers have been accepted.
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include <trial/net/io_context.hpp>
+#include <trial/datagram/fake_socket.hpp>
+#include "benchmark.hpp"
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+// Run handlers until none are ready
+void drain(trial::net::io_context& io)
+{
+    while (io.poll() > 0)
+    {
+    }
+    io.restart();
+}
+
+class server
+{
+public:
+    server(const trial::net::executor& executor,
+           const trial::datagram::endpoint& local_endpoint,
+           std::size_t peers)
+        : executor(executor),
+          acceptor(executor, local_endpoint),
+          peers(peers)
+    {
+        accept();
+    }
+
+    std::size_t size() const { return sockets.size(); }
+
+private:
+    void accept()
+    {
+        // No accept is left pending when the acceptor is destroyed
+        if (sockets.size() == peers)
+            return;
+        sockets.emplace_back(new trial::datagram::fake::socket(executor));
+        auto& socket = *sockets.back();
+        acceptor.async_accept(
+            socket,
+            [this, &socket] (boost::system::error_code error)
+            {
+                if (error)
+                    return;
+                receive(socket);
+                accept();
+            });
+    }
+
+    void receive(trial::datagram::fake::socket& socket)
+    {
+        socket.async_receive(
+            [this, &socket] (boost::system::error_code error,
+                             trial::datagram::buffer datagram)
+            {
+                if (error)
+                    return;
+                socket.try_send(boost::asio::buffer(datagram.data(), datagram.size()), error);
+                receive(socket);
+            });
+    }
+
+private:
+    trial::net::executor executor;
+    trial::datagram::fake::acceptor acceptor;
+    std::size_t peers;
+    std::vector<std::unique_ptr<trial::datagram::fake::socket>> sockets;
+};
+
+class peer
+{
+public:
+    peer(const trial::net::executor& executor,
+         const trial::datagram::endpoint& local_endpoint,
+         std::uint64_t& echoes)
+        : socket(executor, local_endpoint),
+          echoes(echoes)
+    {
+    }
+
+    void connect(const trial::datagram::endpoint& remote_endpoint)
+    {
+        socket.async_connect(
+            remote_endpoint,
+            [this] (boost::system::error_code error)
+            {
+                if (!error)
+                {
+                    receive();
+                }
+            });
+    }
+
+    void send(const std::vector<char>& payload)
+    {
+        boost::system::error_code error;
+        socket.try_send(boost::asio::buffer(payload), error);
+    }
+
+private:
+    void receive()
+    {
+        socket.async_receive(
+            [this] (boost::system::error_code error,
+                    trial::datagram::buffer)
+            {
+                if (error)
+                    return;
+                ++echoes;
+                receive();
+            });
+    }
+
+private:
+    trial::datagram::fake::socket socket;
+    std::uint64_t& echoes;
+};
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    long peers, size, count, burst, loss, reorder, seed;
+    bool json;
+    std::string label;
+    try
+    {
+        benchmark::arguments args(argc, argv);
+        peers = std::max(1L, args.get("peers", 100L));
+        size = std::max(1L, args.get("size", 64L));
+        count = std::max(1L, args.get("datagrams", 1000000L));
+        burst = std::max(1L, args.get("burst", 16L));
+        loss = std::max(0L, args.get("loss", 0L));
+        reorder = std::max(0L, args.get("reorder", 0L));
+        seed = args.get("seed", 1L);
+        label = args.get("label", std::string());
+        json = args.flag("json");
+        args.check();
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << ex.what() << std::endl
+                  << "Usage: " << argv[0]
+                  << " [--peers N] [--size BYTES] [--datagrams N] [--burst N]"
+                  << " [--loss PERCENT] [--reorder PERCENT] [--seed N] [--label TEXT] [--json]" << std::endl;
+        return 1;
+    }
+
+    trial::net::io_context io;
+    const auto executor = trial::net::extension::get_executor(io);
+    auto& network = trial::datagram::fake_network::get(executor);
+    network.seed(static_cast<std::uint32_t>(seed));
+
+    const trial::datagram::endpoint server_endpoint(boost::asio::ip::address_v4(0x0A000001), 5000);
+    server echo(executor, server_endpoint, peers);
+
+    std::uint64_t echoes = 0;
+    std::vector<std::unique_ptr<peer>> clients;
+    const std::vector<char> payload(size, 'x');
+    for (long i = 0; i < peers; ++i)
+    {
+        const trial::datagram::endpoint local_endpoint(boost::asio::ip::address_v4(0x0A010000 + i / 50000),
+                                                       static_cast<unsigned short>(10000 + i % 50000));
+        clients.emplace_back(new peer(executor, local_endpoint, echoes));
+        clients.back()->connect(server_endpoint);
+    }
+    drain(io);
+    // The first datagram of each peer is accepted by the server
+    for (auto& client : clients)
+    {
+        client->send(payload);
+    }
+    drain(io);
+    echoes = 0;
+
+    network.loss(loss / 100.0);
+    network.reorder(reorder / 100.0);
+    const auto before = network.statistics();
+
+    const auto allocations_before = benchmark::allocation_count().load();
+    const auto start = clock_type::now();
+    long sent = 0;
+    while (sent < count)
+    {
+        for (auto& client : clients)
+        {
+            for (long i = 0; i < burst; ++i)
+            {
+                client->send(payload);
+            }
+        }
+        sent += peers * burst;
+        network.flush();
+        drain(io);
+    }
+    const std::chrono::nanoseconds elapsed = clock_type::now() - start;
+    const auto allocations = benchmark::allocation_count().load() - allocations_before;
+    const auto after = network.statistics();
+
+    benchmark::report output("fake");
+    output.config("label", label);
+    output.config("peers", peers);
+    output.config("size", size);
+    output.config("datagrams", sent);
+    output.config("burst", burst);
+    output.config("loss", loss);
+    output.config("reorder", reorder);
+    output.config("accepted", static_cast<long>(echo.size()));
+    output.result("round_trips_per_second", echoes / std::chrono::duration<double>(elapsed).count());
+    output.result("ns_per_round_trip", echoes ? double(elapsed.count()) / echoes : 0.0);
+    output.result("allocations_per_round_trip", echoes ? double(allocations) / echoes : 0.0);
+    output.result("lost", double(after.lost - before.lost));
+    output.result("reordered", double(after.reordered - before.reordered));
+    output.result("overflowed", double(after.overflowed - before.overflowed));
+    output.write(std::cout, json);
+    return 0;
+}
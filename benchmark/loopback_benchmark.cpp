@@ -0,0 +1,362 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Echo round-trips over loopback.
+//
+// The server uses trial.datagram on its own io_context, which is run by the
+// given number of threads. Every peer is a plain UDP socket on a separate
+// io_context that sends a datagram, waits for the echo, and then sends the
+// next one. Lost datagrams are retransmitted.
+//
+// Allocations are counted for the whole process, whereas CPU time is only
+// measured for the server threads.
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <trial/net/io_context.hpp>
+#include <trial/datagram/acceptor.hpp>
+#include <trial/datagram/socket.hpp>
+#include "benchmark.hpp"
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+enum phase_type
+{
+    warmup,
+    measure,
+    done
+};
+
+struct shared_state
+{
+    std::atomic<int> phase{warmup};
+    std::atomic<std::uint64_t> round_trips{0};
+    std::atomic<std::uint64_t> retransmits{0};
+    std::mutex mutex;
+    std::chrono::nanoseconds server_cpu{0};
+};
+
+class session : public std::enable_shared_from_this<session>
+{
+public:
+    session(std::unique_ptr<trial::datagram::socket> socket)
+        : socket(std::move(socket))
+    {
+    }
+
+    void start()
+    {
+        do_receive();
+    }
+
+private:
+    void do_receive()
+    {
+        auto self(shared_from_this());
+        socket->async_receive([self] (boost::system::error_code error,
+                                      trial::datagram::buffer datagram)
+                              {
+                                  if (!error)
+                                  {
+                                      self->message = std::move(datagram);
+                                      self->do_send();
+                                  }
+                              });
+    }
+
+    void do_send()
+    {
+        auto self(shared_from_this());
+        socket->async_send(boost::asio::buffer(message.data(), message.size()),
+                           [self] (boost::system::error_code error,
+                                   std::size_t)
+                           {
+                               if (!error)
+                               {
+                                   self->do_receive();
+                               }
+                           });
+    }
+
+private:
+    std::unique_ptr<trial::datagram::socket> socket;
+    trial::datagram::buffer message;
+};
+
+class server
+{
+public:
+    server(trial::net::io_context& io)
+        : io(io),
+          acceptor(trial::net::extension::get_executor(io),
+                   trial::datagram::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+    {
+        do_accept();
+    }
+
+    trial::datagram::endpoint local_endpoint() const
+    {
+        return acceptor.local_endpoint();
+    }
+
+private:
+    void do_accept()
+    {
+        auto socket = std::make_shared<std::unique_ptr<trial::datagram::socket>>(
+            new trial::datagram::socket(trial::net::extension::get_executor(io)));
+        acceptor.async_accept(**socket,
+                              [this, socket] (boost::system::error_code error)
+                              {
+                                  if (!error)
+                                  {
+                                      std::make_shared<session>(std::move(*socket))->start();
+                                      do_accept();
+                                  }
+                              });
+    }
+
+private:
+    trial::net::io_context& io;
+    trial::datagram::acceptor acceptor;
+};
+
+class peer : public std::enable_shared_from_this<peer>
+{
+public:
+    peer(trial::net::io_context& io,
+         const boost::asio::ip::udp::endpoint& server_endpoint,
+         std::size_t size,
+         shared_state& state)
+        : strand(boost::asio::make_strand(io)),
+          socket(strand, boost::asio::ip::udp::endpoint(server_endpoint.address(), 0)),
+          timer(strand),
+          server_endpoint(server_endpoint),
+          output(std::max(size, sizeof(header))),
+          input(output.size()),
+          state(state)
+    {
+    }
+
+    const std::vector<std::uint64_t>& samples() const
+    {
+        return latencies;
+    }
+
+    void start()
+    {
+        do_receive();
+        do_send();
+    }
+
+private:
+    struct header
+    {
+        std::uint64_t sequence;
+        std::int64_t timestamp;
+    };
+
+    void do_send()
+    {
+        header h{sequence, clock_type::now().time_since_epoch().count()};
+        std::memcpy(output.data(), &h, sizeof(h));
+        boost::system::error_code error;
+        socket.send_to(boost::asio::buffer(output), server_endpoint, 0, error);
+
+        auto self(shared_from_this());
+        const auto current = sequence;
+        timer.expires_after(std::chrono::milliseconds(200));
+        timer.async_wait([self, current] (boost::system::error_code error)
+                         {
+                             if (!error && (self->sequence == current) && (self->state.phase != done))
+                             {
+                                 ++self->state.retransmits;
+                                 self->do_send();
+                             }
+                         });
+    }
+
+    void do_receive()
+    {
+        auto self(shared_from_this());
+        socket.async_receive(boost::asio::buffer(input),
+                             [self] (boost::system::error_code error,
+                                     std::size_t length)
+                             {
+                                 if (!error)
+                                 {
+                                     self->process_receive(length);
+                                 }
+                             });
+    }
+
+    void process_receive(std::size_t length)
+    {
+        header h;
+        if (length >= sizeof(h))
+        {
+            std::memcpy(&h, input.data(), sizeof(h));
+            if (h.sequence == sequence)
+            {
+                const auto phase = state.phase.load();
+                if (phase == done)
+                {
+                    timer.cancel();
+                    return;
+                }
+                if (phase == measure)
+                {
+                    latencies.push_back(clock_type::now().time_since_epoch().count() - h.timestamp);
+                    ++state.round_trips;
+                }
+                ++sequence;
+                do_send();
+            }
+        }
+        do_receive();
+    }
+
+private:
+    boost::asio::strand<trial::net::io_context::executor_type> strand;
+    boost::asio::ip::udp::socket socket;
+    boost::asio::steady_timer timer;
+    boost::asio::ip::udp::endpoint server_endpoint;
+    std::uint64_t sequence = 0;
+    std::vector<char> output;
+    std::vector<char> input;
+    std::vector<std::uint64_t> latencies;
+    shared_state& state;
+};
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    long threads, client_threads, peers, size, warmup_ms, duration_ms;
+    bool json;
+    std::string label;
+    try
+    {
+        benchmark::arguments args(argc, argv);
+        threads = std::max(1L, args.get("threads", 1L));
+        client_threads = std::max(1L, args.get("client-threads", 1L));
+        peers = std::max(1L, args.get("peers", 100L));
+        size = std::max(1L, args.get("size", 64L));
+        warmup_ms = std::max(0L, args.get("warmup", 500L));
+        duration_ms = std::max(1L, args.get("duration", 3000L));
+        label = args.get("label", std::string());
+        json = args.flag("json");
+        args.check();
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << ex.what() << std::endl
+                  << "Usage: " << argv[0]
+                  << " [--threads N] [--client-threads N] [--peers N] [--size BYTES]"
+                  << " [--warmup MS] [--duration MS] [--label TEXT] [--json]" << std::endl;
+        return 1;
+    }
+
+    shared_state state;
+    trial::net::io_context server_io;
+    trial::net::io_context client_io;
+    server s(server_io);
+
+    std::vector<std::shared_ptr<peer>> clients;
+    for (long i = 0; i < peers; ++i)
+    {
+        clients.push_back(std::make_shared<peer>(client_io, s.local_endpoint(), size, state));
+        clients.back()->start();
+    }
+
+    std::vector<std::thread> workers;
+    for (long i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([&server_io, &state]
+                             {
+                                 bool started = false;
+                                 std::chrono::nanoseconds start{0};
+                                 while (state.phase != done)
+                                 {
+                                     server_io.run_for(std::chrono::milliseconds(10));
+                                     if (!started && (state.phase != warmup))
+                                     {
+                                         started = true;
+                                         start = benchmark::thread_cpu_time();
+                                     }
+                                 }
+                                 const auto used = benchmark::thread_cpu_time() - start;
+                                 std::lock_guard<std::mutex> lock(state.mutex);
+                                 state.server_cpu += used;
+                             });
+    }
+    for (long i = 0; i < client_threads; ++i)
+    {
+        workers.emplace_back([&client_io, &state]
+                             {
+                                 while (state.phase != done)
+                                 {
+                                     client_io.run_for(std::chrono::milliseconds(10));
+                                 }
+                             });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(warmup_ms));
+    const auto allocations_before = benchmark::allocation_count().load();
+    const auto start = clock_type::now();
+    state.phase = measure;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+    state.phase = done;
+    const auto elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+    const auto allocations = benchmark::allocation_count().load() - allocations_before;
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    const double round_trips = state.round_trips.load();
+    const double datagrams = 2 * round_trips;
+    std::vector<std::uint64_t> latencies;
+    for (const auto& client : clients)
+    {
+        latencies.insert(latencies.end(), client->samples().begin(), client->samples().end());
+    }
+
+    benchmark::report output("loopback");
+    output.config("label", label);
+    output.config("threads", threads);
+    output.config("client_threads", client_threads);
+    output.config("peers", peers);
+    output.config("size", size);
+    output.config("duration_ms", duration_ms);
+    output.result("round_trips_per_second", round_trips / elapsed);
+    output.result("datagrams_per_second", datagrams / elapsed);
+    output.result("latency_p50_us", benchmark::percentile(latencies, 0.50) / 1e3);
+    output.result("latency_p99_us", benchmark::percentile(latencies, 0.99) / 1e3);
+    output.result("latency_p999_us", benchmark::percentile(latencies, 0.999) / 1e3);
+    output.result("allocations_per_datagram", datagrams > 0 ? allocations / datagrams : 0.0);
+    output.result("server_cpu_ns_per_datagram", datagrams > 0 ? state.server_cpu.count() / datagrams : 0.0);
+    output.result("retransmits", state.retransmits.load());
+    output.write(std::cout, json);
+    return (round_trips > 0) ? 0 : 1;
+}
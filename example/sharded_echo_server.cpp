@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include <trial/net/io_context.hpp>
+#include <trial/datagram/acceptor.hpp>
+#include <trial/datagram/socket.hpp>
+
+class session : public std::enable_shared_from_this<session>
+{
+    using message_type = std::vector<char>;
+
+public:
+    session(std::shared_ptr<trial::datagram::socket> socket)
+        : socket(socket)
+    {
+    }
+
+    void start()
+    {
+        do_receive();
+    }
+
+private:
+    void do_receive()
+    {
+        assert(socket);
+        auto self(shared_from_this());
+        std::shared_ptr<message_type> message = std::make_shared<message_type>(1400);
+        socket->async_receive(boost::asio::buffer(*message),
+                              [self, message] (boost::system::error_code error,
+                                               std::size_t length)
+                              {
+                                  if (!error)
+                                  {
+                                      // Echo the message
+                                      self->do_send(message, length);
+                                  }
+                              });
+    }
+
+    void do_send(std::shared_ptr<message_type> message,
+                 std::size_t length)
+    {
+        assert(socket);
+        auto self(shared_from_this());
+        socket->async_send(boost::asio::buffer(*message, length),
+                           [self, message] (boost::system::error_code error,
+                                            std::size_t)
+                           {
+                               if (!error)
+                               {
+                                   self->do_receive();
+                               }
+                           });
+    }
+
+private:
+    std::shared_ptr<trial::datagram::socket> socket;
+};
+
+// Accepts sessions on one shard. Every shard has its own io_context.
+
+class shard
+{
+public:
+    shard(trial::net::io_context& io,
+          trial::datagram::acceptor& acceptor)
+        : io(io),
+          acceptor(acceptor)
+    {
+        do_accept();
+    }
+
+private:
+    void do_accept()
+    {
+        auto socket = std::make_shared<trial::datagram::socket>(trial::net::extension::get_executor(io));
+        acceptor.async_accept(*socket,
+                              [this, socket] (boost::system::error_code error)
+                              {
+                                  if (!error)
+                                  {
+                                      // Session will keep itself alive as long as required
+                                      std::make_shared<session>(socket)->start();
+                                      do_accept();
+                                  }
+                              });
+    }
+
+private:
+    trial::net::io_context& io;
+    trial::datagram::acceptor& acceptor;
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <port> <threads>" << std::endl;
+        return 1;
+    }
+    const auto count = std::max(1, std::atoi(argv[2]));
+
+    std::vector<std::unique_ptr<trial::net::io_context>> contexts;
+    std::vector<trial::net::executor> executors;
+    for (int i = 0; i < count; ++i)
+    {
+        contexts.emplace_back(new trial::net::io_context);
+        executors.emplace_back(trial::net::extension::get_executor(*contexts.back()));
+    }
+
+    trial::datagram::endpoint endpoint(trial::datagram::protocol::v4(),
+                                       std::atoi(argv[1]));
+    trial::datagram::acceptor acceptor(executors, endpoint);
+
+    std::vector<std::unique_ptr<shard>> shards;
+    for (auto& io : contexts)
+    {
+        shards.emplace_back(new shard(*io, acceptor));
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& io : contexts)
+    {
+        auto context = io.get();
+        threads.emplace_back([context] { context->run(); });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    return 0;
+}
@@ -12,9 +12,11 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include <memory>
+#include <vector>
 #include <trial/net/io_context.hpp>
 #include <trial/datagram/detail/service.hpp>
 #include <trial/datagram/endpoint.hpp>
+#include <trial/datagram/option.hpp>
 #include <trial/datagram/socket.hpp>
 
 namespace trial
@@ -22,15 +24,43 @@ namespace trial
 namespace datagram
 {
 
-class acceptor
-    : public boost::asio::basic_io_object<detail::service<protocol>>
+template <typename NextLayer>
+class basic_acceptor
+    : public boost::asio::basic_io_object<detail::service<protocol, NextLayer>>
 {
+    using service_type = detail::service<protocol, NextLayer>;
+    using multiplexer_type = typename service_type::multiplexer_type;
+
 public:
     using endpoint_type = trial::datagram::endpoint;
-    using socket_type = trial::datagram::socket;
+    using socket_type = basic_socket<NextLayer>;
+    using next_layer_type = NextLayer;
+
+    basic_acceptor(const net::executor&,
+                   endpoint_type local_endpoint,
+                   const option::io_backend& = option::io_backend());
 
-    acceptor(const net::executor&,
-             endpoint_type local_endpoint);
+    // Acceptor with peer promotion
+    //
+    // The UDP socket is bound to the local endpoint with SO_REUSEPORT, so
+    // that the connected sockets of promoted peers can bind to it as well.
+    // Only acceptors constructed this way, or sharded acceptors, can enable
+    // option::peer_promotion.
+    basic_acceptor(const net::executor&,
+                   endpoint_type local_endpoint,
+                   const option::peer_promotion&,
+                   const option::io_backend& = option::io_backend());
+
+    // Sharded acceptor
+    //
+    // Each executor gets its own UDP socket that is bound to the local
+    // endpoint with SO_REUSEPORT. The kernel pins each remote endpoint to one
+    // of these sockets by flow hash. A socket is accepted from the shard that
+    // runs on the same io_context as the socket, so the io_contexts should be
+    // distinct and each run by its own thread.
+    basic_acceptor(const std::vector<net::executor>&,
+                   endpoint_type local_endpoint,
+                   const option::io_backend& = option::io_backend());
 
     template <typename AcceptHandler>
     void async_accept(socket_type& socket,
@@ -38,10 +68,43 @@ public:
 
     endpoint_type local_endpoint() const;
 
+    template <typename SettableSocketOption>
+    void set_option(const SettableSocketOption& option);
+
+    template <typename SettableSocketOption>
+    void set_option(const SettableSocketOption& option,
+                    boost::system::error_code&);
+
+    template <typename GettableSocketOption>
+    void get_option(GettableSocketOption& option) const;
+
+    template <typename GettableSocketOption>
+    void get_option(GettableSocketOption& option,
+                    boost::system::error_code&) const;
+
+    void get_option(option::statistics& option,
+                    boost::system::error_code&) const;
+    void get_option(option::receive_latency& option,
+                    boost::system::error_code&) const;
+
 private:
-    std::shared_ptr<detail::multiplexer> multiplexer;
+    template <typename AcceptHandler>
+    class accept_handler;
+
+    std::shared_ptr<multiplexer_type> select(socket_type&) const;
+
+    // Sum of the snapshots of all shards
+    template <typename Snapshot>
+    void get_total(Snapshot&,
+                   boost::system::error_code&) const;
+
+private:
+    std::shared_ptr<multiplexer_type> multiplexer;
+    std::vector<std::shared_ptr<multiplexer_type>> shards;
 };
 
+using acceptor = basic_acceptor<protocol::socket>;
+
 } // namespace datagram
 } // namespace trial
 
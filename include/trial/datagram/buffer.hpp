@@ -0,0 +1,80 @@
+#ifndef TRIAL_DATAGRAM_BUFFER_HPP
+#define TRIAL_DATAGRAM_BUFFER_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <cstddef>
+#include <utility>
+#include <boost/asio/buffer.hpp>
+#include <trial/datagram/detail/buffer.hpp>
+
+namespace trial
+{
+namespace datagram
+{
+
+template <typename> class basic_socket;
+
+// A received datagram that is owned by the application.
+//
+// The content is read-only and refers directly to the storage that the
+// datagram was received into. The storage is recycled when the buffer is
+// destroyed.
+
+class buffer
+{
+public:
+    using value_type = char;
+    using const_iterator = const char *;
+
+    buffer() = default;
+    buffer(buffer&&) = default;
+    buffer& operator=(buffer&&) = default;
+
+    const char *data() const noexcept { return storage.data(); }
+    std::size_t size() const noexcept { return storage.size(); }
+    bool empty() const noexcept { return size() == 0; }
+
+    const_iterator begin() const noexcept { return data(); }
+    const_iterator end() const noexcept { return data() + size(); }
+
+    // The datagram was larger than the receive slot and has been cut short.
+    bool truncated() const noexcept { return is_truncated; }
+
+    // The time at which the kernel received the datagram, or the epoch
+    // unless the receive_timestamp option is enabled.
+    std::chrono::system_clock::time_point timestamp() const noexcept { return storage.times().arrival; }
+
+    operator boost::asio::const_buffer() const noexcept
+    {
+        return boost::asio::const_buffer(data(), size());
+    }
+
+private:
+    template <typename> friend class basic_socket;
+
+    buffer(detail::buffer storage,
+           bool truncated) noexcept
+        : storage(std::move(storage)),
+          is_truncated(truncated)
+    {
+    }
+
+private:
+    detail::buffer storage;
+    bool is_truncated = false;
+};
+
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_BUFFER_HPP
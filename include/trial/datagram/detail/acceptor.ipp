@@ -11,49 +11,245 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
 #include <cassert>
 #include <utility>
 #include <functional>
+#include <type_traits>
+#include <boost/asio/error.hpp>
 
 namespace trial
 {
 namespace datagram
 {
 
-inline acceptor::acceptor(const net::executor& executor,
-                          endpoint_type local_endpoint)
-    : boost::asio::basic_io_object<detail::service<protocol>>(static_cast<net::io_context&>(executor.context())),
-      multiplexer(get_service().add(local_endpoint))
+template <typename NextLayer>
+basic_acceptor<NextLayer>::basic_acceptor(const net::executor& executor,
+                                          endpoint_type local_endpoint,
+                                          const option::io_backend& backend)
+    : boost::asio::basic_io_object<service_type>(static_cast<net::io_context&>(executor.context())),
+      multiplexer(this->get_service().add(local_endpoint, false, backend))
 {
 }
 
+template <typename NextLayer>
+basic_acceptor<NextLayer>::basic_acceptor(const net::executor& executor,
+                                          endpoint_type local_endpoint,
+                                          const option::peer_promotion& promotion,
+                                          const option::io_backend& backend)
+    : boost::asio::basic_io_object<service_type>(static_cast<net::io_context&>(executor.context())),
+      multiplexer(this->get_service().add(local_endpoint, true, backend))
+{
+    set_option(promotion);
+}
+
+template <typename NextLayer>
+basic_acceptor<NextLayer>::basic_acceptor(const std::vector<net::executor>& executors,
+                                          endpoint_type local_endpoint,
+                                          const option::io_backend& backend)
+    : boost::asio::basic_io_object<service_type>(static_cast<net::io_context&>(executors.at(0).context())),
+      multiplexer(this->get_service().add(local_endpoint, true, backend))
+{
+    // Remaining shards must bind to the same port if it was ephemeral
+    local_endpoint.port(multiplexer->next_layer().local_endpoint().port());
+
+    shards.push_back(multiplexer);
+    for (std::size_t i = 1; i < executors.size(); ++i)
+    {
+        auto& context = static_cast<net::io_context&>(executors[i].context());
+        auto shard = boost::asio::use_service<service_type>(context).add(local_endpoint, true, backend);
+        if (std::find(shards.begin(), shards.end(), shard) == shards.end())
+        {
+            shards.push_back(std::move(shard));
+        }
+    }
+}
+
+template <typename NextLayer>
 template <typename AcceptHandler>
-void acceptor::async_accept(socket_type& socket,
-                            AcceptHandler&& handler)
+void basic_acceptor<NextLayer>::async_accept(socket_type& socket,
+                                             AcceptHandler&& handler)
 {
     assert(multiplexer);
 
-    multiplexer->async_accept
-        (socket,
-         [this, &socket, handler]
-         (const boost::system::error_code& error)
-         {
-             if (!error)
-             {
-                 socket.set_multiplexer(multiplexer);
-                 multiplexer->add(&socket);
-             }
-             handler(error);
-         });
+    auto shard = select(socket);
+    if (!shard)
+    {
+        // Socket does not belong to any shard
+        net::post(
+            boost::asio::get_associated_executor(handler, net::extension::get_executor(socket)),
+            [handler]() mutable
+            {
+                handler(boost::asio::error::make_error_code(boost::asio::error::invalid_argument));
+            });
+        return;
+    }
+
+    using handler_type = typename std::decay<AcceptHandler>::type;
+    multiplexer_type *owner = shard.get();
+    owner->async_accept(socket,
+                        accept_handler<handler_type>(owner,
+                                                     socket,
+                                                     std::forward<AcceptHandler>(handler)));
+}
+
+// Keeps the executor and allocator of the user handler, so the accept
+// completes through them.
+
+template <typename NextLayer>
+template <typename AcceptHandler>
+class basic_acceptor<NextLayer>::accept_handler
+{
+public:
+    using executor_type = boost::asio::associated_executor_t<AcceptHandler, net::executor>;
+    using allocator_type = detail::handler_allocator_t<AcceptHandler>;
+
+    template <typename Handler>
+    accept_handler(multiplexer_type *owner,
+                   socket_type& socket,
+                   Handler&& handler)
+        : owner(owner),
+          socket(&socket),
+          handler(std::forward<Handler>(handler))
+    {
+    }
+
+    executor_type get_executor() const noexcept
+    {
+        return boost::asio::get_associated_executor(handler, net::extension::get_executor(*socket));
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return detail::get_handler_allocator(handler);
+    }
+
+    void operator()(const boost::system::error_code& error)
+    {
+        if (!error)
+        {
+            // The multiplexer has already registered the socket
+            socket->set_multiplexer(owner->shared_from_this());
+        }
+        handler(error);
+    }
+
+private:
+    multiplexer_type *owner;
+    socket_type *socket;
+    AcceptHandler handler;
+};
+
+template <typename NextLayer>
+auto basic_acceptor<NextLayer>::select(socket_type& socket) const -> std::shared_ptr<multiplexer_type>
+{
+    if (shards.empty())
+        return multiplexer;
+
+    auto& context = static_cast<net::io_context&>(net::extension::get_executor(socket).context());
+    for (const auto& shard : shards)
+    {
+        if (&static_cast<net::io_context&>(shard->get_executor().context()) == &context)
+            return shard;
+    }
+    return {};
 }
 
-inline acceptor::endpoint_type acceptor::local_endpoint() const
+template <typename NextLayer>
+typename basic_acceptor<NextLayer>::endpoint_type basic_acceptor<NextLayer>::local_endpoint() const
 {
     assert(multiplexer);
 
     return multiplexer->next_layer().local_endpoint();
 }
 
+template <typename NextLayer>
+template <typename SettableSocketOption>
+void basic_acceptor<NextLayer>::set_option(const SettableSocketOption& option)
+{
+    boost::system::error_code error;
+    set_option(option, error);
+    if (error)
+        throw boost::system::system_error(error);
+}
+
+template <typename NextLayer>
+template <typename SettableSocketOption>
+void basic_acceptor<NextLayer>::set_option(const SettableSocketOption& option,
+                                           boost::system::error_code& error)
+{
+    assert(multiplexer);
+
+    if (shards.empty())
+    {
+        multiplexer->set_option(option, error);
+        return;
+    }
+    for (auto& shard : shards)
+    {
+        shard->set_option(option, error);
+        if (error)
+            return;
+    }
+}
+
+template <typename NextLayer>
+template <typename GettableSocketOption>
+void basic_acceptor<NextLayer>::get_option(GettableSocketOption& option) const
+{
+    boost::system::error_code error;
+    get_option(option, error);
+    if (error)
+        throw boost::system::system_error(error);
+}
+
+template <typename NextLayer>
+template <typename GettableSocketOption>
+void basic_acceptor<NextLayer>::get_option(GettableSocketOption& option,
+                                           boost::system::error_code& error) const
+{
+    assert(multiplexer);
+
+    multiplexer->get_option(option, error);
+}
+
+template <typename NextLayer>
+void basic_acceptor<NextLayer>::get_option(option::statistics& option,
+                                           boost::system::error_code& error) const
+{
+    get_total(option, error);
+}
+
+template <typename NextLayer>
+void basic_acceptor<NextLayer>::get_option(option::receive_latency& option,
+                                           boost::system::error_code& error) const
+{
+    get_total(option, error);
+}
+
+template <typename NextLayer>
+template <typename Snapshot>
+void basic_acceptor<NextLayer>::get_total(Snapshot& option,
+                                          boost::system::error_code& error) const
+{
+    assert(multiplexer);
+
+    if (shards.empty())
+    {
+        multiplexer->get_option(option, error);
+        return;
+    }
+    option = Snapshot();
+    for (const auto& shard : shards)
+    {
+        Snapshot snapshot;
+        shard->get_option(snapshot, error);
+        if (error)
+            return;
+        option += snapshot;
+    }
+}
+
 } // namespace datagram
 } // namespace trial
 
@@ -0,0 +1,233 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_BATCH_RECEIVER_HPP
+#define TRIAL_DATAGRAM_DETAIL_BATCH_RECEIVER_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <boost/system/error_code.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <trial/datagram/detail/buffer.hpp>
+#include <trial/datagram/detail/offload.hpp>
+#include <trial/datagram/detail/timestamp.hpp>
+
+#if defined(__linux__)
+# include <cerrno>
+# include <sys/types.h>
+# include <sys/socket.h>
+# define TRIAL_DATAGRAM_HAS_RECVMMSG 1
+#endif
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// Receives several datagrams with a single system call into preallocated
+// slots.
+
+class batch_receiver
+{
+public:
+    using endpoint_type = boost::asio::ip::udp::endpoint;
+    using native_handle_type = int;
+
+    static constexpr bool is_supported()
+    {
+#if defined(TRIAL_DATAGRAM_HAS_RECVMMSG)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    std::size_t capacity() const { return slots.size(); }
+
+    void resize(std::size_t count, std::size_t size, buffer_pool&);
+
+    // Non-blocking receive. Returns the number of received datagrams.
+    std::size_t receive(native_handle_type, boost::system::error_code&);
+
+    // Take ownership of a received datagram. The slot is replenished from
+    // the pool.
+    detail::buffer release(std::size_t index, buffer_pool&);
+
+    std::size_t size(std::size_t index) const;
+    bool truncated(std::size_t index) const;
+    endpoint_type endpoint(std::size_t index) const;
+    // Size of coalesced datagrams, or zero if not coalesced
+    std::size_t segment_size(std::size_t index) const;
+    // Kernel timestamp, or the epoch if not enabled
+    timestamp::time_point arrival(std::size_t index) const;
+
+private:
+    std::vector<detail::buffer> slots;
+#if defined(TRIAL_DATAGRAM_HAS_RECVMMSG)
+    std::vector<struct ::mmsghdr> headers;
+    std::vector<struct ::iovec> vectors;
+    std::vector<struct ::sockaddr_storage> names;
+    std::vector<offload::control_block> controls;
+#endif
+};
+
+inline void batch_receiver::resize(std::size_t count,
+                                   std::size_t size,
+                                   buffer_pool& pool)
+{
+    slots.clear();
+    slots.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        slots.emplace_back(pool.allocate(size));
+    }
+#if defined(TRIAL_DATAGRAM_HAS_RECVMMSG)
+    headers.assign(count, ::mmsghdr());
+    vectors.assign(count, ::iovec());
+    names.assign(count, ::sockaddr_storage());
+    controls.assign(count, offload::control_block());
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        vectors[i].iov_base = slots[i].data();
+        vectors[i].iov_len = slots[i].size();
+        headers[i].msg_hdr.msg_iov = &vectors[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+}
+
+inline std::size_t batch_receiver::receive(native_handle_type handle,
+                                           boost::system::error_code& error)
+{
+#if defined(TRIAL_DATAGRAM_HAS_RECVMMSG)
+    for (std::size_t i = 0; i < headers.size(); ++i)
+    {
+        // Reset values that the kernel has overwritten by previous calls
+        headers[i].msg_hdr.msg_name = &names[i];
+        headers[i].msg_hdr.msg_namelen = sizeof(names[i]);
+        headers[i].msg_hdr.msg_control = controls[i].data;
+        headers[i].msg_hdr.msg_controllen = sizeof(controls[i].data);
+        headers[i].msg_hdr.msg_flags = 0;
+    }
+    int result = 0;
+    do
+    {
+        result = ::recvmmsg(handle,
+                            headers.data(),
+                            static_cast<unsigned int>(headers.size()),
+                            MSG_DONTWAIT,
+                            nullptr);
+    } while ((result < 0) && (errno == EINTR));
+    if (result < 0)
+    {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            error = boost::asio::error::would_block;
+        else
+            error = boost::system::error_code(errno, boost::asio::error::get_system_category());
+        return 0;
+    }
+    error = boost::system::error_code();
+    return static_cast<std::size_t>(result);
+#else
+    (void)handle;
+    error = boost::asio::error::operation_not_supported;
+    return 0;
+#endif
+}
+
+inline detail::buffer batch_receiver::release(std::size_t index,
+                                              buffer_pool& pool)
+{
+    const auto length = size(index);
+    auto& slot = slots[index];
+    auto result = pool.allocate(length);
+    if (result.capacity() < slot.capacity())
+    {
+        // Small datagrams are copied to avoid holding on to large slots
+        std::memcpy(result.data(), slot.data(), length);
+    }
+    else
+    {
+        // Hand over the slot and use the new buffer in its place
+        const auto slot_size = slot.size();
+        std::swap(result, slot);
+        slot.resize(slot_size);
+        result.resize(length);
+#if defined(TRIAL_DATAGRAM_HAS_RECVMMSG)
+        vectors[index].iov_base = slot.data();
+#endif
+    }
+    return result;
+}
+
+inline std::size_t batch_receiver::size(std::size_t index) const
+{
+#if defined(TRIAL_DATAGRAM_HAS_RECVMMSG)
+    // msg_len contains the actual datagram size unless it was truncated
+    return std::min<std::size_t>(headers[index].msg_len, slots[index].size());
+#else
+    (void)index;
+    return 0;
+#endif
+}
+
+inline bool batch_receiver::truncated(std::size_t index) const
+{
+#if defined(TRIAL_DATAGRAM_HAS_RECVMMSG)
+    return headers[index].msg_hdr.msg_flags & MSG_TRUNC;
+#else
+    (void)index;
+    return false;
+#endif
+}
+
+inline batch_receiver::endpoint_type batch_receiver::endpoint(std::size_t index) const
+{
+    endpoint_type result;
+#if defined(TRIAL_DATAGRAM_HAS_RECVMMSG)
+    const auto length = headers[index].msg_hdr.msg_namelen;
+    std::memcpy(result.data(), &names[index], length);
+    result.resize(length);
+#else
+    (void)index;
+#endif
+    return result;
+}
+
+inline std::size_t batch_receiver::segment_size(std::size_t index) const
+{
+#if defined(TRIAL_DATAGRAM_HAS_RECVMMSG)
+    return offload::segment_size(headers[index].msg_hdr);
+#else
+    (void)index;
+    return 0;
+#endif
+}
+
+inline timestamp::time_point batch_receiver::arrival(std::size_t index) const
+{
+#if defined(TRIAL_DATAGRAM_HAS_RECVMMSG)
+    return timestamp::arrival(headers[index].msg_hdr);
+#else
+    (void)index;
+    return timestamp::time_point();
+#endif
+}
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_BATCH_RECEIVER_HPP
@@ -0,0 +1,318 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_BATCH_SENDER_HPP
+#define TRIAL_DATAGRAM_DETAIL_BATCH_SENDER_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <boost/system/error_code.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <trial/datagram/detail/operation.hpp>
+
+#if defined(__linux__)
+# include <cerrno>
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <sys/uio.h>
+# define TRIAL_DATAGRAM_HAS_SENDMMSG 1
+#endif
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// Pending send. The result is stored in the operation until the handler is
+// invoked, so completed sends can be queued without allocations.
+
+class send_operation
+    : public operation<boost::system::error_code, std::size_t>
+{
+public:
+    send_operation(complete_type complete,
+                   destroy_type destroy) noexcept
+        : operation(complete, destroy)
+    {
+    }
+
+    boost::system::error_code error;
+    std::size_t length = 0;
+};
+
+using send_queue = operation_queue<send_operation>;
+
+// Invokes the handlers of completed sends in order.
+
+inline void complete_sends(send_queue& queue)
+{
+    while (!queue.empty())
+    {
+        auto op = queue.pop().release();
+        op->complete(op->error, op->length);
+    }
+}
+
+// Completion handler that completes a send operation. Used to hand an
+// operation to the asynchronous send of the next layer.
+
+class send_completion
+{
+public:
+    using allocator_type = recycling_allocator<void>;
+
+    explicit send_completion(operation_pointer<send_operation> operation)
+        : operation(std::move(operation))
+    {
+    }
+
+    allocator_type get_allocator() const noexcept { return allocator_type(); }
+
+    void operator()(const boost::system::error_code& error,
+                    std::size_t length)
+    {
+        operation.release()->complete(error, length);
+    }
+
+    operation_pointer<send_operation> release() noexcept
+    {
+        return std::move(operation);
+    }
+
+private:
+    operation_pointer<send_operation> operation;
+};
+
+// The operation completes through the executor and allocator of the handler.
+
+template <typename Handler,
+          typename Executor>
+operation_pointer<send_operation> make_send_operation(Handler&& handler,
+                                                      const Executor& fallback)
+{
+    auto allocator = get_handler_allocator(handler);
+    auto executor = boost::asio::get_associated_executor(handler, fallback);
+    return make_operation<send_operation>(std::forward<Handler>(handler),
+                                          allocator,
+                                          executor);
+}
+
+template <typename Executor>
+operation_pointer<send_operation> make_send_operation(send_completion&& handler,
+                                                      const Executor&)
+{
+    return handler.release();
+}
+
+// Collects outgoing datagrams and sends them with a single system call.
+//
+// The buffers are not copied, so they must remain valid until the
+// operation is completed, as usual for asynchronous operations.
+
+class batch_sender
+{
+public:
+    using endpoint_type = boost::asio::ip::udp::endpoint;
+    using native_handle_type = int;
+    using operation_type = operation_pointer<send_operation>;
+
+    static constexpr bool is_supported()
+    {
+#if defined(TRIAL_DATAGRAM_HAS_SENDMMSG)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool empty() const { return first_entry == entries.size(); }
+    std::size_t size() const { return entries.size() - first_entry; }
+    std::size_t bytes() const { return total_bytes; }
+
+    template <typename ConstBufferSequence>
+    void push(const ConstBufferSequence& buffers,
+              const endpoint_type& endpoint,
+              operation_type operation);
+
+    // Non-blocking send of queued datagrams. Completed operations are
+    // appended to the output queue. Returns false if the socket would block.
+    bool send(native_handle_type,
+              send_queue& output);
+
+    // Complete all queued datagrams with an error.
+    void cancel(const boost::system::error_code&,
+                send_queue& output);
+
+private:
+    void pop_front(send_queue& output,
+                   const boost::system::error_code& error,
+                   std::size_t length);
+    void compact();
+
+private:
+#if defined(TRIAL_DATAGRAM_HAS_SENDMMSG)
+    using vector_type = struct ::iovec;
+#else
+    struct vector_type { const void *iov_base; std::size_t iov_len; };
+#endif
+
+    struct entry
+    {
+        endpoint_type endpoint;
+        std::size_t count;
+        std::size_t length;
+        operation_type operation;
+    };
+    // Sent entries are skipped rather than erased, so the storage is
+    // reused without allocations once the queue has been drained
+    std::vector<entry> entries;
+    std::vector<vector_type> vectors;
+    std::size_t first_entry = 0;
+    std::size_t first_vector = 0;
+    std::size_t total_bytes = 0;
+#if defined(TRIAL_DATAGRAM_HAS_SENDMMSG)
+    std::vector<struct ::mmsghdr> headers;
+#endif
+};
+
+template <typename ConstBufferSequence>
+void batch_sender::push(const ConstBufferSequence& buffers,
+                        const endpoint_type& endpoint,
+                        operation_type operation)
+{
+    compact();
+    entry item{endpoint, 0, 0, std::move(operation)};
+    const auto end = boost::asio::buffer_sequence_end(buffers);
+    for (auto it = boost::asio::buffer_sequence_begin(buffers); it != end; ++it)
+    {
+        boost::asio::const_buffer buffer(*it);
+        vector_type vector;
+        vector.iov_base = const_cast<void *>(buffer.data());
+        vector.iov_len = buffer.size();
+        vectors.push_back(vector);
+        ++item.count;
+        item.length += buffer.size();
+    }
+    total_bytes += item.length;
+    entries.emplace_back(std::move(item));
+}
+
+inline bool batch_sender::send(native_handle_type handle,
+                               send_queue& output)
+{
+#if defined(TRIAL_DATAGRAM_HAS_SENDMMSG)
+    // Limit imposed by the kernel on the number of messages per call
+    constexpr std::size_t max_messages = 1024;
+
+    while (!empty())
+    {
+        const auto count = std::min(size(), max_messages);
+        headers.assign(count, ::mmsghdr());
+        std::size_t offset = first_vector;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            auto& item = entries[first_entry + i];
+            auto& header = headers[i].msg_hdr;
+            header.msg_name = item.endpoint.data();
+            header.msg_namelen = static_cast<socklen_t>(item.endpoint.size());
+            header.msg_iov = vectors.data() + offset;
+            header.msg_iovlen = item.count;
+            offset += item.count;
+        }
+
+        int result = 0;
+        do
+        {
+            result = ::sendmmsg(handle,
+                                headers.data(),
+                                static_cast<unsigned int>(count),
+                                MSG_DONTWAIT);
+        } while ((result < 0) && (errno == EINTR));
+
+        if (result < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                return false;
+
+            // The error belongs to the first unsent datagram. The remaining
+            // datagrams are attempted in the next iteration.
+            pop_front(output,
+                      boost::system::error_code(errno, boost::asio::error::get_system_category()),
+                      0);
+        }
+        else
+        {
+            for (int i = 0; i < result; ++i)
+            {
+                pop_front(output,
+                          boost::system::error_code(),
+                          headers[i].msg_len);
+            }
+        }
+    }
+#else
+    (void)handle;
+    cancel(boost::asio::error::operation_not_supported, output);
+#endif
+    return true;
+}
+
+inline void batch_sender::cancel(const boost::system::error_code& error,
+                                 send_queue& output)
+{
+    while (!empty())
+    {
+        pop_front(output, error, 0);
+    }
+}
+
+inline void batch_sender::pop_front(send_queue& output,
+                                    const boost::system::error_code& error,
+                                    std::size_t length)
+{
+    auto& item = entries[first_entry];
+    item.operation->error = error;
+    item.operation->length = length;
+    output.push(std::move(item.operation));
+    total_bytes -= item.length;
+    first_vector += item.count;
+    ++first_entry;
+    if (empty())
+    {
+        entries.clear();
+        vectors.clear();
+        first_entry = 0;
+        first_vector = 0;
+    }
+}
+
+inline void batch_sender::compact()
+{
+    // Datagrams that are left behind by a partial send
+    if (first_entry * 2 < entries.size())
+        return;
+    entries.erase(entries.begin(), entries.begin() + first_entry);
+    vectors.erase(vectors.begin(), vectors.begin() + first_vector);
+    first_entry = 0;
+    first_vector = 0;
+}
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_BATCH_SENDER_HPP
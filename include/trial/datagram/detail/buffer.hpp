@@ -12,7 +12,15 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include <algorithm>
-#include <vector>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <trial/datagram/option.hpp>
 
 namespace trial
 {
@@ -21,7 +29,466 @@ namespace datagram
 namespace detail
 {
 
-using buffer = std::vector<char>;
+class buffer_pool;
+
+// A buffer is a movable handle to datagram storage obtained from a
+// buffer_pool. The storage is returned to the pool when the handle is
+// destroyed.
+//
+// Several handles can share the same storage, which is then returned to the
+// pool when the last of them is destroyed. Shared storage must not be
+// modified. A shared handle can refer to part of the storage, such as one
+// segment of a coalesced datagram.
+//
+// The storage also carries the receive timestamps of the datagram.
+
+class buffer
+{
+public:
+    buffer() noexcept = default;
+    buffer(const buffer&) = delete;
+    buffer(buffer&&) noexcept;
+    ~buffer();
+
+    buffer& operator=(const buffer&) = delete;
+    buffer& operator=(buffer&&) noexcept;
+
+    explicit operator bool() const noexcept { return storage != nullptr; }
+
+    char *data() noexcept;
+    const char *data() const noexcept;
+    std::size_t size() const noexcept { return length; }
+    std::size_t capacity() const noexcept;
+
+    // Size cannot exceed capacity
+    void resize(std::size_t) noexcept;
+    void reset() noexcept;
+
+    // Another handle to the same storage
+    buffer share() const noexcept;
+    // Another handle to length bytes of the same storage from offset
+    buffer share(std::size_t offset, std::size_t length) const noexcept;
+
+    struct timestamps
+    {
+        // Arrival in the kernel, or the epoch if not reported
+        std::chrono::system_clock::time_point arrival;
+        // Demultiplexing, or the epoch if not recorded
+        std::chrono::steady_clock::time_point demuxed;
+    };
+
+    timestamps times() const noexcept;
+    void times(const timestamps&) noexcept;
+
+private:
+    friend class buffer_pool;
+
+    struct block
+    {
+        buffer_pool *owner;
+        block *next;
+        std::size_t capacity;
+        std::size_t size_class;
+        timestamps stamps;
+        std::atomic<std::size_t> references;
+    };
+
+    buffer(block *, std::size_t, std::size_t = 0) noexcept;
+
+private:
+    block *storage = nullptr;
+    std::size_t length = 0;
+    // Start of the data within the storage
+    std::size_t offset = 0;
+};
+
+// The buffer pool recycles datagram storage in a small number of size
+// classes. Released storage is cached for reuse until the configured limits
+// are reached, after which it is returned to the heap.
+//
+// Every size class has its own free list and lock, and the counters are
+// atomic, so buffers can be allocated and released by several threads
+// without contending on a pool-wide lock.
+//
+// The pool outlives its owner until all outstanding buffers are released.
+
+class buffer_pool
+{
+public:
+    struct statistics
+    {
+        // Buffers handed out and not yet released
+        std::size_t buffers = 0;
+        std::size_t bytes = 0;
+        // Released buffers retained for reuse
+        std::size_t cached_buffers = 0;
+        std::size_t cached_bytes = 0;
+        // Storage obtained from the heap
+        std::size_t allocations = 0;
+    };
+
+    struct deleter
+    {
+        void operator()(buffer_pool *pool) const { pool->detach(); }
+    };
+    using pointer = std::unique_ptr<buffer_pool, deleter>;
+
+    static pointer create();
+
+    buffer allocate(std::size_t size);
+
+    // Limits on the retained storage across all size classes
+    void limit(std::size_t max_bytes, std::size_t max_buffers);
+    std::pair<std::size_t, std::size_t> limits() const;
+
+    statistics current() const;
+    statistics high_water() const;
+
+private:
+    friend class buffer;
+
+    static constexpr std::size_t size_class_count = 4;
+    static constexpr std::size_t unpooled = size_class_count;
+
+    struct free_list
+    {
+        std::mutex mutex;
+        buffer::block *head = nullptr;
+    };
+
+    buffer_pool() = default;
+    ~buffer_pool();
+
+    static std::size_t class_capacity(std::size_t size_class);
+    static std::size_t size_class_of(std::size_t size);
+    static void raise(std::atomic<std::size_t>& peak, std::size_t value) noexcept;
+
+    void deallocate(buffer::block *) noexcept;
+    bool reserve(std::size_t capacity) noexcept;
+    void detach() noexcept;
+    void release() noexcept;
+
+private:
+    free_list free_lists[size_class_count];
+    std::atomic<std::size_t> max_bytes{option::buffer_pool::default_max_bytes};
+    std::atomic<std::size_t> max_buffers{option::buffer_pool::default_max_buffers};
+
+    std::atomic<std::size_t> buffers{0};
+    std::atomic<std::size_t> bytes{0};
+    std::atomic<std::size_t> cached_buffers{0};
+    std::atomic<std::size_t> cached_bytes{0};
+    std::atomic<std::size_t> allocations{0};
+
+    std::atomic<std::size_t> peak_buffers{0};
+    std::atomic<std::size_t> peak_bytes{0};
+    std::atomic<std::size_t> peak_cached_buffers{0};
+    std::atomic<std::size_t> peak_cached_bytes{0};
+
+    // One reference for the owner and one for every outstanding buffer
+    std::atomic<std::size_t> references{1};
+    std::atomic<bool> detached{false};
+};
+
+//-----------------------------------------------------------------------------
+// buffer
+//-----------------------------------------------------------------------------
+
+inline buffer::buffer(block *storage,
+                      std::size_t length,
+                      std::size_t offset) noexcept
+    : storage(storage),
+      length(length),
+      offset(offset)
+{
+}
+
+inline buffer::buffer(buffer&& other) noexcept
+    : storage(other.storage),
+      length(other.length),
+      offset(other.offset)
+{
+    other.storage = nullptr;
+    other.length = 0;
+    other.offset = 0;
+}
+
+inline buffer::~buffer()
+{
+    reset();
+}
+
+inline buffer& buffer::operator=(buffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        std::swap(storage, other.storage);
+        std::swap(length, other.length);
+        std::swap(offset, other.offset);
+    }
+    return *this;
+}
+
+inline char *buffer::data() noexcept
+{
+    return storage ? reinterpret_cast<char *>(storage + 1) + offset : nullptr;
+}
+
+inline const char *buffer::data() const noexcept
+{
+    return storage ? reinterpret_cast<const char *>(storage + 1) + offset : nullptr;
+}
+
+inline std::size_t buffer::capacity() const noexcept
+{
+    return storage ? storage->capacity - offset : 0;
+}
+
+inline void buffer::resize(std::size_t size) noexcept
+{
+    assert(size <= capacity());
+    length = size;
+}
+
+inline void buffer::reset() noexcept
+{
+    if (storage)
+    {
+        // A sole owner skips the atomic decrement, because nobody else can
+        // share the storage
+        if ((storage->references.load(std::memory_order_acquire) == 1) ||
+            (storage->references.fetch_sub(1, std::memory_order_acq_rel) == 1))
+        {
+            storage->owner->deallocate(storage);
+        }
+        storage = nullptr;
+        length = 0;
+        offset = 0;
+    }
+}
+
+inline buffer buffer::share() const noexcept
+{
+    if (!storage)
+        return buffer();
+    storage->references.fetch_add(1, std::memory_order_relaxed);
+    return buffer(storage, length, offset);
+}
+
+inline buffer buffer::share(std::size_t offset,
+                            std::size_t length) const noexcept
+{
+    assert(offset + length <= size());
+    if (!storage)
+        return buffer();
+    storage->references.fetch_add(1, std::memory_order_relaxed);
+    return buffer(storage, length, this->offset + offset);
+}
+
+inline buffer::timestamps buffer::times() const noexcept
+{
+    return storage ? storage->stamps : timestamps();
+}
+
+inline void buffer::times(const timestamps& value) noexcept
+{
+    if (storage)
+    {
+        storage->stamps = value;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// buffer_pool
+//-----------------------------------------------------------------------------
+
+inline buffer_pool::pointer buffer_pool::create()
+{
+    return pointer(new buffer_pool);
+}
+
+inline buffer_pool::~buffer_pool()
+{
+    for (auto& list : free_lists)
+    {
+        while (list.head)
+        {
+            auto next = list.head->next;
+            ::operator delete(list.head);
+            list.head = next;
+        }
+    }
+}
+
+inline std::size_t buffer_pool::class_capacity(std::size_t size_class)
+{
+    // Small datagrams, Ethernet MTU, jumbo frames, and maximum UDP payload
+    static constexpr std::size_t capacities[size_class_count] = { 256, 2048, 9216, 65536 };
+    return capacities[size_class];
+}
+
+inline std::size_t buffer_pool::size_class_of(std::size_t size)
+{
+    for (std::size_t size_class = 0; size_class < size_class_count; ++size_class)
+    {
+        if (size <= class_capacity(size_class))
+            return size_class;
+    }
+    return unpooled;
+}
+
+inline void buffer_pool::raise(std::atomic<std::size_t>& peak,
+                               std::size_t value) noexcept
+{
+    auto current = peak.load(std::memory_order_relaxed);
+    while ((current < value) &&
+           !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+inline buffer buffer_pool::allocate(std::size_t size)
+{
+    const auto size_class = size_class_of(size);
+    const auto capacity = (size_class == unpooled) ? size : class_capacity(size_class);
+    buffer::block *storage = nullptr;
+    if (size_class != unpooled)
+    {
+        auto& list = free_lists[size_class];
+        std::lock_guard<decltype(list.mutex)> lock(list.mutex);
+        storage = list.head;
+        if (storage)
+        {
+            list.head = storage->next;
+        }
+    }
+    if (storage)
+    {
+        cached_buffers.fetch_sub(1, std::memory_order_relaxed);
+        cached_bytes.fetch_sub(capacity, std::memory_order_relaxed);
+    }
+    else
+    {
+        storage = ::new (::operator new(sizeof(buffer::block) + capacity)) buffer::block;
+        storage->owner = this;
+        storage->next = nullptr;
+        storage->capacity = capacity;
+        storage->size_class = size_class;
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    references.fetch_add(1, std::memory_order_relaxed);
+    raise(peak_buffers, buffers.fetch_add(1, std::memory_order_relaxed) + 1);
+    raise(peak_bytes, bytes.fetch_add(capacity, std::memory_order_relaxed) + capacity);
+
+    storage->stamps = buffer::timestamps();
+    storage->references.store(1, std::memory_order_relaxed);
+    return buffer(storage, size);
+}
+
+inline void buffer_pool::deallocate(buffer::block *storage) noexcept
+{
+    buffers.fetch_sub(1, std::memory_order_relaxed);
+    bytes.fetch_sub(storage->capacity, std::memory_order_relaxed);
+
+    const auto size_class = storage->size_class;
+    if ((size_class != unpooled) &&
+        !detached.load(std::memory_order_acquire) &&
+        reserve(storage->capacity))
+    {
+        auto& list = free_lists[size_class];
+        std::lock_guard<decltype(list.mutex)> lock(list.mutex);
+        storage->next = list.head;
+        list.head = storage;
+    }
+    else
+    {
+        ::operator delete(storage);
+    }
+    release();
+}
+
+inline bool buffer_pool::reserve(std::size_t capacity) noexcept
+{
+    // Claim room within the limits before the storage is cached. Concurrent
+    // claims may briefly overshoot, in which case the storage is freed.
+    const auto count = cached_buffers.fetch_add(1, std::memory_order_relaxed) + 1;
+    const auto total = cached_bytes.fetch_add(capacity, std::memory_order_relaxed) + capacity;
+    if ((count > max_buffers.load(std::memory_order_relaxed)) ||
+        (total > max_bytes.load(std::memory_order_relaxed)))
+    {
+        cached_buffers.fetch_sub(1, std::memory_order_relaxed);
+        cached_bytes.fetch_sub(capacity, std::memory_order_relaxed);
+        return false;
+    }
+    raise(peak_cached_buffers, count);
+    raise(peak_cached_bytes, total);
+    return true;
+}
+
+inline void buffer_pool::detach() noexcept
+{
+    detached.store(true, std::memory_order_release);
+    release();
+}
+
+inline void buffer_pool::release() noexcept
+{
+    if (references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete this;
+    }
+}
+
+inline void buffer_pool::limit(std::size_t max_bytes,
+                               std::size_t max_buffers)
+{
+    this->max_bytes.store(max_bytes, std::memory_order_relaxed);
+    this->max_buffers.store(max_buffers, std::memory_order_relaxed);
+    // Trim retained storage to the new limits, starting with the largest
+    for (std::size_t size_class = size_class_count; size_class-- > 0;)
+    {
+        auto& list = free_lists[size_class];
+        std::lock_guard<decltype(list.mutex)> lock(list.mutex);
+        while (list.head &&
+               ((cached_buffers.load(std::memory_order_relaxed) > max_buffers) ||
+                (cached_bytes.load(std::memory_order_relaxed) > max_bytes)))
+        {
+            auto storage = list.head;
+            list.head = storage->next;
+            cached_buffers.fetch_sub(1, std::memory_order_relaxed);
+            cached_bytes.fetch_sub(storage->capacity, std::memory_order_relaxed);
+            ::operator delete(storage);
+        }
+    }
+}
+
+inline std::pair<std::size_t, std::size_t> buffer_pool::limits() const
+{
+    return std::make_pair(max_bytes.load(std::memory_order_relaxed),
+                          max_buffers.load(std::memory_order_relaxed));
+}
+
+inline buffer_pool::statistics buffer_pool::current() const
+{
+    statistics result;
+    result.buffers = buffers.load(std::memory_order_relaxed);
+    result.bytes = bytes.load(std::memory_order_relaxed);
+    result.cached_buffers = cached_buffers.load(std::memory_order_relaxed);
+    result.cached_bytes = cached_bytes.load(std::memory_order_relaxed);
+    result.allocations = allocations.load(std::memory_order_relaxed);
+    return result;
+}
+
+inline buffer_pool::statistics buffer_pool::high_water() const
+{
+    statistics result;
+    result.buffers = peak_buffers.load(std::memory_order_relaxed);
+    result.bytes = peak_bytes.load(std::memory_order_relaxed);
+    result.cached_buffers = peak_cached_buffers.load(std::memory_order_relaxed);
+    result.cached_bytes = peak_cached_bytes.load(std::memory_order_relaxed);
+    result.allocations = allocations.load(std::memory_order_relaxed);
+    return result;
+}
 
 } // namespace detail
 } // namespace datagram
@@ -0,0 +1,180 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_COMPLETION_LIST_HPP
+#define TRIAL_DATAGRAM_DETAIL_COMPLETION_LIST_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include <boost/system/error_code.hpp>
+#include <trial/datagram/detail/buffer.hpp>
+#include <trial/datagram/detail/operation.hpp>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+class socket_base;
+struct socket_inbox;
+
+using receive_operation = operation<boost::system::error_code, detail::buffer>;
+
+class accept_operation
+    : public operation<boost::system::error_code>
+{
+public:
+    accept_operation(complete_type complete,
+                     destroy_type destroy,
+                     socket_base *socket)
+        : operation(complete, destroy),
+          socket(socket)
+    {
+    }
+
+    socket_base *const socket;
+};
+
+// Datagram for a socket that is delivered by its worker executor
+struct worker_handoff
+{
+    std::shared_ptr<socket_inbox> inbox;
+    boost::system::error_code error;
+    detail::buffer datagram;
+};
+
+// Hands datagrams to the mailboxes of their workers, see worker_mailbox.hpp
+inline void hand_off(std::vector<worker_handoff>&);
+
+// Operations that have been completed while a lock was held. The handlers
+// are invoked after the lock has been released, so they are free to start
+// new operations. Datagrams for worker executors are handed off at the same
+// time.
+//
+// The storage is cached per thread to avoid allocations.
+
+class completion_list
+{
+public:
+    completion_list()
+    {
+        entries.swap(cache());
+    }
+
+    completion_list(const completion_list&) = delete;
+    completion_list& operator=(const completion_list&) = delete;
+
+    ~completion_list()
+    {
+        entries.accepts.clear();
+        entries.receives.clear();
+        entries.handoffs.clear();
+        // Keep the larger storage of each kind for the next list
+        auto& cached = cache();
+        if (cached.accepts.capacity() < entries.accepts.capacity())
+        {
+            cached.accepts.swap(entries.accepts);
+        }
+        if (cached.receives.capacity() < entries.receives.capacity())
+        {
+            cached.receives.swap(entries.receives);
+        }
+        if (cached.handoffs.capacity() < entries.handoffs.capacity())
+        {
+            cached.handoffs.swap(entries.handoffs);
+        }
+    }
+
+    void push(operation_pointer<accept_operation> operation,
+              const boost::system::error_code& error)
+    {
+        entries.accepts.push_back(accept_entry{std::move(operation), error});
+    }
+
+    void push(operation_pointer<receive_operation> operation,
+              const boost::system::error_code& error,
+              detail::buffer datagram)
+    {
+        entries.receives.push_back(receive_entry{std::move(operation), error, std::move(datagram)});
+    }
+
+    void push(std::shared_ptr<socket_inbox> inbox,
+              const boost::system::error_code& error,
+              detail::buffer datagram)
+    {
+        entries.handoffs.push_back(worker_handoff{std::move(inbox), error, std::move(datagram)});
+    }
+
+    // Accept handlers are invoked before receive handlers, so an accepted
+    // socket is ready before it receives datagrams.
+    void invoke()
+    {
+        for (auto& entry : entries.accepts)
+        {
+            entry.operation.release()->complete(entry.error);
+        }
+        if (!entries.handoffs.empty())
+        {
+            hand_off(entries.handoffs);
+        }
+        for (auto& entry : entries.receives)
+        {
+            entry.operation.release()->complete(entry.error, std::move(entry.datagram));
+        }
+        entries.accepts.clear();
+        entries.receives.clear();
+    }
+
+private:
+    struct accept_entry
+    {
+        operation_pointer<accept_operation> operation;
+        boost::system::error_code error;
+    };
+
+    struct receive_entry
+    {
+        operation_pointer<receive_operation> operation;
+        boost::system::error_code error;
+        detail::buffer datagram;
+    };
+
+    struct storage
+    {
+        void swap(storage& other)
+        {
+            accepts.swap(other.accepts);
+            receives.swap(other.receives);
+            handoffs.swap(other.handoffs);
+        }
+
+        std::vector<accept_entry> accepts;
+        std::vector<receive_entry> receives;
+        std::vector<worker_handoff> handoffs;
+    };
+
+    static storage& cache()
+    {
+        static thread_local storage cached;
+        return cached;
+    }
+
+private:
+    storage entries;
+};
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_COMPLETION_LIST_HPP
@@ -0,0 +1,106 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_ENDPOINT_KEY_HPP
+#define TRIAL_DATAGRAM_DETAIL_ENDPOINT_KEY_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <boost/asio/ip/udp.hpp>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// Compact representation of an endpoint for hashing and comparison.
+//
+// IPv4 endpoints only use the low word, so hashing and comparing them does
+// not involve the IPv6 address bytes.
+
+class endpoint_key
+{
+public:
+    using endpoint_type = boost::asio::ip::udp::endpoint;
+
+    struct hash
+    {
+        std::size_t operator()(const endpoint_key& key) const noexcept
+        {
+            if (key.family == 4)
+                return mix((key.low << 16) | key.port);
+            return mix(key.high ^ mix(key.low ^ ((std::uint64_t(key.scope) << 16) | key.port)));
+        }
+    };
+
+    endpoint_key() = default;
+
+    explicit endpoint_key(const endpoint_type& endpoint)
+        : port(endpoint.port())
+    {
+        const auto address = endpoint.address();
+        if (address.is_v4())
+        {
+            family = 4;
+            low = address.to_v4().to_uint();
+        }
+        else
+        {
+            family = 6;
+            const auto v6 = address.to_v6();
+            const auto bytes = v6.to_bytes();
+            std::memcpy(&high, bytes.data(), sizeof(high));
+            std::memcpy(&low, bytes.data() + sizeof(high), sizeof(low));
+            scope = static_cast<std::uint32_t>(v6.scope_id());
+        }
+    }
+
+    friend bool operator==(const endpoint_key& lhs, const endpoint_key& rhs) noexcept
+    {
+        return (lhs.low == rhs.low) &&
+            (lhs.port == rhs.port) &&
+            (lhs.family == rhs.family) &&
+            (lhs.high == rhs.high) &&
+            (lhs.scope == rhs.scope);
+    }
+
+    friend bool operator!=(const endpoint_key& lhs, const endpoint_key& rhs) noexcept
+    {
+        return !(lhs == rhs);
+    }
+
+private:
+    static std::size_t mix(std::uint64_t value) noexcept
+    {
+        // Finalizer from MurmurHash3
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdULL;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ULL;
+        value ^= value >> 33;
+        return static_cast<std::size_t>(value);
+    }
+
+private:
+    std::uint64_t high = 0;
+    std::uint64_t low = 0;
+    std::uint32_t scope = 0;
+    std::uint16_t port = 0;
+    std::uint16_t family = 0;
+};
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_ENDPOINT_KEY_HPP
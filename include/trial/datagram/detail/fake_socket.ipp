@@ -0,0 +1,548 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <boost/asio/error.hpp>
+#include <boost/system/system_error.hpp>
+
+namespace trial
+{
+namespace datagram
+{
+
+//-----------------------------------------------------------------------------
+// fake_network
+//-----------------------------------------------------------------------------
+
+inline fake_network::fake_network(boost::asio::execution_context& context)
+    : boost::asio::detail::execution_context_service_base<fake_network>(context)
+{
+}
+
+inline fake_network& fake_network::get(const net::executor& executor)
+{
+    return boost::asio::use_service<fake_network>(executor.context());
+}
+
+inline void fake_network::seed(std::uint32_t value)
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    generator.seed(value);
+}
+
+inline void fake_network::loss(double probability)
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    loss_probability = probability;
+}
+
+inline void fake_network::reorder(double probability)
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    reorder_probability = probability;
+}
+
+inline void fake_network::capacity(std::size_t datagrams)
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    queue_capacity = datagrams;
+}
+
+inline void fake_network::inject(const endpoint_type& from,
+                                 const endpoint_type& to,
+                                 const void *data,
+                                 std::size_t size)
+{
+    const char *first = static_cast<const char *>(data);
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    transmit(datagram_type{from, to, std::vector<char>(first, first + size)});
+}
+
+inline void fake_network::flush()
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    if (holding)
+    {
+        holding = false;
+        deliver(std::move(held));
+    }
+}
+
+inline fake_network::counters fake_network::statistics() const
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    return stats;
+}
+
+inline void fake_network::shutdown()
+{
+    // Pending handlers may own the objects that own the sockets, so they are
+    // destroyed after the mutex has been released
+    std::vector<fake_socket::receive_handler> receive_handlers;
+    std::vector<fake_socket::wait_handler> wait_handlers;
+    {
+        std::lock_guard<decltype(mutex)> lock(mutex);
+        for (auto socket : sockets)
+        {
+            socket->abort_locked(receive_handlers, wait_handlers);
+        }
+        holding = false;
+        held = datagram_type();
+    }
+}
+
+inline bool fake_network::chance(double probability)
+{
+    if (probability <= 0.0)
+        return false;
+    const double range = double(generator.max() - generator.min()) + 1.0;
+    return double(generator() - generator.min()) < probability * range;
+}
+
+inline void fake_network::bind(fake_socket& socket,
+                               endpoint_type endpoint,
+                               boost::system::error_code& error)
+{
+    if (endpoint.port() == 0)
+    {
+        // Allocate an ephemeral port
+        for (unsigned int attempt = 0; attempt < 65536u - ephemeral_port; ++attempt)
+        {
+            endpoint.port(next_port);
+            if (next_port == 65535)
+            {
+                next_port = ephemeral_port;
+            }
+            else
+            {
+                ++next_port;
+            }
+            if (bindings.find(endpoint) == bindings.end())
+                break;
+        }
+    }
+    if (!bindings.insert(std::make_pair(endpoint, &socket)).second)
+    {
+        error = boost::asio::error::address_in_use;
+        return;
+    }
+    socket.endpoint = endpoint;
+    socket.bound = true;
+    error = boost::system::error_code();
+}
+
+inline void fake_network::unbind(fake_socket& socket)
+{
+    if (socket.bound)
+    {
+        bindings.erase(socket.endpoint);
+        socket.bound = false;
+    }
+}
+
+inline void fake_network::transmit(datagram_type datagram)
+{
+    if (chance(loss_probability))
+    {
+        ++stats.lost;
+        return;
+    }
+    if (!holding && chance(reorder_probability))
+    {
+        ++stats.reordered;
+        holding = true;
+        held = std::move(datagram);
+        return;
+    }
+    deliver(std::move(datagram));
+    if (holding)
+    {
+        holding = false;
+        deliver(std::move(held));
+    }
+}
+
+inline void fake_network::deliver(datagram_type datagram)
+{
+    auto socket = find(datagram.to);
+    if (!socket)
+    {
+        ++stats.lost;
+        return;
+    }
+    if ((queue_capacity > 0) && (socket->queue.size() >= queue_capacity))
+    {
+        ++stats.overflowed;
+        return;
+    }
+    ++stats.delivered;
+    socket->enqueue(std::move(datagram));
+}
+
+inline fake_socket *fake_network::find(const endpoint_type& endpoint) const
+{
+    auto where = bindings.find(endpoint);
+    if (where != bindings.end())
+        return where->second;
+
+    const auto any = endpoint.address().is_v4()
+        ? endpoint_type(boost::asio::ip::address_v4::any(), endpoint.port())
+        : endpoint_type(boost::asio::ip::address_v6::any(), endpoint.port());
+    where = bindings.find(any);
+    return (where == bindings.end()) ? nullptr : where->second;
+}
+
+//-----------------------------------------------------------------------------
+// fake_socket
+//-----------------------------------------------------------------------------
+
+inline fake_socket::fake_socket(const net::executor& executor)
+    : executor(executor),
+      network(fake_network::get(executor))
+{
+}
+
+inline fake_socket::~fake_socket()
+{
+    boost::system::error_code ignored;
+    close(ignored);
+}
+
+inline void fake_socket::open(const protocol_type& protocol)
+{
+    boost::system::error_code error;
+    open(protocol, error);
+    if (error)
+        throw boost::system::system_error(error);
+}
+
+inline void fake_socket::open(const protocol_type&,
+                              boost::system::error_code& error)
+{
+    std::lock_guard<decltype(network.mutex)> lock(network.mutex);
+    if (opened)
+    {
+        error = boost::asio::error::already_open;
+        return;
+    }
+    opened = true;
+    network.sockets.push_back(this);
+    error = boost::system::error_code();
+}
+
+inline bool fake_socket::is_open() const
+{
+    std::lock_guard<decltype(network.mutex)> lock(network.mutex);
+    return opened;
+}
+
+inline void fake_socket::close()
+{
+    boost::system::error_code error;
+    close(error);
+    if (error)
+        throw boost::system::system_error(error);
+}
+
+inline void fake_socket::close(boost::system::error_code& error)
+{
+    std::vector<receive_handler> receive_handlers;
+    std::vector<wait_handler> wait_handlers;
+    {
+        std::lock_guard<decltype(network.mutex)> lock(network.mutex);
+        if (opened)
+        {
+            abort_locked(receive_handlers, wait_handlers);
+            network.unbind(*this);
+            auto& sockets = network.sockets;
+            sockets.erase(std::remove(sockets.begin(), sockets.end(), this), sockets.end());
+            queue.clear();
+            opened = false;
+        }
+    }
+    post_aborted(receive_handlers, wait_handlers);
+    error = boost::system::error_code();
+}
+
+inline void fake_socket::cancel()
+{
+    abort();
+}
+
+inline void fake_socket::bind(const endpoint_type& endpoint)
+{
+    boost::system::error_code error;
+    bind(endpoint, error);
+    if (error)
+        throw boost::system::system_error(error);
+}
+
+inline void fake_socket::bind(const endpoint_type& local_endpoint,
+                              boost::system::error_code& error)
+{
+    std::lock_guard<decltype(network.mutex)> lock(network.mutex);
+    if (!opened)
+    {
+        error = boost::asio::error::bad_descriptor;
+        return;
+    }
+    if (bound)
+    {
+        error = boost::asio::error::invalid_argument;
+        return;
+    }
+    network.bind(*this, local_endpoint, error);
+}
+
+inline auto fake_socket::local_endpoint() const -> endpoint_type
+{
+    boost::system::error_code error;
+    auto result = local_endpoint(error);
+    if (error)
+        throw boost::system::system_error(error);
+    return result;
+}
+
+inline auto fake_socket::local_endpoint(boost::system::error_code& error) const -> endpoint_type
+{
+    std::lock_guard<decltype(network.mutex)> lock(network.mutex);
+    if (!opened)
+    {
+        error = boost::asio::error::bad_descriptor;
+        return {};
+    }
+    error = boost::system::error_code();
+    return endpoint;
+}
+
+template <typename GettableSocketOption>
+void fake_socket::get_option(GettableSocketOption&,
+                             boost::system::error_code& error) const
+{
+    error = boost::asio::error::operation_not_supported;
+}
+
+inline void fake_socket::io_control(bytes_readable& command,
+                                    boost::system::error_code& error)
+{
+    std::lock_guard<decltype(network.mutex)> lock(network.mutex);
+    command = bytes_readable(queue.empty() ? 0 : queue.front().data.size());
+    error = boost::system::error_code();
+}
+
+template <typename MutableBufferSequence,
+          typename ReadHandler>
+void fake_socket::async_receive_from(const MutableBufferSequence& buffers,
+                                     endpoint_type& sender,
+                                     message_flags flags,
+                                     ReadHandler&& handler)
+{
+    pending_receive operation{
+        std::vector<boost::asio::mutable_buffer>(boost::asio::buffer_sequence_begin(buffers),
+                                                 boost::asio::buffer_sequence_end(buffers)),
+        &sender,
+        flags,
+        receive_handler(std::forward<ReadHandler>(handler))};
+
+    std::lock_guard<decltype(network.mutex)> lock(network.mutex);
+    if (!opened)
+    {
+        net::post(executor, std::bind(std::move(operation.handler), boost::asio::error::bad_descriptor, std::size_t(0)));
+        return;
+    }
+    receives.push_back(std::move(operation));
+    complete_locked();
+}
+
+template <typename MutableBufferSequence>
+std::size_t fake_socket::receive_from(const MutableBufferSequence& buffers,
+                                      endpoint_type& sender,
+                                      message_flags flags,
+                                      boost::system::error_code& error)
+{
+    std::lock_guard<decltype(network.mutex)> lock(network.mutex);
+    if (!opened)
+    {
+        error = boost::asio::error::bad_descriptor;
+        return 0;
+    }
+    if (queue.empty())
+    {
+        error = boost::asio::error::would_block;
+        return 0;
+    }
+    error = boost::system::error_code();
+    return copy_front(std::vector<boost::asio::mutable_buffer>(boost::asio::buffer_sequence_begin(buffers),
+                                                               boost::asio::buffer_sequence_end(buffers)),
+                      sender,
+                      flags);
+}
+
+template <typename ConstBufferSequence,
+          typename WriteHandler>
+void fake_socket::async_send_to(const ConstBufferSequence& buffers,
+                                const endpoint_type& destination,
+                                WriteHandler&& handler)
+{
+    boost::system::error_code error;
+    const auto length = send_to(buffers, destination, 0, error);
+    net::post(executor, std::bind(std::forward<WriteHandler>(handler), error, length));
+}
+
+template <typename ConstBufferSequence>
+std::size_t fake_socket::send_to(const ConstBufferSequence& buffers,
+                                 const endpoint_type& destination,
+                                 message_flags,
+                                 boost::system::error_code& error)
+{
+    datagram_type datagram;
+    datagram.to = destination;
+    datagram.data.resize(boost::asio::buffer_size(buffers));
+    boost::asio::buffer_copy(boost::asio::buffer(datagram.data), buffers);
+    const auto length = datagram.data.size();
+
+    std::lock_guard<decltype(network.mutex)> lock(network.mutex);
+    ensure_bound(error);
+    if (error)
+        return 0;
+    datagram.from = endpoint;
+    if (datagram.from.address().is_unspecified())
+    {
+        // The source address is chosen by the route, which is loopback here
+        datagram.from.address(endpoint.address().is_v4()
+                              ? boost::asio::ip::address(boost::asio::ip::address_v4::loopback())
+                              : boost::asio::ip::address(boost::asio::ip::address_v6::loopback()));
+    }
+    network.transmit(std::move(datagram));
+    return length;
+}
+
+template <typename WaitHandler>
+void fake_socket::async_wait(wait_type type,
+                             WaitHandler&& handler)
+{
+    wait_handler operation(std::forward<WaitHandler>(handler));
+
+    std::lock_guard<decltype(network.mutex)> lock(network.mutex);
+    if (!opened)
+    {
+        net::post(executor, std::bind(std::move(operation), boost::asio::error::bad_descriptor));
+        return;
+    }
+    if ((type != wait_read) || !queue.empty())
+    {
+        // Sending never blocks
+        net::post(executor, std::bind(std::move(operation), boost::system::error_code()));
+        return;
+    }
+    waits.push_back(std::move(operation));
+}
+
+inline void fake_socket::enqueue(datagram_type datagram)
+{
+    queue.push_back(std::move(datagram));
+    complete_locked();
+}
+
+inline void fake_socket::complete_locked()
+{
+    if (queue.empty())
+        return;
+
+    for (auto& handler : waits)
+    {
+        net::post(executor, std::bind(std::move(handler), boost::system::error_code()));
+    }
+    waits.clear();
+
+    // A peek leaves the datagram for the following receive operation
+    while (!receives.empty() && !queue.empty())
+    {
+        auto operation = std::move(receives.front());
+        receives.pop_front();
+        const auto length = copy_front(operation.buffers, *operation.sender, operation.flags);
+        net::post(executor, std::bind(std::move(operation.handler), boost::system::error_code(), length));
+    }
+}
+
+inline std::size_t fake_socket::copy_front(const std::vector<boost::asio::mutable_buffer>& buffers,
+                                           endpoint_type& sender,
+                                           message_flags flags)
+{
+    auto& datagram = queue.front();
+    sender = datagram.from;
+    // Surplus bytes are discarded as with a UDP socket
+    const auto length = boost::asio::buffer_copy(buffers, boost::asio::buffer(datagram.data));
+    if ((flags & message_peek) == 0)
+    {
+        queue.pop_front();
+    }
+    return length;
+}
+
+inline void fake_socket::abort_locked(std::vector<receive_handler>& receive_handlers,
+                                      std::vector<wait_handler>& wait_handlers)
+{
+    for (auto& operation : receives)
+    {
+        receive_handlers.push_back(std::move(operation.handler));
+    }
+    receives.clear();
+    for (auto& handler : waits)
+    {
+        wait_handlers.push_back(std::move(handler));
+    }
+    waits.clear();
+}
+
+inline void fake_socket::abort()
+{
+    std::vector<receive_handler> receive_handlers;
+    std::vector<wait_handler> wait_handlers;
+    {
+        std::lock_guard<decltype(network.mutex)> lock(network.mutex);
+        abort_locked(receive_handlers, wait_handlers);
+    }
+    post_aborted(receive_handlers, wait_handlers);
+}
+
+inline void fake_socket::post_aborted(std::vector<receive_handler>& receive_handlers,
+                                      std::vector<wait_handler>& wait_handlers)
+{
+    for (auto& handler : receive_handlers)
+    {
+        net::post(executor, std::bind(std::move(handler), boost::asio::error::operation_aborted, std::size_t(0)));
+    }
+    for (auto& handler : wait_handlers)
+    {
+        net::post(executor, std::bind(std::move(handler), boost::asio::error::operation_aborted));
+    }
+}
+
+inline void fake_socket::ensure_bound(boost::system::error_code& error)
+{
+    if (!opened)
+    {
+        error = boost::asio::error::bad_descriptor;
+        return;
+    }
+    if (bound)
+    {
+        error = boost::system::error_code();
+        return;
+    }
+    // An unbound socket is bound to an ephemeral port when it sends
+    network.bind(*this, endpoint_type(boost::asio::ip::address_v4::any(), 0), error);
+}
+
+} // namespace datagram
+} // namespace trial
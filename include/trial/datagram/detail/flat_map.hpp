@@ -0,0 +1,198 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_FLAT_MAP_HPP
+#define TRIAL_DATAGRAM_DETAIL_FLAT_MAP_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// Open-addressing hash table with linear probing.
+//
+// Entries are stored inline in a single array whose size is a power of two,
+// and erased entries are removed by shifting subsequent entries backwards,
+// so lookups never have to skip tombstones.
+
+template <typename Key, typename T, typename Hash>
+class flat_map
+{
+public:
+    using key_type = Key;
+    using mapped_type = T;
+
+    bool empty() const noexcept { return count == 0; }
+    std::size_t size() const noexcept { return count; }
+
+    // Returns nullptr if key is not found
+    T *find(const Key& key) noexcept;
+    const T *find(const Key& key) const noexcept;
+
+    // Does not overwrite an existing entry
+    std::pair<T *, bool> insert(const Key& key, T value);
+
+    bool erase(const Key& key) noexcept;
+
+    template <typename Function>
+    void for_each(Function&& function);
+
+private:
+    struct slot
+    {
+        Key key;
+        T value;
+        bool occupied = false;
+    };
+
+    std::size_t home(const Key& key) const noexcept { return Hash()(key) & (slots.size() - 1); }
+    std::size_t next(std::size_t index) const noexcept { return (index + 1) & (slots.size() - 1); }
+    std::size_t locate(const Key& key) const noexcept;
+    void grow();
+
+private:
+    static constexpr std::size_t initial_capacity = 16;
+
+    std::vector<slot> slots;
+    std::size_t count = 0;
+};
+
+template <typename Key, typename T, typename Hash>
+std::size_t flat_map<Key, T, Hash>::locate(const Key& key) const noexcept
+{
+    // Returns either the slot containing the key or the empty slot where it
+    // would be inserted. The table is never full.
+    auto index = home(key);
+    while (slots[index].occupied && !(slots[index].key == key))
+    {
+        index = next(index);
+    }
+    return index;
+}
+
+template <typename Key, typename T, typename Hash>
+T *flat_map<Key, T, Hash>::find(const Key& key) noexcept
+{
+    if (count == 0)
+        return nullptr;
+
+    auto& entry = slots[locate(key)];
+    return entry.occupied ? &entry.value : nullptr;
+}
+
+template <typename Key, typename T, typename Hash>
+const T *flat_map<Key, T, Hash>::find(const Key& key) const noexcept
+{
+    if (count == 0)
+        return nullptr;
+
+    const auto& entry = slots[locate(key)];
+    return entry.occupied ? &entry.value : nullptr;
+}
+
+template <typename Key, typename T, typename Hash>
+std::pair<T *, bool> flat_map<Key, T, Hash>::insert(const Key& key, T value)
+{
+    // Keep load factor at or below one half
+    if (2 * (count + 1) > slots.size())
+    {
+        grow();
+    }
+    auto& entry = slots[locate(key)];
+    if (entry.occupied)
+        return std::make_pair(&entry.value, false);
+
+    entry.key = key;
+    entry.value = std::move(value);
+    entry.occupied = true;
+    ++count;
+    return std::make_pair(&entry.value, true);
+}
+
+template <typename Key, typename T, typename Hash>
+bool flat_map<Key, T, Hash>::erase(const Key& key) noexcept
+{
+    if (count == 0)
+        return false;
+
+    auto hole = locate(key);
+    if (!slots[hole].occupied)
+        return false;
+
+    // Move subsequent entries in the probe sequence into the hole unless
+    // they would end up before their home slot.
+    auto index = hole;
+    while (true)
+    {
+        index = next(index);
+        if (!slots[index].occupied)
+            break;
+
+        const auto wanted = home(slots[index].key);
+        const bool stays = (hole <= index)
+            ? ((hole < wanted) && (wanted <= index))
+            : ((hole < wanted) || (wanted <= index));
+        if (stays)
+            continue;
+
+        slots[hole].key = std::move(slots[index].key);
+        slots[hole].value = std::move(slots[index].value);
+        hole = index;
+    }
+    slots[hole].key = Key();
+    slots[hole].value = T();
+    slots[hole].occupied = false;
+    --count;
+    return true;
+}
+
+template <typename Key, typename T, typename Hash>
+template <typename Function>
+void flat_map<Key, T, Hash>::for_each(Function&& function)
+{
+    for (auto& entry : slots)
+    {
+        if (entry.occupied)
+        {
+            function(entry.key, entry.value);
+        }
+    }
+}
+
+template <typename Key, typename T, typename Hash>
+void flat_map<Key, T, Hash>::grow()
+{
+    std::vector<slot> old(slots.empty() ? initial_capacity : 2 * slots.size());
+    old.swap(slots);
+    count = 0;
+    for (auto& entry : old)
+    {
+        if (entry.occupied)
+        {
+            auto& target = slots[locate(entry.key)];
+            target.key = std::move(entry.key);
+            target.value = std::move(entry.value);
+            target.occupied = true;
+            ++count;
+        }
+    }
+}
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_FLAT_MAP_HPP
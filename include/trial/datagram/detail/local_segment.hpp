@@ -0,0 +1,491 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_LOCAL_SEGMENT_HPP
+#define TRIAL_DATAGRAM_DETAIL_LOCAL_SEGMENT_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <boost/system/error_code.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/ip/udp.hpp>
+
+#if defined(__linux__) && (ATOMIC_LLONG_LOCK_FREE == 2)
+# define TRIAL_DATAGRAM_HAS_LOCAL_TRANSPORT 1
+#endif
+
+#if defined(TRIAL_DATAGRAM_HAS_LOCAL_TRANSPORT)
+# include <cerrno>
+# include <fcntl.h>
+# include <signal.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// Ring buffer of datagrams in a named shared-memory segment.
+//
+// The segment is created by the multiplexer that owns a local endpoint and
+// is opened by the multiplexers that send to it, whether they are in the
+// same process or in other processes. Any number of producers may push
+// datagrams concurrently, but only the owner pops them. Neither operation
+// uses a lock or a system call.
+//
+// The consumer announces that it is about to wait before it checks the ring
+// for the last time, and a producer that observes the announcement must
+// wake up the consumer by other means.
+
+class local_segment
+{
+public:
+    using endpoint_type = boost::asio::ip::udp::endpoint;
+
+    static constexpr bool is_supported()
+    {
+#if defined(TRIAL_DATAGRAM_HAS_LOCAL_TRANSPORT)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Name of the segment of a local endpoint, which is also used for the
+    // doorbell
+    static std::string name(const endpoint_type& local_endpoint);
+
+    // Only loopback and unspecified addresses can be reached via a segment
+    static bool is_reachable(const endpoint_type& endpoint);
+
+    // Create the segment of a local endpoint. Fails with address_in_use if
+    // the segment is owned by a running process.
+    static std::unique_ptr<local_segment> create(const endpoint_type& local_endpoint,
+                                                 std::size_t slots,
+                                                 std::size_t slot_size,
+                                                 boost::system::error_code&);
+
+    // Open the segment that receives datagrams sent to a remote endpoint
+    static std::unique_ptr<local_segment> open(const endpoint_type& remote_endpoint,
+                                               boost::system::error_code&);
+
+    local_segment(const local_segment&) = delete;
+    local_segment& operator=(const local_segment&) = delete;
+    ~local_segment();
+
+    const std::string& name() const { return segment_name; }
+    std::size_t slot_size() const;
+
+    // False once the owner has closed the segment
+    bool is_open() const;
+
+    // Producer interface
+    //
+    // Returns false if the ring is full or closed, or if the datagram does
+    // not fit into a slot.
+    template <typename ConstBufferSequence>
+    bool push(const ConstBufferSequence& buffers,
+              const endpoint_type& source);
+
+    // Returns true if the consumer must be woken up
+    bool wake();
+
+    // Consumer interface
+    //
+    // Calls function(data, size, source) with the oldest datagram. Returns
+    // false if the ring is empty.
+    template <typename Function>
+    bool pop(Function&& function);
+
+    bool empty() const;
+
+    // Announce that the consumer is about to wait
+    void sleep();
+
+private:
+    struct header_type;
+    struct slot_type;
+
+    local_segment(std::string name,
+                  void *memory,
+                  std::size_t length,
+                  bool owner);
+
+    static std::unique_ptr<local_segment> map(const std::string& name,
+                                              int descriptor,
+                                              bool owner,
+                                              boost::system::error_code&);
+
+    header_type& header() const;
+    slot_type& slot(std::uint64_t position) const;
+
+private:
+    std::string segment_name;
+    void *memory;
+    std::size_t length;
+    bool owner;
+};
+
+#if defined(TRIAL_DATAGRAM_HAS_LOCAL_TRANSPORT)
+
+struct local_segment::header_type
+{
+    static constexpr std::uint32_t signature = 0x54444752; // TDGR
+
+    std::uint32_t magic;
+    std::uint32_t capacity;
+    std::uint32_t slot_size;
+    std::uint32_t stride;
+    std::int32_t owner;
+    std::atomic<std::uint32_t> open;
+    std::atomic<std::uint32_t> sleeping;
+    alignas(64) std::atomic<std::uint64_t> head;
+    alignas(64) std::atomic<std::uint64_t> tail;
+};
+
+struct local_segment::slot_type
+{
+    // Position of the producer that may write the slot, or position + 1 when
+    // the slot holds a datagram for the consumer
+    std::atomic<std::uint64_t> sequence;
+    std::uint32_t size;
+    std::uint16_t family;
+    std::uint16_t port;
+    std::uint8_t address[16];
+    // Followed by the datagram
+
+    std::uint8_t *data() { return reinterpret_cast<std::uint8_t *>(this + 1); }
+};
+
+inline std::string local_segment::name(const endpoint_type& local_endpoint)
+{
+    return "/trial.datagram." + local_endpoint.address().to_string() + "." + std::to_string(local_endpoint.port());
+}
+
+inline bool local_segment::is_reachable(const endpoint_type& endpoint)
+{
+    return endpoint.address().is_loopback() || endpoint.address().is_unspecified();
+}
+
+inline std::unique_ptr<local_segment> local_segment::create(const endpoint_type& local_endpoint,
+                                                            std::size_t slots,
+                                                            std::size_t slot_size,
+                                                            boost::system::error_code& error)
+{
+    std::size_t capacity = 1;
+    while (capacity < slots)
+    {
+        capacity *= 2;
+    }
+    const std::size_t stride = (sizeof(slot_type) + slot_size + 63) & ~std::size_t(63);
+    const std::size_t length = ((sizeof(header_type) + 63) & ~std::size_t(63)) + capacity * stride;
+
+    const auto segment_name = name(local_endpoint);
+    int descriptor = ::shm_open(segment_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if ((descriptor == -1) && (errno == EEXIST))
+    {
+        // Reclaim the segment if its owner has terminated without removing it
+        boost::system::error_code ignored;
+        auto existing = open(local_endpoint, ignored);
+        if (existing)
+        {
+            error = boost::asio::error::address_in_use;
+            return {};
+        }
+        ::shm_unlink(segment_name.c_str());
+        descriptor = ::shm_open(segment_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (descriptor == -1)
+    {
+        error = boost::system::error_code(errno, boost::system::system_category());
+        return {};
+    }
+    if (::ftruncate(descriptor, length) == -1)
+    {
+        error = boost::system::error_code(errno, boost::system::system_category());
+        ::close(descriptor);
+        ::shm_unlink(segment_name.c_str());
+        return {};
+    }
+    auto result = map(segment_name, descriptor, true, error);
+    if (!result)
+    {
+        ::shm_unlink(segment_name.c_str());
+        return {};
+    }
+
+    auto& header = result->header();
+    header.capacity = std::uint32_t(capacity);
+    header.slot_size = std::uint32_t(slot_size);
+    header.stride = std::uint32_t(stride);
+    header.owner = ::getpid();
+    header.head.store(0);
+    header.tail.store(0);
+    header.sleeping.store(0);
+    for (std::uint64_t position = 0; position < capacity; ++position)
+    {
+        result->slot(position).sequence.store(position, std::memory_order_relaxed);
+    }
+    header.open.store(1);
+    // Producers only use the segment once the signature is in place
+    std::atomic_thread_fence(std::memory_order_release);
+    header.magic = header_type::signature;
+    return result;
+}
+
+inline std::unique_ptr<local_segment> local_segment::open(const endpoint_type& remote_endpoint,
+                                                          boost::system::error_code& error)
+{
+    const auto segment_name = name(remote_endpoint);
+    const int descriptor = ::shm_open(segment_name.c_str(), O_RDWR, 0);
+    if (descriptor == -1)
+    {
+        error = boost::system::error_code(errno, boost::system::system_category());
+        return {};
+    }
+    auto result = map(segment_name, descriptor, false, error);
+    if (!result)
+        return {};
+    if (result->header().magic != header_type::signature)
+    {
+        // Not yet initialized by the owner
+        error = boost::asio::error::try_again;
+        return {};
+    }
+    if (!result->is_open() ||
+        ((::kill(result->header().owner, 0) == -1) && (errno == ESRCH)))
+    {
+        // Left behind by an owner that has terminated
+        error = boost::asio::error::connection_refused;
+        return {};
+    }
+    return result;
+}
+
+inline std::unique_ptr<local_segment> local_segment::map(const std::string& segment_name,
+                                                         int descriptor,
+                                                         bool owner,
+                                                         boost::system::error_code& error)
+{
+    struct ::stat status;
+    if (::fstat(descriptor, &status) == -1)
+    {
+        error = boost::system::error_code(errno, boost::system::system_category());
+        ::close(descriptor);
+        return {};
+    }
+    const std::size_t length = status.st_size;
+    if (length < sizeof(header_type))
+    {
+        error = boost::asio::error::try_again;
+        ::close(descriptor);
+        return {};
+    }
+    void *memory = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if (memory == MAP_FAILED)
+    {
+        error = boost::system::error_code(errno, boost::system::system_category());
+        return {};
+    }
+    error = boost::system::error_code();
+    return std::unique_ptr<local_segment>(new local_segment(segment_name, memory, length, owner));
+}
+
+inline local_segment::local_segment(std::string name,
+                                    void *memory,
+                                    std::size_t length,
+                                    bool owner)
+    : segment_name(std::move(name)),
+      memory(memory),
+      length(length),
+      owner(owner)
+{
+}
+
+inline local_segment::~local_segment()
+{
+    if (owner)
+    {
+        header().open.store(0);
+        ::shm_unlink(segment_name.c_str());
+    }
+    ::munmap(memory, length);
+}
+
+inline local_segment::header_type& local_segment::header() const
+{
+    return *static_cast<header_type *>(memory);
+}
+
+inline local_segment::slot_type& local_segment::slot(std::uint64_t position) const
+{
+    auto& head = header();
+    auto *slots = static_cast<std::uint8_t *>(memory) + ((sizeof(header_type) + 63) & ~std::size_t(63));
+    return *reinterpret_cast<slot_type *>(slots + (position & (head.capacity - 1)) * head.stride);
+}
+
+inline std::size_t local_segment::slot_size() const
+{
+    return header().slot_size;
+}
+
+inline bool local_segment::is_open() const
+{
+    return header().open.load(std::memory_order_acquire) != 0;
+}
+
+template <typename ConstBufferSequence>
+bool local_segment::push(const ConstBufferSequence& buffers,
+                         const endpoint_type& source)
+{
+    auto& head = header();
+    const std::size_t size = boost::asio::buffer_size(buffers);
+    if ((size > head.slot_size) || !is_open())
+        return false;
+
+    auto position = head.head.load(std::memory_order_relaxed);
+    while (true)
+    {
+        auto& entry = slot(position);
+        const auto sequence = entry.sequence.load(std::memory_order_acquire);
+        const auto difference = std::int64_t(sequence - position);
+        if (difference == 0)
+        {
+            if (head.head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                entry.size = std::uint32_t(size);
+                entry.port = source.port();
+                if (source.address().is_v4())
+                {
+                    entry.family = 4;
+                    const auto bytes = source.address().to_v4().to_bytes();
+                    std::memcpy(entry.address, bytes.data(), bytes.size());
+                }
+                else
+                {
+                    entry.family = 6;
+                    const auto bytes = source.address().to_v6().to_bytes();
+                    std::memcpy(entry.address, bytes.data(), bytes.size());
+                }
+                boost::asio::buffer_copy(boost::asio::buffer(entry.data(), size), buffers);
+                entry.sequence.store(position + 1, std::memory_order_seq_cst);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            // Full
+            return false;
+        }
+        else
+        {
+            position = head.head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+inline bool local_segment::wake()
+{
+    return header().sleeping.exchange(0, std::memory_order_seq_cst) != 0;
+}
+
+template <typename Function>
+bool local_segment::pop(Function&& function)
+{
+    auto& head = header();
+    const auto position = head.tail.load(std::memory_order_relaxed);
+    auto& entry = slot(position);
+    if (entry.sequence.load(std::memory_order_acquire) != position + 1)
+        return false;
+
+    endpoint_type source;
+    if (entry.family == 4)
+    {
+        boost::asio::ip::address_v4::bytes_type bytes;
+        std::memcpy(bytes.data(), entry.address, bytes.size());
+        source = endpoint_type(boost::asio::ip::address_v4(bytes), entry.port);
+    }
+    else
+    {
+        boost::asio::ip::address_v6::bytes_type bytes;
+        std::memcpy(bytes.data(), entry.address, bytes.size());
+        source = endpoint_type(boost::asio::ip::address_v6(bytes), entry.port);
+    }
+    function(static_cast<const std::uint8_t *>(entry.data()), std::size_t(entry.size), source);
+    entry.sequence.store(position + head.capacity, std::memory_order_release);
+    head.tail.store(position + 1, std::memory_order_relaxed);
+    return true;
+}
+
+inline bool local_segment::empty() const
+{
+    auto& head = header();
+    const auto position = head.tail.load(std::memory_order_relaxed);
+    return slot(position).sequence.load(std::memory_order_seq_cst) != position + 1;
+}
+
+inline void local_segment::sleep()
+{
+    header().sleeping.store(1, std::memory_order_seq_cst);
+}
+
+#else
+
+struct local_segment::header_type {};
+struct local_segment::slot_type {};
+
+inline std::string local_segment::name(const endpoint_type&) { return {}; }
+inline bool local_segment::is_reachable(const endpoint_type&) { return false; }
+
+inline std::unique_ptr<local_segment> local_segment::create(const endpoint_type&,
+                                                            std::size_t,
+                                                            std::size_t,
+                                                            boost::system::error_code& error)
+{
+    error = boost::asio::error::operation_not_supported;
+    return {};
+}
+
+inline std::unique_ptr<local_segment> local_segment::open(const endpoint_type&,
+                                                          boost::system::error_code& error)
+{
+    error = boost::asio::error::operation_not_supported;
+    return {};
+}
+
+inline local_segment::~local_segment() {}
+inline std::size_t local_segment::slot_size() const { return 0; }
+inline bool local_segment::is_open() const { return false; }
+template <typename ConstBufferSequence>
+bool local_segment::push(const ConstBufferSequence&, const endpoint_type&) { return false; }
+inline bool local_segment::wake() { return false; }
+template <typename Function>
+bool local_segment::pop(Function&&) { return false; }
+inline bool local_segment::empty() const { return true; }
+inline void local_segment::sleep() {}
+
+#endif
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_LOCAL_SEGMENT_HPP
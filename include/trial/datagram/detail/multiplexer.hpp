@@ -12,15 +12,39 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <functional>
 #include <deque>
 #include <tuple>
-#include <map>
+#include <type_traits>
 #include <boost/asio/placeholders.hpp>
+#include <boost/asio/ip/multicast.hpp>
 #include <boost/asio/ip/udp.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <trial/net/executor.hpp>
+#include <trial/datagram/option.hpp>
 #include <trial/datagram/detail/buffer.hpp>
+#include <trial/datagram/detail/endpoint_key.hpp>
+#include <trial/datagram/detail/flat_map.hpp>
+#include <trial/datagram/detail/local_segment.hpp>
+#include <trial/datagram/detail/operation.hpp>
+#include <trial/datagram/detail/completion_list.hpp>
+#include <trial/datagram/detail/batch_receiver.hpp>
+#include <trial/datagram/detail/batch_sender.hpp>
+#include <trial/datagram/detail/offload.hpp>
+#include <trial/datagram/detail/peer_channel.hpp>
+#include <trial/datagram/detail/statistics.hpp>
+#include <trial/datagram/detail/timer_wheel.hpp>
+#include <trial/datagram/detail/timestamp.hpp>
+#include <trial/datagram/detail/token_bucket.hpp>
+#include <trial/datagram/detail/uring.hpp>
+#include <trial/datagram/detail/worker_mailbox.hpp>
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+# include <boost/asio/posix/stream_descriptor.hpp>
+#endif
 
 namespace trial
 {
@@ -33,22 +57,37 @@ class socket_base;
 
 // The multiplexer mediates between trial.datagram sockets and the underlying
 // UDP socket.
+//
+// The multiplexer can be used from several threads running the io_context.
+// Its state is split between a receive lock, which covers demultiplexing
+// and the socket registry, and a send lock, which covers batching, pacing
+// and submission, so senders do not wait for a demultiplexing burst. Each
+// promoted peer is read under the lock of its own channel. Locks are taken
+// in that order, and handlers are never invoked while a lock is held.
+//
+// The next layer is normally a UDP socket, but can be any datagram socket
+// with the same interface and endpoint type, such as datagram::fake_socket.
+// Features that need the native UDP socket, such as batching, offloading,
+// io_uring, promotion and the local transport, are then unavailable.
 
-class multiplexer
-    : public std::enable_shared_from_this<multiplexer>
+template <typename NextLayer>
+class basic_multiplexer
+    : public std::enable_shared_from_this<basic_multiplexer<NextLayer>>
 {
 public:
-    // Must be the underlying UDP types
     using protocol_type = boost::asio::ip::udp;
-    using next_layer_type = protocol_type::socket;
+    using next_layer_type = NextLayer;
     using endpoint_type = protocol_type::endpoint;
     using buffer_type = detail::buffer;
 
+    static_assert(std::is_same<typename next_layer_type::endpoint_type, endpoint_type>::value,
+                  "The next layer must use UDP endpoints");
+
     // Use factory method to ensure that multiplexer is created as shared_ptr
     template <typename... Types>
-    static std::unique_ptr<multiplexer> create(Types&&...);
+    static std::unique_ptr<basic_multiplexer> create(Types&&...);
 
-    ~multiplexer();
+    ~basic_multiplexer();
 
     void add(socket_base *);
     void remove(socket_base *);
@@ -64,45 +103,464 @@ public:
                        const endpoint_type& endpoint,
                        CompletionToken&& token) -> typename net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>;
 
-    void start_receive();
+    // Send buffers as datagrams of segment_size bytes
+    template <typename ConstBufferSequence,
+              typename CompletionToken>
+    auto async_send_segments_to(const ConstBufferSequence& buffers,
+                                const endpoint_type& endpoint,
+                                std::size_t segment_size,
+                                CompletionToken&& token) -> typename net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>;
+
+    // Non-blocking send that fails with would_block instead of waiting
+    template <typename ConstBufferSequence>
+    std::size_t try_send_to(const ConstBufferSequence& buffers,
+                            const endpoint_type& endpoint,
+                            boost::system::error_code&);
+
+    // Send to the remote endpoint of a socket
+    template <typename ConstBufferSequence,
+              typename CompletionToken>
+    auto async_send(socket_base&,
+                    const ConstBufferSequence& buffers,
+                    CompletionToken&& token) -> typename net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>;
+
+    template <typename ConstBufferSequence>
+    std::size_t try_send(socket_base&,
+                         const ConstBufferSequence& buffers,
+                         boost::system::error_code&);
+
+    void start_receive(socket_base&);
+
+    // Flow control of datagrams queued on sockets
+    void add_queued(std::size_t bytes);
+    void remove_queued(std::size_t bytes);
+
+    // Record activity on a socket for idle expiry
+    void touch(socket_base&);
+
+    // Counters that are also updated by sockets
+    multiplexer_statistics& counters();
+
+    // Record the latency of a dispatched datagram
+    void dispatched(const buffer_type&);
+
+    // Multicast group of the local endpoint
+    void subscribe(socket_base&,
+                   const option::multicast_subscription&,
+                   boost::system::error_code&);
+    void get_subscription(const socket_base&,
+                          option::multicast_subscription&,
+                          boost::system::error_code&) const;
+
+    template <typename SettableSocketOption>
+    void set_option(const SettableSocketOption&,
+                    boost::system::error_code&);
+    void set_option(const option::receive_batch&,
+                    boost::system::error_code&);
+    void set_option(const option::send_batch&,
+                    boost::system::error_code&);
+    void set_option(const option::buffer_pool&,
+                    boost::system::error_code&);
+    void set_option(const option::listen_backlog&,
+                    boost::system::error_code&);
+    void set_option(const option::receive_pause&,
+                    boost::system::error_code&);
+    void set_option(const option::receive_offload&,
+                    boost::system::error_code&);
+    void set_option(const option::idle_timeout&,
+                    boost::system::error_code&);
+    void set_option(const option::receive_timestamp&,
+                    boost::system::error_code&);
+    void set_option(const option::peer_promotion&,
+                    boost::system::error_code&);
+    void set_option(const option::local_transport&,
+                    boost::system::error_code&);
+    void set_option(const option::worker_delivery&,
+                    boost::system::error_code&);
+    void set_option(const option::send_pacing&,
+                    boost::system::error_code&);
+    void set_option(const option::multicast_subscription&,
+                    boost::system::error_code&);
+
+    template <typename GettableSocketOption>
+    void get_option(GettableSocketOption&,
+                    boost::system::error_code&) const;
+    void get_option(option::buffer_pool&,
+                    boost::system::error_code&) const;
+    void get_option(option::listen_backlog&,
+                    boost::system::error_code&) const;
+    void get_option(option::receive_offload&,
+                    boost::system::error_code&) const;
+    void get_option(option::idle_timeout&,
+                    boost::system::error_code&) const;
+    void get_option(option::statistics&,
+                    boost::system::error_code&) const;
+    void get_option(option::receive_timestamp&,
+                    boost::system::error_code&) const;
+    void get_option(option::receive_latency&,
+                    boost::system::error_code&) const;
+    void get_option(option::io_backend&,
+                    boost::system::error_code&) const;
+    void get_option(option::peer_promotion&,
+                    boost::system::error_code&) const;
+    void get_option(option::local_transport&,
+                    boost::system::error_code&) const;
+    void get_option(option::worker_delivery&,
+                    boost::system::error_code&) const;
+    void get_option(option::send_pacing&,
+                    boost::system::error_code&) const;
+    void get_option(option::multicast_subscription&,
+                    boost::system::error_code&) const;
 
     const next_layer_type& next_layer() const;
     next_layer_type& next_layer();
 
+    const net::executor& get_executor() const;
+
 private:
-    multiplexer(const net::executor&,
-                const endpoint_type& local_endpoint);
+    // Access to the receive path for benchmarks
+    friend struct multiplexer_access;
 
+    using accept_output_type = std::tuple<boost::system::error_code, buffer_type, endpoint_type>;
+
+    basic_multiplexer(const net::executor&,
+                      const endpoint_type& local_endpoint,
+                      bool reuse_port,
+                      const option::io_backend&);
+
+    // Whether the next layer is a UDP socket with a native handle
+    static constexpr bool is_native()
+    {
+        return std::is_same<next_layer_type, boost::asio::ip::udp::socket>::value;
+    }
+
+    void start_receive_locked();
+    void fulfill_receive(std::size_t count = 1);
+    bool is_receive_paused() const;
+    void arm_receive();
     void do_start_receive();
+    void do_start_receive_batch();
+    // Reads from the next layer or from a peer channel. Ancillary data is
+    // read if coalescing or timestamps are enabled on the source.
+    template <typename Source>
+    buffer_type read_datagram(Source&,
+                              bool ancillary,
+                              endpoint_type&,
+                              std::size_t& segment_size,
+                              boost::system::error_code&);
 
     void process_receive(const boost::system::error_code&,
-                         std::unique_ptr<buffer_type>,
-                         const endpoint_type&);
+                         buffer_type,
+                         const endpoint_type&,
+                         std::size_t segment_size,
+                         completion_list&);
+    void process_receive_batch(const boost::system::error_code&,
+                               std::size_t count,
+                               completion_list&);
+    // Returns the number of receive and accept requests completed
+    std::size_t process_segments(const boost::system::error_code&,
+                                 buffer_type,
+                                 const endpoint_type&,
+                                 std::size_t segment_size,
+                                 completion_list&);
+    template <typename Function>
+    void split_segments(const boost::system::error_code&,
+                        buffer_type,
+                        std::size_t segment_size,
+                        Function&&);
+    void record_received(const boost::system::error_code&,
+                         buffer_type&,
+                         bool timestamps);
+    std::size_t process_datagram(const boost::system::error_code&,
+                                 buffer_type,
+                                 const endpoint_type&,
+                                 completion_list&);
+    void accept(detail::operation_pointer<accept_operation>,
+                const boost::system::error_code&,
+                buffer_type,
+                const endpoint_type&,
+                completion_list&);
+    static bool is_accepted(const boost::system::error_code&);
+
+    void enqueue_listen(const boost::system::error_code&,
+                        buffer_type,
+                        const endpoint_type&);
+    std::unique_ptr<accept_output_type> take_listen();
+
+    // Send with the send lock held
+    template <typename ConstBufferSequence,
+              typename WriteHandler>
+    void do_send_to(const ConstBufferSequence& buffers,
+                    const endpoint_type& endpoint,
+                    WriteHandler&& handler);
+    template <typename ConstBufferSequence,
+              typename WriteHandler>
+    void do_send(socket_base&,
+                 const ConstBufferSequence& buffers,
+                 WriteHandler&& handler);
+    template <typename ConstBufferSequence>
+    std::size_t do_try_send_to(const ConstBufferSequence& buffers,
+                               const endpoint_type& endpoint,
+                               boost::system::error_code&);
+    template <typename ConstBufferSequence>
+    void do_send_segments_to(const ConstBufferSequence& buffers,
+                             const endpoint_type& endpoint,
+                             std::size_t segment_size,
+                             detail::operation_pointer<send_operation>);
+    template <typename ConstBufferSequence>
+    class segment_wait_handler;
+
+    template <typename WriteHandler>
+    class counting_send_handler;
+
+    void count_send(const boost::system::error_code&,
+                    std::size_t length,
+                    std::size_t datagrams);
+
+    // Completed sends are counted before they are completed. Deferred
+    // completions are posted, because handlers must not be invoked from
+    // within the initiating function.
+    send_queue flush_send();
+    void deliver_send(send_queue,
+                      bool defer_completion);
+    void complete_send(send_queue,
+                       bool defer_completion);
+    void complete_send(detail::operation_pointer<send_operation>,
+                       const boost::system::error_code&,
+                       std::size_t length);
+
+    // Send pacing. Returns false if the send must be deferred.
+    bool pace(socket_base *,
+              std::size_t size);
+    template <typename Function>
+    void defer_send(socket_base *,
+                    std::size_t size,
+                    detail::operation_pointer<send_operation>,
+                    Function&& send);
+    void abort_deferred(socket_base&);
+    void process_pacing();
+    void arm_pacing_timer(const std::chrono::steady_clock::time_point&);
+
+    // io_uring backend
+    void open_ring(const option::io_backend&);
+    void do_start_receive_ring();
+    void arm_ring_receive();
+    void arm_ring_wait();
+    void post_ring_submit();
+    // Returns true if received datagrams are ready to be taken
+    bool process_ring(send_queue&);
+    void process_ring_receive(completion_list&);
+    template <typename ConstBufferSequence,
+              typename WriteHandler>
+    void ring_send_to(const ConstBufferSequence& buffers,
+                      const endpoint_type& endpoint,
+                      WriteHandler&& handler);
+
+    using idle_wheel_type = detail::timer_wheel<socket_base>;
+    using idle_tick_type = idle_wheel_type::tick_type;
+
+    // Queue a datagram on a socket, or hand it to the worker of the socket.
+    // Returns true if it completes a receive request.
+    bool deliver(socket_base&,
+                 const boost::system::error_code&,
+                 buffer_type,
+                 completion_list&);
+    void attach_worker(socket_base&);
+    void detach_worker(socket_base&);
+
+    // Hand a datagram of the multicast group to all subscribers
+    std::size_t fan_out(const boost::system::error_code&,
+                        buffer_type,
+                        completion_list&);
+    void unsubscribe(socket_base&);
+    template <typename Membership>
+    static Membership multicast_membership(const boost::asio::ip::address& group,
+                                           const boost::asio::ip::address& network_interface);
+
+    void promote(socket_base&);
+    void demote(socket_base&);
+    // Called with the channel locked
+    void arm_channel(const std::shared_ptr<peer_channel>&);
+    void process_channel(peer_channel&,
+                         completion_list&);
+
+    // Shared-memory transport
+    using doorbell_type = boost::asio::local::datagram_protocol::socket;
+    void open_local(const option::local_transport&,
+                    boost::system::error_code&);
+    void close_local();
+    template <typename ConstBufferSequence>
+    bool local_send_to(const ConstBufferSequence& buffers,
+                       const endpoint_type& endpoint);
+    detail::local_segment *local_peer(const endpoint_type&);
+    static doorbell_type::endpoint_type local_doorbell_endpoint(const detail::local_segment&);
+    void arm_local();
+    void resume_local(std::size_t generation,
+                      bool doorbell);
+    void process_local(completion_list&);
+
+    void track(socket_base&);
+    idle_tick_type idle_clock() const;
+    void arm_idle_timer();
+    void process_idle(const boost::system::error_code&,
+                      completion_list&);
 
 private:
+    mutable std::mutex receive_mutex;
+    mutable std::mutex send_mutex;
     net::executor executor;
     next_layer_type real_socket;
+    detail::buffer_pool::pointer pool;
 
-    using socket_map = std::map<endpoint_type, socket_base *>;
+    // Protected by the receive lock
+    using socket_map = detail::flat_map<endpoint_key, socket_base *, endpoint_key::hash>;
     socket_map sockets;
 
-    std::atomic<int> pending_receive_count;
+    int pending_receive_count;
 
-    using accept_handler_type = std::function<void (const boost::system::error_code&)>;
-    using accept_input_type = std::tuple<socket_base *, accept_handler_type>;
-    std::deque<std::unique_ptr<accept_input_type>> acceptor_queue;
+    detail::operation_queue<accept_operation> acceptor_queue;
 
-    // FIXME: Bounded queue? (like listen() backlog)
-    using accept_output_type = std::tuple<boost::system::error_code, std::unique_ptr<buffer_type>, endpoint_type>;
     std::deque<std::unique_ptr<accept_output_type>> listen_queue;
+    // Queued datagrams by remote endpoint for the coalesce policy
+    detail::flat_map<endpoint_key, accept_output_type *, endpoint_key::hash> listen_index;
+    option::listen_backlog backlog;
+    struct
+    {
+        std::size_t accepted = 0;
+        std::size_t queued = 0;
+        std::size_t dropped = 0;
+    } listen_counters;
 
     std::uint8_t peek[1];
+    endpoint_type peek_endpoint;
+    detail::batch_receiver batch;
+    bool receive_coalescing;
+    bool receive_timestamps;
+
+    // Protected by the send lock
+    detail::batch_sender sender;
+    option::send_batch send_threshold;
+    bool send_flush_pending;
+    bool send_waiting;
+
+    // Updated by sockets without holding a lock
+    std::atomic<std::size_t> queued_bytes;
+    std::atomic<std::size_t> pause_threshold;
+    std::atomic<bool> resume_pending;
+    std::atomic<bool> receive_paused;
+
+    // Idle expiry
+    idle_wheel_type idle_wheel;
+    boost::asio::steady_timer idle_timer;
+    const std::chrono::steady_clock::time_point idle_epoch;
+    option::idle_timeout idle_limit;
+    idle_tick_type idle_ticks;
+    bool idle_timer_running;
+    std::size_t idle_expired;
+    // Read by sockets without holding a lock
+    std::atomic<idle_tick_type> idle_tick;
+
+    multiplexer_statistics stats;
+
+    // Promotion to connected UDP sockets
+    const bool reuse_port;
+    option::peer_promotion promotion;
+    std::size_t promoted_count;
+    std::size_t promotion_failures;
+
+    // Send pacing, protected by the send lock
+    struct deferred_send
+    {
+        socket_base *socket;
+        std::size_t size;
+        std::chrono::steady_clock::time_point queued;
+        detail::operation_pointer<send_operation> operation;
+        std::function<void (detail::operation_pointer<send_operation>)> send;
+    };
+    option::send_pacing pacing;
+    detail::token_bucket send_bucket;
+    detail::token_bucket socket_bucket;
+    std::chrono::steady_clock::time_point send_drained;
+    std::deque<deferred_send> deferred_sends;
+    boost::asio::steady_timer pacing_timer;
+    std::chrono::steady_clock::time_point pacing_deadline;
+    bool pacing_timer_running;
+    std::size_t deferred_count;
+    std::chrono::steady_clock::duration deferred_delay;
+    std::chrono::steady_clock::duration deferred_max_delay;
+
+    // Worker executors, which are few and searched linearly
+    bool worker_enabled;
+    std::vector<std::shared_ptr<detail::worker_mailbox>> workers;
+    std::atomic<std::size_t> worker_delivered;
+
+    // Shared-memory transport. Peer rings are opened on first use. The inbox
+    // is changed with both locks held, the peers and the bell that wakes
+    // them belong to the send lock, and the rest to the receive lock.
+    struct local_peer_type
+    {
+        std::unique_ptr<detail::local_segment> segment;
+        std::chrono::steady_clock::time_point retry;
+    };
+    option::local_transport local_option;
+    std::unique_ptr<detail::local_segment> local_inbox;
+    std::unique_ptr<doorbell_type> local_doorbell;
+    std::unique_ptr<doorbell_type> local_bell;
+    endpoint_type local_source;
+    detail::flat_map<endpoint_key, local_peer_type, endpoint_key::hash> local_peers;
+    // Discards continuations of a closed transport
+    std::size_t local_generation;
+    std::size_t local_sent;
+    std::size_t local_received;
+    std::size_t local_fallbacks;
+
+    // Multicast subscribers and memberships by interface
+    std::vector<socket_base *> subscribers;
+    std::vector<std::pair<boost::asio::ip::address, std::size_t>> memberships;
+    std::size_t multicast_datagrams;
+
+    // io_uring backend, protected by the send lock. Received datagrams are
+    // taken with both locks held and demultiplexed with the receive lock.
+    struct ring_send_request
+    {
+        detail::uring::send_request request;
+        detail::operation_pointer<send_operation> operation;
+    };
+    option::io_backend backend;
+    std::vector<std::unique_ptr<ring_send_request>> ring_send_storage;
+    std::vector<ring_send_request *> ring_send_free;
+    std::unique_ptr<detail::uring> ring;
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+    std::unique_ptr<boost::asio::posix::stream_descriptor> ring_event;
+#endif
+    std::vector<detail::uring::completion> ring_received;
+    struct ring_datagram
+    {
+        boost::system::error_code error;
+        buffer_type datagram;
+        endpoint_type remote_endpoint;
+        std::size_t segment_size;
+    };
+    std::vector<ring_datagram> ring_taken;
+    std::size_t ring_sends;
+    bool ring_wanted;
+    bool ring_receiving;
+    bool ring_waiting;
+    bool ring_submit_pending;
 };
 
+using multiplexer = basic_multiplexer<boost::asio::ip::udp::socket>;
+
 } // namespace detail
 } // namespace datagram
 } // namespace trial
 
 #include <trial/datagram/detail/multiplexer.ipp>
+#include <trial/datagram/detail/multiplexer_offload.ipp>
+#include <trial/datagram/detail/multiplexer_pacing.ipp>
+#include <trial/datagram/detail/multiplexer_promotion.ipp>
+#include <trial/datagram/detail/multiplexer_multicast.ipp>
+#include <trial/datagram/detail/multiplexer_local.ipp>
+#include <trial/datagram/detail/multiplexer_uring.ipp>
 
 #endif // TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_HPP
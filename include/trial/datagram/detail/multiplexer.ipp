@@ -11,7 +11,9 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
 #include <cassert>
+#include <functional>
 #include <utility>
 #include <boost/asio/buffer.hpp>
 #include <trial/datagram/detail/socket_base.hpp>
@@ -23,129 +25,1253 @@ namespace datagram
 namespace detail
 {
 
+template <typename NextLayer>
 template <typename... Types>
-std::unique_ptr<multiplexer> multiplexer::create(Types&&... args)
+std::unique_ptr<basic_multiplexer<NextLayer>> basic_multiplexer<NextLayer>::create(Types&&... args)
 {
-    std::unique_ptr<multiplexer> self(new multiplexer{std::forward<Types>(args)...});
+    std::unique_ptr<basic_multiplexer> self(new basic_multiplexer{std::forward<Types>(args)...});
     return self;
 }
 
-inline multiplexer::multiplexer(const net::executor& executor,
-                                const endpoint_type& local_endpoint)
+template <typename NextLayer>
+basic_multiplexer<NextLayer>::basic_multiplexer(const net::executor& executor,
+                                                const endpoint_type& local_endpoint,
+                                                bool reuse_port,
+                                                const option::io_backend& backend)
     : executor(executor),
-      real_socket(executor, local_endpoint),
-      pending_receive_count(0)
+      real_socket(executor),
+      pool(buffer_pool::create()),
+      pending_receive_count(0),
+      receive_coalescing(false),
+      receive_timestamps(false),
+      send_flush_pending(false),
+      send_waiting(false),
+      queued_bytes(0),
+      pause_threshold(0),
+      resume_pending(false),
+      receive_paused(false),
+      idle_timer(executor),
+      idle_epoch(std::chrono::steady_clock::now()),
+      idle_ticks(0),
+      idle_timer_running(false),
+      idle_expired(0),
+      idle_tick(0),
+      reuse_port(reuse_port),
+      promoted_count(0),
+      promotion_failures(0),
+      pacing_timer(executor),
+      pacing_timer_running(false),
+      deferred_count(0),
+      deferred_delay(std::chrono::steady_clock::duration::zero()),
+      deferred_max_delay(std::chrono::steady_clock::duration::zero()),
+      worker_enabled(false),
+      worker_delivered(0),
+      local_generation(0),
+      local_sent(0),
+      local_received(0),
+      local_fallbacks(0),
+      multicast_datagrams(0),
+      backend(backend),
+      ring_sends(0),
+      ring_wanted(false),
+      ring_receiving(false),
+      ring_waiting(false),
+      ring_submit_pending(false)
 {
+    real_socket.open(local_endpoint.protocol());
+    if (reuse_port)
+    {
+#if defined(SO_REUSEPORT)
+        real_socket.set_option(option::reuse_port(true));
+#else
+        throw boost::system::system_error(boost::asio::error::operation_not_supported);
+#endif
+    }
+    if (local_endpoint.address().is_multicast())
+    {
+        // Other processes may subscribe to the same group
+        real_socket.set_option(boost::asio::socket_base::reuse_address(true));
+    }
+    real_socket.bind(local_endpoint);
+    // Synchronous operations must report would_block rather than wait
+    real_socket.non_blocking(true);
+    if (backend.backend() == option::io_backend::uring)
+    {
+        open_ring(backend);
+    }
 }
 
-inline multiplexer::~multiplexer()
+template <typename NextLayer>
+basic_multiplexer<NextLayer>::~basic_multiplexer()
 {
     assert(sockets.empty());
     assert(acceptor_queue.empty());
 
+    idle_wheel.clear();
+
     listen_queue.clear();
+
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+    if (ring_event)
+    {
+        // The eventfd is closed by the ring
+        ring_event->release();
+    }
+#endif
 }
 
-inline void multiplexer::add(socket_base *socket)
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::add(socket_base *socket)
 {
     assert(socket);
 
-    sockets.insert(socket_map::value_type(socket->remote_endpoint(), socket));
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    sockets.insert(endpoint_key(socket->remote_endpoint()), socket);
+    stats.sockets.set(sockets.size());
+    track(*socket);
+    attach_worker(*socket);
+    if (promotion.policy() == option::peer_promotion::always)
+    {
+        promote(*socket);
+    }
 }
 
-inline void multiplexer::remove(socket_base *socket)
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::remove(socket_base *socket)
 {
     assert(socket);
 
-    sockets.erase(socket->remote_endpoint());
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    const endpoint_key key(socket->remote_endpoint());
+    auto where = sockets.find(key);
+    if (where && (*where == socket))
+    {
+        sockets.erase(key);
+        stats.sockets.set(sockets.size());
+    }
+    if (socket->idle_entry.linked())
+    {
+        idle_wheel.erase(socket->idle_entry);
+    }
+    demote(*socket);
+    detach_worker(*socket);
+    {
+        std::lock_guard<decltype(send_mutex)> send_lock(send_mutex);
+        abort_deferred(*socket);
+    }
+    unsubscribe(*socket);
 
     // Pending requests must receive an operation_aborted
-    auto it = acceptor_queue.begin();
-    while (it != acceptor_queue.end())
+    detail::operation_queue<accept_operation> remaining;
+    while (!acceptor_queue.empty())
     {
-        if (std::get<0>(**it) == socket)
+        auto input = acceptor_queue.pop();
+        if (input->socket == socket)
         {
-            auto handler = std::get<1>(**it);
             net::post(
                 executor,
-                [handler]
-                {
-                    handler(boost::asio::error::make_error_code(boost::asio::error::operation_aborted));
-                });
-            it = acceptor_queue.erase(it);
+                std::bind(
+                    [] (detail::operation_pointer<accept_operation>& input)
+                    {
+                        input.release()->complete(boost::asio::error::make_error_code(boost::asio::error::operation_aborted));
+                    },
+                    std::move(input)));
         }
         else
         {
-            ++it;
+            remaining.push(std::move(input));
         }
     }
+    while (!remaining.empty())
+    {
+        acceptor_queue.push(remaining.pop());
+    }
 }
 
+template <typename NextLayer>
 template <typename SocketType,
           typename AcceptHandler>
-void multiplexer::async_accept(SocketType& socket,
-                               AcceptHandler&& handler)
+void basic_multiplexer<NextLayer>::async_accept(SocketType& socket,
+                                                AcceptHandler&& handler)
 {
     // Accept requests are handled on a first-come first-serve basis
 
+    auto allocator = detail::get_handler_allocator(handler);
+    auto handler_executor = boost::asio::get_associated_executor(handler, net::extension::get_executor(socket));
+    auto operation = detail::make_operation<accept_operation>(std::forward<AcceptHandler>(handler),
+                                                              allocator,
+                                                              handler_executor,
+                                                              &socket);
+
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
     if (listen_queue.empty())
     {
-        std::unique_ptr<accept_input_type> operation(
-            new accept_input_type(&socket,
-                                  std::move(handler)));
-        acceptor_queue.emplace_back(std::move(operation));
+        acceptor_queue.push(std::move(operation));
     }
     else
     {
         net::post(
-            net::extension::get_executor(next_layer()),
-            [this, &socket, handler]
-            {
-                assert(!listen_queue.empty());
+            executor,
+            std::bind(
+                [this] (detail::operation_pointer<accept_operation>& operation)
+                {
+                    completion_list completions;
+                    {
+                        std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+                        if (listen_queue.empty())
+                        {
+                            // Queued datagram was taken by an earlier accept request
+                            acceptor_queue.push(std::move(operation));
+                            return;
+                        }
 
-                auto output = std::move(listen_queue.front());
-                listen_queue.pop_front();
+                        auto output = take_listen();
+                        accept(std::move(operation),
+                               std::get<0>(*output),
+                               std::move(std::get<1>(*output)),
+                               std::get<2>(*output),
+                               completions);
+                    }
+                    completions.invoke();
+                },
+                std::move(operation)));
+    }
 
-                const auto& error = std::get<0>(*output);
-                if (!error)
-                {
-                    socket.remote_endpoint(std::get<2>(*output));
-                    // Queue datagram for later use
-                    socket.enqueue(error, std::move(std::get<1>(*output)));
-                }
-                handler(error);
-            });
+    start_receive_locked();
+}
+
+template <typename NextLayer>
+template <typename ConstBufferSequence,
+          typename CompletionToken>
+auto basic_multiplexer<NextLayer>::async_send_to(const ConstBufferSequence& buffers,
+                                                 const endpoint_type& endpoint,
+                                                 CompletionToken&& token) -> typename net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>
+{
+    net::async_completion<CompletionToken, void(boost::system::error_code, std::size_t)> async(token);
+
+    std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+    const auto size = boost::asio::buffer_size(buffers);
+    if (!pace(nullptr, size))
+    {
+        defer_send(nullptr,
+                   size,
+                   make_send_operation(std::move(async.completion_handler), executor),
+                   [this, buffers, endpoint] (detail::operation_pointer<send_operation> operation)
+                   {
+                       do_send_to(buffers, endpoint, send_completion(std::move(operation)));
+                   });
+        return async.result.get();
     }
+    do_send_to(buffers,
+               endpoint,
+               std::move(async.completion_handler));
+    return async.result.get();
+}
 
-    if (pending_receive_count++ == 0)
+template <typename NextLayer>
+template <typename ConstBufferSequence,
+          typename WriteHandler>
+void basic_multiplexer<NextLayer>::do_send_to(const ConstBufferSequence& buffers,
+                                              const endpoint_type& endpoint,
+                                              WriteHandler&& handler)
+{
+    if (local_send_to(buffers, endpoint))
+    {
+        complete_send(make_send_operation(std::forward<WriteHandler>(handler), executor),
+                      boost::system::error_code(),
+                      boost::asio::buffer_size(buffers));
+    }
+    else if (ring)
     {
-        do_start_receive();
+        ring_send_to(buffers,
+                     endpoint,
+                     std::forward<WriteHandler>(handler));
+    }
+    else if (send_threshold.count() > 1)
+    {
+        sender.push(buffers,
+                    endpoint,
+                    make_send_operation(std::forward<WriteHandler>(handler), executor));
+        if ((sender.size() >= send_threshold.count()) ||
+            (sender.bytes() >= send_threshold.bytes()))
+        {
+            deliver_send(flush_send(), true);
+        }
+        else if (!send_flush_pending)
+        {
+            // Flush when the currently ready handlers have been executed
+            send_flush_pending = true;
+            auto self = this->shared_from_this();
+            // Recycled storage leaves the cache of Asio to the pending receive
+            net::post(
+                executor,
+                detail::make_recycled(
+                    [this, self]
+                    {
+                        send_queue completions;
+                        {
+                            std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+                            send_flush_pending = false;
+                            completions = flush_send();
+                        }
+                        deliver_send(std::move(completions), false);
+                    }));
+        }
+    }
+    else
+    {
+#if defined(TRIAL_DATAGRAM_NO_STATISTICS)
+        next_layer().async_send_to(buffers,
+                                   endpoint,
+                                   std::forward<WriteHandler>(handler));
+#else
+        using handler_type = typename std::decay<WriteHandler>::type;
+        next_layer().async_send_to(buffers,
+                                   endpoint,
+                                   counting_send_handler<handler_type>(this->shared_from_this(),
+                                                                       std::forward<WriteHandler>(handler)));
+#endif
     }
 }
 
+template <typename NextLayer>
+template <typename ConstBufferSequence>
+std::size_t basic_multiplexer<NextLayer>::try_send_to(const ConstBufferSequence& buffers,
+                                                      const endpoint_type& endpoint,
+                                                      boost::system::error_code& error)
+{
+    std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+    if (!pace(nullptr, boost::asio::buffer_size(buffers)))
+    {
+        error = boost::asio::error::would_block;
+        return 0;
+    }
+    return do_try_send_to(buffers, endpoint, error);
+}
+
+template <typename NextLayer>
+template <typename ConstBufferSequence>
+std::size_t basic_multiplexer<NextLayer>::do_try_send_to(const ConstBufferSequence& buffers,
+                                                         const endpoint_type& endpoint,
+                                                         boost::system::error_code& error)
+{
+    if (local_send_to(buffers, endpoint))
+    {
+        error = boost::system::error_code();
+        return boost::asio::buffer_size(buffers);
+    }
+    if (!sender.empty())
+    {
+        // Preserve the order of datagrams already queued for batched sending
+        deliver_send(flush_send(), true);
+    }
+    const auto length = next_layer().send_to(buffers, endpoint, 0, error);
+    if (error != boost::asio::error::would_block)
+    {
+        count_send(error, length, 1);
+    }
+    return length;
+}
+
+template <typename NextLayer>
 template <typename ConstBufferSequence,
           typename CompletionToken>
-auto multiplexer::async_send_to(const ConstBufferSequence& buffers,
-                                const endpoint_type& endpoint,
-                                CompletionToken&& token) -> typename net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>
+auto basic_multiplexer<NextLayer>::async_send(socket_base& socket,
+                                              const ConstBufferSequence& buffers,
+                                              CompletionToken&& token) -> typename net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>
 {
     net::async_completion<CompletionToken, void(boost::system::error_code, std::size_t)> async(token);
-    next_layer().async_send_to(buffers,
-                               endpoint,
-                               std::forward<decltype(async.completion_handler)>(async.completion_handler));
+
+    std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+    const auto size = boost::asio::buffer_size(buffers);
+    if (!pace(&socket, size))
+    {
+        // The deferred send is aborted if the socket is removed first
+        auto where = &socket;
+        defer_send(where,
+                   size,
+                   make_send_operation(std::move(async.completion_handler), executor),
+                   [this, where, buffers] (detail::operation_pointer<send_operation> operation)
+                   {
+                       do_send(*where, buffers, send_completion(std::move(operation)));
+                   });
+        return async.result.get();
+    }
+    do_send(socket,
+            buffers,
+            std::move(async.completion_handler));
     return async.result.get();
 }
 
-inline void multiplexer::start_receive()
+template <typename NextLayer>
+template <typename ConstBufferSequence,
+          typename WriteHandler>
+void basic_multiplexer<NextLayer>::do_send(socket_base& socket,
+                                           const ConstBufferSequence& buffers,
+                                           WriteHandler&& handler)
+{
+    if (socket.channel && !local_inbox)
+    {
+        // Connected send without route lookup
+#if defined(TRIAL_DATAGRAM_NO_STATISTICS)
+        socket.channel->next_layer.async_send(buffers,
+                                              std::forward<WriteHandler>(handler));
+#else
+        using handler_type = typename std::decay<WriteHandler>::type;
+        socket.channel->next_layer.async_send(buffers,
+                                              counting_send_handler<handler_type>(this->shared_from_this(),
+                                                                                  std::forward<WriteHandler>(handler)));
+#endif
+        return;
+    }
+    do_send_to(buffers,
+               socket.remote_endpoint(),
+               std::forward<WriteHandler>(handler));
+}
+
+template <typename NextLayer>
+template <typename ConstBufferSequence>
+std::size_t basic_multiplexer<NextLayer>::try_send(socket_base& socket,
+                                                   const ConstBufferSequence& buffers,
+                                                   boost::system::error_code& error)
+{
+    std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+    if (!pace(&socket, boost::asio::buffer_size(buffers)))
+    {
+        error = boost::asio::error::would_block;
+        return 0;
+    }
+    if (socket.channel && !local_inbox)
+    {
+        const auto length = socket.channel->next_layer.send(buffers, 0, error);
+        if (error != boost::asio::error::would_block)
+        {
+            count_send(error, length, 1);
+        }
+        return length;
+    }
+    return do_try_send_to(buffers, socket.remote_endpoint(), error);
+}
+
+template <typename NextLayer>
+template <typename WriteHandler>
+class basic_multiplexer<NextLayer>::counting_send_handler
+{
+public:
+    using executor_type = boost::asio::associated_executor_t<WriteHandler, net::executor>;
+    using allocator_type = boost::asio::associated_allocator_t<WriteHandler>;
+
+    counting_send_handler(std::shared_ptr<basic_multiplexer> self,
+                          WriteHandler&& handler)
+        : self(std::move(self)),
+          handler(std::move(handler))
+    {
+    }
+
+    // The send completes through the executor and allocator of the handler
+    executor_type get_executor() const noexcept
+    {
+        return boost::asio::get_associated_executor(handler, self->executor);
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return boost::asio::get_associated_allocator(handler);
+    }
+
+    void operator()(const boost::system::error_code& error,
+                    std::size_t length)
+    {
+        self->count_send(error, length, 1);
+        handler(error, length);
+    }
+
+private:
+    std::shared_ptr<basic_multiplexer> self;
+    WriteHandler handler;
+};
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::count_send(const boost::system::error_code& error,
+                                              std::size_t length,
+                                              std::size_t datagrams)
+{
+    if (!error)
+    {
+        stats.datagrams_sent.add(datagrams);
+        stats.bytes_sent.add(length);
+    }
+    else if (error != boost::asio::error::operation_aborted)
+    {
+        stats.send_errors.add();
+    }
+}
+
+template <typename NextLayer>
+send_queue basic_multiplexer<NextLayer>::flush_send()
+{
+    send_queue completions;
+    if (send_waiting)
+        return completions;
+
+    if (!sender.send(next_layer().native_handle(), completions))
+    {
+        // Wait until the kernel send buffer has room for more datagrams
+        send_waiting = true;
+        auto self = this->shared_from_this();
+        next_layer().async_wait(
+            next_layer_type::wait_write,
+            [this, self] (const boost::system::error_code& error)
+            {
+                send_queue completions;
+                {
+                    std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+                    send_waiting = false;
+                    if (error)
+                    {
+                        sender.cancel(error, completions);
+                    }
+                    else
+                    {
+                        completions = flush_send();
+                    }
+                }
+                deliver_send(std::move(completions), false);
+            });
+    }
+    return completions;
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::deliver_send(send_queue completions,
+                                                bool defer_completion)
+{
+    completions.for_each(
+        [this] (const send_operation& operation)
+        {
+            count_send(operation.error, operation.length, 1);
+        });
+    complete_send(std::move(completions), defer_completion);
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::complete_send(send_queue completions,
+                                                 bool defer_completion)
+{
+    if (completions.empty())
+        return;
+
+    if (defer_completion)
+    {
+        net::post(
+            executor,
+            detail::make_recycled(std::bind(
+                [] (send_queue& completions)
+                {
+                    complete_sends(completions);
+                },
+                std::move(completions))));
+    }
+    else
+    {
+        complete_sends(completions);
+    }
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::complete_send(detail::operation_pointer<send_operation> operation,
+                                                 const boost::system::error_code& error,
+                                                 std::size_t length)
+{
+    operation->error = error;
+    operation->length = length;
+    send_queue completions;
+    completions.push(std::move(operation));
+    complete_send(std::move(completions), true);
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::start_receive(socket_base& socket)
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    if (socket.channel)
+    {
+        auto channel = socket.channel;
+        std::lock_guard<decltype(channel->mutex)> channel_lock(channel->mutex);
+        arm_channel(channel);
+    }
+    // The shared socket may still hold datagrams from before promotion
+    start_receive_locked();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::start_receive_locked()
 {
     if (pending_receive_count++ == 0)
     {
-        do_start_receive();
+        arm_receive();
+    }
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::fulfill_receive(std::size_t count)
+{
+    pending_receive_count -= static_cast<int>(std::min(count, static_cast<std::size_t>(pending_receive_count)));
+}
+
+template <typename NextLayer>
+template <typename SettableSocketOption>
+void basic_multiplexer<NextLayer>::set_option(const SettableSocketOption& option,
+                                              boost::system::error_code& error)
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    next_layer().set_option(option, error);
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::receive_batch& option,
+                                              boost::system::error_code& error)
+{
+    if ((option.count() == 0) || (option.size() == 0))
+    {
+        error = boost::asio::error::invalid_argument;
+        return;
+    }
+    if ((option.count() > 1) && (!batch_receiver::is_supported() || !is_native()))
+    {
+        error = boost::asio::error::operation_not_supported;
+        return;
+    }
+    // Slots are only used by the completion handler
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    if (option.count() > 1)
+    {
+        batch.resize(option.count(), option.size(), *pool);
+    }
+    else
+    {
+        batch.resize(0, 0, *pool);
+    }
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::send_batch& option,
+                                              boost::system::error_code& error)
+{
+    if ((option.count() == 0) || (option.bytes() == 0))
+    {
+        error = boost::asio::error::invalid_argument;
+        return;
+    }
+    if ((option.count() > 1) && (!batch_sender::is_supported() || !is_native()))
+    {
+        error = boost::asio::error::operation_not_supported;
+        return;
+    }
+    std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+    send_threshold = option;
+    if (send_threshold.count() == 1)
+    {
+        // Datagrams that are already queued must not be left behind
+        deliver_send(flush_send(), true);
+    }
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::buffer_pool& option,
+                                              boost::system::error_code& error)
+{
+    pool->limit(option.max_bytes(), option.max_buffers());
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+template <typename GettableSocketOption>
+void basic_multiplexer<NextLayer>::get_option(GettableSocketOption& option,
+                                              boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    next_layer().get_option(option, error);
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::buffer_pool& option,
+                                              boost::system::error_code& error) const
+{
+    const auto limits = pool->limits();
+    const auto peak = pool->high_water();
+    option = option::buffer_pool(limits.first, limits.second);
+    option.high_water(peak.buffers, peak.bytes, peak.cached_bytes);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::listen_backlog& option,
+                                              boost::system::error_code& error)
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    backlog = option::listen_backlog(option.size(), option.policy());
+    // Index queued datagrams if the policy has changed
+    listen_index = decltype(listen_index)();
+    if (backlog.policy() == option::listen_backlog::coalesce)
+    {
+        for (auto& output : listen_queue)
+        {
+            if (is_accepted(std::get<0>(*output)))
+            {
+                listen_index.insert(endpoint_key(std::get<2>(*output)), output.get());
+            }
+        }
+    }
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::listen_backlog& option,
+                                              boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    option = backlog;
+    option.counters(listen_counters.accepted,
+                    listen_counters.queued,
+                    listen_counters.dropped);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::receive_pause& option,
+                                              boost::system::error_code& error)
+{
+    pause_threshold = option.bytes();
+    remove_queued(0);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::receive_offload& option,
+                                              boost::system::error_code& error)
+{
+    if (!is_native() && option.enabled())
+    {
+        error = boost::asio::error::operation_not_supported;
+        return;
+    }
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    offload::enable_receive(next_layer().native_handle(), option.enabled(), error);
+    if (!error)
+    {
+        receive_coalescing = option.enabled();
+    }
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::receive_offload& option,
+                                              boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    option = option::receive_offload(receive_coalescing);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::receive_timestamp& option,
+                                              boost::system::error_code& error)
+{
+    if (!is_native() && option.enabled())
+    {
+        error = boost::asio::error::operation_not_supported;
+        return;
+    }
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    timestamp::enable(next_layer().native_handle(), option.enabled(), error);
+    if (!error)
+    {
+        receive_timestamps = option.enabled();
+    }
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::receive_timestamp& option,
+                                              boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    option = option::receive_timestamp(receive_timestamps);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::peer_promotion& option,
+                                              boost::system::error_code& error)
+{
+    if ((option.policy() == option::peer_promotion::after) && (option.datagrams() == 0))
+    {
+        error = boost::asio::error::invalid_argument;
+        return;
+    }
+    if (!is_native() && (option.policy() != option::peer_promotion::never))
+    {
+        // Connected sockets are UDP sockets
+        error = boost::asio::error::operation_not_supported;
+        return;
+    }
+    if (!reuse_port && (option.policy() != option::peer_promotion::never))
+    {
+        // SO_REUSEPORT cannot be set after bind
+        error = boost::asio::error::operation_not_supported;
+        return;
+    }
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    promotion = option::peer_promotion(option.policy(), option.datagrams());
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::peer_promotion& option,
+                                              boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    option = promotion;
+    option.counters(promoted_count, promotion_failures);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::local_transport& option,
+                                              boost::system::error_code& error)
+{
+    std::lock_guard<decltype(receive_mutex)> receive_lock(receive_mutex);
+    std::lock_guard<decltype(send_mutex)> send_lock(send_mutex);
+    error = boost::system::error_code();
+    if (!option.enabled())
+    {
+        close_local();
+        local_option = option;
+        return;
+    }
+    if (local_inbox)
+        return;
+    if (!is_native())
+    {
+        // The ring would bypass the next layer
+        error = boost::asio::error::operation_not_supported;
+        return;
+    }
+
+    open_local(option, error);
+    if (!error)
+    {
+        local_option = option;
     }
 }
 
-inline void multiplexer::do_start_receive()
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::local_transport& option,
+                                              boost::system::error_code& error) const
 {
+    std::lock_guard<decltype(receive_mutex)> receive_lock(receive_mutex);
+    std::lock_guard<decltype(send_mutex)> send_lock(send_mutex);
+    option = option::local_transport(local_inbox != nullptr,
+                                     local_option.slots(),
+                                     local_option.slot_size());
+    option.counters(local_sent, local_received, local_fallbacks);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::worker_delivery& option,
+                                              boost::system::error_code& error)
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    worker_enabled = option.enabled();
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::worker_delivery& option,
+                                              boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    std::size_t notifications = 0;
+    for (const auto& worker : workers)
+    {
+        notifications += worker->notifications();
+    }
+    option = option::worker_delivery(worker_enabled);
+    option.counters(worker_delivered, notifications);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::send_pacing& option,
+                                              boost::system::error_code& error)
+{
+    std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+    // Only enforced by the fq queueing discipline, so failure is ignored
+    if (is_native())
+    {
+        boost::system::error_code ignored;
+        detail::set_kernel_pacing(next_layer().native_handle(), option.rate(), ignored);
+    }
+    pacing = option;
+    send_bucket = detail::token_bucket(option.rate(), option.burst());
+    socket_bucket = detail::token_bucket(option.socket_rate(), option.socket_burst());
+    // Release the deferred sends that the new rates admit
+    process_pacing();
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::send_pacing& option,
+                                              boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+    option = pacing;
+    option.counters(deferred_count, deferred_delay, deferred_max_delay);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::multicast_subscription&,
+                                              boost::system::error_code& error)
+{
+    // Only sockets can subscribe
+    error = boost::asio::error::operation_not_supported;
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::multicast_subscription& option,
+                                              boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    option = option::multicast_subscription(!subscribers.empty());
+    option.counters(subscribers.size(), multicast_datagrams);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::add_queued(std::size_t bytes)
+{
+    queued_bytes += bytes;
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::remove_queued(std::size_t bytes)
+{
+    // Called with a socket locked, so resumption is deferred
+    queued_bytes -= bytes;
+    if (receive_paused && !is_receive_paused() && !resume_pending.exchange(true))
+    {
+        auto self = this->shared_from_this();
+        net::post(
+            executor,
+            [this, self]
+            {
+                std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+                resume_pending = false;
+                if (receive_paused && !is_receive_paused())
+                {
+                    // Resume reading from the UDP socket
+                    receive_paused = false;
+                    if (pending_receive_count > 0)
+                    {
+                        do_start_receive();
+                    }
+                }
+            });
+    }
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::set_option(const option::idle_timeout& option,
+                                              boost::system::error_code& error)
+{
+    if ((option.timeout() < option::idle_timeout::duration::zero()) ||
+        (option.resolution() <= option::idle_timeout::duration::zero()))
+    {
+        error = boost::asio::error::invalid_argument;
+        return;
+    }
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    idle_limit = option::idle_timeout(option.timeout(), option.resolution());
+    const auto resolution = idle_limit.resolution().count();
+    idle_ticks = (idle_limit.timeout().count() + resolution - 1) / resolution;
+
+    // Ticks have changed length, so reschedule all sockets
+    idle_wheel.clear();
+    sockets.for_each([this] (const endpoint_key&, socket_base *socket)
+                     {
+                         track(*socket);
+                     });
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::idle_timeout& option,
+                                              boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    option = idle_limit;
+    option.expired(idle_expired);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::statistics& option,
+                                              boost::system::error_code& error) const
+{
+    // Read without locking
+    option.datagrams_received_ = stats.datagrams_received.load();
+    option.bytes_received_ = stats.bytes_received.load();
+    option.datagrams_sent_ = stats.datagrams_sent.load();
+    option.bytes_sent_ = stats.bytes_sent.load();
+    option.truncated_ = stats.truncated.load();
+    option.unknown_ = stats.unknown.load();
+    option.listen_dropped_ = stats.listen_dropped.load();
+    option.queue_dropped_ = stats.queue_dropped.load();
+    option.expired_ = stats.expired.load();
+    option.receive_errors_ = stats.receive_errors.load();
+    option.send_errors_ = stats.send_errors.load();
+    option.receive_pauses_ = stats.receive_pauses.load();
+    option.sockets_ = stats.sockets.load();
+    option.listen_depth_ = stats.listen_depth.load();
+    option.queued_bytes_ = queued_bytes;
+    option.receive_paused_ = receive_paused;
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::io_backend& option,
+                                              boost::system::error_code& error) const
+{
+    option = backend;
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_option(option::receive_latency& option,
+                                              boost::system::error_code& error) const
+{
+    // Read without locking
+    for (std::size_t i = 0; i < option::latency_histogram::bucket_count; ++i)
+    {
+        option.kernel_to_demux_.counts_[i] = stats.kernel_to_demux.load(i);
+        option.demux_to_handler_.counts_[i] = stats.demux_to_handler.load(i);
+    }
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+multiplexer_statistics& basic_multiplexer<NextLayer>::counters()
+{
+    return stats;
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::dispatched(const buffer_type& datagram)
+{
+    // Only stamped while receive timestamps are enabled
+    const auto demuxed = datagram.times().demuxed;
+    if (demuxed != std::chrono::steady_clock::time_point())
+    {
+        stats.demux_to_handler.record(std::chrono::steady_clock::now() - demuxed);
+    }
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::touch(socket_base& socket)
+{
+    socket.idle_activity.store(idle_tick.load(std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+}
+
+template <typename NextLayer>
+bool basic_multiplexer<NextLayer>::deliver(socket_base& socket,
+                                           const boost::system::error_code& error,
+                                           buffer_type datagram,
+                                           completion_list& completions)
+{
+    if (socket.inbox)
+    {
+        // Datagrams in flight complete the earlier receive requests. They
+        // are counted first, so a concurrent drain can only make the result
+        // too small, which costs an extra read.
+        const auto in_flight = socket.inbox->in_flight.fetch_add(1, std::memory_order_acquire);
+        ++worker_delivered;
+        completions.push(socket.inbox, error, std::move(datagram));
+        return socket.pending_receives() > in_flight;
+    }
+    return socket.enqueue(error, std::move(datagram), completions);
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::attach_worker(socket_base& socket)
+{
+    if (!worker_enabled || socket.inbox)
+        return;
+
+    const auto worker = socket.handler_executor();
+    if (worker == executor)
+        return;
+
+    std::shared_ptr<detail::worker_mailbox> mailbox;
+    for (const auto& candidate : workers)
+    {
+        if (candidate->get_executor() == worker)
+        {
+            mailbox = candidate;
+            break;
+        }
+    }
+    if (!mailbox)
+    {
+        mailbox = std::make_shared<detail::worker_mailbox>(worker);
+        workers.push_back(mailbox);
+    }
+    socket.inbox = std::make_shared<detail::socket_inbox>(&socket, std::move(mailbox));
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::detach_worker(socket_base& socket)
+{
+    if (!socket.inbox)
+        return;
+
+    {
+        // Wait for a delivery in progress
+        std::lock_guard<decltype(socket.inbox->mutex)> lock(socket.inbox->mutex);
+        socket.inbox->owner = nullptr;
+    }
+    socket.inbox.reset();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::track(socket_base& socket)
+{
+    if (socket.idle_entry.linked())
+    {
+        idle_wheel.erase(socket.idle_entry);
+    }
+    if (idle_ticks == 0)
+        return;
+
+    const auto tick = idle_clock();
+    if (idle_wheel.empty())
+    {
+        // The wheel has not turned while it was empty
+        idle_wheel.advance(tick, [] (socket_base&) {});
+        idle_tick = tick;
+    }
+    socket.idle_activity.store(tick, std::memory_order_relaxed);
+    // The extra tick ensures that a full timeout has elapsed at expiry
+    idle_wheel.insert(socket.idle_entry, tick + idle_ticks + 1);
+    arm_idle_timer();
+}
+
+template <typename NextLayer>
+typename basic_multiplexer<NextLayer>::idle_tick_type basic_multiplexer<NextLayer>::idle_clock() const
+{
+    return (std::chrono::steady_clock::now() - idle_epoch) / idle_limit.resolution();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::arm_idle_timer()
+{
+    if (idle_timer_running || idle_wheel.empty())
+        return;
+
+    idle_timer_running = true;
+    idle_timer.expires_at(idle_epoch + (idle_clock() + 1) * idle_limit.resolution());
+    // The timer must not keep the multiplexer alive
+    std::weak_ptr<basic_multiplexer> weak = this->shared_from_this();
+    idle_timer.async_wait(
+        [this, weak] (const boost::system::error_code& error)
+        {
+            auto self = weak.lock();
+            if (!self)
+                return;
+
+            completion_list completions;
+            {
+                std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+                process_idle(error, completions);
+            }
+            completions.invoke();
+        });
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::process_idle(const boost::system::error_code& error,
+                                                completion_list& completions)
+{
+    idle_timer_running = false;
+    if (error && (error != boost::asio::error::operation_aborted))
+        return;
+
+    const auto tick = idle_clock();
+    idle_tick = tick;
+    idle_wheel.advance(
+        tick,
+        [this, tick, &completions] (socket_base& socket)
+        {
+            const auto deadline = socket.idle_activity.load(std::memory_order_relaxed) + idle_ticks + 1;
+            if (deadline > tick)
+            {
+                // Active since it was scheduled
+                idle_wheel.insert(socket.idle_entry, deadline);
+                return;
+            }
+            const endpoint_key key(socket.remote_endpoint());
+            auto where = sockets.find(key);
+            if (where && (*where == &socket))
+            {
+                sockets.erase(key);
+                stats.sockets.set(sockets.size());
+            }
+            ++idle_expired;
+            stats.expired.add();
+            demote(socket);
+            socket.expire(completions);
+        });
+    arm_idle_timer();
+}
+
+template <typename NextLayer>
+bool basic_multiplexer<NextLayer>::is_receive_paused() const
+{
+    return (pause_threshold > 0) && (queued_bytes > pause_threshold);
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::arm_receive()
+{
+    if (is_receive_paused())
+    {
+        // Leave datagrams in the kernel until the sockets catch up
+        if (!receive_paused.exchange(true))
+        {
+            stats.receive_pauses.add();
+        }
+        return;
+    }
+    do_start_receive();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::do_start_receive()
+{
+    if (ring)
+    {
+        do_start_receive_ring();
+        return;
+    }
+    if (batch.capacity() > 1)
+    {
+        do_start_receive_batch();
+        return;
+    }
+
     // Read next UDP datagram.
     //
     // If we supply a buffer whose size is smaller than the datagram, then
@@ -156,100 +1282,378 @@ inline void multiplexer::do_start_receive()
     // The peek buffer is a workaround of OSX, which calls the handler
     // immediately if passed a zero-sized buffer.
 
-    auto remote_endpoint = std::make_shared<endpoint_type>();
-    auto self = shared_from_this();
+    auto self = this->shared_from_this();
     next_layer().async_receive_from(
         boost::asio::buffer(peek),
-        *remote_endpoint,
+        peek_endpoint,
         next_layer_type::message_peek,
-        [this, self, remote_endpoint] (boost::system::error_code error, std::size_t) mutable
+        [this, self] (boost::system::error_code error, std::size_t) mutable
         {
+            completion_list completions;
+            std::unique_lock<decltype(receive_mutex)> lock(receive_mutex);
             if (!error)
             {
-                // The size_t parameter is determined by the peek buffer so we
-                // must query the actual datagram size.
-                next_layer_type::bytes_readable readable(true);
-                next_layer().io_control(readable, error);
+                std::size_t segment_size = 0;
+                auto datagram = read_datagram(next_layer(),
+                                              receive_coalescing || receive_timestamps,
+                                              peek_endpoint,
+                                              segment_size,
+                                              error);
+                // The endpoint is overwritten by the next receive operation
+                const auto remote_endpoint = peek_endpoint;
+                process_receive(error, std::move(datagram), remote_endpoint, segment_size, completions);
+                lock.unlock();
+                completions.invoke();
+                return;
+            }
+            process_receive(error, {}, endpoint_type(), 0, completions);
+            lock.unlock();
+            completions.invoke();
+        });
+}
+
+template <typename NextLayer>
+template <typename Source>
+typename basic_multiplexer<NextLayer>::buffer_type basic_multiplexer<NextLayer>::read_datagram(Source& source,
+                                                                                               bool ancillary,
+                                                                                               endpoint_type& remote_endpoint,
+                                                                                               std::size_t& segment_size,
+                                                                                               boost::system::error_code& error)
+{
+    // The size_t parameter of a peek is determined by the peek buffer so we
+    // must query the actual datagram size.
+    typename Source::bytes_readable readable(true);
+    source.io_control(readable, error);
+    if (error)
+    {
+        remote_endpoint = endpoint_type();
+        return {};
+    }
+
+    // Datagram is available so we can read it synchronously.
+    auto datagram = pool->allocate(readable.get());
+    segment_size = 0;
+    if (ancillary)
+    {
+        // Coalesced datagrams and timestamps are reported in ancillary data
+        buffer_type::timestamps times;
+        datagram.resize(offload::receive(source.native_handle(),
+                                         datagram.data(),
+                                         datagram.size(),
+                                         remote_endpoint,
+                                         segment_size,
+                                         times.arrival,
+                                         error));
+        datagram.times(times);
+    }
+    else
+    {
+        source.receive_from(
+            boost::asio::buffer(datagram.data(), datagram.size()),
+            remote_endpoint,
+            0,
+            error);
+    }
+    return datagram;
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::process_receive(const boost::system::error_code& error,
+                                                   buffer_type datagram,
+                                                   const endpoint_type& remote_endpoint,
+                                                   std::size_t segment_size,
+                                                   completion_list& completions)
+{
+    if (error == boost::asio::error::operation_aborted)
+    {
+        fulfill_receive();
+        return;
+    }
+
+    if (!is_accepted(error))
+    {
+        stats.receive_errors.add();
+    }
+
+    // A read fulfills at least one pending receive request
+    const auto fulfilled = process_segments(error, std::move(datagram), remote_endpoint, segment_size, completions);
+    fulfill_receive(std::max<std::size_t>(fulfilled, 1));
+
+    if (pending_receive_count > 0)
+    {
+        arm_receive();
+    }
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::do_start_receive_batch()
+{
+    // Wait for readability and drain the batch with a single system call.
+    // Truncation is reported by the kernel.
+
+    auto self = this->shared_from_this();
+    next_layer().async_wait(
+        next_layer_type::wait_read,
+        [this, self] (boost::system::error_code error)
+        {
+            completion_list completions;
+            {
+                std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+                std::size_t count = 0;
                 if (!error)
                 {
-                    std::size_t length = readable.get();
-
-                    // Datagram is available so we can read it synchronously.
-                    std::unique_ptr<buffer_type> datagram(new buffer_type(length));
-                    next_layer().receive_from(
-                        boost::asio::buffer(datagram->data(), datagram->capacity()),
-                        *remote_endpoint,
-                        0,
-                        error);
-                    process_receive(error, std::move(datagram), *remote_endpoint);
-                    return;
+                    count = batch.receive(next_layer().native_handle(), error);
+                    if (error == boost::asio::error::would_block)
+                    {
+                        // Spurious wake-up
+                        do_start_receive_batch();
+                        return;
+                    }
                 }
+                process_receive_batch(error, count, completions);
             }
-            process_receive(error, {}, *remote_endpoint);
+            completions.invoke();
         });
 }
 
-inline
-void multiplexer::process_receive(const boost::system::error_code& error,
-                                  std::unique_ptr<buffer_type> datagram,
-                                  const endpoint_type& remote_endpoint)
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::process_receive_batch(const boost::system::error_code& error,
+                                                         std::size_t count,
+                                                         completion_list& completions)
 {
-    --pending_receive_count;
-
-    if (error == boost::asio::error::operation_aborted)
+    if (error)
+    {
+        process_receive(error, {}, endpoint_type(), 0, completions);
         return;
+    }
+
+    // Fulfills the receive requests it completes, and at least one
+    std::size_t fulfilled = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        auto datagram = batch.release(i, *pool);
+        if (receive_timestamps)
+        {
+            buffer_type::timestamps times;
+            times.arrival = batch.arrival(i);
+            datagram.times(times);
+        }
+        boost::system::error_code status;
+        if (batch.truncated(i))
+        {
+            status = boost::asio::error::message_size;
+        }
+        fulfilled += process_segments(status,
+                                      std::move(datagram),
+                                      batch.endpoint(i),
+                                      batch.segment_size(i),
+                                      completions);
+    }
+    fulfill_receive(std::max<std::size_t>(fulfilled, 1));
 
     if (pending_receive_count > 0)
     {
-        do_start_receive();
+        arm_receive();
+    }
+}
+
+template <typename NextLayer>
+std::size_t basic_multiplexer<NextLayer>::process_datagram(const boost::system::error_code& error,
+                                                           buffer_type datagram,
+                                                           const endpoint_type& remote_endpoint,
+                                                           completion_list& completions)
+{
+    record_received(error, datagram, receive_timestamps);
+
+    if (!subscribers.empty() && is_accepted(error))
+    {
+        return fan_out(error, std::move(datagram), completions);
     }
 
-    auto recipient = sockets.find(remote_endpoint);
-    if (recipient == sockets.end())
+    auto recipient = sockets.find(endpoint_key(remote_endpoint));
+    if (!recipient)
     {
         // Unknown endpoint
+        if (is_accepted(error))
+        {
+            stats.unknown.add();
+        }
         if (!acceptor_queue.empty())
         {
             // Process pending async_accept request
-            auto input = std::move(acceptor_queue.front());
-            acceptor_queue.pop_front();
+            accept(acceptor_queue.pop(),
+                   error,
+                   std::move(datagram),
+                   remote_endpoint,
+                   completions);
+            return 1;
+        }
+        enqueue_listen(error, std::move(datagram), remote_endpoint);
+        // FIXME: start_receive ?
+        return 0;
+    }
 
-            if (!error)
-            {
-                auto& socket = *std::get<0>(*input);
-                socket.remote_endpoint(remote_endpoint);
-                // Queue datagram for later use
-                socket.enqueue(error, std::move(datagram));
-            }
-            std::get<1>(*input)(error); // Invoke handler
+    // Enqueue datagram on socket
+    auto& socket = **recipient;
+    touch(socket);
+    const std::size_t fulfilled = deliver(socket, error, std::move(datagram), completions) ? 1 : 0;
+    if ((promotion.policy() == option::peer_promotion::after) &&
+        !socket.promotion_tried &&
+        (++socket.shared_received >= promotion.datagrams()))
+    {
+        promote(socket);
+    }
+    return fulfilled;
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::record_received(const boost::system::error_code& error,
+                                                   buffer_type& datagram,
+                                                   bool timestamps)
+{
+    if (!is_accepted(error))
+        return;
+
+    stats.datagrams_received.add();
+    stats.bytes_received.add(datagram.size());
+    if (error)
+    {
+        stats.truncated.add();
+    }
+    if (timestamps)
+    {
+        auto times = datagram.times();
+        times.demuxed = std::chrono::steady_clock::now();
+        if (times.arrival != timestamp::time_point())
+        {
+            stats.kernel_to_demux.record(timestamp::clock_type::now() - times.arrival);
         }
-        else
+        datagram.times(times);
+    }
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::accept(detail::operation_pointer<accept_operation> operation,
+                                          const boost::system::error_code& error,
+                                          buffer_type datagram,
+                                          const endpoint_type& remote_endpoint,
+                                          completion_list& completions)
+{
+    if (is_accepted(error))
+    {
+        ++listen_counters.accepted;
+        auto& socket = *operation->socket;
+        socket.remote_endpoint(remote_endpoint);
+        // Register before unlocking so the endpoint is not accepted twice
+        sockets.insert(endpoint_key(remote_endpoint), &socket);
+        stats.sockets.set(sockets.size());
+        track(socket);
+        attach_worker(socket);
+        // Queue datagram for later use
+        deliver(socket, error, std::move(datagram), completions);
+        if (promotion.policy() == option::peer_promotion::always)
         {
-            std::unique_ptr<accept_output_type> output(
-                new accept_output_type(error,
-                                       std::move(datagram),
-                                       remote_endpoint));
-            listen_queue.emplace_back(std::move(output));
-            // FIXME: start_receive ?
+            promote(socket);
         }
+        completions.push(std::move(operation), boost::system::error_code());
     }
     else
     {
-        // Enqueue datagram on socket
-        (*recipient).second->enqueue(error, std::move(datagram));
+        completions.push(std::move(operation), error);
     }
 }
 
-inline const multiplexer::next_layer_type& multiplexer::next_layer() const
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::enqueue_listen(const boost::system::error_code& error,
+                                                  buffer_type datagram,
+                                                  const endpoint_type& remote_endpoint)
+{
+    const bool coalesce = (backlog.policy() == option::listen_backlog::coalesce) && is_accepted(error);
+    if (coalesce)
+    {
+        auto where = listen_index.find(endpoint_key(remote_endpoint));
+        if (where)
+        {
+            // Replace earlier datagram from the same remote endpoint
+            std::get<0>(**where) = error;
+            std::get<1>(**where) = std::move(datagram);
+            ++listen_counters.dropped;
+            stats.listen_dropped.add();
+            return;
+        }
+    }
+
+    if (listen_queue.size() >= backlog.size())
+    {
+        if ((backlog.policy() != option::listen_backlog::drop_oldest) || listen_queue.empty())
+        {
+            ++listen_counters.dropped;
+            stats.listen_dropped.add();
+            return;
+        }
+        take_listen();
+        ++listen_counters.dropped;
+        stats.listen_dropped.add();
+    }
+
+    std::unique_ptr<accept_output_type> output(
+        new accept_output_type(error,
+                               std::move(datagram),
+                               remote_endpoint));
+    if (coalesce)
+    {
+        listen_index.insert(endpoint_key(remote_endpoint), output.get());
+    }
+    listen_queue.emplace_back(std::move(output));
+    stats.listen_depth.set(listen_queue.size());
+    ++listen_counters.queued;
+}
+
+template <typename NextLayer>
+std::unique_ptr<typename basic_multiplexer<NextLayer>::accept_output_type> basic_multiplexer<NextLayer>::take_listen()
+{
+    assert(!listen_queue.empty());
+
+    auto output = std::move(listen_queue.front());
+    listen_queue.pop_front();
+    stats.listen_depth.set(listen_queue.size());
+    if (!listen_index.empty())
+    {
+        const endpoint_key key(std::get<2>(*output));
+        auto where = listen_index.find(key);
+        if (where && (*where == output.get()))
+        {
+            listen_index.erase(key);
+        }
+    }
+    return output;
+}
+
+template <typename NextLayer>
+bool basic_multiplexer<NextLayer>::is_accepted(const boost::system::error_code& error)
+{
+    // A truncated datagram still identifies the remote endpoint
+    return !error || (error == boost::asio::error::message_size);
+}
+
+template <typename NextLayer>
+const typename basic_multiplexer<NextLayer>::next_layer_type& basic_multiplexer<NextLayer>::next_layer() const
 {
     return real_socket;
 }
 
-inline multiplexer::next_layer_type& multiplexer::next_layer()
+template <typename NextLayer>
+typename basic_multiplexer<NextLayer>::next_layer_type& basic_multiplexer<NextLayer>::next_layer()
 {
     return real_socket;
 }
 
+template <typename NextLayer>
+const net::executor& basic_multiplexer<NextLayer>::get_executor() const
+{
+    return executor;
+}
+
 } // namespace detail
 } // namespace datagram
 } // namespace trial
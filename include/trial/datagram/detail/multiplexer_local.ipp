@@ -0,0 +1,284 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_LOCAL_IPP
+#define TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_LOCAL_IPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <boost/asio/buffer.hpp>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::open_local(const option::local_transport& option,
+                                              boost::system::error_code& error)
+{
+    if (!detail::local_segment::is_supported())
+    {
+        error = boost::asio::error::operation_not_supported;
+        return;
+    }
+    if ((option.slots() == 0) || (option.slot_size() == 0))
+    {
+        error = boost::asio::error::invalid_argument;
+        return;
+    }
+    const auto local_endpoint = next_layer().local_endpoint(error);
+    if (error)
+        return;
+    if (!detail::local_segment::is_reachable(local_endpoint))
+    {
+        // Peers could not tell that the endpoint is local
+        error = boost::asio::error::invalid_argument;
+        return;
+    }
+
+    auto inbox = detail::local_segment::create(local_endpoint,
+                                               option.slots(),
+                                               option.slot_size(),
+                                               error);
+    if (error)
+        return;
+    std::unique_ptr<doorbell_type> doorbell(new doorbell_type(executor));
+    doorbell->open(doorbell_type::protocol_type(), error);
+    if (!error)
+    {
+        doorbell->bind(local_doorbell_endpoint(*inbox), error);
+    }
+    if (!error)
+    {
+        doorbell->non_blocking(true, error);
+    }
+    // Peers are woken via a socket of the send path
+    std::unique_ptr<doorbell_type> bell(new doorbell_type(executor));
+    if (!error)
+    {
+        bell->open(doorbell_type::protocol_type(), error);
+    }
+    if (!error)
+    {
+        bell->non_blocking(true, error);
+    }
+    if (error)
+        return;
+
+    local_inbox = std::move(inbox);
+    local_doorbell = std::move(doorbell);
+    local_bell = std::move(bell);
+    local_source = local_endpoint;
+    arm_local();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::close_local()
+{
+    if (!local_inbox)
+        return;
+
+    // Datagrams left in the ring are lost
+    ++local_generation;
+    boost::system::error_code error;
+    local_doorbell->close(error);
+    local_doorbell.reset();
+    local_bell.reset();
+    local_inbox.reset();
+    local_peers = decltype(local_peers)();
+}
+
+template <typename NextLayer>
+template <typename ConstBufferSequence>
+bool basic_multiplexer<NextLayer>::local_send_to(const ConstBufferSequence& buffers,
+                                                 const endpoint_type& endpoint)
+{
+    if (!local_inbox || !endpoint.address().is_loopback())
+        return false;
+
+    auto segment = local_peer(endpoint);
+    if (!segment)
+        return false;
+
+    auto source = local_source;
+    if (source.address().is_unspecified())
+    {
+        // The address that the kernel would have chosen
+        source.address(endpoint.address().is_v4()
+                       ? boost::asio::ip::address(boost::asio::ip::address_v4::loopback())
+                       : boost::asio::ip::address(boost::asio::ip::address_v6::loopback()));
+    }
+    if (!sender.empty())
+    {
+        // Preserve the order of datagrams already queued for batched sending
+        deliver_send(flush_send(), true);
+    }
+    if (!segment->push(buffers, source))
+    {
+        ++local_fallbacks;
+        return false;
+    }
+    ++local_sent;
+    count_send(boost::system::error_code(), boost::asio::buffer_size(buffers), 1);
+    if (segment->wake())
+    {
+        // The receiver waits for the doorbell
+        const std::uint8_t bell = 0;
+        boost::system::error_code error;
+        local_bell->send_to(boost::asio::buffer(&bell, sizeof(bell)),
+                            local_doorbell_endpoint(*segment),
+                            0,
+                            error);
+    }
+    return true;
+}
+
+template <typename NextLayer>
+detail::local_segment *basic_multiplexer<NextLayer>::local_peer(const endpoint_type& endpoint)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const endpoint_key key(endpoint);
+    auto peer = local_peers.find(key);
+    if (peer)
+    {
+        if (peer->segment)
+        {
+            if (peer->segment->is_open())
+                return peer->segment.get();
+            // The remote endpoint has been closed
+            peer->segment.reset();
+        }
+        else if (now < peer->retry)
+            return nullptr;
+    }
+    else
+    {
+        peer = local_peers.insert(key, local_peer_type()).first;
+    }
+
+    // The remote endpoint may be bound to the unspecified address
+    boost::system::error_code error;
+    peer->segment = detail::local_segment::open(endpoint, error);
+    if (!peer->segment)
+    {
+        const auto any = endpoint.address().is_v4()
+            ? boost::asio::ip::address(boost::asio::ip::address_v4::any())
+            : boost::asio::ip::address(boost::asio::ip::address_v6::any());
+        peer->segment = detail::local_segment::open(endpoint_type(any, endpoint.port()), error);
+    }
+    if (peer->segment && !peer->segment->is_open())
+    {
+        peer->segment.reset();
+    }
+    peer->retry = now + std::chrono::seconds(1);
+    return peer->segment.get();
+}
+
+template <typename NextLayer>
+typename basic_multiplexer<NextLayer>::doorbell_type::endpoint_type basic_multiplexer<NextLayer>::local_doorbell_endpoint(const detail::local_segment& segment)
+{
+    // Abstract socket address, which disappears with the socket
+    std::string path(1, '\0');
+    path += segment.name();
+    return doorbell_type::endpoint_type(path);
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::arm_local()
+{
+    // Announce the wait before the last check of the ring
+    local_inbox->sleep();
+    std::weak_ptr<basic_multiplexer> weak = this->shared_from_this();
+    const auto generation = local_generation;
+    if (!local_inbox->empty())
+    {
+        local_inbox->wake();
+        net::post(
+            executor,
+            [weak, generation]
+            {
+                if (auto self = weak.lock())
+                {
+                    self->resume_local(generation, false);
+                }
+            });
+        return;
+    }
+    local_doorbell->async_wait(
+        doorbell_type::wait_read,
+        [weak, generation] (const boost::system::error_code& error)
+        {
+            if (error)
+                return;
+            if (auto self = weak.lock())
+            {
+                self->resume_local(generation, true);
+            }
+        });
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::resume_local(std::size_t generation,
+                                                bool doorbell)
+{
+    completion_list completions;
+    {
+        std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+        if (generation != local_generation)
+            return;
+
+        if (doorbell)
+        {
+            std::uint8_t bells[64];
+            boost::system::error_code error;
+            while (!error)
+            {
+                local_doorbell->receive(boost::asio::buffer(bells), 0, error);
+            }
+        }
+        process_local(completions);
+    }
+    completions.invoke();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::process_local(completion_list& completions)
+{
+    // Drain a bounded number of datagrams before other handlers get a turn
+    const std::size_t limit = 64;
+    for (std::size_t i = 0; i < limit; ++i)
+    {
+        const bool found = local_inbox->pop(
+            [this, &completions]
+            (const std::uint8_t *data, std::size_t size, const endpoint_type& remote_endpoint)
+            {
+                auto datagram = pool->allocate(size);
+                std::memcpy(datagram.data(), data, size);
+                ++local_received;
+                process_datagram(boost::system::error_code(),
+                                 std::move(datagram),
+                                 remote_endpoint,
+                                 completions);
+            });
+        if (!found)
+            break;
+    }
+    arm_local();
+}
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_LOCAL_IPP
@@ -0,0 +1,165 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_MULTICAST_IPP
+#define TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_MULTICAST_IPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::subscribe(socket_base& socket,
+                                             const option::multicast_subscription& option,
+                                             boost::system::error_code& error)
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    if (!option.enabled())
+    {
+        unsubscribe(socket);
+        error = boost::system::error_code();
+        return;
+    }
+    const auto group = next_layer().local_endpoint(error).address();
+    if (error)
+        return;
+    if (!group.is_multicast())
+    {
+        // Must be bound to the group so only its datagrams are delivered
+        error = boost::asio::error::invalid_argument;
+        return;
+    }
+    if (socket.subscribed)
+    {
+        if (socket.subscribed_interface == option.network_interface())
+        {
+            error = boost::system::error_code();
+            return;
+        }
+        unsubscribe(socket);
+    }
+
+    auto where = std::find_if(memberships.begin(),
+                              memberships.end(),
+                              [&option] (const std::pair<boost::asio::ip::address, std::size_t>& membership)
+                              {
+                                  return membership.first == option.network_interface();
+                              });
+    if (where == memberships.end())
+    {
+        next_layer().set_option(multicast_membership<boost::asio::ip::multicast::join_group>(group, option.network_interface()),
+                                error);
+        if (error)
+            return;
+        where = memberships.emplace(memberships.end(), option.network_interface(), 0);
+    }
+    ++where->second;
+    socket.subscribed_interface = option.network_interface();
+    socket.subscribed = true;
+    subscribers.push_back(&socket);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::get_subscription(const socket_base& socket,
+                                                    option::multicast_subscription& option,
+                                                    boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+    option = option::multicast_subscription(socket.subscribed,
+                                            socket.subscribed_interface,
+                                            option.queue_limit());
+    option.counters(subscribers.size(), multicast_datagrams);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+std::size_t basic_multiplexer<NextLayer>::fan_out(const boost::system::error_code& error,
+                                                  buffer_type datagram,
+                                                  completion_list& completions)
+{
+    // The UDP socket is bound to the group, see subscribe()
+    if (subscribers.empty())
+        return 0;
+
+    ++multicast_datagrams;
+
+    // Subscribers share the storage, and the last takes the original
+    std::size_t fulfilled = 0;
+    const auto last = subscribers.size() - 1;
+    for (std::size_t i = 0; i <= last; ++i)
+    {
+        if (deliver(*subscribers[i],
+                    error,
+                    (i < last) ? datagram.share() : std::move(datagram),
+                    completions))
+        {
+            ++fulfilled;
+        }
+    }
+    return fulfilled;
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::unsubscribe(socket_base& socket)
+{
+    if (!socket.subscribed)
+        return;
+
+    socket.subscribed = false;
+    subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), &socket),
+                      subscribers.end());
+    auto where = std::find_if(memberships.begin(),
+                              memberships.end(),
+                              [&socket] (const std::pair<boost::asio::ip::address, std::size_t>& membership)
+                              {
+                                  return membership.first == socket.subscribed_interface;
+                              });
+    if ((where != memberships.end()) && (--where->second == 0))
+    {
+        // Leave the group when the last subscriber of the interface is gone
+        boost::system::error_code error;
+        const auto group = next_layer().local_endpoint(error).address();
+        if (!error)
+        {
+            next_layer().set_option(multicast_membership<boost::asio::ip::multicast::leave_group>(group, where->first),
+                                    error);
+        }
+        memberships.erase(where);
+    }
+}
+
+template <typename NextLayer>
+template <typename Membership>
+Membership basic_multiplexer<NextLayer>::multicast_membership(const boost::asio::ip::address& group,
+                                                              const boost::asio::ip::address& network_interface)
+{
+    if (group.is_v4())
+    {
+        return Membership(group.to_v4(),
+                          network_interface.is_v4()
+                          ? network_interface.to_v4()
+                          : boost::asio::ip::address_v4::any());
+    }
+    // IPv6 interfaces are identified by their scope
+    return Membership(group.to_v6(),
+                      network_interface.is_v6() ? network_interface.to_v6().scope_id() : 0);
+}
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_MULTICAST_IPP
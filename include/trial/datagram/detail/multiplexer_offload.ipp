@@ -0,0 +1,195 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_OFFLOAD_IPP
+#define TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_OFFLOAD_IPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+template <typename NextLayer>
+template <typename ConstBufferSequence,
+          typename CompletionToken>
+auto basic_multiplexer<NextLayer>::async_send_segments_to(const ConstBufferSequence& buffers,
+                                                          const endpoint_type& endpoint,
+                                                          std::size_t segment_size,
+                                                          CompletionToken&& token) -> typename net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>
+{
+    net::async_completion<CompletionToken, void(boost::system::error_code, std::size_t)> async(token);
+
+    std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+    auto operation = make_send_operation(std::move(async.completion_handler), executor);
+    const auto size = boost::asio::buffer_size(buffers);
+    if (!pace(nullptr, size))
+    {
+        defer_send(nullptr,
+                   size,
+                   std::move(operation),
+                   [this, buffers, endpoint, segment_size] (detail::operation_pointer<send_operation> operation)
+                   {
+                       if (!sender.empty())
+                       {
+                           deliver_send(flush_send(), true);
+                       }
+                       do_send_segments_to(buffers,
+                                           endpoint,
+                                           segment_size,
+                                           std::move(operation));
+                   });
+        return async.result.get();
+    }
+    if (!sender.empty())
+    {
+        // Preserve the order of datagrams already queued for batched sending
+        deliver_send(flush_send(), true);
+    }
+    do_send_segments_to(buffers,
+                        endpoint,
+                        segment_size,
+                        std::move(operation));
+    return async.result.get();
+}
+
+// Resumes a segmented send when the kernel send buffer has room
+
+template <typename NextLayer>
+template <typename ConstBufferSequence>
+class basic_multiplexer<NextLayer>::segment_wait_handler
+{
+public:
+    using allocator_type = recycling_allocator<void>;
+
+    segment_wait_handler(std::shared_ptr<basic_multiplexer> self,
+                         const ConstBufferSequence& buffers,
+                         const endpoint_type& endpoint,
+                         std::size_t segment_size,
+                         detail::operation_pointer<send_operation> operation)
+        : self(std::move(self)),
+          buffers(buffers),
+          endpoint(endpoint),
+          segment_size(segment_size),
+          operation(std::move(operation))
+    {
+    }
+
+    allocator_type get_allocator() const noexcept { return allocator_type(); }
+
+    void operator()(const boost::system::error_code& error)
+    {
+        if (error)
+        {
+            self->count_send(error, 0, 0);
+            operation.release()->complete(error, 0);
+            return;
+        }
+        std::lock_guard<decltype(self->send_mutex)> lock(self->send_mutex);
+        self->do_send_segments_to(buffers,
+                                  endpoint,
+                                  segment_size,
+                                  std::move(operation));
+    }
+
+private:
+    std::shared_ptr<basic_multiplexer> self;
+    ConstBufferSequence buffers;
+    endpoint_type endpoint;
+    std::size_t segment_size;
+    detail::operation_pointer<send_operation> operation;
+};
+
+template <typename NextLayer>
+template <typename ConstBufferSequence>
+void basic_multiplexer<NextLayer>::do_send_segments_to(const ConstBufferSequence& buffers,
+                                                       const endpoint_type& endpoint,
+                                                       std::size_t segment_size,
+                                                       detail::operation_pointer<send_operation> operation)
+{
+    if (!is_native())
+    {
+        // Segmentation offload needs a UDP socket
+        complete_send(std::move(operation), boost::asio::error::operation_not_supported, 0);
+        return;
+    }
+    boost::system::error_code error;
+    const auto length = offload::send(next_layer().native_handle(),
+                                      buffers,
+                                      endpoint,
+                                      segment_size,
+                                      error);
+    if (error == boost::asio::error::would_block)
+    {
+        // Wait until the kernel send buffer has room for the datagrams
+        next_layer().async_wait(
+            next_layer_type::wait_write,
+            segment_wait_handler<ConstBufferSequence>(this->shared_from_this(),
+                                                      buffers,
+                                                      endpoint,
+                                                      segment_size,
+                                                      std::move(operation)));
+        return;
+    }
+    count_send(error, length, segment_size ? (length + segment_size - 1) / segment_size : 0);
+    complete_send(std::move(operation), error, length);
+}
+
+template <typename NextLayer>
+std::size_t basic_multiplexer<NextLayer>::process_segments(const boost::system::error_code& error,
+                                                           buffer_type datagram,
+                                                           const endpoint_type& remote_endpoint,
+                                                           std::size_t segment_size,
+                                                           completion_list& completions)
+{
+    std::size_t fulfilled = 0;
+    split_segments(error,
+                   std::move(datagram),
+                   segment_size,
+                   [this, &fulfilled, &remote_endpoint, &completions]
+                   (const boost::system::error_code& error, buffer_type segment)
+                   {
+                       fulfilled += process_datagram(error, std::move(segment), remote_endpoint, completions);
+                   });
+    return fulfilled;
+}
+
+template <typename NextLayer>
+template <typename Function>
+void basic_multiplexer<NextLayer>::split_segments(const boost::system::error_code& error,
+                                                  buffer_type datagram,
+                                                  std::size_t segment_size,
+                                                  Function&& function)
+{
+    if ((segment_size == 0) || (datagram.size() <= segment_size) || !is_accepted(error))
+    {
+        function(error, std::move(datagram));
+        return;
+    }
+
+    // Split coalesced datagrams into views of the shared storage, which
+    // also carries their timestamps. Only the last can be truncated.
+    for (std::size_t offset = 0; offset < datagram.size(); offset += segment_size)
+    {
+        const auto length = std::min(segment_size, datagram.size() - offset);
+        const bool last = (offset + length == datagram.size());
+        function(last ? error : boost::system::error_code(),
+                 datagram.share(offset, length));
+    }
+}
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_OFFLOAD_IPP
@@ -0,0 +1,191 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_PACING_IPP
+#define TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_PACING_IPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+template <typename NextLayer>
+bool basic_multiplexer<NextLayer>::pace(socket_base *socket,
+                                        std::size_t size)
+{
+    if (!send_bucket.limited() && !socket_bucket.limited())
+        return true;
+
+    // Preserve the order of deferred sends
+    if (socket && (socket->deferred_sends > 0))
+        return false;
+    if (send_bucket.limited() && !deferred_sends.empty())
+        return false;
+
+    const auto now = std::chrono::steady_clock::now();
+    if (send_bucket.delay(send_drained, size, now) > std::chrono::steady_clock::duration::zero())
+        return false;
+    if (socket)
+    {
+        if (socket_bucket.delay(socket->send_drained, size, now) > std::chrono::steady_clock::duration::zero())
+            return false;
+        socket_bucket.consume(socket->send_drained, size, now);
+    }
+    send_bucket.consume(send_drained, size, now);
+    return true;
+}
+
+template <typename NextLayer>
+template <typename Function>
+void basic_multiplexer<NextLayer>::defer_send(socket_base *socket,
+                                              std::size_t size,
+                                              detail::operation_pointer<send_operation> operation,
+                                              Function&& send)
+{
+    deferred_sends.push_back(
+        deferred_send{
+            socket,
+            size,
+            std::chrono::steady_clock::now(),
+            std::move(operation),
+            std::forward<Function>(send)});
+    if (socket)
+    {
+        ++socket->deferred_sends;
+    }
+    process_pacing();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::abort_deferred(socket_base& socket)
+{
+    if (socket.deferred_sends == 0)
+        return;
+
+    for (auto where = deferred_sends.begin(); where != deferred_sends.end();)
+    {
+        if (where->socket == &socket)
+        {
+            auto operation = std::move(where->operation);
+            where = deferred_sends.erase(where);
+            complete_send(std::move(operation), boost::asio::error::operation_aborted, 0);
+        }
+        else
+        {
+            ++where;
+        }
+    }
+    socket.deferred_sends = 0;
+    // Later sends may have waited for the aborted ones
+    process_pacing();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::process_pacing()
+{
+    using clock_type = std::chrono::steady_clock;
+    const auto now = clock_type::now();
+    auto deadline = clock_type::time_point::max();
+    // Sockets held back by their own bucket
+    std::vector<socket_base *> blocked;
+
+    for (auto where = deferred_sends.begin(); where != deferred_sends.end();)
+    {
+        auto socket = where->socket;
+        if (socket && (std::find(blocked.begin(), blocked.end(), socket) != blocked.end()))
+        {
+            ++where;
+            continue;
+        }
+        const auto shared_delay = send_bucket.delay(send_drained, where->size, now);
+        if (shared_delay > clock_type::duration::zero())
+        {
+            // The aggregate bucket releases sends strictly in order
+            deadline = std::min(deadline, now + shared_delay);
+            break;
+        }
+        if (socket)
+        {
+            const auto socket_delay = socket_bucket.delay(socket->send_drained, where->size, now);
+            if (socket_delay > clock_type::duration::zero())
+            {
+                deadline = std::min(deadline, now + socket_delay);
+                blocked.push_back(socket);
+                ++where;
+                continue;
+            }
+            socket_bucket.consume(socket->send_drained, where->size, now);
+            --socket->deferred_sends;
+        }
+        send_bucket.consume(send_drained, where->size, now);
+
+        const auto delay = now - where->queued;
+        if (delay > clock_type::duration::zero())
+        {
+            ++deferred_count;
+            deferred_delay += delay;
+            deferred_max_delay = std::max(deferred_max_delay, delay);
+        }
+        auto operation = std::move(where->operation);
+        auto send = std::move(where->send);
+        where = deferred_sends.erase(where);
+        send(std::move(operation));
+    }
+
+    if (deadline != clock_type::time_point::max())
+    {
+        arm_pacing_timer(deadline);
+    }
+    else if (pacing_timer_running)
+    {
+        // Nothing left to release
+        pacing_timer_running = false;
+        pacing_timer.cancel();
+    }
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::arm_pacing_timer(const std::chrono::steady_clock::time_point& deadline)
+{
+    if (pacing_timer_running && (pacing_deadline <= deadline))
+        return;
+
+    // Moving the expiry cancels a later wait
+    pacing_timer_running = true;
+    pacing_deadline = deadline;
+    pacing_timer.expires_at(deadline);
+    // The timer must not keep the multiplexer alive
+    std::weak_ptr<basic_multiplexer> weak = this->shared_from_this();
+    pacing_timer.async_wait(
+        [this, weak] (const boost::system::error_code& error)
+        {
+            if (error == boost::asio::error::operation_aborted)
+                return;
+            auto self = weak.lock();
+            if (!self)
+                return;
+
+            std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+            pacing_timer_running = false;
+            process_pacing();
+        });
+}
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_PACING_IPP
@@ -0,0 +1,192 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_PROMOTION_IPP
+#define TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_PROMOTION_IPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <memory>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::promote(socket_base& socket)
+{
+    socket.promotion_tried = true;
+    if (socket.channel)
+        return;
+
+    auto channel = std::make_shared<peer_channel>(executor);
+    auto& connected = channel->next_layer;
+    boost::system::error_code error;
+    const auto local_endpoint = next_layer().local_endpoint(error);
+    if (!error)
+    {
+        connected.open(local_endpoint.protocol(), error);
+    }
+#if defined(SO_REUSEPORT)
+    if (!error)
+    {
+        connected.set_option(option::reuse_port(true), error);
+    }
+#endif
+    if (!error)
+    {
+        connected.bind(local_endpoint, error);
+    }
+    if (!error)
+    {
+        // The kernel prefers the connected socket
+        connected.connect(socket.remote_endpoint(), error);
+    }
+    if (!error)
+    {
+        connected.non_blocking(true, error);
+    }
+    if (!error && receive_coalescing)
+    {
+        offload::enable_receive(connected.native_handle(), true, error);
+    }
+    if (!error && receive_timestamps)
+    {
+        timestamp::enable(connected.native_handle(), true, error);
+    }
+    if (error)
+    {
+        // Remain on the shared UDP socket
+        ++promotion_failures;
+        return;
+    }
+
+    channel->owner = &socket;
+    channel->ancillary = receive_coalescing || receive_timestamps;
+    channel->timestamps = receive_timestamps;
+    {
+        // Senders use the channel as soon as it is published
+        std::lock_guard<decltype(send_mutex)> send_lock(send_mutex);
+        socket.channel = channel;
+    }
+    ++promoted_count;
+    if (socket.pending_receives() > 0)
+    {
+        std::lock_guard<decltype(channel->mutex)> channel_lock(channel->mutex);
+        arm_channel(channel);
+    }
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::demote(socket_base& socket)
+{
+    socket.shared_received = 0;
+    socket.promotion_tried = false;
+    if (!socket.channel)
+        return;
+
+    std::shared_ptr<peer_channel> channel;
+    {
+        std::lock_guard<decltype(send_mutex)> send_lock(send_mutex);
+        channel.swap(socket.channel);
+    }
+    // Waits for the channel to finish a burst for the socket
+    std::lock_guard<decltype(channel->mutex)> channel_lock(channel->mutex);
+    channel->owner = nullptr;
+    boost::system::error_code error;
+    channel->next_layer.close(error);
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::arm_channel(const std::shared_ptr<peer_channel>& channel)
+{
+    if (!channel->owner || channel->waiting)
+        return;
+
+    channel->waiting = true;
+    auto self = this->shared_from_this();
+    channel->next_layer.async_wait(
+        next_layer_type::wait_read,
+        [this, self, channel] (const boost::system::error_code& error)
+        {
+            completion_list completions;
+            {
+                std::lock_guard<decltype(channel->mutex)> lock(channel->mutex);
+                channel->waiting = false;
+                if (!channel->owner)
+                    return;
+
+                if (error)
+                {
+                    if (error != boost::asio::error::operation_aborted)
+                    {
+                        stats.receive_errors.add();
+                        channel->owner->enqueue(error, {}, completions);
+                    }
+                }
+                else
+                {
+                    process_channel(*channel, completions);
+                    if (channel->owner->pending_receives() > 0)
+                    {
+                        arm_channel(channel);
+                    }
+                }
+            }
+            completions.invoke();
+        });
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::process_channel(peer_channel& channel,
+                                                   completion_list& completions)
+{
+    // Drain a bounded number of datagrams per readiness event
+    const std::size_t limit = 64;
+    for (std::size_t i = 0; i < limit; ++i)
+    {
+        endpoint_type remote_endpoint;
+        std::size_t segment_size = 0;
+        boost::system::error_code error;
+        auto datagram = read_datagram(channel.next_layer, channel.ancillary, remote_endpoint, segment_size, error);
+        if (error == boost::asio::error::would_block)
+            break;
+        if (error == boost::asio::error::connection_refused)
+        {
+            // Reported for an earlier send
+            continue;
+        }
+        if (error)
+        {
+            stats.receive_errors.add();
+            channel.owner->enqueue(error, {}, completions);
+            break;
+        }
+        // The remote endpoint is known, so the socket table is not needed
+        auto& owner = *channel.owner;
+        split_segments(error,
+                       std::move(datagram),
+                       segment_size,
+                       [this, &channel, &owner, &completions]
+                       (const boost::system::error_code& error, buffer_type segment)
+                       {
+                           record_received(error, segment, channel.timestamps);
+                           touch(owner);
+                           deliver(owner, error, std::move(segment), completions);
+                       });
+    }
+}
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_PROMOTION_IPP
@@ -0,0 +1,318 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_URING_IPP
+#define TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_URING_IPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::open_ring(const option::io_backend& option)
+{
+    if (!is_native())
+        throw boost::system::system_error(boost::asio::error::operation_not_supported);
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+    boost::system::error_code error;
+    std::unique_ptr<detail::uring> instance(new detail::uring);
+    // The submission queue is sized like the provided buffers
+    instance->open(static_cast<unsigned>(std::min<std::size_t>(option.count(), 4096)),
+                   option.count(),
+                   option.size(),
+                   error);
+    if (error)
+        throw boost::system::system_error(error);
+    ring_event.reset(new boost::asio::posix::stream_descriptor(executor, instance->event_handle()));
+    ring = std::move(instance);
+#else
+    (void)option;
+    throw boost::system::system_error(boost::asio::error::operation_not_supported);
+#endif
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::do_start_receive_ring()
+{
+    std::lock_guard<decltype(send_mutex)> send_lock(send_mutex);
+    ring_wanted = true;
+    if (!ring_received.empty())
+    {
+        // Datagrams have arrived while no receive request was pending
+        auto self = this->shared_from_this();
+        net::post(
+            executor,
+            [this, self]
+            {
+                completion_list completions;
+                {
+                    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+                    process_ring_receive(completions);
+                }
+                completions.invoke();
+            });
+        return;
+    }
+    arm_ring_receive();
+    arm_ring_wait();
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::arm_ring_receive()
+{
+    // The multishot receive stays armed until it runs out of buffers
+    if (ring_receiving)
+        return;
+
+    if (ring->receive(next_layer().native_handle(), 0))
+    {
+        ring_receiving = true;
+        boost::system::error_code error;
+        ring->submit(error);
+    }
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::arm_ring_wait()
+{
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+    if (ring_waiting)
+        return;
+
+    ring_waiting = true;
+    auto self = this->shared_from_this();
+    ring_event->async_wait(
+        boost::asio::posix::stream_descriptor::wait_read,
+        [this, self] (const boost::system::error_code& error)
+        {
+            send_queue sent;
+            bool received = false;
+            {
+                std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+                ring_waiting = false;
+                if (error)
+                    return;
+
+                received = process_ring(sent);
+                if (ring_wanted || (ring_sends > 0))
+                {
+                    arm_ring_wait();
+                }
+            }
+            deliver_send(std::move(sent), false);
+            if (received)
+            {
+                completion_list completions;
+                {
+                    std::lock_guard<decltype(receive_mutex)> lock(receive_mutex);
+                    process_ring_receive(completions);
+                }
+                completions.invoke();
+            }
+        });
+#endif
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::post_ring_submit()
+{
+    // Submit when the currently ready handlers have been executed
+    if (ring_submit_pending)
+        return;
+
+    ring_submit_pending = true;
+    auto self = this->shared_from_this();
+    net::post(
+        executor,
+        [this, self]
+        {
+            std::lock_guard<decltype(send_mutex)> lock(send_mutex);
+            ring_submit_pending = false;
+            // Leftover entries are retried with the next completions
+            boost::system::error_code error;
+            ring->submit(error);
+        });
+}
+
+template <typename NextLayer>
+template <typename ConstBufferSequence,
+          typename WriteHandler>
+void basic_multiplexer<NextLayer>::ring_send_to(const ConstBufferSequence& buffers,
+                                                const endpoint_type& endpoint,
+                                                WriteHandler&& handler)
+{
+    ring_send_request *request = nullptr;
+    if (ring_send_free.empty())
+    {
+        ring_send_storage.emplace_back(new ring_send_request);
+        request = ring_send_storage.back().get();
+    }
+    else
+    {
+        request = ring_send_free.back();
+        ring_send_free.pop_back();
+    }
+    request->request.prepare(buffers, endpoint);
+    if (!ring->send(next_layer().native_handle(),
+                    request->request,
+                    reinterpret_cast<std::uint64_t>(request)))
+    {
+        ring_send_free.push_back(request);
+        auto operation = make_send_operation(std::forward<WriteHandler>(handler), executor);
+        operation->error = boost::asio::error::no_buffer_space;
+        send_queue completions;
+        completions.push(std::move(operation));
+        deliver_send(std::move(completions), true);
+        return;
+    }
+    request->operation = make_send_operation(std::forward<WriteHandler>(handler), executor);
+    ++ring_sends;
+    post_ring_submit();
+    arm_ring_wait();
+}
+
+template <typename NextLayer>
+bool basic_multiplexer<NextLayer>::process_ring(send_queue& sent)
+{
+    ring->consume(
+        [this, &sent] (const detail::uring::completion& item)
+        {
+            if (item.user_data == 0)
+            {
+                if (!detail::uring::has_more(item))
+                {
+                    ring_receiving = false;
+                }
+                // Running out of buffers only ends the multishot receive
+                if (detail::uring::has_buffer(item) || (item.result != -ENOBUFS))
+                {
+                    ring_received.push_back(item);
+                }
+                return;
+            }
+
+            auto request = reinterpret_cast<ring_send_request *>(item.user_data);
+            --ring_sends;
+            auto operation = std::move(request->operation);
+            ring_send_free.push_back(request);
+            if (item.result < 0)
+            {
+                operation->error = boost::system::error_code(-item.result, boost::asio::error::get_system_category());
+            }
+            else
+            {
+                operation->length = static_cast<std::size_t>(item.result);
+            }
+            sent.push(std::move(operation));
+        });
+
+    if (ring->has_unsubmitted())
+    {
+        boost::system::error_code error;
+        ring->submit(error);
+    }
+
+    if (!ring_wanted)
+        return false;
+    if (ring_received.empty())
+    {
+        arm_ring_receive();
+        return false;
+    }
+    return true;
+}
+
+template <typename NextLayer>
+void basic_multiplexer<NextLayer>::process_ring_receive(completion_list& completions)
+{
+    {
+        // Copy so the provided buffers can be reused at once. The receive
+        // lock keeps the datagrams in order until they are demultiplexed.
+        std::lock_guard<decltype(send_mutex)> send_lock(send_mutex);
+        if (!ring_wanted || ring_received.empty())
+            return;
+
+        ring_wanted = false;
+        for (const auto& item : ring_received)
+        {
+            if (!detail::uring::has_buffer(item))
+            {
+                const boost::system::error_code error(-item.result, boost::asio::error::get_system_category());
+                if (error != boost::asio::error::operation_aborted)
+                {
+                    stats.receive_errors.add();
+                    ring_taken.push_back(ring_datagram{error, {}, endpoint_type(), 0});
+                }
+                continue;
+            }
+
+            const char *data = nullptr;
+            endpoint_type remote_endpoint;
+            bool truncated = false;
+            const auto length = ring->payload(item, data, remote_endpoint, truncated);
+            auto datagram = pool->allocate(length);
+            if (length > 0)
+            {
+                std::memcpy(datagram.data(), data, length);
+            }
+            std::size_t segment_size = 0;
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+            if (receive_coalescing || receive_timestamps)
+            {
+                const auto header = ring->control(item);
+                segment_size = offload::segment_size(header);
+                buffer_type::timestamps times;
+                times.arrival = timestamp::arrival(header);
+                datagram.times(times);
+            }
+#endif
+            ring->recycle(item);
+
+            boost::system::error_code status;
+            if (truncated)
+            {
+                status = boost::asio::error::message_size;
+            }
+            ring_taken.push_back(ring_datagram{status, std::move(datagram), remote_endpoint, segment_size});
+        }
+        ring_received.clear();
+    }
+
+    // Fulfills the receive requests it completes, and at least one
+    std::size_t fulfilled = 0;
+    for (auto& item : ring_taken)
+    {
+        fulfilled += process_segments(item.error,
+                                      std::move(item.datagram),
+                                      item.remote_endpoint,
+                                      item.segment_size,
+                                      completions);
+    }
+    ring_taken.clear();
+    fulfill_receive(std::max<std::size_t>(fulfilled, 1));
+
+    if (pending_receive_count > 0)
+    {
+        arm_receive();
+    }
+}
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_MULTIPLEXER_URING_IPP
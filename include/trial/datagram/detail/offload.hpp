@@ -0,0 +1,280 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_OFFLOAD_HPP
+#define TRIAL_DATAGRAM_DETAIL_OFFLOAD_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <boost/system/error_code.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <trial/datagram/detail/timestamp.hpp>
+
+#if defined(__linux__)
+# include <cerrno>
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <sys/uio.h>
+# include <netinet/in.h>
+# include <netinet/udp.h>
+# if defined(UDP_SEGMENT)
+#  define TRIAL_DATAGRAM_HAS_UDP_SEGMENT 1
+# endif
+# if defined(UDP_GRO)
+#  define TRIAL_DATAGRAM_HAS_UDP_GRO 1
+# endif
+#endif
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// UDP segmentation offload.
+//
+// On send, the kernel splits a large buffer into datagrams of equal size
+// (UDP_SEGMENT). On receive, the kernel coalesces consecutive datagrams from
+// the same flow into a single buffer and reports the original datagram size
+// (UDP_GRO).
+
+namespace offload
+{
+
+using native_handle_type = int;
+using endpoint_type = boost::asio::ip::udp::endpoint;
+
+// Kernel limits on a segmented send
+constexpr std::size_t max_segments = 64;
+constexpr std::size_t max_payload = 65507;
+
+constexpr bool is_send_supported()
+{
+#if defined(TRIAL_DATAGRAM_HAS_UDP_SEGMENT)
+    return true;
+#else
+    return false;
+#endif
+}
+
+constexpr bool is_receive_supported()
+{
+#if defined(TRIAL_DATAGRAM_HAS_UDP_GRO)
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Space for the ancillary data of a received datagram, which may report
+// both coalescing and a timestamp
+struct control_block
+{
+#if defined(TRIAL_DATAGRAM_HAS_UDP_GRO)
+    alignas(struct ::cmsghdr) char data[CMSG_SPACE(sizeof(int)) + timestamp::control_space];
+#elif defined(TRIAL_DATAGRAM_HAS_SO_TIMESTAMPNS)
+    alignas(struct ::cmsghdr) char data[timestamp::control_space];
+#else
+    char data[1];
+#endif
+};
+
+inline boost::system::error_code last_error()
+{
+#if defined(__linux__)
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return boost::asio::error::would_block;
+    return boost::system::error_code(errno, boost::asio::error::get_system_category());
+#else
+    return boost::asio::error::operation_not_supported;
+#endif
+}
+
+// Non-blocking send of buffers as datagrams of segment_size bytes. The last
+// datagram may be shorter.
+template <typename ConstBufferSequence>
+std::size_t send(native_handle_type handle,
+                 const ConstBufferSequence& buffers,
+                 const endpoint_type& endpoint,
+                 std::size_t segment_size,
+                 boost::system::error_code& error)
+{
+#if defined(TRIAL_DATAGRAM_HAS_UDP_SEGMENT)
+    std::vector<struct ::iovec> vectors;
+    std::size_t total = 0;
+    for (auto it = boost::asio::buffer_sequence_begin(buffers);
+         it != boost::asio::buffer_sequence_end(buffers);
+         ++it)
+    {
+        boost::asio::const_buffer buffer(*it);
+        struct ::iovec vector;
+        vector.iov_base = const_cast<void *>(buffer.data());
+        vector.iov_len = buffer.size();
+        vectors.push_back(vector);
+        total += buffer.size();
+    }
+    if ((segment_size == 0) || (segment_size > UINT16_MAX))
+    {
+        error = boost::asio::error::invalid_argument;
+        return 0;
+    }
+    if ((total > max_payload) || ((total + segment_size - 1) / segment_size > max_segments))
+    {
+        error = boost::asio::error::message_size;
+        return 0;
+    }
+
+    control_block control;
+    std::memset(&control, 0, sizeof(control));
+    struct ::msghdr header;
+    std::memset(&header, 0, sizeof(header));
+    header.msg_name = const_cast<void *>(static_cast<const void *>(endpoint.data()));
+    header.msg_namelen = static_cast<::socklen_t>(endpoint.size());
+    header.msg_iov = vectors.data();
+    header.msg_iovlen = vectors.size();
+    header.msg_control = control.data;
+    header.msg_controllen = CMSG_SPACE(sizeof(std::uint16_t));
+    auto message = CMSG_FIRSTHDR(&header);
+    message->cmsg_level = SOL_UDP;
+    message->cmsg_type = UDP_SEGMENT;
+    message->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+    const std::uint16_t size = static_cast<std::uint16_t>(segment_size);
+    std::memcpy(CMSG_DATA(message), &size, sizeof(size));
+
+    ::ssize_t result = 0;
+    do
+    {
+        result = ::sendmsg(handle, &header, MSG_DONTWAIT);
+    } while ((result < 0) && (errno == EINTR));
+    if (result < 0)
+    {
+        error = last_error();
+        return 0;
+    }
+    error = boost::system::error_code();
+    return static_cast<std::size_t>(result);
+#else
+    (void)handle;
+    (void)buffers;
+    (void)endpoint;
+    (void)segment_size;
+    error = boost::asio::error::operation_not_supported;
+    return 0;
+#endif
+}
+
+inline void enable_receive(native_handle_type handle,
+                           bool enable,
+                           boost::system::error_code& error)
+{
+#if defined(TRIAL_DATAGRAM_HAS_UDP_GRO)
+    int value = enable ? 1 : 0;
+    if (::setsockopt(handle, SOL_UDP, UDP_GRO, &value, sizeof(value)) < 0)
+    {
+        error = last_error();
+        return;
+    }
+    error = boost::system::error_code();
+#else
+    (void)handle;
+    error = enable
+        ? boost::system::error_code(boost::asio::error::operation_not_supported)
+        : boost::system::error_code();
+#endif
+}
+
+// Size of the datagrams that have been coalesced into a received buffer, or
+// zero if the buffer contains a single datagram.
+#if defined(__linux__)
+inline std::size_t segment_size(const struct ::msghdr& header)
+{
+#if defined(TRIAL_DATAGRAM_HAS_UDP_GRO)
+    for (auto message = CMSG_FIRSTHDR(&header);
+         message != nullptr;
+         message = CMSG_NXTHDR(const_cast<struct ::msghdr *>(&header), message))
+    {
+        if ((message->cmsg_level == SOL_UDP) && (message->cmsg_type == UDP_GRO))
+        {
+            int size = 0;
+            std::memcpy(&size, CMSG_DATA(message), sizeof(size));
+            return (size > 0) ? static_cast<std::size_t>(size) : 0;
+        }
+    }
+#else
+    (void)header;
+#endif
+    return 0;
+}
+#endif
+
+// Non-blocking receive of a single, possibly coalesced, datagram, along
+// with its kernel timestamp if enabled.
+inline std::size_t receive(native_handle_type handle,
+                           void *data,
+                           std::size_t size,
+                           endpoint_type& endpoint,
+                           std::size_t& segment,
+                           timestamp::time_point& arrival,
+                           boost::system::error_code& error)
+{
+    segment = 0;
+    arrival = timestamp::time_point();
+#if defined(__linux__)
+    control_block control;
+    struct ::iovec vector;
+    vector.iov_base = data;
+    vector.iov_len = size;
+    struct ::msghdr header;
+    std::memset(&header, 0, sizeof(header));
+    header.msg_name = endpoint.data();
+    header.msg_namelen = static_cast<::socklen_t>(endpoint.capacity());
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control.data;
+    header.msg_controllen = sizeof(control.data);
+
+    ::ssize_t result = 0;
+    do
+    {
+        result = ::recvmsg(handle, &header, MSG_DONTWAIT);
+    } while ((result < 0) && (errno == EINTR));
+    if (result < 0)
+    {
+        error = last_error();
+        return 0;
+    }
+    endpoint.resize(header.msg_namelen);
+    segment = segment_size(header);
+    arrival = timestamp::arrival(header);
+    error = (header.msg_flags & MSG_TRUNC)
+        ? boost::system::error_code(boost::asio::error::message_size)
+        : boost::system::error_code();
+    return static_cast<std::size_t>(result);
+#else
+    (void)handle;
+    (void)data;
+    (void)size;
+    (void)endpoint;
+    error = boost::asio::error::operation_not_supported;
+    return 0;
+#endif
+}
+
+} // namespace offload
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_OFFLOAD_HPP
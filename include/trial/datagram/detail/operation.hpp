@@ -0,0 +1,572 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_OPERATION_HPP
+#define TRIAL_DATAGRAM_DETAIL_OPERATION_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/dispatch.hpp>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// Per-thread cache of recently released operation storage.
+//
+// Operations are released before their handler is invoked, so a handler
+// that starts a new operation of the same kind gets the storage back
+// without going to the heap.
+
+class recycling_cache
+{
+public:
+    static recycling_cache& instance()
+    {
+        static thread_local recycling_cache cache;
+        return cache;
+    }
+
+    ~recycling_cache()
+    {
+        for (auto& slot : slots)
+        {
+            ::operator delete(slot.pointer);
+        }
+    }
+
+    void *allocate(std::size_t size)
+    {
+        size = round(size);
+        // Take the smallest block that fits, so larger blocks remain for
+        // larger operations
+        decltype(&slots[0]) best = nullptr;
+        for (auto& slot : slots)
+        {
+            if (slot.pointer && (slot.size >= size) && (!best || (slot.size < best->size)))
+            {
+                best = &slot;
+            }
+        }
+        if (!best)
+            return ::operator new(size);
+        auto result = best->pointer;
+        best->pointer = nullptr;
+        return result;
+    }
+
+    void deallocate(void *pointer, std::size_t size) noexcept
+    {
+        size = round(size);
+        // Keep the largest blocks, because they can be reused by any
+        // operation that fits
+        auto *victim = &slots[0];
+        for (auto& slot : slots)
+        {
+            if (!slot.pointer)
+            {
+                victim = &slot;
+                break;
+            }
+            if (slot.size < victim->size)
+            {
+                victim = &slot;
+            }
+        }
+        if (victim->pointer && (victim->size >= size))
+        {
+            ::operator delete(pointer);
+            return;
+        }
+        ::operator delete(victim->pointer);
+        victim->pointer = pointer;
+        victim->size = size;
+    }
+
+private:
+    recycling_cache() = default;
+
+    static std::size_t round(std::size_t size) noexcept
+    {
+        return (size + granularity - 1) & ~(granularity - 1);
+    }
+
+private:
+    static constexpr std::size_t granularity = 64;
+    static constexpr std::size_t slot_count = 4;
+
+    struct
+    {
+        void *pointer = nullptr;
+        std::size_t size = 0;
+    } slots[slot_count];
+};
+
+// Allocator used for handlers without an associated allocator.
+
+template <typename T>
+class recycling_allocator
+{
+public:
+    using value_type = T;
+
+    recycling_allocator() = default;
+
+    template <typename U>
+    recycling_allocator(const recycling_allocator<U>&) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T *>(recycling_cache::instance().allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *pointer, std::size_t n) noexcept
+    {
+        recycling_cache::instance().deallocate(pointer, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const recycling_allocator<U>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const recycling_allocator<U>&) const noexcept { return false; }
+};
+
+template <typename Handler>
+using handler_allocator_t = boost::asio::associated_allocator_t<Handler, recycling_allocator<void>>;
+
+template <typename Handler>
+handler_allocator_t<Handler> get_handler_allocator(const Handler& handler)
+{
+    return boost::asio::get_associated_allocator(handler, recycling_allocator<void>());
+}
+
+// Function object whose storage comes from the recycling cache when it is
+// posted. Asio only recycles a single block per thread, which is often taken
+// by the pending read of the multiplexer.
+
+template <typename Function>
+class recycled_function
+{
+public:
+    using allocator_type = recycling_allocator<void>;
+
+    explicit recycled_function(Function function)
+        : function(std::move(function))
+    {
+    }
+
+    allocator_type get_allocator() const noexcept { return allocator_type(); }
+
+    void operator()() { function(); }
+
+private:
+    Function function;
+};
+
+template <typename Function>
+recycled_function<typename std::decay<Function>::type> make_recycled(Function&& function)
+{
+    return recycled_function<typename std::decay<Function>::type>(std::forward<Function>(function));
+}
+
+// Whether a handler can be invoked directly from the calling thread, which
+// requires that the thread is running the executor of the handler.
+
+template <typename Executor>
+auto running_in_this_thread(const Executor& executor, int) -> decltype(executor.running_in_this_thread())
+{
+    return executor.running_in_this_thread();
+}
+
+template <typename Executor>
+bool running_in_this_thread(const Executor&, long)
+{
+    // Cannot tell
+    return false;
+}
+
+template <typename Handler,
+          typename Executor>
+bool can_invoke_inline(const Handler& handler,
+                       const Executor& fallback)
+{
+    return running_in_this_thread(boost::asio::get_associated_executor(handler, fallback), 0);
+}
+
+template <std::size_t...>
+struct index_list {};
+
+template <std::size_t N,
+          std::size_t... Indices>
+struct make_index_list : make_index_list<N - 1, N - 1, Indices...> {};
+
+template <std::size_t... Indices>
+struct make_index_list<0, Indices...>
+{
+    using type = index_list<Indices...>;
+};
+
+// Handler together with its arguments, so it can be submitted to an
+// executor. The storage comes from the allocator of the operation.
+
+template <typename Handler,
+          typename Allocator,
+          typename... Args>
+class bound_handler
+{
+public:
+    using allocator_type = Allocator;
+
+    template <typename... Types>
+    bound_handler(Handler handler,
+                  const Allocator& allocator,
+                  Types&&... args)
+        : handler(std::move(handler)),
+          allocator(allocator),
+          arguments(std::forward<Types>(args)...)
+    {
+    }
+
+    allocator_type get_allocator() const noexcept { return allocator; }
+
+    void operator()()
+    {
+        invoke(typename make_index_list<sizeof...(Args)>::type());
+    }
+
+private:
+    template <std::size_t... Indices>
+    void invoke(index_list<Indices...>)
+    {
+        handler(std::move(std::get<Indices>(arguments))...);
+    }
+
+private:
+    Handler handler;
+    Allocator allocator;
+    std::tuple<Args...> arguments;
+};
+
+// Invokes a handler on its executor. The handler is invoked directly if the
+// calling thread already runs the executor, and is dispatched otherwise, so
+// handlers that are bound to a strand never run concurrently.
+
+template <typename Executor,
+          typename Handler,
+          typename Allocator,
+          typename... Args>
+void dispatch_handler(const Executor& executor,
+                      Handler&& handler,
+                      const Allocator& allocator,
+                      Args&&... args)
+{
+    if (running_in_this_thread(executor, 0))
+    {
+        handler(std::forward<Args>(args)...);
+        return;
+    }
+    using bound_type = bound_handler<typename std::decay<Handler>::type,
+                                     Allocator,
+                                     typename std::decay<Args>::type...>;
+    boost::asio::dispatch(executor,
+                          bound_type(std::forward<Handler>(handler),
+                                     allocator,
+                                     std::forward<Args>(args)...));
+}
+
+// Bounds the nesting of handlers that are invoked inline on a thread.
+
+class inline_scope
+{
+public:
+    static constexpr std::size_t limit = 16;
+
+    inline_scope() noexcept { ++depth(); }
+    ~inline_scope() { --depth(); }
+
+    inline_scope(const inline_scope&) = delete;
+    inline_scope& operator=(const inline_scope&) = delete;
+
+    static bool available() noexcept { return depth() < limit; }
+
+private:
+    static std::size_t& depth() noexcept
+    {
+        static thread_local std::size_t value = 0;
+        return value;
+    }
+};
+
+// Type-erased pending operation.
+//
+// Operations are linked intrusively into an operation_queue, so queueing
+// does not allocate. An operation must be either completed or destroyed
+// exactly once.
+
+template <typename... Args>
+class operation
+{
+public:
+    void complete(Args... args)
+    {
+        complete_function(this, std::forward<Args>(args)...);
+    }
+
+    void destroy() noexcept
+    {
+        destroy_function(this);
+    }
+
+protected:
+    using complete_type = void (*)(operation *, Args...);
+    using destroy_type = void (*)(operation *);
+
+    operation(complete_type complete,
+              destroy_type destroy) noexcept
+        : complete_function(complete),
+          destroy_function(destroy)
+    {
+    }
+
+    ~operation() = default;
+
+private:
+    template <typename> friend class operation_queue;
+
+    operation *next = nullptr;
+    complete_type complete_function;
+    destroy_type destroy_function;
+};
+
+struct operation_deleter
+{
+    template <typename Operation>
+    void operator()(Operation *op) const noexcept { op->destroy(); }
+};
+
+template <typename Operation>
+using operation_pointer = std::unique_ptr<Operation, operation_deleter>;
+
+// Operation that invokes a handler on its executor. The storage is obtained
+// from the allocator and is returned before the handler is invoked.
+
+template <typename Operation,
+          typename Handler,
+          typename Allocator,
+          typename Executor>
+class handler_operation
+    : public Operation
+{
+public:
+    template <typename... Types>
+    static operation_pointer<Operation> create(Handler handler,
+                                               const Allocator& allocator,
+                                               const Executor& executor,
+                                               Types&&... args)
+    {
+        allocator_type storage_allocator(allocator);
+        auto storage = storage_allocator.allocate(1);
+        try
+        {
+            return operation_pointer<Operation>(
+                new (storage) handler_operation(std::move(handler),
+                                                allocator,
+                                                executor,
+                                                std::forward<Types>(args)...));
+        }
+        catch (...)
+        {
+            storage_allocator.deallocate(storage, 1);
+            throw;
+        }
+    }
+
+private:
+    using allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<handler_operation>;
+
+    template <typename... Types>
+    handler_operation(Handler&& handler,
+                      const Allocator& allocator,
+                      const Executor& executor,
+                      Types&&... args)
+        : Operation(&handler_operation::do_complete,
+                    &handler_operation::do_destroy,
+                    std::forward<Types>(args)...),
+          handler(std::move(handler)),
+          allocator(allocator),
+          executor(executor)
+    {
+    }
+
+    template <typename Base,
+              typename... Args>
+    static void do_complete(Base *base, Args... args)
+    {
+        auto self = static_cast<handler_operation *>(base);
+        Handler function(std::move(self->handler));
+        const Allocator allocator(self->allocator);
+        const Executor executor(self->executor);
+        self->release();
+        dispatch_handler(executor,
+                         std::move(function),
+                         allocator,
+                         std::forward<Args>(args)...);
+    }
+
+    template <typename Base>
+    static void do_destroy(Base *base) noexcept
+    {
+        static_cast<handler_operation *>(base)->release();
+    }
+
+    void release() noexcept
+    {
+        allocator_type storage_allocator(allocator);
+        this->~handler_operation();
+        storage_allocator.deallocate(this, 1);
+    }
+
+private:
+    Handler handler;
+    Allocator allocator;
+    Executor executor;
+};
+
+template <typename Operation,
+          typename Handler,
+          typename Allocator,
+          typename Executor,
+          typename... Types>
+operation_pointer<Operation> make_operation(Handler&& handler,
+                                            const Allocator& allocator,
+                                            const Executor& executor,
+                                            Types&&... args)
+{
+    using handler_type = typename std::decay<Handler>::type;
+    return handler_operation<Operation, handler_type, Allocator, Executor>::create(std::forward<Handler>(handler),
+                                                                                    allocator,
+                                                                                    executor,
+                                                                                    std::forward<Types>(args)...);
+}
+
+// First-in first-out queue of pending operations.
+
+template <typename Operation>
+class operation_queue
+{
+public:
+    operation_queue() = default;
+    operation_queue(const operation_queue&) = delete;
+    operation_queue& operator=(const operation_queue&) = delete;
+
+    operation_queue(operation_queue&& other) noexcept
+        : head(other.head),
+          tail(other.tail),
+          count(other.count)
+    {
+        other.head = nullptr;
+        other.tail = nullptr;
+        other.count = 0;
+    }
+
+    operation_queue& operator=(operation_queue&& other) noexcept
+    {
+        if (this != &other)
+        {
+            clear();
+            std::swap(head, other.head);
+            std::swap(tail, other.tail);
+            std::swap(count, other.count);
+        }
+        return *this;
+    }
+
+    ~operation_queue()
+    {
+        clear();
+    }
+
+    bool empty() const noexcept { return head == nullptr; }
+    std::size_t size() const noexcept { return count; }
+
+    void push(operation_pointer<Operation> op) noexcept
+    {
+        ++count;
+        auto raw = op.release();
+        if (tail)
+        {
+            link(tail) = raw;
+        }
+        else
+        {
+            head = raw;
+        }
+        tail = raw;
+    }
+
+    operation_pointer<Operation> pop() noexcept
+    {
+        --count;
+        auto raw = head;
+        head = static_cast<Operation *>(link(raw));
+        link(raw) = nullptr;
+        if (!head)
+        {
+            tail = nullptr;
+        }
+        return operation_pointer<Operation>(raw);
+    }
+
+    Operation& front() noexcept { return *head; }
+
+    template <typename Function>
+    void for_each(Function&& function)
+    {
+        for (auto op = head; op; op = static_cast<Operation *>(link(op)))
+        {
+            function(*op);
+        }
+    }
+
+    void clear() noexcept
+    {
+        while (!empty())
+        {
+            pop();
+        }
+    }
+
+private:
+    template <typename... Args>
+    static auto link(operation<Args...> *op) noexcept -> decltype((op->next))
+    {
+        return op->next;
+    }
+
+private:
+    Operation *head = nullptr;
+    Operation *tail = nullptr;
+    std::size_t count = 0;
+};
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_OPERATION_HPP
@@ -0,0 +1,55 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_PEER_CHANNEL_HPP
+#define TRIAL_DATAGRAM_DETAIL_PEER_CHANNEL_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <mutex>
+#include <boost/asio/ip/udp.hpp>
+#include <trial/net/executor.hpp>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+class socket_base;
+
+// Connected UDP socket of a promoted remote endpoint.
+//
+// Owned by the multiplexer and read under a mutex of its own, so promoted
+// peers are demultiplexed in parallel. The owner is reset when the socket
+// is removed, so pending operations can tell that the channel has been
+// abandoned.
+
+struct peer_channel
+{
+    using next_layer_type = boost::asio::ip::udp::socket;
+
+    explicit peer_channel(const net::executor& executor)
+        : next_layer(executor)
+    {
+    }
+
+    std::mutex mutex;
+    next_layer_type next_layer;
+    socket_base *owner = nullptr;
+    bool waiting = false;
+    // Receive options that were enabled on the connected socket
+    bool ancillary = false;
+    bool timestamps = false;
+};
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_PEER_CHANNEL_HPP
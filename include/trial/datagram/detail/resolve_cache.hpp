@@ -0,0 +1,265 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_RESOLVE_CACHE_HPP
+#define TRIAL_DATAGRAM_DETAIL_RESOLVE_CACHE_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/system/error_code.hpp>
+#include <trial/net/executor.hpp>
+#include <trial/net/internet.hpp>
+#include <trial/datagram/option.hpp>
+#include <trial/datagram/detail/flat_map.hpp>
+#include <trial/datagram/detail/operation.hpp>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// Resolved endpoints by host and service name.
+//
+// A resolution that is in progress collects the handlers of identical
+// requests, so only one resolver query is made per host and service name.
+// Each handler is invoked through the executor of its own request. The
+// results are retained until the time-to-live expires. Expired entries are
+// discarded when they are looked up again, and all of them are discarded
+// whenever the number of entries has doubled since the last sweep.
+
+template <typename Protocol>
+class resolve_cache
+{
+    using resolver_type = typename Protocol::resolver;
+    using clock_type = std::chrono::steady_clock;
+
+public:
+    using endpoint_type = typename Protocol::endpoint;
+    using results_type = std::vector<endpoint_type>;
+    using handler_type = std::function<void (const boost::system::error_code&, const results_type&)>;
+
+    // Invoke handler with the resolved endpoints. The handler is invoked
+    // directly if the endpoints are cached, and through the executor
+    // otherwise.
+    void async_resolve(const net::executor& executor,
+                       const std::string& host,
+                       const std::string& service,
+                       handler_type handler);
+
+    void set_option(const option::resolve_cache&);
+    void get_option(option::resolve_cache&) const;
+
+private:
+    struct key_type
+    {
+        std::string host;
+        std::string service;
+
+        bool operator==(const key_type& other) const
+        {
+            return (host == other.host) && (service == other.service);
+        }
+
+        struct hash
+        {
+            std::size_t operator()(const key_type& key) const
+            {
+                const std::hash<std::string> hasher;
+                const auto seed = hasher(key.host);
+                return seed ^ (hasher(key.service) + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+            }
+        };
+    };
+
+    struct waiter_type
+    {
+        net::executor executor;
+        handler_type handler;
+    };
+
+    struct entry_type
+    {
+        results_type results;
+        clock_type::time_point expiry;
+        // Requests waiting for a resolution in progress
+        std::vector<waiter_type> waiting;
+        bool resolving = false;
+    };
+
+    void process_resolve(const key_type& key,
+                         const boost::system::error_code& error,
+                         typename resolver_type::iterator where);
+    void prune(clock_type::time_point now);
+
+private:
+    mutable std::mutex mutex;
+    detail::flat_map<key_type, entry_type, typename key_type::hash> entries;
+    clock_type::duration ttl = clock_type::duration::zero();
+    // Number of entries that triggers the next sweep of expired entries
+    std::size_t prune_size = 64;
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t coalesced = 0;
+};
+
+template <typename Protocol>
+void resolve_cache<Protocol>::async_resolve(const net::executor& executor,
+                                            const std::string& host,
+                                            const std::string& service,
+                                            handler_type handler)
+{
+    key_type key{host, service};
+    {
+        std::unique_lock<decltype(mutex)> lock(mutex);
+        const auto now = clock_type::now();
+        if (entries.size() >= prune_size)
+        {
+            prune(now);
+        }
+        auto entry = entries.insert(key, entry_type{}).first;
+        if (entry->resolving)
+        {
+            ++coalesced;
+            entry->waiting.push_back(waiter_type{executor, std::move(handler)});
+            return;
+        }
+        if (!entry->results.empty() && (now < entry->expiry))
+        {
+            ++hits;
+            const auto results = entry->results;
+            lock.unlock();
+            handler(boost::system::error_code(), results);
+            return;
+        }
+        ++misses;
+        entry->results.clear();
+        entry->resolving = true;
+        entry->waiting.push_back(waiter_type{executor, std::move(handler)});
+    }
+
+    auto resolver = std::make_shared<resolver_type>(executor);
+    net::extension::async_resolve(
+        resolver,
+        host,
+        service,
+        [this, key, resolver]
+        (const boost::system::error_code& error, typename resolver_type::iterator where)
+        {
+            this->process_resolve(key, error, where);
+        });
+}
+
+template <typename Protocol>
+void resolve_cache<Protocol>::process_resolve(const key_type& key,
+                                              const boost::system::error_code& error,
+                                              typename resolver_type::iterator where)
+{
+    results_type results;
+    if (!error)
+    {
+        for (; where != typename resolver_type::iterator(); ++where)
+        {
+            results.push_back(*where);
+        }
+    }
+
+    std::vector<waiter_type> waiting;
+    {
+        std::lock_guard<decltype(mutex)> lock(mutex);
+        auto entry = entries.find(key);
+        assert(entry);
+        waiting.swap(entry->waiting);
+        if (error || (ttl == clock_type::duration::zero()))
+        {
+            entries.erase(key);
+        }
+        else
+        {
+            entry->results = results;
+            entry->expiry = clock_type::now() + ttl;
+            entry->resolving = false;
+        }
+    }
+    for (auto& waiter : waiting)
+    {
+        dispatch_handler(waiter.executor,
+                         std::move(waiter.handler),
+                         std::allocator<void>(),
+                         error,
+                         results);
+    }
+}
+
+template <typename Protocol>
+void resolve_cache<Protocol>::prune(clock_type::time_point now)
+{
+    // Keep resolutions in progress, as their handlers are still waiting
+    std::vector<key_type> expired;
+    entries.for_each(
+        [&expired, now] (const key_type& key, const entry_type& entry)
+        {
+            if (!entry.resolving && (entry.expiry <= now))
+            {
+                expired.push_back(key);
+            }
+        });
+    for (const auto& key : expired)
+    {
+        entries.erase(key);
+    }
+    prune_size = std::max(2 * entries.size(), std::size_t(64));
+}
+
+template <typename Protocol>
+void resolve_cache<Protocol>::set_option(const option::resolve_cache& option)
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    ttl = option.ttl();
+    if (ttl == clock_type::duration::zero())
+    {
+        // Keep resolutions in progress, as their handlers are still waiting
+        std::vector<key_type> expired;
+        entries.for_each(
+            [&expired] (const key_type& key, const entry_type& entry)
+            {
+                if (!entry.resolving)
+                {
+                    expired.push_back(key);
+                }
+            });
+        for (const auto& key : expired)
+        {
+            entries.erase(key);
+        }
+    }
+}
+
+template <typename Protocol>
+void resolve_cache<Protocol>::get_option(option::resolve_cache& option) const
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    option = option::resolve_cache(ttl);
+    option.counters(hits, misses, coalesced);
+}
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_RESOLVE_CACHE_HPP
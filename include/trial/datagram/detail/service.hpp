@@ -12,10 +12,13 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include <memory>
-#include <map>
 #include <mutex>
 #include <trial/net/io_context.hpp>
 #include <trial/datagram/endpoint.hpp>
+#include <trial/datagram/option.hpp>
+#include <trial/datagram/detail/endpoint_key.hpp>
+#include <trial/datagram/detail/flat_map.hpp>
+#include <trial/datagram/detail/resolve_cache.hpp>
 
 namespace trial
 {
@@ -23,27 +26,40 @@ namespace datagram
 {
 namespace detail
 {
-class multiplexer;
+template <typename> class basic_multiplexer;
 
 // One service is instantiated for trial.datagram. This service can contain
 // several multiplexers, one per local endpoint, and a multiplexer can contain
 // several remote endpoints.
 
-template <typename Protocol>
+template <typename Protocol,
+          typename NextLayer = typename Protocol::socket>
 class service
     : public net::io_context::service
 {
     using endpoint_type = trial::datagram::endpoint;
 
 public:
+    using multiplexer_type = detail::basic_multiplexer<NextLayer>;
+
     static net::io_context::id id;
 
     explicit service(net::io_context& io);
 
     // Get or create the multiplexer that owns a local endpoint
-    std::shared_ptr<detail::multiplexer> add(const endpoint_type& local_endpoint);
+    //
+    // A multiplexer created with reuse_port can share the local endpoint
+    // with multiplexers in other services. The backend only applies if the
+    // multiplexer is created.
+    std::shared_ptr<multiplexer_type> add(const endpoint_type& local_endpoint,
+                                          bool reuse_port = false,
+                                          const option::io_backend& backend = option::io_backend());
     void remove(const endpoint_type& local_endpoint);
 
+    // Resolved host and service names shared by all sockets
+    detail::resolve_cache<Protocol>& resolver() { return resolver_cache; }
+    const detail::resolve_cache<Protocol>& resolver() const { return resolver_cache; }
+
     // Required by boost::asio::basic_io_object
     struct implementation_type {};
     void construct(implementation_type&) {}
@@ -58,7 +74,8 @@ private:
 private:
     net::io_context& context;
     std::mutex mutex;
-    std::map< endpoint_type, std::weak_ptr<detail::multiplexer> > multiplexers;
+    detail::flat_map<endpoint_key, std::weak_ptr<multiplexer_type>, endpoint_key::hash> multiplexers;
+    detail::resolve_cache<Protocol> resolver_cache;
 };
 
 } // namespace detail
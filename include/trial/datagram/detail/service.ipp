@@ -20,59 +20,65 @@ namespace datagram
 namespace detail
 {
 
-template <typename Protocol>
-net::io_context::id service<Protocol>::id;
+template <typename Protocol, typename NextLayer>
+net::io_context::id service<Protocol, NextLayer>::id;
 
-template <typename Protocol>
-service<Protocol>::service(net::io_context& io)
+template <typename Protocol, typename NextLayer>
+service<Protocol, NextLayer>::service(net::io_context& io)
     : net::io_context::service(io),
       context(io)
 {
 }
 
-template <typename Protocol>
-std::shared_ptr<detail::multiplexer> service<Protocol>::add(const endpoint_type& local_endpoint)
+template <typename Protocol, typename NextLayer>
+auto service<Protocol, NextLayer>::add(const endpoint_type& local_endpoint,
+                                       bool reuse_port,
+                                       const option::io_backend& backend) -> std::shared_ptr<multiplexer_type>
 {
     std::lock_guard<decltype(mutex)> lock(mutex);
 
-    std::shared_ptr<detail::multiplexer> result;
-    auto where = multiplexers.lower_bound(local_endpoint);
-    if ((where == multiplexers.end()) || (multiplexers.key_comp()(local_endpoint, where->first)))
+    std::shared_ptr<multiplexer_type> result;
+    const endpoint_key key(local_endpoint);
+    auto where = multiplexers.find(key);
+    if (!where)
     {
         // Multiplexer for local endpoint does not exists
-        result = std::move(detail::multiplexer::create(net::extension::get_executor(context),
-                                                       local_endpoint));
-        where = multiplexers.insert(
-            where,
-            typename decltype(multiplexers)::value_type(local_endpoint, result));
+        result = std::move(multiplexer_type::create(net::extension::get_executor(context),
+                                                    local_endpoint,
+                                                    reuse_port,
+                                                    backend));
+        multiplexers.insert(key, result);
     }
     else
     {
-        result = where->second.lock();
+        result = where->lock();
         if (!result)
         {
             // This can happen if an acceptor has failed
             // Reassign if empty
-            result = std::move(detail::multiplexer::create(net::extension::get_executor(context),
-                                                           local_endpoint));
-            where->second = result;
+            result = std::move(multiplexer_type::create(net::extension::get_executor(context),
+                                                        local_endpoint,
+                                                        reuse_port,
+                                                        backend));
+            *where = result;
         }
     }
     return result;
 }
 
-template <typename Protocol>
-void service<Protocol>::remove(const endpoint_type& local_endpoint)
+template <typename Protocol, typename NextLayer>
+void service<Protocol, NextLayer>::remove(const endpoint_type& local_endpoint)
 {
     std::lock_guard<decltype(mutex)> lock(mutex);
 
-    auto where = multiplexers.find(local_endpoint);
-    if (where != multiplexers.end())
+    const endpoint_key key(local_endpoint);
+    auto where = multiplexers.find(key);
+    if (where)
     {
         // Only remove if multiplexer is unused
-        if (!where->second.lock())
+        if (!where->lock())
         {
-            multiplexers.erase(where);
+            multiplexers.erase(key);
         }
     }
 }
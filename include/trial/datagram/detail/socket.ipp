@@ -10,6 +10,7 @@
 
 #include <algorithm>
 #include <functional>
+#include <type_traits>
 #include <boost/asio/error.hpp>
 #include <trial/net/executor.hpp>
 #include <trial/net/internet.hpp>
@@ -20,38 +21,46 @@ namespace trial
 namespace datagram
 {
 
-inline socket::socket(socket&& other)
-    : basic_io_object<service_type>(std::forward<decltype(other)>(other)),
+template <typename NextLayer>
+basic_socket<NextLayer>::basic_socket(basic_socket&& other)
+    : boost::asio::basic_io_object<service_type>(std::forward<decltype(other)>(other)),
       multiplexer(other.multiplexer)
 {
 }
 
-inline socket::socket(const net::executor& executor)
+template <typename NextLayer>
+basic_socket<NextLayer>::basic_socket(const net::executor& executor)
     : boost::asio::basic_io_object<service_type>(static_cast<net::io_context&>(executor.context()))
 {
 }
 
-inline socket::socket(const net::executor& executor,
-                      const endpoint_type& local_endpoint)
+template <typename NextLayer>
+basic_socket<NextLayer>::basic_socket(const net::executor& executor,
+                                      const endpoint_type& local_endpoint,
+                                      const option::io_backend& backend)
     : boost::asio::basic_io_object<service_type>(static_cast<net::io_context&>(executor.context())),
-      multiplexer(get_service().add(local_endpoint))
+      multiplexer(this->get_service().add(local_endpoint, false, backend))
 {
 }
 
-inline socket::~socket()
+template <typename NextLayer>
+basic_socket<NextLayer>::~basic_socket()
 {
     if (multiplexer)
     {
+        // No datagrams are delivered after removal
         multiplexer->remove(this);
+        multiplexer->remove_queued(receive_queued_bytes);
         auto local = local_endpoint();
         multiplexer.reset();
-        get_service().remove(local);
+        this->get_service().remove(local);
     }
 }
 
+template <typename NextLayer>
 template <typename CompletionToken>
-auto socket::async_connect(const endpoint_type& remote_endpoint,
-                           CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code)>
+auto basic_socket<NextLayer>::async_connect(const endpoint_type& remote_endpoint,
+                                            CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code)>
 {
     net::async_completion<CompletionToken, void(boost::system::error_code, std::size_t)> async(token);
     auto&& handler = async.completion_handler;
@@ -77,25 +86,34 @@ auto socket::async_connect(const endpoint_type& remote_endpoint,
     return async.result.get();
 }
 
+template <typename NextLayer>
 template <typename ConnectHandler>
-void socket::process_connect(const boost::system::error_code& error,
-                             const endpoint_type& remote_endpoint,
-                             ConnectHandler&& handler)
+void basic_socket<NextLayer>::process_connect(const boost::system::error_code& error,
+                                              const endpoint_type& remote_endpoint,
+                                              ConnectHandler&& handler)
 {
     // FIXME: Remove from multiplexer if already connected to different remote endpoint?
     if (!error)
     {
         assert(multiplexer);
         remote = remote_endpoint;
+        {
+            std::lock_guard<decltype(mutex)> lock(mutex);
+            expired = false;
+        }
         multiplexer->add(this);
     }
-    handler(error);
+    detail::dispatch_handler(boost::asio::get_associated_executor(handler, net::extension::get_executor(*this)),
+                             std::move(handler),
+                             boost::asio::get_associated_allocator(handler),
+                             error);
 }
 
+template <typename NextLayer>
 template <typename CompletionToken>
-auto socket::async_connect(const std::string& host,
-                           const std::string& service,
-                           CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code)>
+auto basic_socket<NextLayer>::async_connect(const std::string& host,
+                                            const std::string& service,
+                                            CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code)>
 {
     net::async_completion<CompletionToken, void(boost::system::error_code)> async(token);
     auto&& handler = async.completion_handler;
@@ -108,76 +126,104 @@ auto socket::async_connect(const std::string& host,
     }
     else
     {
-        std::shared_ptr<resolver_type> resolver
-            = std::make_shared<resolver_type>(net::extension::get_executor(*this));
-        net::extension::async_resolve(
-            resolver,
+        option::address_family family;
+        {
+            std::lock_guard<decltype(mutex)> lock(mutex);
+            family = connect_family;
+        }
+        this->get_service().resolver().async_resolve(
+            net::extension::get_executor(*this),
             host,
             service,
-            [this, handler, resolver]
-            (const boost::system::error_code& error, resolver_type::iterator where) mutable
+            [this, handler, family]
+            (const boost::system::error_code& error, const resolve_results& results) mutable
             {
                  // Process resolve
-                 if (error)
+                 if (error || results.empty())
                  {
-                     handler(error);
+                     auto executor = boost::asio::get_associated_executor(handler, net::extension::get_executor(*this));
+                     auto allocator = boost::asio::get_associated_allocator(handler);
+                     detail::dispatch_handler(executor,
+                                              std::move(handler),
+                                              allocator,
+                                              error
+                                              ? error
+                                              : boost::asio::error::make_error_code(boost::asio::error::host_not_found));
                  }
                  else
                  {
-                     this->async_next_connect(where, resolver, handler);
+                     auto endpoints = std::make_shared<resolve_results>(results);
+                     if (family.family() != option::address_family::any)
+                     {
+                         const bool v4 = (family.family() == option::address_family::ipv4);
+                         std::stable_partition(endpoints->begin(),
+                                               endpoints->end(),
+                                               [v4] (const endpoint_type& endpoint)
+                                               {
+                                                   return endpoint.address().is_v4() == v4;
+                                               });
+                     }
+                     this->async_next_connect(0, std::move(endpoints), handler);
                  }
              });
     }
     return async.result.get();
 }
 
+template <typename NextLayer>
 template <typename ConnectHandler>
-void socket::async_next_connect(resolver_type::iterator where,
-                                std::shared_ptr<resolver_type> resolver,
-                                ConnectHandler&& handler)
+void basic_socket<NextLayer>::async_next_connect(std::size_t where,
+                                                 std::shared_ptr<resolve_results> endpoints,
+                                                 ConnectHandler&& handler)
 {
+    const auto remote_endpoint = (*endpoints)[where];
     async_connect(
-        *where,
-        [this, where, resolver, handler]
+        remote_endpoint,
+        [this, where, endpoints, handler]
         (const boost::system::error_code& error) mutable
         {
             this->process_next_connect(error,
                                        where,
-                                       resolver,
+                                       endpoints,
                                        handler);
         });
 }
 
+template <typename NextLayer>
 template <typename ConnectHandler>
-void socket::process_next_connect(const boost::system::error_code& error,
-                                  resolver_type::iterator where,
-                                  std::shared_ptr<resolver_type> resolver,
-                                  ConnectHandler&& handler)
+void basic_socket<NextLayer>::process_next_connect(const boost::system::error_code& error,
+                                                   std::size_t where,
+                                                   std::shared_ptr<resolve_results> endpoints,
+                                                   ConnectHandler&& handler)
 {
     if (error)
     {
         ++where;
-        if (where == resolver_type::iterator())
+        if (where == endpoints->size())
         {
             // No addresses left to connect to
-            handler(error);
+            detail::dispatch_handler(boost::asio::get_associated_executor(handler, net::extension::get_executor(*this)),
+                                     std::move(handler),
+                                     boost::asio::get_associated_allocator(handler),
+                                     error);
         }
         else
         {
             // Try the next address
-            async_next_connect(where, resolver, handler);
+            async_next_connect(where, endpoints, handler);
         }
     }
     else
     {
-        process_connect(error, *where, std::forward<decltype(handler)>(handler));
+        process_connect(error, (*endpoints)[where], std::forward<decltype(handler)>(handler));
     }
 }
 
+template <typename NextLayer>
 template <typename MutableBufferSequence,
           typename CompletionToken>
-auto socket::async_receive(const MutableBufferSequence& buffers,
-                           CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>
+auto basic_socket<NextLayer>::async_receive(const MutableBufferSequence& buffers,
+                                            CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>
 {
     net::async_completion<CompletionToken, void(boost::system::error_code, std::size_t)> async(token);
     auto&& handler = async.completion_handler;
@@ -190,55 +236,269 @@ auto socket::async_receive(const MutableBufferSequence& buffers,
     }
     else
     {
-        if (receive_output_queue.empty())
+        receive_output_type output;
+        if (dequeue_immediate(handler, output))
         {
-            std::unique_ptr<receive_input_type> operation(
-                new receive_input_type(buffers,
-                                       std::forward<decltype(handler)>(handler)));
-            receive_input_queue.emplace(std::move(operation));
-
-            multiplexer->start_receive();
-        }
-        else
-        {
-            net::post(
-                net::extension::get_executor(*this),
-                [this, buffers, handler] () mutable
-                {
-                    auto output = std::move(this->receive_output_queue.front());
-                    receive_output_queue.pop();
-
-                    process_receive(std::get<0>(*output),
-                                    *std::get<1>(*output),
-                                    buffers,
-                                    handler);
-                });
+            detail::inline_scope scope;
+            process_receive(std::get<0>(output), std::get<1>(output), buffers, handler);
+            return async.result.get();
         }
+        using handler_type = typename std::decay<decltype(handler)>::type;
+        auto allocator = detail::get_handler_allocator(handler);
+        auto executor = boost::asio::get_associated_executor(handler, net::extension::get_executor(*this));
+        start_receive(detail::make_operation<receive_operation>(
+            copy_receive_handler<MutableBufferSequence, handler_type>(buffers,
+                                                                      std::move(handler)),
+            allocator,
+            executor));
     }
     return async.result.get();
 }
 
+template <typename NextLayer>
 template <typename MutableBufferSequence,
           typename ReadHandler>
-void socket::process_receive(const boost::system::error_code& error,
-                             const detail::buffer& datagram,
-                             const MutableBufferSequence& buffers,
-                             ReadHandler&& handler)
+class basic_socket<NextLayer>::copy_receive_handler
+{
+public:
+    copy_receive_handler(const MutableBufferSequence& buffers,
+                         ReadHandler&& handler)
+        : buffers(buffers),
+          handler(std::move(handler))
+    {
+    }
+
+    void operator()(const boost::system::error_code& error,
+                    detail::buffer datagram)
+    {
+        basic_socket::process_receive(error, datagram, buffers, handler);
+    }
+
+private:
+    MutableBufferSequence buffers;
+    ReadHandler handler;
+};
+
+template <typename NextLayer>
+template <typename MutableBufferSequence>
+std::size_t basic_socket<NextLayer>::copy_receive(const boost::system::error_code& error,
+                                                  const detail::buffer& datagram,
+                                                  const MutableBufferSequence& buffers)
 {
     auto length = std::min(boost::asio::buffer_size(buffers), datagram.size());
-    if (!error)
+    if (!error || (error == boost::asio::error::message_size))
     {
         boost::asio::buffer_copy(buffers,
-                                 boost::asio::buffer(datagram),
+                                 boost::asio::buffer(datagram.data(), datagram.size()),
                                  length);
     }
-    handler(error, length);
+    return length;
+}
+
+template <typename NextLayer>
+template <typename MutableBufferSequence,
+          typename ReadHandler>
+void basic_socket<NextLayer>::process_receive(const boost::system::error_code& error,
+                                              const detail::buffer& datagram,
+                                              const MutableBufferSequence& buffers,
+                                              ReadHandler& handler)
+{
+    handler(error, copy_receive(error, datagram, buffers));
+}
+
+template <typename NextLayer>
+template <typename MutableBufferSequence>
+std::size_t basic_socket<NextLayer>::try_receive(const MutableBufferSequence& buffers,
+                                                 boost::system::error_code& error)
+{
+    receive_output_type output;
+    if (!try_dequeue(output, error))
+        return 0;
+    error = std::get<0>(output);
+    return copy_receive(error, std::get<1>(output), buffers);
+}
+
+template <typename NextLayer>
+datagram::buffer basic_socket<NextLayer>::try_receive(boost::system::error_code& error)
+{
+    receive_output_type output;
+    if (!try_dequeue(output, error))
+        return datagram::buffer();
+    // Truncation is reported by the buffer rather than as an error
+    const auto& status = std::get<0>(output);
+    error = (status == boost::asio::error::message_size) ? boost::system::error_code() : status;
+    return make_buffer(status, std::move(std::get<1>(output)));
+}
+
+template <typename NextLayer>
+template <typename CompletionToken>
+auto basic_socket<NextLayer>::async_receive(CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code, datagram::buffer)>
+{
+    net::async_completion<CompletionToken, void(boost::system::error_code, datagram::buffer)> async(token);
+    auto&& handler = async.completion_handler;
+
+    if (!multiplexer)
+    {
+        net::post(
+            boost::asio::get_associated_executor(handler, net::extension::get_executor(*this)),
+            [this, handler] () mutable
+            {
+                process_receive(boost::asio::error::not_connected, {}, handler);
+            });
+    }
+    else
+    {
+        receive_output_type output;
+        if (dequeue_immediate(handler, output))
+        {
+            detail::inline_scope scope;
+            process_receive(std::get<0>(output), std::move(std::get<1>(output)), handler);
+            return async.result.get();
+        }
+        using handler_type = typename std::decay<decltype(handler)>::type;
+        auto allocator = detail::get_handler_allocator(handler);
+        auto executor = boost::asio::get_associated_executor(handler, net::extension::get_executor(*this));
+        start_receive(detail::make_operation<receive_operation>(
+            owned_receive_handler<handler_type>(std::move(handler)),
+            allocator,
+            executor));
+    }
+    return async.result.get();
+}
+
+template <typename NextLayer>
+template <typename ReceiveHandler>
+class basic_socket<NextLayer>::owned_receive_handler
+{
+public:
+    explicit owned_receive_handler(ReceiveHandler&& handler)
+        : handler(std::move(handler))
+    {
+    }
+
+    void operator()(const boost::system::error_code& error,
+                    detail::buffer datagram)
+    {
+        basic_socket::process_receive(error, std::move(datagram), handler);
+    }
+
+private:
+    ReceiveHandler handler;
+};
+
+template <typename NextLayer>
+template <typename ReceiveHandler>
+void basic_socket<NextLayer>::process_receive(const boost::system::error_code& error,
+                                              detail::buffer datagram,
+                                              ReceiveHandler& handler)
+{
+    // Truncation is reported by the buffer rather than as an error
+    const bool truncated = (error == boost::asio::error::message_size);
+    handler(truncated ? boost::system::error_code() : error,
+            make_buffer(error, std::move(datagram)));
+}
+
+template <typename NextLayer>
+datagram::buffer basic_socket<NextLayer>::make_buffer(const boost::system::error_code& error,
+                                                      detail::buffer datagram)
+{
+    return datagram::buffer(std::move(datagram),
+                            error == boost::asio::error::message_size);
+}
+
+template <typename NextLayer>
+template <typename CompletionToken>
+auto basic_socket<NextLayer>::async_receive_batch(std::size_t max_count,
+                                                  CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code, std::vector<datagram::buffer>)>
+{
+    net::async_completion<CompletionToken, void(boost::system::error_code, std::vector<datagram::buffer>)> async(token);
+    auto&& handler = async.completion_handler;
+
+    if (!multiplexer || (max_count == 0))
+    {
+        const auto error = multiplexer
+            ? boost::asio::error::invalid_argument
+            : boost::asio::error::not_connected;
+        net::post(
+            boost::asio::get_associated_executor(handler, net::extension::get_executor(*this)),
+            [handler, error] () mutable
+            {
+                handler(boost::asio::error::make_error_code(error), std::vector<datagram::buffer>());
+            });
+    }
+    else
+    {
+        receive_output_type output;
+        if (dequeue_immediate(handler, output))
+        {
+            detail::inline_scope scope;
+            process_receive_batch(std::get<0>(output), std::move(std::get<1>(output)), max_count, handler);
+            return async.result.get();
+        }
+        using handler_type = typename std::decay<decltype(handler)>::type;
+        auto allocator = detail::get_handler_allocator(handler);
+        auto executor = boost::asio::get_associated_executor(handler, net::extension::get_executor(*this));
+        start_receive(detail::make_operation<receive_operation>(
+            batch_receive_handler<handler_type>(this, max_count, std::move(handler)),
+            allocator,
+            executor));
+    }
+    return async.result.get();
+}
+
+// Completes with the datagram that fulfilled the receive request, followed
+// by any datagrams that have been queued since then.
+
+template <typename NextLayer>
+template <typename ReceiveHandler>
+class basic_socket<NextLayer>::batch_receive_handler
+{
+public:
+    batch_receive_handler(basic_socket *self,
+                          std::size_t max_count,
+                          ReceiveHandler&& handler)
+        : self(self),
+          max_count(max_count),
+          handler(std::move(handler))
+    {
+    }
+
+    void operator()(const boost::system::error_code& error,
+                    detail::buffer datagram)
+    {
+        self->process_receive_batch(error, std::move(datagram), max_count, handler);
+    }
+
+private:
+    basic_socket *self;
+    std::size_t max_count;
+    ReceiveHandler handler;
+};
+
+template <typename NextLayer>
+template <typename ReceiveHandler>
+void basic_socket<NextLayer>::process_receive_batch(const boost::system::error_code& error,
+                                                    detail::buffer datagram,
+                                                    std::size_t max_count,
+                                                    ReceiveHandler& handler)
+{
+    std::vector<datagram::buffer> datagrams;
+    const bool truncated = (error == boost::asio::error::message_size);
+    if (!error || truncated)
+    {
+        datagrams.reserve(max_count);
+        datagrams.push_back(make_buffer(error, std::move(datagram)));
+        dequeue_batch(datagrams, max_count);
+    }
+    handler(truncated ? boost::system::error_code() : error,
+            std::move(datagrams));
 }
 
+template <typename NextLayer>
 template <typename ConstBufferSequence,
           typename CompletionToken>
-auto socket::async_send(const ConstBufferSequence& buffers,
-                        CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>
+auto basic_socket<NextLayer>::async_send(const ConstBufferSequence& buffers,
+                                         CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>
 {
     net::async_completion<CompletionToken, void(boost::system::error_code, std::size_t)> async(token);
     auto&& handler = async.completion_handler;
@@ -251,99 +511,395 @@ auto socket::async_send(const ConstBufferSequence& buffers,
     }
     else
     {
-        multiplexer->async_send_to(
+        stats.datagrams_sent.add();
+        stats.bytes_sent.add(boost::asio::buffer_size(buffers));
+        multiplexer->touch(*this);
+        using handler_type = typename std::decay<decltype(handler)>::type;
+        multiplexer->async_send(
+            *this,
             buffers,
-            remote,
-            [handler] (const boost::system::error_code& error,
-                       std::size_t length) mutable
-            {
-                // Process send
-                handler(error, length);
-            });
+            send_handler<handler_type>(net::extension::get_executor(*this),
+                                       std::move(handler)));
+    }
+    return async.result.get();
+}
+
+// Send completions are invoked through the executor of the user handler,
+// whichever thread completes the send.
+
+template <typename NextLayer>
+template <typename WriteHandler>
+class basic_socket<NextLayer>::send_handler
+{
+public:
+    using executor_type = boost::asio::associated_executor_t<WriteHandler, net::executor>;
+    using allocator_type = detail::handler_allocator_t<WriteHandler>;
+
+    send_handler(const net::executor& fallback,
+                 WriteHandler&& handler)
+        : executor(boost::asio::get_associated_executor(handler, fallback)),
+          handler(std::move(handler))
+    {
+    }
+
+    executor_type get_executor() const noexcept { return executor; }
+    // Handlers without an allocator use the recycling cache
+    allocator_type get_allocator() const noexcept { return detail::get_handler_allocator(handler); }
+
+    void operator()(const boost::system::error_code& error,
+                    std::size_t length)
+    {
+        detail::dispatch_handler(executor,
+                                 std::move(handler),
+                                 get_allocator(),
+                                 error,
+                                 length);
+    }
+
+private:
+    executor_type executor;
+    WriteHandler handler;
+};
+
+template <typename NextLayer>
+template <typename ConstBufferSequence>
+std::size_t basic_socket<NextLayer>::try_send(const ConstBufferSequence& buffers,
+                                              boost::system::error_code& error)
+{
+    if (!multiplexer)
+    {
+        error = boost::asio::error::not_connected;
+        return 0;
+    }
+    const auto length = multiplexer->try_send(*this, buffers, error);
+    if (!error)
+    {
+        stats.datagrams_sent.add();
+        stats.bytes_sent.add(length);
+        multiplexer->touch(*this);
+    }
+    return length;
+}
+
+template <typename NextLayer>
+template <typename ConstBufferSequence,
+          typename CompletionToken>
+auto basic_socket<NextLayer>::async_send_segments(const ConstBufferSequence& buffers,
+                                                  std::size_t segment_size,
+                                                  CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>
+{
+    net::async_completion<CompletionToken, void(boost::system::error_code, std::size_t)> async(token);
+    auto&& handler = async.completion_handler;
+
+    if (!multiplexer)
+    {
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::not_connected,
+                       0);
+    }
+    else
+    {
+        const auto size = boost::asio::buffer_size(buffers);
+        stats.datagrams_sent.add(segment_size ? (size + segment_size - 1) / segment_size : 0);
+        stats.bytes_sent.add(size);
+        multiplexer->touch(*this);
+        using handler_type = typename std::decay<decltype(handler)>::type;
+        multiplexer->async_send_segments_to(buffers,
+                                            remote,
+                                            segment_size,
+                                            send_handler<handler_type>(net::extension::get_executor(*this),
+                                                                       std::move(handler)));
     }
     return async.result.get();
 }
 
+template <typename NextLayer>
 template <typename Handler,
           typename ErrorCode>
-void socket::invoke_handler(Handler&& handler,
-                            ErrorCode error)
+void basic_socket<NextLayer>::invoke_handler(Handler&& handler,
+                                             ErrorCode error)
 {
     assert(error);
 
     net::post(
-        net::extension::get_executor(*this),
+        boost::asio::get_associated_executor(handler, net::extension::get_executor(*this)),
         [handler, error]() mutable
         {
             handler(boost::asio::error::make_error_code(error));
         });
 }
 
+template <typename NextLayer>
 template <typename Handler,
           typename ErrorCode>
-void socket::invoke_handler(Handler&& handler,
-                            ErrorCode error,
-                            std::size_t size)
+void basic_socket<NextLayer>::invoke_handler(Handler&& handler,
+                                             ErrorCode error,
+                                             std::size_t size)
 {
     assert(error);
 
     net::post(
-        net::extension::get_executor(*this),
+        boost::asio::get_associated_executor(handler, net::extension::get_executor(*this)),
         [handler, error, size]() mutable
         {
             handler(boost::asio::error::make_error_code(error), size);
         });
 }
 
-inline void socket::set_multiplexer(std::shared_ptr<detail::multiplexer> value)
+template <typename NextLayer>
+void basic_socket<NextLayer>::set_multiplexer(std::shared_ptr<multiplexer_type> value)
 {
+    std::lock_guard<decltype(mutex)> lock(mutex);
     multiplexer = value;
+    // Account for datagrams queued before the socket was accepted
+    if (multiplexer)
+    {
+        multiplexer->add_queued(receive_queued_bytes);
+    }
 }
 
-inline void socket::enqueue(const boost::system::error_code& error,
-                            std::unique_ptr<detail::buffer> datagram)
+template <typename NextLayer>
+void basic_socket<NextLayer>::start_receive(detail::operation_pointer<receive_operation> operation)
 {
-    if (receive_input_queue.empty())
+    std::unique_lock<decltype(mutex)> lock(mutex);
+    if (receive_output_queue.empty())
     {
-        std::unique_ptr<receive_output_type> operation(
-            new receive_output_type(error,
-                                    std::move(datagram)));
-        receive_output_queue.emplace(std::move(operation));
+        if (expired)
+        {
+            lock.unlock();
+            net::post(
+                net::extension::get_executor(*this),
+                std::bind(
+                    [] (detail::operation_pointer<receive_operation>& operation)
+                    {
+                        operation.release()->complete(boost::asio::error::make_error_code(boost::asio::error::timed_out),
+                                                      {});
+                    },
+                    std::move(operation)));
+            return;
+        }
+        receive_input_queue.push(std::move(operation));
+        lock.unlock();
+
+        multiplexer->start_receive(*this);
     }
     else
     {
-        auto input = std::move(receive_input_queue.front());
-        receive_input_queue.pop();
+        ++receive_posted;
+        lock.unlock();
+        net::post(
+            net::extension::get_executor(*this),
+            detail::make_recycled(std::bind(
+                [this] (detail::operation_pointer<receive_operation>& operation)
+                {
+                    std::unique_lock<decltype(mutex)> lock(mutex);
+                    --receive_posted;
+                    if (receive_output_queue.empty())
+                    {
+                        // Queued datagram was taken by an earlier receive request
+                        lock.unlock();
+                        start_receive(std::move(operation));
+                        return;
+                    }
+                    auto output = dequeue();
+                    multiplexer->dispatched(std::get<1>(output));
+                    lock.unlock();
+                    operation.release()->complete(std::get<0>(output),
+                                                  std::move(std::get<1>(output)));
+                },
+                std::move(operation))));
+    }
+}
+
+template <typename NextLayer>
+bool basic_socket<NextLayer>::try_dequeue(receive_output_type& output,
+                                          boost::system::error_code& error)
+{
+    if (!multiplexer)
+    {
+        error = boost::asio::error::not_connected;
+        return false;
+    }
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    if (receive_output_queue.empty())
+    {
+        error = expired
+            ? boost::asio::error::make_error_code(boost::asio::error::timed_out)
+            : boost::asio::error::make_error_code(boost::asio::error::would_block);
+        return false;
+    }
+    output = dequeue();
+    multiplexer->dispatched(std::get<1>(output));
+    error = boost::system::error_code();
+    return true;
+}
+
+template <typename NextLayer>
+template <typename Handler>
+bool basic_socket<NextLayer>::dequeue_immediate(const Handler& handler,
+                                                receive_output_type& output)
+{
+    if (!detail::inline_scope::available() ||
+        !detail::can_invoke_inline(handler, net::extension::get_executor(*this)))
+        return false;
+
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    // Posted receive requests must take their datagrams first
+    if (!receive_immediate || receive_output_queue.empty() || (receive_posted > 0))
+        return false;
+    output = dequeue();
+    multiplexer->dispatched(std::get<1>(output));
+    return true;
+}
+
+template <typename NextLayer>
+bool basic_socket<NextLayer>::enqueue(const boost::system::error_code& error,
+                                      detail::buffer datagram,
+                                      detail::completion_list& completions)
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    stats.datagrams_received.add();
+    stats.bytes_received.add(datagram.size());
+    if (receive_input_queue.empty())
+    {
+        const auto size = datagram.size();
+        if ((receive_output_queue.size() >= receive_limit.datagrams()) ||
+            (receive_queued_bytes + size > receive_limit.bytes()))
+        {
+            if (receive_limit.policy() == option::receive_queue::drop_newest)
+            {
+                count_dropped();
+                return false;
+            }
+            while (!receive_output_queue.empty() &&
+                   ((receive_output_queue.size() >= receive_limit.datagrams()) ||
+                    (receive_queued_bytes + size > receive_limit.bytes())))
+            {
+                dequeue();
+                count_dropped();
+            }
+            if ((receive_limit.datagrams() == 0) || (size > receive_limit.bytes()))
+            {
+                // Datagram cannot fit even in an empty queue
+                count_dropped();
+                return false;
+            }
+        }
+
+        receive_output_queue.emplace(error, std::move(datagram));
+        receive_queued_bytes += size;
+        if (multiplexer)
+        {
+            multiplexer->add_queued(size);
+        }
+        return false;
+    }
+    if (multiplexer)
+    {
+        multiplexer->dispatched(datagram);
+    }
+    completions.push(receive_input_queue.pop(), error, std::move(datagram));
+    return true;
+}
+
+template <typename NextLayer>
+void basic_socket<NextLayer>::expire(detail::completion_list& completions)
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    expired = true;
+    while (!receive_input_queue.empty())
+    {
+        completions.push(receive_input_queue.pop(),
+                         boost::asio::error::make_error_code(boost::asio::error::timed_out),
+                         {});
+    }
+}
+
+template <typename NextLayer>
+std::size_t basic_socket<NextLayer>::pending_receives() const
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    return receive_input_queue.size();
+}
+
+template <typename NextLayer>
+net::executor basic_socket<NextLayer>::handler_executor() const
+{
+    return net::extension::get_executor(const_cast<basic_socket&>(*this));
+}
+
+template <typename NextLayer>
+typename basic_socket<NextLayer>::receive_output_type basic_socket<NextLayer>::dequeue()
+{
+    assert(!receive_output_queue.empty());
+
+    auto output = std::move(receive_output_queue.front());
+    receive_output_queue.pop();
+
+    const auto size = std::get<1>(output).size();
+    receive_queued_bytes -= size;
+    if (multiplexer)
+    {
+        multiplexer->remove_queued(size);
+    }
+    return output;
+}
+
+template <typename NextLayer>
+void basic_socket<NextLayer>::dequeue_batch(std::vector<datagram::buffer>& datagrams,
+                                            std::size_t max_count)
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    // Posted receive requests must take their datagrams first
+    if (receive_posted > 0)
+        return;
+    while ((datagrams.size() < max_count) && !receive_output_queue.empty())
+    {
+        auto output = dequeue();
+        multiplexer->dispatched(std::get<1>(output));
+        datagrams.push_back(make_buffer(std::get<0>(output), std::move(std::get<1>(output))));
+    }
+}
 
-        process_receive(error,
-                        *datagram,
-                        std::get<0>(*input),
-                        std::get<1>(*input));
+template <typename NextLayer>
+void basic_socket<NextLayer>::count_dropped()
+{
+    ++receive_dropped;
+    if (multiplexer)
+    {
+        multiplexer->counters().queue_dropped.add();
     }
 }
 
-inline socket::endpoint_type socket::local_endpoint() const
+template <typename NextLayer>
+typename basic_socket<NextLayer>::endpoint_type basic_socket<NextLayer>::local_endpoint() const
 {
     assert(multiplexer);
 
     return multiplexer->next_layer().local_endpoint();
 }
 
-inline void socket::cancel()
+template <typename NextLayer>
+void basic_socket<NextLayer>::cancel()
 {
+    std::lock_guard<decltype(mutex)> lock(mutex);
     while (!receive_input_queue.empty())
     {
-        auto input = std::move(receive_input_queue.front());
-        receive_input_queue.pop();
-
-        invoke_handler(std::forward<decltype(std::get<1>(*input))>(std::get<1>(*input)),
-                       boost::asio::error::operation_aborted,
-                       0);
+        net::post(
+            net::extension::get_executor(*this),
+            std::bind(
+                [] (detail::operation_pointer<receive_operation>& input)
+                {
+                    input.release()->complete(boost::asio::error::make_error_code(boost::asio::error::operation_aborted),
+                                              {});
+                },
+                receive_input_queue.pop()));
     }
 }
 
+template <typename NextLayer>
 template <typename SettableSocketOption>
-void socket::set_option(const SettableSocketOption& option)
+void basic_socket<NextLayer>::set_option(const SettableSocketOption& option)
 {
     boost::system::error_code error;
     set_option(option, error);
@@ -351,13 +907,179 @@ void socket::set_option(const SettableSocketOption& option)
         throw boost::system::system_error(error);
 }
 
+template <typename NextLayer>
+void basic_socket<NextLayer>::set_option(const option::receive_queue& option,
+                                         boost::system::error_code& error)
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    receive_limit = option::receive_queue(option.datagrams(),
+                                          option.bytes(),
+                                          option.policy());
+    // An explicit limit is kept when unsubscribing
+    unsubscribed_datagrams = 0;
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_socket<NextLayer>::get_option(option::receive_queue& option,
+                                         boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    option = receive_limit;
+    option.dropped(receive_dropped);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_socket<NextLayer>::set_option(const option::receive_immediate& option,
+                                         boost::system::error_code& error)
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    receive_immediate = option.enabled();
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_socket<NextLayer>::get_option(option::receive_immediate& option,
+                                         boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    option = option::receive_immediate(receive_immediate);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_socket<NextLayer>::get_option(option::socket_statistics& option,
+                                         boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    option.datagrams_received_ = stats.datagrams_received.load();
+    option.bytes_received_ = stats.bytes_received.load();
+    option.datagrams_sent_ = stats.datagrams_sent.load();
+    option.bytes_sent_ = stats.bytes_sent.load();
+    option.dropped_ = receive_dropped;
+    option.queue_depth_ = receive_output_queue.size();
+    option.queued_bytes_ = receive_queued_bytes;
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_socket<NextLayer>::set_option(const option::address_family& option,
+                                         boost::system::error_code& error)
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    connect_family = option;
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_socket<NextLayer>::get_option(option::address_family& option,
+                                         boost::system::error_code& error) const
+{
+    std::lock_guard<decltype(mutex)> lock(mutex);
+    option = connect_family;
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_socket<NextLayer>::set_option(const option::resolve_cache& option,
+                                         boost::system::error_code& error)
+{
+    this->get_service().resolver().set_option(option);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_socket<NextLayer>::get_option(option::resolve_cache& option,
+                                         boost::system::error_code& error) const
+{
+    this->get_service().resolver().get_option(option);
+    error = boost::system::error_code();
+}
+
+template <typename NextLayer>
+void basic_socket<NextLayer>::set_option(const option::multicast_subscription& option,
+                                         boost::system::error_code& error)
+{
+    assert(multiplexer);
+
+    if (option.enabled())
+    {
+        std::lock_guard<decltype(mutex)> lock(mutex);
+        if (receive_limit.datagrams() > option.queue_limit())
+        {
+            // Bound the storage that a slow subscriber can hold on to
+            if (unsubscribed_datagrams == 0)
+            {
+                unsubscribed_datagrams = receive_limit.datagrams();
+            }
+            receive_limit = option::receive_queue(option.queue_limit(),
+                                                  receive_limit.bytes(),
+                                                  receive_limit.policy());
+        }
+    }
+    multiplexer->subscribe(*this, option, error);
+
+    option::multicast_subscription current;
+    boost::system::error_code ignored;
+    multiplexer->get_subscription(*this, current, ignored);
+    if (!current.enabled())
+    {
+        // Lift the bound when unsubscribed or when subscribing failed
+        std::lock_guard<decltype(mutex)> lock(mutex);
+        if (unsubscribed_datagrams != 0)
+        {
+            receive_limit = option::receive_queue(unsubscribed_datagrams,
+                                                  receive_limit.bytes(),
+                                                  receive_limit.policy());
+            unsubscribed_datagrams = 0;
+        }
+    }
+}
+
+template <typename NextLayer>
+void basic_socket<NextLayer>::get_option(option::multicast_subscription& option,
+                                         boost::system::error_code& error) const
+{
+    assert(multiplexer);
+
+    {
+        std::lock_guard<decltype(mutex)> lock(mutex);
+        option = option::multicast_subscription(false,
+                                                option::multicast_subscription::address_type(),
+                                                receive_limit.datagrams());
+    }
+    multiplexer->get_subscription(*this, option, error);
+}
+
+template <typename NextLayer>
 template <typename SettableSocketOption>
-void socket::set_option(const SettableSocketOption& option,
-                        boost::system::error_code& error)
+void basic_socket<NextLayer>::set_option(const SettableSocketOption& option,
+                                         boost::system::error_code& error)
+{
+    assert(multiplexer);
+
+    multiplexer->set_option(option, error);
+}
+
+template <typename NextLayer>
+template <typename GettableSocketOption>
+void basic_socket<NextLayer>::get_option(GettableSocketOption& option) const
+{
+    boost::system::error_code error;
+    get_option(option, error);
+    if (error)
+        throw boost::system::system_error(error);
+}
+
+template <typename NextLayer>
+template <typename GettableSocketOption>
+void basic_socket<NextLayer>::get_option(GettableSocketOption& option,
+                                         boost::system::error_code& error) const
 {
     assert(multiplexer);
 
-    multiplexer->next_layer().set_option(option, error);
+    multiplexer->get_option(option, error);
 }
 
 } // namespace datagram
@@ -11,11 +11,17 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <memory>
 #include <boost/asio/socket_base.hpp>
 #include <boost/asio/ip/udp.hpp>
+#include <trial/net/executor.hpp>
 #include <trial/datagram/detail/buffer.hpp>
+#include <trial/datagram/detail/completion_list.hpp>
+#include <trial/datagram/detail/peer_channel.hpp>
+#include <trial/datagram/detail/timer_wheel.hpp>
 
 namespace trial
 {
@@ -23,7 +29,9 @@ namespace datagram
 {
 namespace detail
 {
-class multiplexer;
+template <typename> class basic_multiplexer;
+class worker_mailbox;
+struct socket_inbox;
 
 class socket_base
     : public boost::asio::socket_base
@@ -32,18 +40,56 @@ public:
     // Must be the underlying UDP types
     using endpoint_type = boost::asio::ip::udp::endpoint;
 
+    socket_base()
+        : idle_entry(this),
+          idle_activity(0)
+    {
+    }
+
     virtual ~socket_base() = default;
 
     endpoint_type remote_endpoint() const { return remote; }
 
 protected:
-    friend class multiplexer;
+    template <typename> friend class basic_multiplexer;
+    friend class worker_mailbox;
     void remote_endpoint(const endpoint_type& r) { remote = r; }
-    virtual void enqueue(const boost::system::error_code&,
-                         std::unique_ptr<detail::buffer>) = 0;
+    // Called with the multiplexer locked, or by the worker executor of the
+    // socket. Handlers must be added to the completion list rather than
+    // invoked. Returns true if a receive request was completed.
+    virtual bool enqueue(const boost::system::error_code&,
+                         detail::buffer,
+                         completion_list&) = 0;
+    // Called with the multiplexer locked when the remote endpoint has been
+    // silent for too long. The socket has already been removed.
+    virtual void expire(completion_list&) = 0;
+    // Called with the multiplexer locked
+    virtual std::size_t pending_receives() const = 0;
+    // The executor that runs the handlers of the socket
+    virtual net::executor handler_executor() const = 0;
 
 protected:
     endpoint_type remote;
+
+    // Idle tracking, which is owned by the multiplexer
+    timer_wheel<socket_base>::entry idle_entry;
+    std::atomic<timer_wheel<socket_base>::tick_type> idle_activity;
+
+    // Promotion to a connected UDP socket, which is owned by the multiplexer
+    std::shared_ptr<peer_channel> channel;
+    std::size_t shared_received = 0;
+    bool promotion_tried = false;
+
+    // Delivery via the worker executor, which is owned by the multiplexer
+    std::shared_ptr<socket_inbox> inbox;
+
+    // Send pacing, which is owned by the multiplexer
+    std::chrono::steady_clock::time_point send_drained;
+    std::size_t deferred_sends = 0;
+
+    // Multicast subscription, which is owned by the multiplexer
+    boost::asio::ip::address subscribed_interface;
+    bool subscribed = false;
 };
 
 } // namespace detail
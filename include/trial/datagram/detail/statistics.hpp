@@ -0,0 +1,173 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_STATISTICS_HPP
+#define TRIAL_DATAGRAM_DETAIL_STATISTICS_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <trial/datagram/option.hpp>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// Counters and gauges that can be read from any thread while they are
+// being updated. Relaxed ordering is sufficient because each value is read
+// independently.
+//
+// A counter must only be updated with a lock held, which avoids the cost of
+// an atomic read-modify-write. A shared_counter can be updated by several
+// threads at once.
+//
+// Defining TRIAL_DATAGRAM_NO_STATISTICS removes them, in which case they
+// always read as zero.
+
+#if defined(TRIAL_DATAGRAM_NO_STATISTICS)
+
+class counter
+{
+public:
+    void add(std::uint64_t = 1) noexcept {}
+    std::uint64_t load() const noexcept { return 0; }
+};
+
+using shared_counter = counter;
+
+class gauge
+{
+public:
+    void set(std::uint64_t) noexcept {}
+    std::uint64_t load() const noexcept { return 0; }
+};
+
+#else
+
+class counter
+{
+public:
+    void add(std::uint64_t amount = 1) noexcept
+    {
+        value.store(value.load(std::memory_order_relaxed) + amount,
+                    std::memory_order_relaxed);
+    }
+
+    std::uint64_t load() const noexcept
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::uint64_t> value{0};
+};
+
+class shared_counter
+{
+public:
+    void add(std::uint64_t amount = 1) noexcept
+    {
+        value.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    std::uint64_t load() const noexcept
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::uint64_t> value{0};
+};
+
+class gauge
+{
+public:
+    void set(std::uint64_t amount) noexcept
+    {
+        value.store(amount, std::memory_order_relaxed);
+    }
+
+    std::uint64_t load() const noexcept
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::uint64_t> value{0};
+};
+
+#endif
+
+// Latency distribution that can be updated by several threads at once. The
+// buckets are described by option::latency_histogram.
+
+class latency_histogram
+{
+public:
+    void record(std::chrono::nanoseconds latency) noexcept
+    {
+        buckets[option::latency_histogram::bucket(latency)].add();
+    }
+
+    std::uint64_t load(std::size_t bucket) const noexcept
+    {
+        return buckets[bucket].load();
+    }
+
+private:
+    shared_counter buckets[option::latency_histogram::bucket_count];
+};
+
+// Updated with the multiplexer locked, except where noted
+
+struct multiplexer_statistics
+{
+    counter datagrams_received;
+    counter bytes_received;
+    // Updated by send completions
+    shared_counter datagrams_sent;
+    shared_counter bytes_sent;
+    shared_counter send_errors;
+    counter truncated;
+    counter unknown;
+    counter listen_dropped;
+    // Updated with a socket locked
+    shared_counter queue_dropped;
+    counter expired;
+    counter receive_errors;
+    counter receive_pauses;
+    gauge sockets;
+    gauge listen_depth;
+    // Updated when receive timestamps are enabled
+    latency_histogram kernel_to_demux;
+    // Updated with a socket locked
+    latency_histogram demux_to_handler;
+};
+
+// Updated with the socket locked, except where noted
+
+struct socket_statistics
+{
+    counter datagrams_received;
+    counter bytes_received;
+    // Updated by the initiating functions
+    shared_counter datagrams_sent;
+    shared_counter bytes_sent;
+};
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_STATISTICS_HPP
@@ -0,0 +1,235 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_TIMER_WHEEL_HPP
+#define TRIAL_DATAGRAM_DETAIL_TIMER_WHEEL_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// Hierarchical timing wheel with intrusive entries.
+//
+// Time is measured in ticks. Each level has a fixed number of slots, and a
+// slot on one level spans all the slots of the level below. Entries are
+// placed on the lowest level that can hold their expiry, and are moved to
+// lower levels as the wheel turns. Insertion and removal are O(1).
+//
+// Expiries beyond the range of the wheel are clamped to the range, so the
+// owner must check whether an expired entry is really due.
+
+template <typename Owner>
+class timer_wheel
+{
+public:
+    using tick_type = std::uint64_t;
+
+    class entry
+    {
+    public:
+        explicit entry(Owner *owner) : owner(owner) {}
+        entry(const entry&) = delete;
+        entry& operator=(const entry&) = delete;
+
+        bool linked() const noexcept { return prev != nullptr; }
+
+        Owner *const owner;
+
+    private:
+        friend class timer_wheel;
+
+        entry *prev = nullptr;
+        entry *next = nullptr;
+        tick_type expiry = 0;
+    };
+
+    timer_wheel() = default;
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+
+    ~timer_wheel()
+    {
+        clear();
+    }
+
+    bool empty() const noexcept { return count == 0; }
+    std::size_t size() const noexcept { return count; }
+
+    // The next tick to be processed
+    tick_type now() const noexcept { return current; }
+
+    void insert(entry& e, tick_type expiry) noexcept
+    {
+        assert(!e.linked());
+
+        e.expiry = (expiry < current) ? current : expiry;
+        link(e);
+        ++count;
+    }
+
+    void erase(entry& e) noexcept
+    {
+        assert(e.linked());
+
+        unlink(e);
+        --count;
+    }
+
+    void clear() noexcept
+    {
+        for (auto& level : levels)
+        {
+            for (auto& slot : level)
+            {
+                while (slot.next != &slot)
+                {
+                    unlink(*slot.next);
+                }
+            }
+        }
+        count = 0;
+    }
+
+    // Process all ticks up to and including the given tick. Expired entries
+    // are unlinked before their owner is passed to the function, which may
+    // insert them again with a later expiry.
+    template <typename Function>
+    void advance(tick_type until,
+                 Function&& function)
+    {
+        if (count == 0)
+        {
+            // Nothing to cascade or expire
+            if (until >= current)
+            {
+                current = until + 1;
+            }
+            return;
+        }
+
+        while (current <= until)
+        {
+            const auto index = current & mask;
+            if (index == 0)
+            {
+                cascade(1);
+            }
+
+            sentinel expired;
+            take(levels[0][index], expired);
+            while (expired.next != &expired)
+            {
+                auto& e = *expired.next;
+                unlink(e);
+                --count;
+                function(*e.owner);
+            }
+            ++current;
+        }
+    }
+
+private:
+    static constexpr unsigned int bits = 6;
+    static constexpr std::size_t slot_count = std::size_t(1) << bits;
+    static constexpr tick_type mask = slot_count - 1;
+    static constexpr std::size_t level_count = 4;
+    static constexpr tick_type range = tick_type(1) << (bits * level_count);
+
+    // List head that is linked to itself when the list is empty
+    struct sentinel : entry
+    {
+        sentinel() : entry(nullptr)
+        {
+            this->prev = this;
+            this->next = this;
+        }
+    };
+
+    void link(entry& e) noexcept
+    {
+        auto delta = e.expiry - current;
+        if (delta >= range)
+        {
+            e.expiry = current + range - 1;
+            delta = range - 1;
+        }
+        std::size_t level = 0;
+        while (delta >= (tick_type(1) << (bits * (level + 1))))
+        {
+            ++level;
+        }
+        auto& slot = levels[level][(e.expiry >> (bits * level)) & mask];
+        e.prev = slot.prev;
+        e.next = &slot;
+        slot.prev->next = &e;
+        slot.prev = &e;
+    }
+
+    static void unlink(entry& e) noexcept
+    {
+        e.prev->next = e.next;
+        e.next->prev = e.prev;
+        e.prev = nullptr;
+        e.next = nullptr;
+    }
+
+    // Move all entries of a slot to another list
+    static void take(sentinel& slot, sentinel& target) noexcept
+    {
+        if (slot.next == &slot)
+            return;
+        target.next = slot.next;
+        target.prev = slot.prev;
+        target.next->prev = &target;
+        target.prev->next = &target;
+        slot.next = &slot;
+        slot.prev = &slot;
+    }
+
+    // Redistribute the current slot of a level onto the levels below
+    void cascade(std::size_t level) noexcept
+    {
+        if (level >= level_count)
+            return;
+
+        const auto index = (current >> (bits * level)) & mask;
+        if (index == 0)
+        {
+            cascade(level + 1);
+        }
+        sentinel moved;
+        take(levels[level][index], moved);
+        while (moved.next != &moved)
+        {
+            auto& e = *moved.next;
+            unlink(e);
+            link(e);
+        }
+    }
+
+private:
+    tick_type current = 0;
+    std::size_t count = 0;
+    sentinel levels[level_count][slot_count];
+};
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_TIMER_WHEEL_HPP
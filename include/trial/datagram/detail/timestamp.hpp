@@ -0,0 +1,113 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_TIMESTAMP_HPP
+#define TRIAL_DATAGRAM_DETAIL_TIMESTAMP_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <boost/system/error_code.hpp>
+#include <boost/asio/error.hpp>
+
+#if defined(__linux__)
+# include <cerrno>
+# include <ctime>
+# include <sys/socket.h>
+# if defined(SO_TIMESTAMPNS)
+#  define TRIAL_DATAGRAM_HAS_SO_TIMESTAMPNS 1
+# endif
+#endif
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// Kernel receive timestamps (SO_TIMESTAMPNS).
+//
+// The kernel records the wall-clock time at which a datagram arrived and
+// reports it as ancillary data on the receive call.
+
+namespace timestamp
+{
+
+using native_handle_type = int;
+using clock_type = std::chrono::system_clock;
+using time_point = clock_type::time_point;
+
+constexpr bool is_supported()
+{
+#if defined(TRIAL_DATAGRAM_HAS_SO_TIMESTAMPNS)
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Space needed for the ancillary data of a timestamp
+#if defined(TRIAL_DATAGRAM_HAS_SO_TIMESTAMPNS)
+constexpr std::size_t control_space = CMSG_SPACE(sizeof(struct ::timespec));
+#else
+constexpr std::size_t control_space = 0;
+#endif
+
+inline void enable(native_handle_type handle,
+                   bool enable,
+                   boost::system::error_code& error)
+{
+#if defined(TRIAL_DATAGRAM_HAS_SO_TIMESTAMPNS)
+    int value = enable ? 1 : 0;
+    if (::setsockopt(handle, SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof(value)) < 0)
+    {
+        error = boost::system::error_code(errno, boost::asio::error::get_system_category());
+        return;
+    }
+    error = boost::system::error_code();
+#else
+    (void)handle;
+    error = enable
+        ? boost::system::error_code(boost::asio::error::operation_not_supported)
+        : boost::system::error_code();
+#endif
+}
+
+// Arrival time of a received datagram, or the epoch if not reported
+#if defined(__linux__)
+inline time_point arrival(const struct ::msghdr& header)
+{
+#if defined(TRIAL_DATAGRAM_HAS_SO_TIMESTAMPNS)
+    for (auto message = CMSG_FIRSTHDR(&header);
+         message != nullptr;
+         message = CMSG_NXTHDR(const_cast<struct ::msghdr *>(&header), message))
+    {
+        if ((message->cmsg_level == SOL_SOCKET) && (message->cmsg_type == SCM_TIMESTAMPNS))
+        {
+            struct ::timespec value;
+            std::memcpy(&value, CMSG_DATA(message), sizeof(value));
+            return time_point(std::chrono::duration_cast<clock_type::duration>(
+                std::chrono::seconds(value.tv_sec) + std::chrono::nanoseconds(value.tv_nsec)));
+        }
+    }
+#else
+    (void)header;
+#endif
+    return time_point();
+}
+#endif
+
+} // namespace timestamp
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_TIMESTAMP_HPP
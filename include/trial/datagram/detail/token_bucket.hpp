@@ -0,0 +1,130 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_TOKEN_BUCKET_HPP
+#define TRIAL_DATAGRAM_DETAIL_TOKEN_BUCKET_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <cstddef>
+#include <boost/system/error_code.hpp>
+#include <boost/asio/error.hpp>
+
+#if defined(__linux__)
+# include <cerrno>
+# include <climits>
+# include <sys/socket.h>
+# if defined(SO_MAX_PACING_RATE)
+#  define TRIAL_DATAGRAM_HAS_SO_MAX_PACING_RATE 1
+# endif
+#endif
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// Token bucket with a rate in octets per second and a burst size in octets.
+//
+// The fill level is kept as the time at which the bucket will have drained,
+// so a bucket is a single time point and refilling needs no bookkeeping. The
+// time points are owned by the caller, which lets one rate apply to many
+// buckets. A datagram larger than the burst size is admitted once the
+// bucket has drained completely.
+
+class token_bucket
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+    using duration = clock_type::duration;
+    using time_point = clock_type::time_point;
+
+    explicit token_bucket(std::size_t rate = 0,
+                          std::size_t burst = 0)
+        : rate(rate),
+          tolerance(cost(burst))
+    {
+    }
+
+    bool limited() const { return rate > 0; }
+
+    // Time until size octets can be admitted
+    duration delay(const time_point& drained,
+                   std::size_t size,
+                   const time_point& now) const
+    {
+        if (!limited() || (drained <= now))
+            return duration::zero();
+
+        const auto filled = drained + cost(size);
+        if (filled <= now + tolerance)
+            return duration::zero();
+        const auto fits = filled - tolerance - now;
+        const auto empty = drained - now;
+        return (fits < empty) ? fits : empty;
+    }
+
+    void consume(time_point& drained,
+                 std::size_t size,
+                 const time_point& now) const
+    {
+        if (!limited())
+            return;
+        drained = ((drained < now) ? now : drained) + cost(size);
+    }
+
+private:
+    duration cost(std::size_t size) const
+    {
+        if (!limited())
+            return duration::zero();
+        using nanoseconds = std::chrono::nanoseconds;
+        return std::chrono::duration_cast<duration>(
+            nanoseconds(static_cast<nanoseconds::rep>(size * 1000000000ull / rate)));
+    }
+
+private:
+    std::size_t rate;
+    duration tolerance;
+};
+
+// Let the kernel pace a socket at rate octets per second
+// (SO_MAX_PACING_RATE), which is enforced by the fq queueing discipline. A
+// rate of zero removes the limit.
+inline void set_kernel_pacing(int handle,
+                              std::size_t rate,
+                              boost::system::error_code& error)
+{
+#if defined(TRIAL_DATAGRAM_HAS_SO_MAX_PACING_RATE)
+    unsigned int value = UINT_MAX;
+    if ((rate > 0) && (rate < UINT_MAX))
+    {
+        value = static_cast<unsigned int>(rate);
+    }
+    if (::setsockopt(handle, SOL_SOCKET, SO_MAX_PACING_RATE, &value, sizeof(value)) < 0)
+    {
+        error = boost::system::error_code(errno, boost::asio::error::get_system_category());
+        return;
+    }
+    error = boost::system::error_code();
+#else
+    (void)handle;
+    error = (rate > 0)
+        ? boost::system::error_code(boost::asio::error::operation_not_supported)
+        : boost::system::error_code();
+#endif
+}
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_TOKEN_BUCKET_HPP
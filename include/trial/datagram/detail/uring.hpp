@@ -0,0 +1,630 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_URING_HPP
+#define TRIAL_DATAGRAM_DETAIL_URING_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <boost/system/error_code.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <trial/datagram/detail/offload.hpp>
+
+#if defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <linux/io_uring.h>
+#  if defined(IORING_RECV_MULTISHOT)
+#   define TRIAL_DATAGRAM_HAS_IO_URING 1
+#  endif
+# endif
+#endif
+
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+# include <cerrno>
+# include <sys/eventfd.h>
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+# include <netinet/in.h>
+# include <unistd.h>
+#endif
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+// Minimal io_uring driver for datagram sockets, which uses the system calls
+// directly.
+//
+// Datagrams are received by a multishot recvmsg into a ring of provided
+// buffers. Completions are signalled on an eventfd, so the caller can wait
+// for them with the io_context.
+//
+// Not thread-safe. The caller must serialize all access.
+
+class uring
+{
+public:
+    using native_handle_type = int;
+    using endpoint_type = boost::asio::ip::udp::endpoint;
+
+    struct completion
+    {
+        std::uint64_t user_data;
+        std::int32_t result;
+        std::uint32_t flags;
+    };
+
+    // Outgoing datagram, which must remain valid until its completion
+    class send_request
+    {
+    public:
+        template <typename ConstBufferSequence>
+        void prepare(const ConstBufferSequence& buffers,
+                     const endpoint_type& endpoint);
+
+        std::size_t size() const { return length; }
+
+    private:
+        friend class uring;
+
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+        struct ::msghdr header;
+        std::vector<struct ::iovec> vectors;
+#endif
+        endpoint_type destination;
+        std::size_t length = 0;
+    };
+
+    static constexpr bool is_supported()
+    {
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    uring() = default;
+    uring(const uring&) = delete;
+    uring& operator=(const uring&) = delete;
+    ~uring();
+
+    void open(unsigned entries,
+              std::size_t buffer_count,
+              std::size_t buffer_size,
+              boost::system::error_code&);
+
+    // Readable when completions are available
+    native_handle_type event_handle() const { return event_fd; }
+
+    // Queue a multishot receive. Completions carry the identifier of the
+    // provided buffer, which must be recycled after use.
+    //
+    // Return false if the submission queue is full.
+    bool receive(native_handle_type, std::uint64_t user_data);
+    bool send(native_handle_type, send_request&, std::uint64_t user_data);
+    void submit(boost::system::error_code&);
+    bool has_unsubmitted() const;
+
+    // Remove and process all available completions
+    template <typename Function>
+    std::size_t consume(Function&&);
+
+    // Whether the multishot receive continues after this completion
+    static bool has_more(const completion&);
+
+    // Datagram in a provided buffer
+    static bool has_buffer(const completion&);
+    std::size_t payload(const completion&,
+                        const char *& data,
+                        endpoint_type& endpoint,
+                        bool& truncated) const;
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+    // Ancillary data of the datagram
+    struct ::msghdr control(const completion&) const;
+#endif
+    void recycle(const completion&);
+
+private:
+    static boost::system::error_code last_error();
+    std::uint16_t buffer_id(const completion&) const;
+    char *buffer(std::uint16_t id) const;
+    std::size_t header_size() const;
+
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+    void provide(std::uint16_t id);
+    struct ::io_uring_sqe *next_sqe();
+    int enter(unsigned submit, unsigned flags);
+#endif
+
+private:
+    native_handle_type ring_fd = -1;
+    native_handle_type event_fd = -1;
+
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+    // Mapped rings
+    void *sq_map = nullptr;
+    std::size_t sq_map_size = 0;
+    void *cq_map = nullptr;
+    std::size_t cq_map_size = 0;
+    struct ::io_uring_sqe *sqes = nullptr;
+    std::size_t sqes_size = 0;
+
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_flags = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned sq_local_tail = 0;
+    unsigned sq_submitted = 0;
+
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    struct ::io_uring_cqe *cqes = nullptr;
+
+    // Provided buffers
+    struct ::io_uring_buf_ring *buffer_ring = nullptr;
+    std::size_t buffer_ring_size = 0;
+    std::uint16_t buffer_mask = 0;
+    std::uint16_t buffer_tail = 0;
+    std::unique_ptr<char[]> buffer_storage;
+    std::size_t buffer_stride = 0;
+
+    struct ::msghdr receive_header;
+#endif
+};
+
+//-----------------------------------------------------------------------------
+
+#if defined(TRIAL_DATAGRAM_HAS_IO_URING)
+
+namespace uring_constants
+{
+
+// Buffer group of the provided buffers
+constexpr std::uint16_t group = 0;
+// Space reserved for the remote address and the ancillary data, which is
+// rounded up so the ancillary data is aligned
+constexpr std::size_t alignment = alignof(struct ::cmsghdr);
+constexpr std::size_t name_size = (sizeof(struct ::sockaddr_in6) + alignment - 1) & ~(alignment - 1);
+constexpr std::size_t control_size = sizeof(offload::control_block);
+
+} // namespace uring_constants
+
+template <typename ConstBufferSequence>
+void uring::send_request::prepare(const ConstBufferSequence& buffers,
+                                  const endpoint_type& endpoint)
+{
+    vectors.clear();
+    length = 0;
+    for (auto it = boost::asio::buffer_sequence_begin(buffers);
+         it != boost::asio::buffer_sequence_end(buffers);
+         ++it)
+    {
+        boost::asio::const_buffer buffer(*it);
+        struct ::iovec vector;
+        vector.iov_base = const_cast<void *>(buffer.data());
+        vector.iov_len = buffer.size();
+        vectors.push_back(vector);
+        length += buffer.size();
+    }
+    destination = endpoint;
+    std::memset(&header, 0, sizeof(header));
+    header.msg_name = destination.data();
+    header.msg_namelen = static_cast<::socklen_t>(destination.size());
+    header.msg_iov = vectors.data();
+    header.msg_iovlen = vectors.size();
+}
+
+inline uring::~uring()
+{
+    // Closing the ring cancels outstanding requests
+    if (ring_fd >= 0)
+        ::close(ring_fd);
+    if (event_fd >= 0)
+        ::close(event_fd);
+    if (sqes)
+        ::munmap(sqes, sqes_size);
+    if (cq_map && (cq_map != sq_map))
+        ::munmap(cq_map, cq_map_size);
+    if (sq_map)
+        ::munmap(sq_map, sq_map_size);
+    if (buffer_ring)
+        ::munmap(buffer_ring, buffer_ring_size);
+}
+
+inline boost::system::error_code uring::last_error()
+{
+    return boost::system::error_code(errno, boost::asio::error::get_system_category());
+}
+
+inline void uring::open(unsigned entries,
+                        std::size_t buffer_count,
+                        std::size_t buffer_size,
+                        boost::system::error_code& error)
+{
+    // The kernel requires a power of two for the provided buffers
+    if ((buffer_count == 0) || (buffer_count > 32768) ||
+        (buffer_count & (buffer_count - 1)) ||
+        (buffer_size == 0) || (buffer_size > UINT32_MAX / 2))
+    {
+        error = boost::asio::error::invalid_argument;
+        return;
+    }
+
+    struct ::io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (ring_fd < 0)
+    {
+        error = last_error();
+        return;
+    }
+
+    sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct ::io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+    }
+    sq_map = ::mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED)
+    {
+        sq_map = nullptr;
+        error = last_error();
+        return;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        cq_map = sq_map;
+    }
+    else
+    {
+        cq_map = ::mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_map == MAP_FAILED)
+        {
+            cq_map = nullptr;
+            error = last_error();
+            return;
+        }
+    }
+    sqes_size = params.sq_entries * sizeof(struct ::io_uring_sqe);
+    auto sqe_map = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqe_map == MAP_FAILED)
+    {
+        error = last_error();
+        return;
+    }
+    sqes = static_cast<struct ::io_uring_sqe *>(sqe_map);
+
+    auto sq = static_cast<char *>(sq_map);
+    sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_flags = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+    sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_entries = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+    sq_local_tail = sq_submitted = *sq_tail;
+    // Submission entries are used in ring order
+    auto array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries; ++i)
+    {
+        array[i] = i;
+    }
+
+    auto cq = static_cast<char *>(cq_map);
+    cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct ::io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0)
+    {
+        error = last_error();
+        return;
+    }
+    if (::syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0)
+    {
+        error = last_error();
+        return;
+    }
+
+    // Provided buffers hold the recvmsg header, the remote address, the
+    // ancillary data, and the payload
+    buffer_ring_size = buffer_count * sizeof(struct ::io_uring_buf);
+    auto ring_map = ::mmap(nullptr, buffer_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring_map == MAP_FAILED)
+    {
+        error = last_error();
+        return;
+    }
+    buffer_ring = static_cast<struct ::io_uring_buf_ring *>(ring_map);
+    struct ::io_uring_buf_reg registration;
+    std::memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<std::uint64_t>(buffer_ring);
+    registration.ring_entries = static_cast<std::uint32_t>(buffer_count);
+    registration.bgid = uring_constants::group;
+    if (::syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+    {
+        error = last_error();
+        return;
+    }
+    buffer_mask = static_cast<std::uint16_t>(buffer_count - 1);
+    buffer_stride = (header_size() + buffer_size + uring_constants::alignment - 1) & ~(uring_constants::alignment - 1);
+    buffer_storage.reset(new char[buffer_count * buffer_stride]);
+    for (std::size_t i = 0; i < buffer_count; ++i)
+    {
+        provide(static_cast<std::uint16_t>(i));
+    }
+    __atomic_store_n(&buffer_ring->tail, buffer_tail, __ATOMIC_RELEASE);
+
+    std::memset(&receive_header, 0, sizeof(receive_header));
+    receive_header.msg_namelen = uring_constants::name_size;
+    receive_header.msg_controllen = uring_constants::control_size;
+
+    error = boost::system::error_code();
+}
+
+inline int uring::enter(unsigned submit,
+                        unsigned flags)
+{
+    int result = 0;
+    do
+    {
+        result = static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, submit, 0, flags, nullptr, 0));
+    } while ((result < 0) && (errno == EINTR));
+    return result;
+}
+
+inline struct ::io_uring_sqe *uring::next_sqe()
+{
+    if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+    {
+        // Submission queue is full
+        boost::system::error_code error;
+        submit(error);
+        if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+            return nullptr;
+    }
+    auto sqe = &sqes[sq_local_tail & sq_mask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+inline bool uring::receive(native_handle_type handle,
+                           std::uint64_t user_data)
+{
+    auto sqe = next_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = handle;
+    sqe->addr = reinterpret_cast<std::uint64_t>(&receive_header);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = uring_constants::group;
+    sqe->user_data = user_data;
+    ++sq_local_tail;
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    return true;
+}
+
+inline bool uring::send(native_handle_type handle,
+                        send_request& request,
+                        std::uint64_t user_data)
+{
+    auto sqe = next_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = handle;
+    sqe->addr = reinterpret_cast<std::uint64_t>(&request.header);
+    sqe->len = 1;
+    sqe->user_data = user_data;
+    ++sq_local_tail;
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    return true;
+}
+
+inline bool uring::has_unsubmitted() const
+{
+    return sq_local_tail != sq_submitted;
+}
+
+inline void uring::submit(boost::system::error_code& error)
+{
+    error = boost::system::error_code();
+    while (has_unsubmitted())
+    {
+        const auto result = enter(sq_local_tail - sq_submitted, 0);
+        if (result < 0)
+        {
+            error = last_error();
+            return;
+        }
+        if (result == 0)
+            return;
+        sq_submitted += static_cast<unsigned>(result);
+    }
+}
+
+template <typename Function>
+std::size_t uring::consume(Function&& function)
+{
+    std::uint64_t events = 0;
+    // Reset the eventfd before the completions are inspected
+    while (::read(event_fd, &events, sizeof(events)) < 0 && (errno == EINTR))
+        continue;
+
+    std::size_t count = 0;
+    while (true)
+    {
+        auto head = *cq_head;
+        const auto tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const auto& entry = cqes[head & cq_mask];
+            completion item{entry.user_data, entry.res, entry.flags};
+            __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+            function(item);
+            ++count;
+        }
+        if (!(__atomic_load_n(sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW))
+            break;
+        // Move completions that did not fit into the completion queue
+        enter(0, IORING_ENTER_GETEVENTS);
+        if (*cq_head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+            break;
+    }
+    return count;
+}
+
+inline bool uring::has_more(const completion& item)
+{
+    return item.flags & IORING_CQE_F_MORE;
+}
+
+inline bool uring::has_buffer(const completion& item)
+{
+    return item.flags & IORING_CQE_F_BUFFER;
+}
+
+inline std::uint16_t uring::buffer_id(const completion& item) const
+{
+    return static_cast<std::uint16_t>(item.flags >> IORING_CQE_BUFFER_SHIFT);
+}
+
+inline char *uring::buffer(std::uint16_t id) const
+{
+    return buffer_storage.get() + id * buffer_stride;
+}
+
+inline std::size_t uring::header_size() const
+{
+    return sizeof(struct ::io_uring_recvmsg_out) + uring_constants::name_size + uring_constants::control_size;
+}
+
+inline std::size_t uring::payload(const completion& item,
+                                  const char *& data,
+                                  endpoint_type& endpoint,
+                                  bool& truncated) const
+{
+    const auto base = buffer(buffer_id(item));
+    struct ::io_uring_recvmsg_out header;
+    std::memcpy(&header, base, sizeof(header));
+
+    const auto name_length = std::min<std::size_t>(header.namelen, uring_constants::name_size);
+    std::memcpy(endpoint.data(), base + sizeof(header), name_length);
+    endpoint.resize(name_length);
+
+    data = base + header_size();
+    const auto available = (item.result > 0)
+        ? static_cast<std::size_t>(item.result) - std::min<std::size_t>(header_size(), item.result)
+        : 0;
+    const auto length = std::min<std::size_t>(header.payloadlen, available);
+    truncated = (header.flags & MSG_TRUNC) || (header.payloadlen > length);
+    return length;
+}
+
+inline struct ::msghdr uring::control(const completion& item) const
+{
+    const auto base = buffer(buffer_id(item));
+    struct ::io_uring_recvmsg_out header;
+    std::memcpy(&header, base, sizeof(header));
+
+    struct ::msghdr result;
+    std::memset(&result, 0, sizeof(result));
+    result.msg_control = base + sizeof(header) + uring_constants::name_size;
+    result.msg_controllen = std::min<std::size_t>(header.controllen, uring_constants::control_size);
+    return result;
+}
+
+inline void uring::recycle(const completion& item)
+{
+    provide(buffer_id(item));
+    __atomic_store_n(&buffer_ring->tail, buffer_tail, __ATOMIC_RELEASE);
+}
+
+inline void uring::provide(std::uint16_t id)
+{
+    // The bufs member is offset by an empty struct in C++, so the entries
+    // are addressed from the start of the ring, which overlays the tail
+    // with the reserved field of the first entry
+    auto entry = reinterpret_cast<struct ::io_uring_buf *>(buffer_ring) + (buffer_tail & buffer_mask);
+    entry->addr = reinterpret_cast<std::uint64_t>(buffer(id));
+    entry->len = static_cast<std::uint32_t>(buffer_stride);
+    entry->bid = id;
+    ++buffer_tail;
+}
+
+#else
+
+template <typename ConstBufferSequence>
+void uring::send_request::prepare(const ConstBufferSequence& buffers,
+                                  const endpoint_type& endpoint)
+{
+    destination = endpoint;
+    length = boost::asio::buffer_size(buffers);
+}
+
+inline uring::~uring() = default;
+
+inline void uring::open(unsigned, std::size_t, std::size_t, boost::system::error_code& error)
+{
+    error = boost::asio::error::operation_not_supported;
+}
+
+inline bool uring::receive(native_handle_type, std::uint64_t) { return false; }
+inline bool uring::send(native_handle_type, send_request&, std::uint64_t) { return false; }
+inline bool uring::has_unsubmitted() const { return false; }
+
+inline void uring::submit(boost::system::error_code& error)
+{
+    error = boost::asio::error::operation_not_supported;
+}
+
+template <typename Function>
+std::size_t uring::consume(Function&&)
+{
+    return 0;
+}
+
+inline bool uring::has_more(const completion&) { return false; }
+inline bool uring::has_buffer(const completion&) { return false; }
+
+inline std::size_t uring::payload(const completion&, const char *& data, endpoint_type&, bool& truncated) const
+{
+    data = nullptr;
+    truncated = false;
+    return 0;
+}
+
+inline void uring::recycle(const completion&) {}
+
+#endif
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_URING_HPP
@@ -0,0 +1,239 @@
+#ifndef TRIAL_DATAGRAM_DETAIL_WORKER_MAILBOX_HPP
+#define TRIAL_DATAGRAM_DETAIL_WORKER_MAILBOX_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/system/error_code.hpp>
+#include <trial/net/executor.hpp>
+#include <trial/datagram/detail/buffer.hpp>
+#include <trial/datagram/detail/completion_list.hpp>
+#include <trial/datagram/detail/socket_base.hpp>
+
+namespace trial
+{
+namespace datagram
+{
+namespace detail
+{
+
+class worker_mailbox;
+
+// Link between a socket and the mailbox of its worker. The owner is cleared
+// when the socket is removed, which waits for a delivery in progress.
+
+struct socket_inbox
+{
+    socket_inbox(socket_base *owner,
+                 std::shared_ptr<worker_mailbox> mailbox)
+        : owner(owner),
+          mailbox(std::move(mailbox))
+    {
+    }
+
+    std::mutex mutex;
+    socket_base *owner;
+    const std::shared_ptr<worker_mailbox> mailbox;
+    // Datagrams handed off but not yet queued on the socket
+    std::atomic<std::size_t> in_flight{0};
+};
+
+// Datagrams that have been demultiplexed for the sockets of one worker
+// executor.
+//
+// Datagrams are handed off in batches after the multiplexer has released
+// its lock. Batches are pushed onto a lock-free stack, so several threads
+// can hand off at once. The worker is notified when the first batch of a
+// burst is pushed, and takes all batches that have arrived by then in one
+// exchange. Drained batches are kept for reuse.
+
+class worker_mailbox
+    : public std::enable_shared_from_this<worker_mailbox>
+{
+public:
+    struct batch
+    {
+        batch *next = nullptr;
+        std::vector<worker_handoff> entries;
+    };
+
+    explicit worker_mailbox(const net::executor& executor)
+        : executor(executor)
+    {
+    }
+
+    worker_mailbox(const worker_mailbox&) = delete;
+    worker_mailbox& operator=(const worker_mailbox&) = delete;
+
+    ~worker_mailbox()
+    {
+        destroy(pending.exchange(nullptr));
+        destroy(spare.exchange(nullptr));
+    }
+
+    const net::executor& get_executor() const { return executor; }
+
+    std::size_t notifications() const { return notified.load(std::memory_order_relaxed); }
+
+    batch *acquire()
+    {
+        // Producers take all spare batches at once, as popping a single one
+        // from a lock-free stack is prone to the ABA problem
+        batch *result = spare.exchange(nullptr, std::memory_order_acquire);
+        if (!result)
+            return new batch;
+
+        if (result->next)
+        {
+            auto last = result->next;
+            while (last->next)
+            {
+                last = last->next;
+            }
+            link(spare, result->next, last);
+            result->next = nullptr;
+        }
+        return result;
+    }
+
+    void push(batch *item)
+    {
+        link(pending, item, item);
+        if (scheduled.exchange(true))
+            return;
+
+        notified.fetch_add(1, std::memory_order_relaxed);
+        auto self = shared_from_this();
+        net::post(executor, [self] { self->drain(); });
+    }
+
+private:
+    static void link(std::atomic<batch *>& stack,
+                     batch *first,
+                     batch *last)
+    {
+        last->next = stack.load(std::memory_order_relaxed);
+        while (!stack.compare_exchange_weak(last->next, first))
+        {
+        }
+    }
+
+    static void destroy(batch *item)
+    {
+        while (item)
+        {
+            auto next = item->next;
+            delete item;
+            item = next;
+        }
+    }
+
+    void drain()
+    {
+        completion_list completions;
+        for (;;)
+        {
+            batch *item = pending.exchange(nullptr);
+            if (!item)
+            {
+                // Batches pushed after the exchange, but before the flag was
+                // cleared, did not notify the worker
+                scheduled.store(false);
+                if (!pending.load() || scheduled.exchange(true))
+                    return;
+                continue;
+            }
+
+            // The stack holds the most recent batch first
+            batch *ordered = nullptr;
+            while (item)
+            {
+                auto next = item->next;
+                item->next = ordered;
+                ordered = item;
+                item = next;
+            }
+            while (ordered)
+            {
+                auto next = ordered->next;
+                deliver(*ordered, completions);
+                link(spare, ordered, ordered);
+                ordered = next;
+            }
+            completions.invoke();
+        }
+    }
+
+    static void deliver(batch& item,
+                        completion_list& completions)
+    {
+        auto& entries = item.entries;
+        for (std::size_t i = 0; i < entries.size();)
+        {
+            // Consecutive datagrams of a socket are queued under one lock
+            auto& inbox = *entries[i].inbox;
+            std::lock_guard<std::mutex> lock(inbox.mutex);
+            do
+            {
+                auto& entry = entries[i];
+                if (inbox.owner)
+                {
+                    inbox.owner->enqueue(entry.error,
+                                         std::move(entry.datagram),
+                                         completions);
+                }
+                inbox.in_flight.fetch_sub(1, std::memory_order_release);
+                ++i;
+            } while ((i < entries.size()) && (entries[i].inbox.get() == &inbox));
+        }
+        entries.clear();
+    }
+
+private:
+    net::executor executor;
+    std::atomic<batch *> pending{nullptr};
+    std::atomic<batch *> spare{nullptr};
+    std::atomic<bool> scheduled{false};
+    std::atomic<std::size_t> notified{0};
+};
+
+// Datagrams for the same worker are pushed as one batch in their original
+// order. Workers are few, so they are searched linearly.
+inline void hand_off(std::vector<worker_handoff>& handoffs)
+{
+    for (std::size_t i = 0; i < handoffs.size(); ++i)
+    {
+        if (!handoffs[i].inbox)
+            continue; // Already handed off
+
+        auto mailbox = handoffs[i].inbox->mailbox;
+        auto item = mailbox->acquire();
+        for (std::size_t j = i; j < handoffs.size(); ++j)
+        {
+            if (handoffs[j].inbox && (handoffs[j].inbox->mailbox == mailbox))
+            {
+                item->entries.push_back(std::move(handoffs[j]));
+            }
+        }
+        mailbox->push(item);
+    }
+    handoffs.clear();
+}
+
+} // namespace detail
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_DETAIL_WORKER_MAILBOX_HPP
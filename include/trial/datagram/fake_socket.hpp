@@ -0,0 +1,266 @@
+#ifndef TRIAL_DATAGRAM_FAKE_SOCKET_HPP
+#define TRIAL_DATAGRAM_FAKE_SOCKET_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <vector>
+#include <boost/system/error_code.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/execution_context.hpp>
+#include <boost/asio/socket_base.hpp>
+#include <trial/net/io_context.hpp>
+#include <trial/net/executor.hpp>
+#include <trial/datagram/endpoint.hpp>
+#include <trial/datagram/socket.hpp>
+#include <trial/datagram/acceptor.hpp>
+
+namespace trial
+{
+namespace datagram
+{
+
+class fake_socket;
+
+// In-process network that connects the fake sockets of an io_context.
+//
+// Datagrams are copied from sender to receiver without system calls. Loss
+// and reordering are decided by a pseudo-random generator, so a run can be
+// repeated with the same seed. A reordered datagram is held back and
+// delivered after the next datagram, or by flush().
+//
+// A datagram is delivered to the socket bound to its destination, or else
+// to a socket bound to the unspecified address and the same port.
+
+class fake_network
+    : public boost::asio::detail::execution_context_service_base<fake_network>
+{
+public:
+    using endpoint_type = datagram::endpoint;
+
+    struct counters
+    {
+        std::size_t delivered = 0;
+        std::size_t lost = 0;
+        std::size_t reordered = 0;
+        std::size_t overflowed = 0;
+    };
+
+    explicit fake_network(boost::asio::execution_context&);
+
+    // Get the network of an io_context
+    static fake_network& get(const net::executor&);
+
+    void seed(std::uint32_t value);
+
+    // Probability in [0, 1] that a datagram is dropped
+    void loss(double probability);
+
+    // Probability in [0, 1] that a datagram is delivered after the next one
+    void reorder(double probability);
+
+    // Maximum number of datagrams queued on a socket before the surplus is
+    // dropped. Zero means unlimited.
+    void capacity(std::size_t datagrams);
+
+    // Deliver a datagram as if it had been sent from one endpoint to
+    // another. The sender need not exist, so bursts can be scripted.
+    void inject(const endpoint_type& from,
+                const endpoint_type& to,
+                const void *data,
+                std::size_t size);
+
+    // Deliver a held back datagram
+    void flush();
+
+    counters statistics() const;
+
+private:
+    friend class fake_socket;
+
+    struct datagram_type
+    {
+        endpoint_type from;
+        endpoint_type to;
+        std::vector<char> data;
+    };
+
+    virtual void shutdown() override;
+
+    bool chance(double probability);
+    void bind(fake_socket&,
+              endpoint_type,
+              boost::system::error_code&);
+    void unbind(fake_socket&);
+    void transmit(datagram_type);
+    void deliver(datagram_type);
+    fake_socket *find(const endpoint_type&) const;
+
+private:
+    mutable std::mutex mutex;
+    std::map<endpoint_type, fake_socket *> bindings;
+    std::vector<fake_socket *> sockets;
+    std::minstd_rand generator;
+    double loss_probability = 0.0;
+    double reorder_probability = 0.0;
+    std::size_t queue_capacity = 0;
+    unsigned short next_port = ephemeral_port;
+    bool holding = false;
+    datagram_type held;
+    counters stats;
+
+    static constexpr unsigned short ephemeral_port = 49152;
+};
+
+// Next layer that exchanges datagrams over a fake_network.
+//
+// Offers the subset of the UDP socket interface that the multiplexer uses.
+// There is no file descriptor, so features that are implemented with system
+// calls on the UDP socket, such as batching, offload, timestamps, peer
+// promotion, the local transport, and io_uring, are not supported.
+
+class fake_socket
+    : public boost::asio::socket_base
+{
+public:
+    using protocol_type = datagram::protocol;
+    using endpoint_type = datagram::endpoint;
+    using executor_type = net::executor;
+    using native_handle_type = int;
+
+    explicit fake_socket(const net::executor&);
+    fake_socket(const fake_socket&) = delete;
+    fake_socket& operator=(const fake_socket&) = delete;
+    ~fake_socket();
+
+    executor_type get_executor() { return executor; }
+    native_handle_type native_handle() const { return -1; }
+
+    void open(const protocol_type&);
+    void open(const protocol_type&,
+              boost::system::error_code&);
+    bool is_open() const;
+    void close();
+    void close(boost::system::error_code&);
+    // Abort pending operations with operation_aborted
+    void cancel();
+
+    void bind(const endpoint_type&);
+    void bind(const endpoint_type&,
+              boost::system::error_code&);
+    endpoint_type local_endpoint() const;
+    endpoint_type local_endpoint(boost::system::error_code&) const;
+
+    // Operations never block, so these only exist for compatibility
+    void non_blocking(bool) {}
+    void non_blocking(bool,
+                      boost::system::error_code& error) { error = {}; }
+
+    // Socket options are accepted and ignored
+    template <typename SettableSocketOption>
+    void set_option(const SettableSocketOption&) {}
+    template <typename SettableSocketOption>
+    void set_option(const SettableSocketOption&,
+                    boost::system::error_code& error) { error = {}; }
+    template <typename GettableSocketOption>
+    void get_option(GettableSocketOption&,
+                    boost::system::error_code& error) const;
+
+    void io_control(bytes_readable&,
+                    boost::system::error_code&);
+
+    template <typename MutableBufferSequence,
+              typename ReadHandler>
+    void async_receive_from(const MutableBufferSequence& buffers,
+                            endpoint_type& sender,
+                            message_flags flags,
+                            ReadHandler&& handler);
+
+    template <typename MutableBufferSequence>
+    std::size_t receive_from(const MutableBufferSequence& buffers,
+                             endpoint_type& sender,
+                             message_flags flags,
+                             boost::system::error_code&);
+
+    template <typename ConstBufferSequence,
+              typename WriteHandler>
+    void async_send_to(const ConstBufferSequence& buffers,
+                       const endpoint_type& destination,
+                       WriteHandler&& handler);
+
+    template <typename ConstBufferSequence>
+    std::size_t send_to(const ConstBufferSequence& buffers,
+                        const endpoint_type& destination,
+                        message_flags flags,
+                        boost::system::error_code&);
+
+    template <typename WaitHandler>
+    void async_wait(wait_type,
+                    WaitHandler&& handler);
+
+private:
+    friend class fake_network;
+
+    using datagram_type = fake_network::datagram_type;
+    using receive_handler = std::function<void (const boost::system::error_code&, std::size_t)>;
+    using wait_handler = std::function<void (const boost::system::error_code&)>;
+
+    struct pending_receive
+    {
+        std::vector<boost::asio::mutable_buffer> buffers;
+        endpoint_type *sender;
+        message_flags flags;
+        receive_handler handler;
+    };
+
+    // Called with the network mutex held
+    void enqueue(datagram_type);
+    void complete_locked();
+    std::size_t copy_front(const std::vector<boost::asio::mutable_buffer>&,
+                           endpoint_type&,
+                           message_flags);
+    void abort_locked(std::vector<receive_handler>&,
+                      std::vector<wait_handler>&);
+    void abort();
+    void post_aborted(std::vector<receive_handler>&,
+                      std::vector<wait_handler>&);
+    void ensure_bound(boost::system::error_code&);
+
+private:
+    net::executor executor;
+    fake_network& network;
+    bool opened = false;
+    bool bound = false;
+    endpoint_type endpoint;
+    std::deque<datagram_type> queue;
+    std::deque<pending_receive> receives;
+    std::vector<wait_handler> waits;
+};
+
+namespace fake
+{
+
+using socket = basic_socket<fake_socket>;
+using acceptor = basic_acceptor<fake_socket>;
+
+} // namespace fake
+
+} // namespace datagram
+} // namespace trial
+
+#include <trial/datagram/detail/fake_socket.ipp>
+
+#endif // TRIAL_DATAGRAM_FAKE_SOCKET_HPP
@@ -0,0 +1,999 @@
+#ifndef TRIAL_DATAGRAM_OPTION_HPP
+#define TRIAL_DATAGRAM_OPTION_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <boost/asio/socket_base.hpp>
+#include <boost/asio/detail/socket_option.hpp>
+#include <boost/asio/ip/address.hpp>
+
+namespace trial
+{
+namespace datagram
+{
+
+template <typename> class basic_socket;
+namespace detail { template <typename> class basic_multiplexer; }
+
+namespace option
+{
+
+// Options that configure trial.datagram itself rather than the underlying
+// UDP socket. They are passed to set_option() on either an acceptor or a
+// socket, and apply to all sockets that share the same local endpoint.
+
+#if defined(SO_REUSEPORT)
+// Allow several UDP sockets to bind to the same local endpoint. The kernel
+// distributes incoming datagrams among them by flow hash.
+
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+// Receive up to count datagrams per readiness event into preallocated slots
+// of the given size. Datagrams larger than the slot size are truncated and
+// reported with the message_size error.
+//
+// A count of one uses the default receive strategy, which never truncates.
+
+class receive_batch
+{
+public:
+    static constexpr std::size_t default_size = 1500;
+
+    explicit receive_batch(std::size_t count = 1,
+                           std::size_t size = default_size)
+        : count_(count),
+          size_(size)
+    {
+    }
+
+    std::size_t count() const { return count_; }
+    std::size_t size() const { return size_; }
+
+private:
+    std::size_t count_;
+    std::size_t size_;
+};
+
+// Queue outgoing datagrams from all sockets that share the local endpoint
+// and send them with a single system call. The queue is flushed when the
+// currently ready handlers have been executed, or as soon as it contains
+// count datagrams or bytes octets.
+//
+// A count of one sends each datagram immediately.
+
+class send_batch
+{
+public:
+    static constexpr std::size_t default_bytes = 64 * 1024;
+
+    explicit send_batch(std::size_t count = 1,
+                        std::size_t bytes = default_bytes)
+        : count_(count),
+          bytes_(bytes)
+    {
+    }
+
+    std::size_t count() const { return count_; }
+    std::size_t bytes() const { return bytes_; }
+
+private:
+    std::size_t count_;
+    std::size_t bytes_;
+};
+
+// Limits on the storage that the datagram buffer pool retains for reuse.
+// Released buffers beyond these limits are returned to the heap.
+//
+// get_option() also reports the high-water marks of the pool.
+
+class buffer_pool
+{
+public:
+    static constexpr std::size_t default_max_bytes = 4 * 1024 * 1024;
+    static constexpr std::size_t default_max_buffers = 1024;
+
+    explicit buffer_pool(std::size_t max_bytes = default_max_bytes,
+                         std::size_t max_buffers = default_max_buffers)
+        : max_bytes_(max_bytes),
+          max_buffers_(max_buffers)
+    {
+    }
+
+    // Retained bytes across all size classes
+    std::size_t max_bytes() const { return max_bytes_; }
+    // Retained buffers across all size classes
+    std::size_t max_buffers() const { return max_buffers_; }
+
+    std::size_t peak_buffers() const { return peak_buffers_; }
+    std::size_t peak_bytes() const { return peak_bytes_; }
+    std::size_t peak_cached_bytes() const { return peak_cached_bytes_; }
+
+    void high_water(std::size_t buffers,
+                    std::size_t bytes,
+                    std::size_t cached_bytes)
+    {
+        peak_buffers_ = buffers;
+        peak_bytes_ = bytes;
+        peak_cached_bytes_ = cached_bytes;
+    }
+
+private:
+    std::size_t max_bytes_;
+    std::size_t max_buffers_;
+    std::size_t peak_buffers_ = 0;
+    std::size_t peak_bytes_ = 0;
+    std::size_t peak_cached_bytes_ = 0;
+};
+
+// Limit on the number of datagrams from unknown remote endpoints that are
+// queued while no accept request is pending, and the policy for handling
+// datagrams that exceed the limit:
+//
+//   drop_newest  Discard the arriving datagram.
+//   drop_oldest  Discard the oldest queued datagram.
+//   coalesce     Keep at most one datagram per remote endpoint, so a later
+//                datagram replaces the earlier one. Datagrams from further
+//                endpoints are discarded when the queue is full.
+//
+// get_option() also reports the number of accepted, queued, and dropped
+// datagrams. A datagram replaced by coalescing counts as dropped, but its
+// replacement does not count as queued.
+
+class listen_backlog
+{
+public:
+    enum policy_type
+    {
+        drop_newest,
+        drop_oldest,
+        coalesce
+    };
+
+    static constexpr std::size_t default_size = 1024;
+
+    explicit listen_backlog(std::size_t size = default_size,
+                            policy_type policy = drop_newest)
+        : size_(size),
+          policy_(policy)
+    {
+    }
+
+    std::size_t size() const { return size_; }
+    policy_type policy() const { return policy_; }
+
+    std::size_t accepted() const { return accepted_; }
+    std::size_t queued() const { return queued_; }
+    std::size_t dropped() const { return dropped_; }
+
+    void counters(std::size_t accepted,
+                  std::size_t queued,
+                  std::size_t dropped)
+    {
+        accepted_ = accepted;
+        queued_ = queued;
+        dropped_ = dropped;
+    }
+
+private:
+    std::size_t size_;
+    policy_type policy_;
+    std::size_t accepted_ = 0;
+    std::size_t queued_ = 0;
+    std::size_t dropped_ = 0;
+};
+
+// Limits on the datagrams that are queued on a socket while no receive
+// request is pending, and the policy for handling datagrams that exceed
+// the limits:
+//
+//   drop_newest  Discard the arriving datagram.
+//   drop_oldest  Discard queued datagrams until the arriving one fits.
+//
+// This option applies to a single socket. get_option() also reports the
+// number of dropped datagrams.
+
+class receive_queue
+{
+public:
+    enum policy_type
+    {
+        drop_newest,
+        drop_oldest
+    };
+
+    explicit receive_queue(std::size_t datagrams = std::numeric_limits<std::size_t>::max(),
+                           std::size_t bytes = std::numeric_limits<std::size_t>::max(),
+                           policy_type policy = drop_newest)
+        : datagrams_(datagrams),
+          bytes_(bytes),
+          policy_(policy)
+    {
+    }
+
+    std::size_t datagrams() const { return datagrams_; }
+    std::size_t bytes() const { return bytes_; }
+    policy_type policy() const { return policy_; }
+
+    std::size_t dropped() const { return dropped_; }
+    void dropped(std::size_t value) { dropped_ = value; }
+
+private:
+    std::size_t datagrams_;
+    std::size_t bytes_;
+    policy_type policy_;
+    std::size_t dropped_ = 0;
+};
+
+// Complete async_receive() inline, rather than posting the completion
+// handler, when a datagram is already queued on the socket and the calling
+// thread is running the executor associated with the handler. The handler
+// may therefore be invoked before async_receive() returns.
+//
+// Nested inline completions are limited, so a handler that initiates the
+// next receive cannot exhaust the stack. This option applies to a single
+// socket.
+
+class receive_immediate
+{
+public:
+    explicit receive_immediate(bool enabled = false)
+        : enabled_(enabled)
+    {
+    }
+
+    bool enabled() const { return enabled_; }
+
+private:
+    bool enabled_;
+};
+
+// Stop reading from the shared UDP socket while the datagrams queued on all
+// sockets of the local endpoint exceed the given number of bytes. Excess
+// datagrams are left in the kernel receive buffer. Reading resumes when the
+// queued datagrams have been consumed below the threshold.
+//
+// A threshold of zero disables flow control.
+
+class receive_pause
+{
+public:
+    explicit receive_pause(std::size_t bytes = 0)
+        : bytes_(bytes)
+    {
+    }
+
+    std::size_t bytes() const { return bytes_; }
+
+private:
+    std::size_t bytes_;
+};
+
+// Let the kernel coalesce consecutive datagrams from the same remote
+// endpoint into a single buffer (UDP generic receive offload). Coalesced
+// datagrams are split into the original datagrams before they are queued on
+// the socket. The original datagrams share the storage of the coalesced
+// buffer, which is recycled when the last of them is released.
+//
+// Coalesced buffers can be up to 64 KiB, so batched receives should use
+// slots of that size to avoid truncation.
+
+class receive_offload
+{
+public:
+    explicit receive_offload(bool enabled = false)
+        : enabled_(enabled)
+    {
+    }
+
+    bool enabled() const { return enabled_; }
+
+private:
+    bool enabled_;
+};
+
+// Expire sockets whose remote endpoint has been silent, so that no datagrams
+// have been received from or sent to it, for the given duration.
+//
+// An expired socket no longer receives datagrams, so later datagrams from
+// its remote endpoint are accepted as a new connection. Pending receive
+// requests on the expired socket fail with the timed_out error, as do later
+// receive requests once the queued datagrams have been consumed.
+//
+// Silence is detected with the given resolution. A timeout of zero disables
+// expiry. get_option() also reports the number of expired sockets.
+
+class idle_timeout
+{
+public:
+    using duration = std::chrono::steady_clock::duration;
+
+    explicit idle_timeout(duration timeout = duration::zero(),
+                          duration resolution = std::chrono::milliseconds(100))
+        : timeout_(timeout),
+          resolution_(resolution)
+    {
+    }
+
+    duration timeout() const { return timeout_; }
+    duration resolution() const { return resolution_; }
+
+    std::size_t expired() const { return expired_; }
+    void expired(std::size_t value) { expired_ = value; }
+
+private:
+    duration timeout_;
+    duration resolution_;
+    std::size_t expired_ = 0;
+};
+
+// Snapshot of the activity of all sockets that share the local endpoint.
+// Only available through get_option().
+//
+// Counters are cumulative, whereas gauges report the current value. The
+// snapshot can be taken from any thread, but the values are read one at a
+// time, so they need not be mutually consistent.
+//
+// Defining TRIAL_DATAGRAM_NO_STATISTICS removes the counting overhead, in
+// which case all counters and the sockets and listen_depth gauges are zero.
+//
+// A sharded acceptor reports the sum over its shards.
+
+class statistics
+{
+public:
+    // Datagrams read from the UDP socket, after splitting coalesced ones
+    std::uint64_t datagrams_received() const { return datagrams_received_; }
+    std::uint64_t bytes_received() const { return bytes_received_; }
+    // Datagrams that the kernel has accepted for sending
+    std::uint64_t datagrams_sent() const { return datagrams_sent_; }
+    std::uint64_t bytes_sent() const { return bytes_sent_; }
+    // Datagrams cut short by a batched receive
+    std::uint64_t truncated() const { return truncated_; }
+    // Datagrams from remote endpoints without a socket
+    std::uint64_t unknown() const { return unknown_; }
+    // Datagrams dropped by the listen backlog or by socket receive queues
+    std::uint64_t listen_dropped() const { return listen_dropped_; }
+    std::uint64_t queue_dropped() const { return queue_dropped_; }
+    // Sockets expired by the idle timeout
+    std::uint64_t expired() const { return expired_; }
+    // Failed system calls, excluding cancellation
+    std::uint64_t receive_errors() const { return receive_errors_; }
+    std::uint64_t send_errors() const { return send_errors_; }
+    // Number of times that reading was paused by flow control
+    std::uint64_t receive_pauses() const { return receive_pauses_; }
+
+    // Gauges
+    std::uint64_t sockets() const { return sockets_; }
+    std::uint64_t listen_depth() const { return listen_depth_; }
+    std::uint64_t queued_bytes() const { return queued_bytes_; }
+    bool receive_paused() const { return receive_paused_; }
+
+    // Accumulate the snapshot of another local endpoint
+    statistics& operator+=(const statistics& other)
+    {
+        datagrams_received_ += other.datagrams_received_;
+        bytes_received_ += other.bytes_received_;
+        datagrams_sent_ += other.datagrams_sent_;
+        bytes_sent_ += other.bytes_sent_;
+        truncated_ += other.truncated_;
+        unknown_ += other.unknown_;
+        listen_dropped_ += other.listen_dropped_;
+        queue_dropped_ += other.queue_dropped_;
+        expired_ += other.expired_;
+        receive_errors_ += other.receive_errors_;
+        send_errors_ += other.send_errors_;
+        receive_pauses_ += other.receive_pauses_;
+        sockets_ += other.sockets_;
+        listen_depth_ += other.listen_depth_;
+        queued_bytes_ += other.queued_bytes_;
+        receive_paused_ = receive_paused_ || other.receive_paused_;
+        return *this;
+    }
+
+private:
+    template <typename> friend class detail::basic_multiplexer;
+
+    std::uint64_t datagrams_received_ = 0;
+    std::uint64_t bytes_received_ = 0;
+    std::uint64_t datagrams_sent_ = 0;
+    std::uint64_t bytes_sent_ = 0;
+    std::uint64_t truncated_ = 0;
+    std::uint64_t unknown_ = 0;
+    std::uint64_t listen_dropped_ = 0;
+    std::uint64_t queue_dropped_ = 0;
+    std::uint64_t expired_ = 0;
+    std::uint64_t receive_errors_ = 0;
+    std::uint64_t send_errors_ = 0;
+    std::uint64_t receive_pauses_ = 0;
+    std::uint64_t sockets_ = 0;
+    std::uint64_t listen_depth_ = 0;
+    std::uint64_t queued_bytes_ = 0;
+    bool receive_paused_ = false;
+};
+
+// Snapshot of the activity of a single socket. Only available through
+// get_option() on a socket.
+
+class socket_statistics
+{
+public:
+    // Datagrams delivered to the socket
+    std::uint64_t datagrams_received() const { return datagrams_received_; }
+    std::uint64_t bytes_received() const { return bytes_received_; }
+    // Datagrams requested to be sent
+    std::uint64_t datagrams_sent() const { return datagrams_sent_; }
+    std::uint64_t bytes_sent() const { return bytes_sent_; }
+    // Datagrams dropped by the receive queue
+    std::uint64_t dropped() const { return dropped_; }
+
+    // Gauges
+    std::uint64_t queue_depth() const { return queue_depth_; }
+    std::uint64_t queued_bytes() const { return queued_bytes_; }
+
+private:
+    template <typename> friend class datagram::basic_socket;
+
+    std::uint64_t datagrams_received_ = 0;
+    std::uint64_t bytes_received_ = 0;
+    std::uint64_t datagrams_sent_ = 0;
+    std::uint64_t bytes_sent_ = 0;
+    std::uint64_t dropped_ = 0;
+    std::uint64_t queue_depth_ = 0;
+    std::uint64_t queued_bytes_ = 0;
+};
+
+// Record the time at which the kernel received each datagram
+// (SO_TIMESTAMPNS).
+//
+// The arrival time is reported by datagram::buffer::timestamp() on datagrams
+// received with the owned-buffer async_receive(). The latency of the receive
+// path is recorded in the receive_latency histograms while the option is
+// enabled.
+//
+// Fails with operation_not_supported if the platform has no kernel receive
+// timestamps.
+
+class receive_timestamp
+{
+public:
+    explicit receive_timestamp(bool enabled = false)
+        : enabled_(enabled)
+    {
+    }
+
+    bool enabled() const { return enabled_; }
+
+private:
+    bool enabled_;
+};
+
+// Distribution of latencies with nanosecond resolution.
+//
+// Latencies below 8 ns have a bucket each. Larger latencies are grouped
+// into 8 buckets per power of two, so a bucket is never wider than 1/8 of
+// its lower bound.
+
+class latency_histogram
+{
+public:
+    using duration = std::chrono::nanoseconds;
+
+    static constexpr std::size_t bucket_count = 488;
+
+    static std::size_t bucket(duration latency)
+    {
+        if (latency.count() < 8)
+            return (latency.count() < 0) ? 0 : static_cast<std::size_t>(latency.count());
+        const auto value = static_cast<std::uint64_t>(latency.count());
+        std::size_t msb = 63;
+        while (!(value >> msb))
+            --msb;
+        return (msb - 2) * 8 + ((value >> (msb - 3)) & 7);
+    }
+
+    // Largest latency in the bucket
+    static duration upper_bound(std::size_t bucket)
+    {
+        if (bucket < 8)
+            return duration(bucket);
+        const auto shift = bucket / 8 - 1;
+        const std::uint64_t lower = std::uint64_t(8 + bucket % 8) << shift;
+        return duration(static_cast<duration::rep>(lower + (std::uint64_t(1) << shift) - 1));
+    }
+
+    latency_histogram()
+        : counts_(bucket_count, 0)
+    {
+    }
+
+    // Number of recorded latencies
+    std::uint64_t count() const
+    {
+        std::uint64_t result = 0;
+        for (auto value : counts_)
+        {
+            result += value;
+        }
+        return result;
+    }
+
+    std::uint64_t count(std::size_t bucket) const { return counts_[bucket]; }
+
+    // Upper bound of the bucket that contains the given fraction, between 0
+    // and 1, of the recorded latencies
+    duration percentile(double fraction) const
+    {
+        const auto total = count();
+        if (total == 0)
+            return duration::zero();
+        auto rank = static_cast<std::uint64_t>(fraction * total + 0.5);
+        rank = std::max<std::uint64_t>(1, std::min(rank, total));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucket_count; ++i)
+        {
+            seen += counts_[i];
+            if (seen >= rank)
+                return upper_bound(i);
+        }
+        return upper_bound(bucket_count - 1);
+    }
+
+    latency_histogram& operator+=(const latency_histogram& other)
+    {
+        for (std::size_t i = 0; i < bucket_count; ++i)
+        {
+            counts_[i] += other.counts_[i];
+        }
+        return *this;
+    }
+
+private:
+    template <typename> friend class detail::basic_multiplexer;
+
+    std::vector<std::uint64_t> counts_;
+};
+
+// Latency of the receive path of all sockets that share the local endpoint.
+// Only available through get_option(), and only recorded while the
+// receive_timestamp option is enabled.
+//
+// kernel_to_demux covers the time from the arrival of a datagram in the
+// kernel until the multiplexer has read it and looks up its recipient. It is
+// measured against the system clock, so clock adjustments distort it.
+//
+// demux_to_handler covers the time from then until the datagram is handed to
+// a receive request, including the time spent in the socket receive queue.
+//
+// Defining TRIAL_DATAGRAM_NO_STATISTICS removes the histograms, in which
+// case they are empty. A sharded acceptor reports the sum over its shards.
+
+class receive_latency
+{
+public:
+    const latency_histogram& kernel_to_demux() const { return kernel_to_demux_; }
+    const latency_histogram& demux_to_handler() const { return demux_to_handler_; }
+
+    receive_latency& operator+=(const receive_latency& other)
+    {
+        kernel_to_demux_ += other.kernel_to_demux_;
+        demux_to_handler_ += other.demux_to_handler_;
+        return *this;
+    }
+
+private:
+    template <typename> friend class detail::basic_multiplexer;
+
+    latency_histogram kernel_to_demux_;
+    latency_histogram demux_to_handler_;
+};
+
+// I/O backend of a local endpoint. The backend is chosen by the acceptor or
+// socket that creates the local endpoint and cannot be changed afterwards.
+//
+//   reactor  Readiness notification from the io_context followed by
+//            non-blocking system calls.
+//   uring    io_uring (Linux 6.0 or later). Datagrams are received by a
+//            multishot receive into a ring of count provided buffers of the
+//            given size, and sends are submitted in batches. Datagrams
+//            larger than the buffer size are truncated and reported with
+//            the message_size error.
+//
+// The receive_batch and send_batch options have no effect with the uring
+// backend. get_option() reports the backend in use.
+
+class io_backend
+{
+public:
+    enum type
+    {
+        reactor,
+        uring
+    };
+
+    static constexpr std::size_t default_count = 256;
+    static constexpr std::size_t default_size = 2048;
+
+    explicit io_backend(type backend = reactor,
+                        std::size_t count = default_count,
+                        std::size_t size = default_size)
+        : backend_(backend),
+          count_(count),
+          size_(size)
+    {
+    }
+
+    type backend() const { return backend_; }
+    std::size_t count() const { return count_; }
+    std::size_t size() const { return size_; }
+
+private:
+    type backend_;
+    std::size_t count_;
+    std::size_t size_;
+};
+
+// Give sockets their own UDP socket, which is bound to the local endpoint
+// with SO_REUSEPORT and connected to the remote endpoint. The kernel then
+// demultiplexes the datagrams of the remote endpoint, the socket has its own
+// receive buffer, and sends avoid a route lookup. Datagrams that are already
+// queued on the shared UDP socket are still delivered.
+//
+//   never   Keep all remote endpoints on the shared UDP socket.
+//   always  Promote sockets when they are accepted or connected.
+//   after   Promote sockets when they have received the given number of
+//           datagrams via the shared UDP socket.
+//
+// Promoted sockets send directly rather than via send batching, and may
+// report connection_refused if the remote endpoint is unreachable.
+// get_option() also reports the number of promoted sockets and failed
+// promotions.
+//
+// SO_REUSEPORT must be set on the shared UDP socket before it is bound, so
+// promotion is only supported by acceptors that were constructed with this
+// option, and by sharded acceptors. Otherwise set_option() fails with
+// operation_not_supported.
+
+class peer_promotion
+{
+public:
+    enum policy_type
+    {
+        never,
+        always,
+        after
+    };
+
+    explicit peer_promotion(policy_type policy = never,
+                            std::size_t datagrams = 0)
+        : policy_(policy),
+          datagrams_(datagrams)
+    {
+    }
+
+    policy_type policy() const { return policy_; }
+    std::size_t datagrams() const { return datagrams_; }
+
+    std::size_t promoted() const { return promoted_; }
+    std::size_t failed() const { return failed_; }
+
+    void counters(std::size_t promoted,
+                  std::size_t failed)
+    {
+        promoted_ = promoted;
+        failed_ = failed;
+    }
+
+private:
+    policy_type policy_;
+    std::size_t datagrams_;
+    std::size_t promoted_ = 0;
+    std::size_t failed_ = 0;
+};
+
+// Cache the endpoints that async_connect() resolves a host and service name
+// to for the given duration, so that later connects to the same target skip
+// resolution. Concurrent resolutions of the same host and service name are
+// coalesced into one, whether or not the results are cached. Failed
+// resolutions are not cached.
+//
+// The cache is shared by all sockets of the io_context. A duration of zero
+// disables caching and clears the cache. get_option() also reports cache
+// hits, misses, and coalesced resolutions.
+
+class resolve_cache
+{
+public:
+    using duration = std::chrono::steady_clock::duration;
+
+    explicit resolve_cache(duration ttl = duration::zero())
+        : ttl_(ttl)
+    {
+    }
+
+    duration ttl() const { return ttl_; }
+
+    std::size_t hits() const { return hits_; }
+    std::size_t misses() const { return misses_; }
+    std::size_t coalesced() const { return coalesced_; }
+
+    void counters(std::size_t hits,
+                  std::size_t misses,
+                  std::size_t coalesced)
+    {
+        hits_ = hits;
+        misses_ = misses;
+        coalesced_ = coalesced;
+    }
+
+private:
+    duration ttl_;
+    std::size_t hits_ = 0;
+    std::size_t misses_ = 0;
+    std::size_t coalesced_ = 0;
+};
+
+// The address family that async_connect() tries first when a host name
+// resolves to both IPv4 and IPv6 endpoints. Otherwise the endpoints are
+// tried in the order returned by the resolver.
+//
+// This option applies to a single socket.
+
+class address_family
+{
+public:
+    enum family_type
+    {
+        any,
+        ipv4,
+        ipv6
+    };
+
+    explicit address_family(family_type family = any)
+        : family_(family)
+    {
+    }
+
+    family_type family() const { return family_; }
+
+private:
+    family_type family_;
+};
+
+// Carry datagrams between local endpoints on the same host through shared
+// memory rather than through the kernel UDP stack.
+//
+// The local endpoint gets a ring of the given number of slots in a
+// shared-memory segment, which other processes can map as well. Datagrams
+// sent to a loopback endpoint whose local endpoint has enabled this option
+// are copied into its ring without a system call. A receiver that has run
+// out of datagrams is woken up via a Unix domain socket, so only the first
+// datagram of a burst costs a system call.
+//
+// Both ends must enable the option, and the local endpoint must have a
+// loopback or unspecified address. Datagrams that are larger than a slot,
+// or that find the ring full, are sent via UDP and may therefore overtake
+// earlier datagrams. get_option() also reports the number of datagrams
+// sent and received via rings, and the number sent via UDP instead.
+
+class local_transport
+{
+public:
+    static constexpr std::size_t default_slots = 1024;
+    static constexpr std::size_t default_slot_size = 2048;
+
+    explicit local_transport(bool enabled = false,
+                             std::size_t slots = default_slots,
+                             std::size_t slot_size = default_slot_size)
+        : enabled_(enabled),
+          slots_(slots),
+          slot_size_(slot_size)
+    {
+    }
+
+    bool enabled() const { return enabled_; }
+    std::size_t slots() const { return slots_; }
+    std::size_t slot_size() const { return slot_size_; }
+
+    std::size_t sent() const { return sent_; }
+    std::size_t received() const { return received_; }
+    std::size_t fallbacks() const { return fallbacks_; }
+
+    void counters(std::size_t sent,
+                  std::size_t received,
+                  std::size_t fallbacks)
+    {
+        sent_ = sent;
+        received_ = received;
+        fallbacks_ = fallbacks;
+    }
+
+private:
+    bool enabled_;
+    std::size_t slots_;
+    std::size_t slot_size_;
+    std::size_t sent_ = 0;
+    std::size_t received_ = 0;
+    std::size_t fallbacks_ = 0;
+};
+
+// Hand datagrams to sockets that run on another executor than the local
+// endpoint via a queue per worker executor, rather than queueing them on
+// the socket and invoking receive handlers from the thread that reads the
+// UDP socket.
+//
+// The threads running the executor of the local endpoint then only read
+// and demultiplex datagrams. Each worker is notified once per burst, and
+// queues the datagrams on its sockets and invokes their receive handlers
+// itself. The executor of a socket is the one that it was constructed with.
+// The option applies to sockets that are accepted or connected after it
+// has been enabled. get_option() also reports the number of datagrams
+// handed to workers and the number of worker notifications.
+
+class worker_delivery
+{
+public:
+    explicit worker_delivery(bool enabled = false)
+        : enabled_(enabled)
+    {
+    }
+
+    bool enabled() const { return enabled_; }
+
+    std::size_t delivered() const { return delivered_; }
+    std::size_t notifications() const { return notifications_; }
+
+    void counters(std::size_t delivered,
+                  std::size_t notifications)
+    {
+        delivered_ = delivered;
+        notifications_ = notifications;
+    }
+
+private:
+    bool enabled_;
+    std::size_t delivered_ = 0;
+    std::size_t notifications_ = 0;
+};
+
+// Pace outgoing datagrams with token buckets, so bursts do not overflow the
+// kernel send buffer or the receive buffers downstream.
+//
+// The aggregate bucket limits all sends from the local endpoint to rate
+// octets per second, and each socket has its own bucket of socket_rate
+// octets per second. A bucket holds up to burst octets, which can be sent
+// at once after a quiet period. A rate of zero leaves that bucket unlimited.
+//
+// Sends that exceed a bucket are deferred and released in order by a single
+// timer. A socket with deferred sends defers its later sends as well.
+// Non-blocking sends fail with would_block instead. The aggregate rate is
+// also passed to the kernel where supported, which enforces it when the fq
+// queueing discipline is used.
+//
+// get_option() also reports the number of deferred sends, and the total and
+// longest time that they were deferred.
+
+class send_pacing
+{
+public:
+    using duration = std::chrono::steady_clock::duration;
+
+    static constexpr std::size_t default_burst = 64 * 1024;
+
+    explicit send_pacing(std::size_t rate = 0,
+                         std::size_t burst = default_burst,
+                         std::size_t socket_rate = 0,
+                         std::size_t socket_burst = default_burst)
+        : rate_(rate),
+          burst_(burst),
+          socket_rate_(socket_rate),
+          socket_burst_(socket_burst)
+    {
+    }
+
+    std::size_t rate() const { return rate_; }
+    std::size_t burst() const { return burst_; }
+    std::size_t socket_rate() const { return socket_rate_; }
+    std::size_t socket_burst() const { return socket_burst_; }
+
+    std::size_t deferred() const { return deferred_; }
+    duration total_delay() const { return total_delay_; }
+    duration max_delay() const { return max_delay_; }
+
+    void counters(std::size_t deferred,
+                  duration total_delay,
+                  duration max_delay)
+    {
+        deferred_ = deferred;
+        total_delay_ = total_delay;
+        max_delay_ = max_delay;
+    }
+
+private:
+    std::size_t rate_;
+    std::size_t burst_;
+    std::size_t socket_rate_;
+    std::size_t socket_burst_;
+    std::size_t deferred_ = 0;
+    duration total_delay_ = duration::zero();
+    duration max_delay_ = duration::zero();
+};
+
+// Subscribe a socket to the datagrams of a multicast group.
+//
+// The local endpoint of the socket must be the group address and port. Its
+// UDP socket is bound to the group address, so it only receives datagrams
+// that were sent to the group. The group is joined on the given interface,
+// or on the default interface if the address is unspecified, when the first
+// subscriber of that interface is added, and left when the last one is
+// removed.
+//
+// Every datagram of the local endpoint is then received once and handed to
+// all subscribers, which share the same read-only storage. Such datagrams
+// are not demultiplexed by remote endpoint. The receive queue of a
+// subscriber is limited to queue_limit datagrams, unless receive_queue is
+// smaller, so a slow subscriber drops datagrams instead of holding on to the
+// storage of all of them. The previous limit is restored when the socket is
+// unsubscribed. Subscribers are served by the executor of the local
+// endpoint.
+//
+// get_option() also reports the number of subscribers of the local endpoint
+// and the number of datagrams that have been handed to them.
+
+class multicast_subscription
+{
+public:
+    using address_type = boost::asio::ip::address;
+
+    static constexpr std::size_t default_queue_limit = 1024;
+
+    explicit multicast_subscription(bool enabled = false,
+                                    const address_type& network_interface = address_type(),
+                                    std::size_t queue_limit = default_queue_limit)
+        : enabled_(enabled),
+          network_interface_(network_interface),
+          queue_limit_(queue_limit)
+    {
+    }
+
+    bool enabled() const { return enabled_; }
+    const address_type& network_interface() const { return network_interface_; }
+    std::size_t queue_limit() const { return queue_limit_; }
+
+    std::size_t subscribers() const { return subscribers_; }
+    std::size_t datagrams() const { return datagrams_; }
+
+    void counters(std::size_t subscribers,
+                  std::size_t datagrams)
+    {
+        subscribers_ = subscribers;
+        datagrams_ = datagrams;
+    }
+
+private:
+    bool enabled_;
+    address_type network_interface_;
+    std::size_t queue_limit_;
+    std::size_t subscribers_ = 0;
+    std::size_t datagrams_ = 0;
+};
+
+} // namespace option
+} // namespace datagram
+} // namespace trial
+
+#endif // TRIAL_DATAGRAM_OPTION_HPP
@@ -13,40 +13,54 @@
 
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <tuple>
 #include <queue>
+#include <vector>
 #include <boost/asio/basic_io_object.hpp>
 #include <boost/asio/ip/udp.hpp> // resolver
 #include <trial/net/io_context.hpp>
 #include <trial/net/executor.hpp>
 #include <trial/datagram/detail/socket_base.hpp>
 #include <trial/datagram/detail/service.hpp>
+#include <trial/datagram/detail/operation.hpp>
+#include <trial/datagram/detail/statistics.hpp>
+#include <trial/datagram/buffer.hpp>
 #include <trial/datagram/endpoint.hpp>
+#include <trial/datagram/option.hpp>
 
 namespace trial
 {
 namespace datagram
 {
-namespace detail { class multiplexer; }
+template <typename> class basic_acceptor;
 
-class acceptor;
+// Datagram socket that shares a local endpoint with other sockets.
+//
+// The next layer is the socket type that the local endpoint is read from,
+// which is a UDP socket unless a fake transport is used for testing.
 
-class socket
+template <typename NextLayer>
+class basic_socket
     : public detail::socket_base,
-      public boost::asio::basic_io_object<detail::service<protocol>>
+      public boost::asio::basic_io_object<detail::service<protocol, NextLayer>>
 {
-    using service_type = detail::service<protocol>;
-    using resolver_type = protocol::resolver;
+    using service_type = detail::service<protocol, NextLayer>;
+    using multiplexer_type = typename service_type::multiplexer_type;
+    using resolve_results = typename detail::resolve_cache<protocol>::results_type;
 
 public:
-    socket(socket&&);
+    using next_layer_type = NextLayer;
+
+    basic_socket(basic_socket&&);
 
-    socket(const net::executor&);
+    basic_socket(const net::executor&);
 
-    socket(const net::executor&,
-           const endpoint_type& local_endpoint);
+    basic_socket(const net::executor&,
+                 const endpoint_type& local_endpoint,
+                 const option::io_backend& = option::io_backend());
 
-    virtual ~socket();
+    virtual ~basic_socket();
 
     template <typename CompletionToken>
     auto async_connect(const endpoint_type& remote_endpoint,
@@ -62,11 +76,45 @@ public:
     auto async_receive(const MutableBufferSequence& buffers,
                        CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>;
 
+    // Receive a datagram without copying it. The completion handler takes
+    // ownership of the received datagram.
+    template <typename CompletionToken>
+    auto async_receive(CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code, datagram::buffer)>;
+
+    // Receive up to max_count datagrams as owned buffers. Completes as soon
+    // as at least one datagram is available.
+    template <typename CompletionToken>
+    auto async_receive_batch(std::size_t max_count,
+                             CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code, std::vector<datagram::buffer>)>;
+
+    // Receive a queued datagram without waiting. Fails with would_block if
+    // no datagram is queued.
+    template <typename MutableBufferSequence>
+    std::size_t try_receive(const MutableBufferSequence& buffers,
+                            boost::system::error_code&);
+
+    datagram::buffer try_receive(boost::system::error_code&);
+
     template <typename ConstBufferSequence,
               typename CompletionToken>
     auto async_send(const ConstBufferSequence& buffers,
                     CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>;
 
+    // Send buffers as consecutive datagrams of segment_size bytes, where
+    // the last datagram may be shorter. The kernel performs the segmentation
+    // (UDP_SEGMENT), so the whole sequence costs a single system call.
+    template <typename ConstBufferSequence,
+              typename CompletionToken>
+    auto async_send_segments(const ConstBufferSequence& buffers,
+                             std::size_t segment_size,
+                             CompletionToken&& token) -> net::async_result_t<CompletionToken, void(boost::system::error_code, std::size_t)>;
+
+    // Send a datagram without waiting. Fails with would_block if the kernel
+    // cannot accept the datagram immediately.
+    template <typename ConstBufferSequence>
+    std::size_t try_send(const ConstBufferSequence& buffers,
+                         boost::system::error_code&);
+
     endpoint_type local_endpoint() const;
     using detail::socket_base::remote_endpoint;
 
@@ -79,16 +127,77 @@ public:
     void set_option(const SettableSocketOption& option,
                     boost::system::error_code&);
 
+    template <typename GettableSocketOption>
+    void get_option(GettableSocketOption& option) const;
+
+    template <typename GettableSocketOption>
+    void get_option(GettableSocketOption& option,
+                    boost::system::error_code&) const;
+
+    void set_option(const option::receive_queue& option,
+                    boost::system::error_code&);
+    void get_option(option::receive_queue& option,
+                    boost::system::error_code&) const;
+    void set_option(const option::receive_immediate& option,
+                    boost::system::error_code&);
+    void get_option(option::receive_immediate& option,
+                    boost::system::error_code&) const;
+    void get_option(option::socket_statistics& option,
+                    boost::system::error_code&) const;
+    void set_option(const option::address_family& option,
+                    boost::system::error_code&);
+    void get_option(option::address_family& option,
+                    boost::system::error_code&) const;
+    void set_option(const option::resolve_cache& option,
+                    boost::system::error_code&);
+    void get_option(option::resolve_cache& option,
+                    boost::system::error_code&) const;
+    void set_option(const option::multicast_subscription& option,
+                    boost::system::error_code&);
+    void get_option(option::multicast_subscription& option,
+                    boost::system::error_code&) const;
+
 private:
-    friend class detail::multiplexer;
-    friend class acceptor;
+    friend multiplexer_type;
+    friend class basic_acceptor<NextLayer>;
 
-    void set_multiplexer(std::shared_ptr<detail::multiplexer> multiplexer);
+    void set_multiplexer(std::shared_ptr<multiplexer_type> multiplexer);
 
-    virtual void enqueue(const boost::system::error_code& error,
-                         std::unique_ptr<detail::buffer> datagram) override;
+    virtual bool enqueue(const boost::system::error_code& error,
+                         detail::buffer datagram,
+                         detail::completion_list&) override;
+    virtual void expire(detail::completion_list&) override;
+    virtual std::size_t pending_receives() const override;
+    virtual net::executor handler_executor() const override;
 
 private:
+    using receive_operation = detail::receive_operation;
+    using receive_output_type = std::tuple<boost::system::error_code, detail::buffer>;
+
+    template <typename MutableBufferSequence,
+              typename ReadHandler>
+    class copy_receive_handler;
+
+    template <typename ReceiveHandler>
+    class owned_receive_handler;
+
+    template <typename ReceiveHandler>
+    class batch_receive_handler;
+
+    template <typename WriteHandler>
+    class send_handler;
+
+    void start_receive(detail::operation_pointer<receive_operation>);
+    bool try_dequeue(receive_output_type&,
+                     boost::system::error_code&);
+    template <typename Handler>
+    bool dequeue_immediate(const Handler&,
+                           receive_output_type&);
+    receive_output_type dequeue();
+    void dequeue_batch(std::vector<datagram::buffer>&,
+                       std::size_t max_count);
+    void count_dropped();
+
     template <typename Handler,
               typename ErrorCode>
     void invoke_handler(Handler&& handler,
@@ -106,33 +215,68 @@ private:
                          ConnectHandler&& handler);
 
     template <typename ConnectHandler>
-    void async_next_connect(resolver_type::iterator where,
-                            std::shared_ptr<resolver_type> resolver,
+    void async_next_connect(std::size_t where,
+                            std::shared_ptr<resolve_results> endpoints,
                             ConnectHandler&& handler);
 
     template <typename ConnectHandler>
     void process_next_connect(const boost::system::error_code& error,
-                              resolver_type::iterator where,
-                              std::shared_ptr<resolver_type> resolver,
+                              std::size_t where,
+                              std::shared_ptr<resolve_results> endpoints,
                               ConnectHandler&& handler);
 
+    template <typename MutableBufferSequence>
+    static std::size_t copy_receive(const boost::system::error_code& error,
+                                    const detail::buffer& datagram,
+                                    const MutableBufferSequence&);
+
     template <typename MutableBufferSequence,
               typename ReadHandler>
-    void process_receive(const boost::system::error_code& error,
-                         const detail::buffer& datagram,
-                         const MutableBufferSequence&,
-                         ReadHandler&&);
+    static void process_receive(const boost::system::error_code& error,
+                                const detail::buffer& datagram,
+                                const MutableBufferSequence&,
+                                ReadHandler&);
+
+    template <typename ReceiveHandler>
+    static void process_receive(const boost::system::error_code& error,
+                                detail::buffer datagram,
+                                ReceiveHandler&);
+
+    template <typename ReceiveHandler>
+    void process_receive_batch(const boost::system::error_code& error,
+                               detail::buffer datagram,
+                               std::size_t max_count,
+                               ReceiveHandler&);
+
+    static datagram::buffer make_buffer(const boost::system::error_code& error,
+                                        detail::buffer datagram);
 
 private:
-    std::shared_ptr<detail::multiplexer> multiplexer;
+    std::shared_ptr<multiplexer_type> multiplexer;
 
-    using read_handler_type = std::function<void (const boost::system::error_code&, std::size_t)>;
-    using receive_input_type = std::tuple<boost::asio::mutable_buffer, read_handler_type>;
-    using receive_output_type = std::tuple<boost::system::error_code, std::unique_ptr<detail::buffer>>;
-    std::queue<std::unique_ptr<receive_input_type>> receive_input_queue;
-    std::queue<std::unique_ptr<receive_output_type>> receive_output_queue;
+    // Protects the receive queues, which are reached both from the
+    // multiplexer and from the initiating functions
+    mutable std::mutex mutex;
+    detail::operation_queue<receive_operation> receive_input_queue;
+    std::queue<receive_output_type> receive_output_queue;
+    std::size_t receive_queued_bytes = 0;
+    std::size_t receive_dropped = 0;
+    option::receive_queue receive_limit;
+    // Datagram limit of receive_limit before a multicast subscription
+    // bounded it, or zero if it has not been bounded
+    std::size_t unsubscribed_datagrams = 0;
+    bool receive_immediate = false;
+    // Address family tried first when connecting to a host name
+    option::address_family connect_family;
+    // Receive requests that have been posted to take a queued datagram
+    std::size_t receive_posted = 0;
+    // The remote endpoint has been silent for too long
+    bool expired = false;
+    detail::socket_statistics stats;
 };
 
+using socket = basic_socket<protocol::socket>;
+
 } // namespace datagram
 } // namespace trial
 
@@ -0,0 +1,340 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Checks that queued receive, send and accept operations do not allocate.
+//
+// Clients send datagrams over loopback to an acceptor whose sockets run a
+// receive, handler and re-receive loop, half of them with the copying and
+// half with the owned-buffer async_receive. The sockets then echo every
+// datagram with async_send, first one datagram at a time and then with
+// batched sending. New clients are accepted by an accept, handler and
+// re-accept loop.
+//
+// After a warm-up, the global operator new is counted while the io_context
+// runs, and the test fails if any allocation is made. The sockets are
+// constructed in advance, and the endpoint table has room for the accepted
+// sockets, so only the operations themselves are measured. Every accepted
+// socket replaces an older one, so the number of pending operations stays
+// the same as in a server whose sessions come and go.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <trial/net/io_context.hpp>
+#include <trial/datagram/acceptor.hpp>
+#include <trial/datagram/socket.hpp>
+
+namespace
+{
+
+// Number of calls to the global operator new
+std::atomic<std::uint64_t> allocations(0);
+
+} // anonymous namespace
+
+void *operator new(std::size_t size)
+{
+    ++allocations;
+    if (void *result = std::malloc(size ? size : 1))
+        return result;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+namespace
+{
+
+const std::size_t client_count = 32;
+const int warmup_rounds = 16;
+const int measured_rounds = 64;
+
+class server
+{
+public:
+    server(const trial::net::executor& executor,
+           std::size_t capacity)
+        : acceptor(executor, trial::datagram::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+    {
+        for (std::size_t i = 0; i < capacity; ++i)
+        {
+            sockets.emplace_back(new trial::datagram::socket(executor));
+        }
+        accept();
+    }
+
+    trial::datagram::endpoint local_endpoint() const { return acceptor.local_endpoint(); }
+
+    std::size_t received() const { return receive_count; }
+    std::size_t sent() const { return send_count; }
+    std::size_t accepted() const { return next; }
+
+    // Reply to every received datagram
+    void echo(bool enable)
+    {
+        echoing = enable;
+    }
+
+    void send_batch(std::size_t count)
+    {
+        acceptor.set_option(trial::datagram::option::send_batch(count));
+    }
+
+    // Close sockets whose remote endpoints will be accepted again
+    void close(std::size_t first, std::size_t last)
+    {
+        for (std::size_t i = first; i < last; ++i)
+        {
+            sockets[i].reset();
+        }
+    }
+
+    // Close the oldest open socket whenever a socket is accepted
+    void replace()
+    {
+        replacing = true;
+    }
+
+private:
+    void accept()
+    {
+        if (next == sockets.size())
+            return;
+        auto index = next;
+        acceptor.async_accept(
+            *sockets[index],
+            [this, index] (const boost::system::error_code& error)
+            {
+                if (error)
+                    return;
+                ++next;
+                if (replacing)
+                {
+                    while (!sockets[oldest])
+                    {
+                        ++oldest;
+                    }
+                    sockets[oldest].reset();
+                }
+                receive(index);
+                accept();
+            });
+    }
+
+    void receive(std::size_t index)
+    {
+        auto& socket = *sockets[index];
+        if (index % 2 == 0)
+        {
+            socket.async_receive(
+                boost::asio::buffer(buffer),
+                [this, index] (const boost::system::error_code& error,
+                               std::size_t)
+                {
+                    if (error)
+                        return;
+                    ++receive_count;
+                    send(index);
+                    receive(index);
+                });
+        }
+        else
+        {
+            socket.async_receive(
+                [this, index] (const boost::system::error_code& error,
+                               trial::datagram::buffer)
+                {
+                    if (error)
+                        return;
+                    ++receive_count;
+                    send(index);
+                    receive(index);
+                });
+        }
+    }
+
+    void send(std::size_t index)
+    {
+        if (!echoing)
+            return;
+        sockets[index]->async_send(
+            boost::asio::buffer(buffer, 16),
+            [this] (const boost::system::error_code& error,
+                    std::size_t)
+            {
+                if (error)
+                    return;
+                ++send_count;
+            });
+    }
+
+private:
+    trial::datagram::acceptor acceptor;
+    std::vector<std::unique_ptr<trial::datagram::socket>> sockets;
+    std::size_t next = 0;
+    bool replacing = false;
+    bool echoing = false;
+    std::size_t oldest = 0;
+    std::size_t receive_count = 0;
+    std::size_t send_count = 0;
+    char buffer[64];
+};
+
+class clients
+{
+public:
+    clients(boost::asio::io_context& io,
+            const trial::datagram::endpoint& remote_endpoint,
+            std::size_t count)
+        : remote_endpoint(remote_endpoint)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            sockets.emplace_back(new boost::asio::ip::udp::socket(io, trial::datagram::endpoint(remote_endpoint.address(), 0)));
+        }
+    }
+
+    void send(std::size_t first, std::size_t last)
+    {
+        const char payload[16] = {};
+        for (std::size_t i = first; i < last; ++i)
+        {
+            sockets[i]->send_to(boost::asio::buffer(payload), remote_endpoint);
+        }
+    }
+
+    // Discard the replies
+    void drain()
+    {
+        char payload[64];
+        for (auto& socket : sockets)
+        {
+            while (socket->available() > 0)
+            {
+                socket->receive(boost::asio::buffer(payload));
+            }
+        }
+    }
+
+private:
+    trial::datagram::endpoint remote_endpoint;
+    std::vector<std::unique_ptr<boost::asio::ip::udp::socket>> sockets;
+};
+
+// Runs the io_context until the condition holds, and returns the number
+// of allocations made meanwhile
+template <typename Condition>
+std::uint64_t run_until(trial::net::io_context& io,
+                        Condition condition)
+{
+    std::uint64_t result = 0;
+    while (!condition())
+    {
+        const auto before = allocations.load();
+        io.run_one_for(std::chrono::seconds(1));
+        result += allocations.load() - before;
+        if (io.stopped())
+            break;
+    }
+    return result;
+}
+
+} // anonymous namespace
+
+int main()
+{
+    trial::net::io_context io;
+    const auto executor = trial::net::extension::get_executor(io);
+
+    // Warm-up accepts twice the clients, and half of their sockets are then
+    // closed, so the endpoint table does not grow during the measurement
+    server receiver(executor, 3 * client_count);
+    clients senders(io, receiver.local_endpoint(), 2 * client_count);
+
+    std::size_t expected = 0;
+    auto received = [&receiver, &expected] { return receiver.received() >= expected; };
+    for (int round = 0; round < warmup_rounds; ++round)
+    {
+        senders.send(0, 2 * client_count);
+        expected += 2 * client_count;
+        run_until(io, received);
+    }
+    receiver.close(client_count, 2 * client_count);
+    io.poll();
+
+    std::uint64_t receive_allocations = 0;
+    for (int round = 0; round < measured_rounds; ++round)
+    {
+        senders.send(0, client_count);
+        expected += client_count;
+        receive_allocations += run_until(io, received);
+    }
+
+    // Every datagram is echoed, without and with batched sending
+    receiver.echo(true);
+    std::size_t expected_sent = 0;
+    auto echoed = [&receiver, &expected, &expected_sent]
+    {
+        return (receiver.received() >= expected) && (receiver.sent() >= expected_sent);
+    };
+    std::uint64_t send_allocations = 0;
+    for (std::size_t batch : { 1, 8 })
+    {
+        receiver.send_batch(batch);
+        for (int round = 0; round < warmup_rounds + measured_rounds; ++round)
+        {
+            senders.send(0, client_count);
+            expected += client_count;
+            expected_sent += client_count;
+            const auto count = run_until(io, echoed);
+            if (round >= warmup_rounds)
+            {
+                send_allocations += count;
+            }
+            senders.drain();
+        }
+    }
+    receiver.echo(false);
+    receiver.send_batch(1);
+
+    // The closed sockets are accepted again, one at a time
+    receiver.replace();
+    std::uint64_t accept_allocations = 0;
+    for (std::size_t i = client_count; i < 2 * client_count; ++i)
+    {
+        senders.send(i, i + 1);
+        ++expected;
+        accept_allocations += run_until(io, received);
+    }
+
+    const bool complete = (receiver.received() == expected) && (receiver.sent() == expected_sent) && (receiver.accepted() == 3 * client_count);
+    std::cout << "received " << receiver.received() << " of " << expected
+              << ", sent " << receiver.sent() << " of " << expected_sent
+              << ", accepted " << receiver.accepted() << " of " << 3 * client_count << std::endl
+              << "allocations: receive " << receive_allocations
+              << ", send " << send_allocations
+              << ", accept " << accept_allocations << std::endl;
+    return (complete && (receive_allocations == 0) && (send_allocations == 0) && (accept_allocations == 0)) ? 0 : 1;
+}
@@ -0,0 +1,348 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Deterministic stress of the demultiplexer and accept path over the fake
+// network.
+//
+// Many peers send numbered datagrams to an acceptor in a fixed order while
+// the network drops and reorders them. The test replays the decisions of
+// the network with its own generator, seeded like the network, to predict
+// which datagrams are lost or held back. The network counters and the
+// sequence numbers that every accepted socket receives must match the
+// prediction exactly, for several seeds.
+//
+// A scripted burst to a socket with a limited queue must overflow by
+// exactly the surplus, and the rest must arrive in order.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include <trial/net/io_context.hpp>
+#include <trial/datagram/fake_socket.hpp>
+
+namespace
+{
+
+int failures = 0;
+
+void check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        ++failures;
+        std::cerr << "FAIL: " << what << std::endl;
+    }
+}
+
+// Run handlers until none are ready
+void drain(trial::net::io_context& io)
+{
+    io.restart();
+    while (io.poll() > 0)
+    {
+    }
+}
+
+struct message
+{
+    std::uint32_t peer;
+    std::uint32_t sequence;
+};
+
+// Sequence numbers received from each peer
+using log_type = std::map<std::uint32_t, std::vector<std::uint32_t>>;
+
+// Replica of the decisions of the fake network
+class model
+{
+public:
+    model(std::uint32_t seed, double loss, double reorder)
+        : loss(loss),
+          reorder(reorder)
+    {
+        generator.seed(seed);
+    }
+
+    void transmit(const message& datagram)
+    {
+        if (chance(loss))
+        {
+            ++counters.lost;
+            return;
+        }
+        if (!holding && chance(reorder))
+        {
+            ++counters.reordered;
+            holding = true;
+            held = datagram;
+            return;
+        }
+        deliver(datagram);
+        if (holding)
+        {
+            holding = false;
+            deliver(held);
+        }
+    }
+
+    void flush()
+    {
+        if (holding)
+        {
+            holding = false;
+            deliver(held);
+        }
+    }
+
+    trial::datagram::fake_network::counters counters;
+    log_type log;
+
+private:
+    bool chance(double probability)
+    {
+        if (probability <= 0.0)
+            return false;
+        const double range = double(generator.max() - generator.min()) + 1.0;
+        return double(generator() - generator.min()) < probability * range;
+    }
+
+    void deliver(const message& datagram)
+    {
+        ++counters.delivered;
+        log[datagram.peer].push_back(datagram.sequence);
+    }
+
+private:
+    std::minstd_rand generator;
+    double loss;
+    double reorder;
+    bool holding = false;
+    message held{0, 0};
+};
+
+class server
+{
+public:
+    server(const trial::net::executor& executor,
+           const trial::datagram::endpoint& local_endpoint,
+           std::size_t peers)
+        : executor(executor),
+          acceptor(executor, local_endpoint),
+          peers(peers)
+    {
+        accept();
+    }
+
+    const log_type& received() const { return log; }
+    std::size_t accepted() const { return accepted_count; }
+
+    trial::datagram::option::statistics statistics() const
+    {
+        trial::datagram::option::statistics result;
+        acceptor.get_option(result);
+        return result;
+    }
+
+private:
+    void accept()
+    {
+        // No accept is left pending when the acceptor is destroyed
+        if (sockets.size() == peers)
+            return;
+        sockets.emplace_back(new trial::datagram::fake::socket(executor));
+        auto& socket = *sockets.back();
+        acceptor.async_accept(
+            socket,
+            [this, &socket] (boost::system::error_code error)
+            {
+                if (error)
+                    return;
+                ++accepted_count;
+                receive(socket);
+                accept();
+            });
+    }
+
+    void receive(trial::datagram::fake::socket& socket)
+    {
+        socket.async_receive(
+            [this, &socket] (boost::system::error_code error,
+                             trial::datagram::buffer datagram)
+            {
+                if (error)
+                    return;
+                message content{0, 0};
+                check(datagram.size() == sizeof(content), "datagram size");
+                std::memcpy(&content, datagram.data(), std::min(datagram.size(), sizeof(content)));
+                check(content.peer == socket.remote_endpoint().port(), "demultiplexed to the right socket");
+                log[content.peer].push_back(content.sequence);
+                receive(socket);
+            });
+    }
+
+private:
+    trial::net::executor executor;
+    trial::datagram::fake::acceptor acceptor;
+    std::size_t peers;
+    std::size_t accepted_count = 0;
+    std::vector<std::unique_ptr<trial::datagram::fake::socket>> sockets;
+    log_type log;
+};
+
+void stress(std::uint32_t seed,
+            double loss,
+            double reorder)
+{
+    const std::uint32_t peers = 64;
+    const std::uint32_t rounds = 50;
+    const std::uint32_t burst = 4;
+    const std::string scenario = "seed " + std::to_string(seed) + ": ";
+
+    // Datagrams are sent in this order
+    const auto content = [burst] (std::uint32_t round, std::uint32_t i, std::uint32_t peer)
+        {
+            return message{10000 + peer, round * burst + i};
+        };
+    model expected(seed, loss, reorder);
+    for (std::uint32_t round = 0; round < rounds; ++round)
+    {
+        for (std::uint32_t i = 0; i < burst; ++i)
+        {
+            for (std::uint32_t peer = 0; peer < peers; ++peer)
+            {
+                expected.transmit(content(round, i, peer));
+            }
+        }
+    }
+    expected.flush();
+
+    trial::net::io_context io;
+    const auto executor = trial::net::extension::get_executor(io);
+    auto& network = trial::datagram::fake_network::get(executor);
+    network.seed(seed);
+    network.loss(loss);
+    network.reorder(reorder);
+
+    const trial::datagram::endpoint server_endpoint(boost::asio::ip::address_v4(0x0A000001), 5000);
+    {
+        // Peers whose datagrams are all lost are never accepted
+        server receiver(executor, server_endpoint, expected.log.size());
+
+        // Peers are identified by their port
+        std::vector<std::unique_ptr<trial::datagram::fake::socket>> clients;
+        for (std::uint32_t peer = 0; peer < peers; ++peer)
+        {
+            const trial::datagram::endpoint local_endpoint(boost::asio::ip::address_v4(0x0A010001),
+                                                           static_cast<unsigned short>(10000 + peer));
+            clients.emplace_back(new trial::datagram::fake::socket(executor, local_endpoint));
+            clients.back()->async_connect(server_endpoint,
+                                          [] (boost::system::error_code error)
+                                          {
+                                              check(!error, "connect");
+                                          });
+        }
+        drain(io);
+
+        for (std::uint32_t round = 0; round < rounds; ++round)
+        {
+            // Interleave the peers within a burst
+            for (std::uint32_t i = 0; i < burst; ++i)
+            {
+                for (std::uint32_t peer = 0; peer < peers; ++peer)
+                {
+                    const auto datagram = content(round, i, peer);
+                    boost::system::error_code error;
+                    clients[peer]->try_send(boost::asio::buffer(&datagram, sizeof(datagram)), error);
+                    check(!error, "send");
+                }
+            }
+            drain(io);
+        }
+        network.flush();
+        drain(io);
+
+        const auto actual = network.statistics();
+        check(actual.delivered == expected.counters.delivered, scenario + "delivered");
+        check(actual.lost == expected.counters.lost, scenario + "lost");
+        check(actual.reordered == expected.counters.reordered, scenario + "reordered");
+        check(actual.overflowed == 0, scenario + "overflowed");
+        check(actual.delivered + actual.lost == peers * rounds * burst, scenario + "all datagrams accounted for");
+        check(receiver.accepted() == expected.log.size(), scenario + "accepted");
+        check(receiver.received() == expected.log, scenario + "delivery order");
+        check(receiver.statistics().datagrams_received() == actual.delivered, scenario + "datagrams received");
+
+        std::cout << scenario << actual.delivered << " delivered, " << actual.lost << " lost, "
+                  << actual.reordered << " reordered" << std::endl;
+    }
+    drain(io);
+}
+
+void overflow()
+{
+    const std::uint32_t capacity = 8;
+    const std::uint32_t burst = 20;
+
+    trial::net::io_context io;
+    const auto executor = trial::net::extension::get_executor(io);
+    auto& network = trial::datagram::fake_network::get(executor);
+    network.capacity(capacity);
+
+    const trial::datagram::endpoint server_endpoint(boost::asio::ip::address_v4(0x0A000001), 5000);
+    const trial::datagram::endpoint peer_endpoint(boost::asio::ip::address_v4(0x0A010001), 10000);
+    {
+        server receiver(executor, server_endpoint, 1);
+        drain(io);
+
+        // The burst arrives before the server runs
+        for (std::uint32_t sequence = 0; sequence < burst; ++sequence)
+        {
+            const message content{peer_endpoint.port(), sequence};
+            network.inject(peer_endpoint, server_endpoint, &content, sizeof(content));
+        }
+        drain(io);
+
+        const auto actual = network.statistics();
+        check(actual.delivered == capacity, "burst delivered up to capacity");
+        check(actual.overflowed == burst - capacity, "burst overflowed");
+        std::vector<std::uint32_t> first;
+        for (std::uint32_t sequence = 0; sequence < capacity; ++sequence)
+        {
+            first.push_back(sequence);
+        }
+        check(receiver.accepted() == 1, "burst accepted once");
+        check(receiver.received() == log_type{{peer_endpoint.port(), first}}, "burst order");
+
+        std::cout << "overflow: " << actual.delivered << " delivered, "
+                  << actual.overflowed << " overflowed" << std::endl;
+    }
+    drain(io);
+}
+
+} // anonymous namespace
+
+int main()
+{
+    stress(1, 0.0, 0.0);
+    for (std::uint32_t seed : { 1u, 42u, 20161231u })
+    {
+        stress(seed, 0.05, 0.1);
+    }
+    stress(7, 0.3, 0.5);
+    overflow();
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,340 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Checks the local transport between two sockets on separate io_contexts.
+//
+// Ring wrap: bursts that nearly fill a small ring are sent and received many
+// times over, so the positions wrap around the ring, and the datagrams must
+// arrive in order without falling back to UDP.
+//
+// Doorbell: the receiver runs in another thread and blocks, so a datagram in
+// its ring is only noticed via the doorbell.
+//
+// UDP fallback: datagrams larger than a slot, and datagrams that find the
+// ring full, are sent via UDP and still arrive.
+//
+// Peer exit: a child process creates a ring and exits without removing it.
+// Datagrams to its endpoint are then sent via UDP, and a new socket on the
+// endpoint reclaims the ring.
+//
+// Exits with 77, which ctest reports as skipped, if the local transport is
+// unavailable.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <trial/net/io_context.hpp>
+#include <trial/datagram/socket.hpp>
+
+namespace
+{
+
+const int skipped = 77;
+const std::size_t slots = 8;
+const std::size_t slot_size = 256;
+
+int failures = 0;
+
+void check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        ++failures;
+        std::cerr << "FAIL: " << what << std::endl;
+    }
+}
+
+const trial::datagram::option::local_transport transport(true, slots, slot_size);
+
+const trial::datagram::endpoint loopback(boost::asio::ip::address_v4::loopback(), 0);
+
+// Runs both io_contexts until the condition holds
+template <typename Condition>
+bool run_until(trial::net::io_context& first,
+               trial::net::io_context& second,
+               Condition condition)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    first.restart();
+    second.restart();
+    while (!condition())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        first.poll();
+        second.run_one_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+trial::datagram::option::local_transport counters(const trial::datagram::socket& socket)
+{
+    trial::datagram::option::local_transport option;
+    socket.get_option(option);
+    return option;
+}
+
+void send(trial::datagram::socket& sender,
+          std::uint32_t sequence,
+          std::size_t size,
+          std::size_t& sent)
+{
+    std::vector<char> message(size);
+    std::memcpy(message.data(), &sequence, sizeof(sequence));
+    sender.async_send(boost::asio::buffer(message),
+                      [&sent] (const boost::system::error_code& error, std::size_t)
+                      {
+                          check(!error, "send");
+                          ++sent;
+                      });
+}
+
+// Receives count datagrams and returns their sequence numbers
+std::vector<std::uint32_t> receive(trial::net::io_context& io,
+                                   trial::net::io_context& other,
+                                   trial::datagram::socket& receiver,
+                                   std::size_t count)
+{
+    std::vector<std::uint32_t> result;
+    while (result.size() < count)
+    {
+        bool done = false;
+        receiver.async_receive(
+            [&done, &result] (const boost::system::error_code& error, trial::datagram::buffer datagram)
+            {
+                done = true;
+                check(!error, "receive");
+                std::uint32_t sequence = 0;
+                if (datagram.size() >= sizeof(sequence))
+                {
+                    std::memcpy(&sequence, datagram.data(), sizeof(sequence));
+                }
+                result.push_back(sequence);
+            });
+        if (!run_until(io, other, [&done] { return done; }))
+        {
+            check(false, "receive completes");
+            break;
+        }
+    }
+    return result;
+}
+
+// Creates a ring for a local endpoint in a child process, which then exits
+// without removing the ring. Returns the port of the local endpoint.
+unsigned short abandon_ring()
+{
+    int channel[2];
+    if (::pipe(channel) == -1)
+        return 0;
+    const auto child = ::fork();
+    if (child == 0)
+    {
+        ::close(channel[0]);
+        unsigned short port = 0;
+        {
+            trial::net::io_context io;
+            trial::datagram::socket socket(trial::net::extension::get_executor(io), loopback);
+            boost::system::error_code error;
+            socket.set_option(transport, error);
+            if (!error)
+            {
+                port = socket.local_endpoint().port();
+            }
+            if (::write(channel[1], &port, sizeof(port)) != sizeof(port))
+            {
+                ::_exit(1);
+            }
+            // Exit without running destructors
+            ::_exit(0);
+        }
+    }
+    ::close(channel[1]);
+    unsigned short port = 0;
+    if ((child == -1) || (::read(channel[0], &port, sizeof(port)) != sizeof(port)))
+    {
+        port = 0;
+    }
+    ::close(channel[0]);
+    if (child != -1)
+    {
+        int status = 0;
+        ::waitpid(child, &status, 0);
+    }
+    return port;
+}
+
+} // anonymous namespace
+
+int main()
+{
+    // Fork before any io_context exists in this process
+    const auto abandoned_port = abandon_ring();
+
+    trial::net::io_context receiver_io;
+    trial::net::io_context sender_io;
+    // Distinct local endpoints, so each socket has its own UDP socket
+    trial::datagram::socket receiver(trial::net::extension::get_executor(receiver_io), loopback);
+    trial::datagram::socket sender(trial::net::extension::get_executor(sender_io),
+                                   trial::datagram::endpoint(boost::asio::ip::address_v4::any(), 0));
+    boost::system::error_code error;
+    receiver.set_option(transport, error);
+    if (error)
+    {
+        std::cout << "local transport unavailable: " << error.message() << std::endl;
+        return skipped;
+    }
+    sender.set_option(transport);
+
+    int connected = 0;
+    const auto on_connect = [&connected] (const boost::system::error_code& error)
+        {
+            check(!error, "connect");
+            ++connected;
+        };
+    receiver.async_connect(trial::datagram::endpoint(boost::asio::ip::address_v4::loopback(),
+                                                     sender.local_endpoint().port()),
+                           on_connect);
+    sender.async_connect(receiver.local_endpoint(), on_connect);
+    check(run_until(receiver_io, sender_io, [&connected] { return connected == 2; }), "connect completes");
+
+    // Ring wrap
+    const std::size_t burst = slots - 2;
+    const std::size_t rounds = 5;
+    std::uint32_t sequence = 0;
+    std::size_t sent = 0;
+    bool ordered = true;
+    for (std::size_t round = 0; round < rounds; ++round)
+    {
+        const auto first = sequence;
+        for (std::size_t i = 0; i < burst; ++i)
+        {
+            send(sender, sequence++, sizeof(sequence), sent);
+        }
+        check(run_until(receiver_io, sender_io, [&sent, &sequence] { return sent == sequence; }), "burst sent");
+        const auto received = receive(receiver_io, sender_io, receiver, burst);
+        for (std::size_t i = 0; i < received.size(); ++i)
+        {
+            ordered = ordered && (received[i] == first + i);
+        }
+    }
+    check(ordered, "ring delivers in order");
+    auto sending = counters(sender);
+    auto receiving = counters(receiver);
+    check(sending.sent() == burst * rounds, "sent via ring");
+    check(sending.fallbacks() == 0, "no fallback within ring capacity");
+    check(receiving.received() == burst * rounds, "received via ring");
+
+    // Doorbell
+    std::atomic<bool> rung(false);
+    receiver.async_receive(
+        [&rung] (const boost::system::error_code& error, trial::datagram::buffer)
+        {
+            check(!error, "receive after doorbell");
+            rung = true;
+        });
+    receiver_io.restart();
+    std::thread waiter([&receiver_io, &rung]
+                       {
+                           const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+                           while (!rung && (std::chrono::steady_clock::now() < deadline))
+                           {
+                               receiver_io.run_one_for(std::chrono::milliseconds(100));
+                           }
+                       });
+    // Let the receiver block
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const auto before_bell = sent;
+    send(sender, sequence++, sizeof(sequence), sent);
+    sender_io.restart();
+    while (sent == before_bell)
+    {
+        sender_io.run_one_for(std::chrono::milliseconds(100));
+    }
+    waiter.join();
+    check(rung, "doorbell wakes receiver");
+    check(counters(receiver).received() == burst * rounds + 1, "doorbell datagram via ring");
+
+    // UDP fallback for an oversized datagram and for a full ring
+    const auto before_fallback = sent;
+    send(sender, sequence++, slot_size + 1, sent);
+    const std::size_t overflow = slots + 3;
+    for (std::size_t i = 0; i < overflow; ++i)
+    {
+        send(sender, sequence++, sizeof(sequence), sent);
+    }
+    check(run_until(receiver_io, sender_io, [&sent, before_fallback, overflow] { return sent == before_fallback + 1 + overflow; }),
+          "fallback sent");
+    // Datagrams via UDP may overtake those in the ring
+    const auto received = receive(receiver_io, sender_io, receiver, 1 + overflow);
+    const std::set<std::uint32_t> unique(received.begin(), received.end());
+    check((unique.size() == 1 + overflow) &&
+          (*unique.begin() == sequence - 1 - overflow) &&
+          (*unique.rbegin() == sequence - 1),
+          "fallback datagrams received");
+    sending = counters(sender);
+    check(sending.fallbacks() == 1 + overflow - slots, "fallback counted");
+    check(sending.sent() == burst * rounds + 1 + slots, "ring filled");
+
+    // Peer exit
+    check(abandoned_port != 0, "child creates ring");
+    if (abandoned_port != 0)
+    {
+        const trial::datagram::endpoint abandoned(boost::asio::ip::address_v4::loopback(), abandoned_port);
+        boost::asio::ip::udp::socket plain(sender_io, abandoned);
+        // Shares the local endpoint, and thereby the ring, of the sender
+        trial::datagram::socket exit_sender(trial::net::extension::get_executor(sender_io),
+                                            trial::datagram::endpoint(boost::asio::ip::address_v4::any(), 0));
+        exit_sender.async_connect(abandoned, on_connect);
+        check(run_until(receiver_io, sender_io, [&connected] { return connected == 3; }), "connect to exited peer");
+        const auto before_exit = counters(sender).sent();
+        bool plain_sent = false;
+        const std::string message = "exit";
+        exit_sender.async_send(boost::asio::buffer(message),
+                               [&plain_sent] (const boost::system::error_code& error, std::size_t)
+                               {
+                                   check(!error, "send to exited peer");
+                                   plain_sent = true;
+                               });
+        check(run_until(receiver_io, sender_io, [&plain_sent] { return plain_sent; }), "send to exited peer completes");
+        std::vector<char> input(64);
+        plain.non_blocking(true);
+        std::size_t length = 0;
+        check(run_until(receiver_io, sender_io,
+                        [&plain, &input, &length]
+                        {
+                            boost::system::error_code ignored;
+                            length = plain.receive(boost::asio::buffer(input), 0, ignored);
+                            return length > 0;
+                        }),
+              "exited peer reached via UDP");
+        check(std::string(input.data(), length) == message, "exited peer content");
+        check(counters(sender).sent() == before_exit, "exited peer not sent via ring");
+        plain.close();
+
+        trial::datagram::socket successor(trial::net::extension::get_executor(receiver_io), abandoned);
+        successor.set_option(transport, error);
+        check(!error, "ring of exited peer reclaimed");
+    }
+
+    std::cout << counters(receiver).received() << " datagrams received via ring, "
+              << counters(sender).fallbacks() << " fallbacks" << std::endl;
+    return (failures == 0) ? 0 : 1;
+}
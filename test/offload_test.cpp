@@ -0,0 +1,184 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Checks segmentation offload over loopback.
+//
+// A socket sends a buffer as segments (UDP_SEGMENT) to a socket that has
+// enabled receive offload (UDP_GRO). Loopback keeps the segments together,
+// so the receiver reads them as one coalesced datagram, which is split into
+// the original datagrams. These must arrive in order with their content
+// intact. Segments share the storage of the coalesced datagram, so with the
+// default receive strategy the buffer pool hands out a single buffer.
+//
+// The exchange is repeated with batched receives.
+//
+// Exits with 77, which ctest reports as skipped, if offload is unavailable.
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <trial/net/io_context.hpp>
+#include <trial/datagram/socket.hpp>
+
+namespace
+{
+
+const int skipped = 77;
+const std::size_t segment_size = 1000;
+const std::size_t payload_size = 4 * segment_size + segment_size / 2;
+
+int failures = 0;
+
+void check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        ++failures;
+        std::cerr << "FAIL: " << what << std::endl;
+    }
+}
+
+template <typename Condition>
+bool run_until(trial::net::io_context& io,
+               Condition condition)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    io.restart();
+    while (!condition())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        io.run_one_for(std::chrono::milliseconds(100));
+    }
+    return true;
+}
+
+// Bytes differ between segments and between neighbouring positions
+char pattern(std::size_t round, std::size_t position)
+{
+    return static_cast<char>((position / segment_size) * 31 + position + round);
+}
+
+// Returns false if offload is unavailable
+bool exchange(trial::net::io_context& io,
+              trial::datagram::socket& sender,
+              trial::datagram::socket& receiver,
+              std::size_t round,
+              bool single_buffer)
+{
+    std::vector<char> payload(payload_size);
+    for (std::size_t i = 0; i < payload.size(); ++i)
+    {
+        payload[i] = pattern(round, i);
+    }
+    bool sent = false;
+    boost::system::error_code send_error;
+    sender.async_send_segments(boost::asio::buffer(payload),
+                               segment_size,
+                               [&sent, &send_error] (const boost::system::error_code& error, std::size_t)
+                               {
+                                   sent = true;
+                                   send_error = error;
+                               });
+    check(run_until(io, [&sent] { return sent; }), "send completes");
+    if (send_error == boost::asio::error::operation_not_supported)
+        return false;
+    check(!send_error, "send");
+
+    // The first receive reads the coalesced datagram and queues the rest
+    std::size_t position = 0;
+    std::size_t segments = 0;
+    while (position < payload_size)
+    {
+        bool done = false;
+        receiver.async_receive(
+            [&] (const boost::system::error_code& error, trial::datagram::buffer datagram)
+            {
+                done = true;
+                check(!error, "receive");
+                check(!datagram.truncated(), "not truncated");
+                const auto expected = std::min(segment_size, payload_size - position);
+                check(datagram.size() == expected, "segment size");
+                for (std::size_t i = 0; (i < datagram.size()) && (i < expected); ++i)
+                {
+                    if (datagram.data()[i] != pattern(round, position + i))
+                    {
+                        check(false, "segment content");
+                        break;
+                    }
+                }
+                position += datagram.size();
+                ++segments;
+            });
+        if (!run_until(io, [&done] { return done; }))
+        {
+            check(false, "receive completes");
+            break;
+        }
+    }
+    check(segments == (payload_size + segment_size - 1) / segment_size, "segment count");
+
+    if (single_buffer)
+    {
+        trial::datagram::option::buffer_pool option;
+        receiver.get_option(option);
+        check(option.peak_buffers() == 1, "segments share the coalesced buffer");
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+int main()
+{
+    trial::net::io_context io;
+    const auto executor = trial::net::extension::get_executor(io);
+    // Distinct local endpoints, so each socket has its own UDP socket
+    trial::datagram::socket receiver(executor, trial::datagram::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    trial::datagram::socket sender(executor, trial::datagram::endpoint(boost::asio::ip::address_v4::any(), 0));
+
+    boost::system::error_code error;
+    receiver.set_option(trial::datagram::option::receive_offload(true), error);
+    if (error)
+    {
+        std::cout << "receive offload unavailable: " << error.message() << std::endl;
+        return skipped;
+    }
+
+    int connected = 0;
+    const auto on_connect = [&connected] (const boost::system::error_code& error)
+        {
+            check(!error, "connect");
+            ++connected;
+        };
+    receiver.async_connect(trial::datagram::endpoint(boost::asio::ip::address_v4::loopback(),
+                                                     sender.local_endpoint().port()),
+                           on_connect);
+    sender.async_connect(receiver.local_endpoint(), on_connect);
+    check(run_until(io, [&connected] { return connected == 2; }), "connect completes");
+
+    if (!exchange(io, sender, receiver, 0, true))
+    {
+        std::cout << "send offload unavailable" << std::endl;
+        return skipped;
+    }
+
+    receiver.set_option(trial::datagram::option::receive_batch(4, 65536));
+    exchange(io, sender, receiver, 1, false);
+
+    trial::datagram::option::statistics statistics;
+    receiver.get_option(statistics);
+    std::cout << statistics.datagrams_received() << " datagrams received as segments" << std::endl;
+    return (failures == 0) ? 0 : 1;
+}
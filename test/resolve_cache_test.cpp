@@ -0,0 +1,165 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Checks the resolve cache that async_connect() uses for host names.
+//
+// The sockets connect to localhost, which is resolved via /etc/hosts rather
+// than DNS. The counters of the cache are checked after a miss, a hit, two
+// coalesced requests, and a request whose entry has expired. The handler of
+// the coalesced request is bound to another io_context, and must run there.
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <trial/net/io_context.hpp>
+#include <trial/datagram/socket.hpp>
+
+namespace
+{
+
+int failures = 0;
+
+void check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        ++failures;
+        std::cerr << "FAIL: " << what << std::endl;
+    }
+}
+
+struct counters
+{
+    std::size_t hits;
+    std::size_t misses;
+    std::size_t coalesced;
+};
+
+counters get_counters(const trial::datagram::socket& socket)
+{
+    trial::datagram::option::resolve_cache option;
+    socket.get_option(option);
+    return counters{option.hits(), option.misses(), option.coalesced()};
+}
+
+void set_ttl(trial::datagram::socket& socket,
+             std::chrono::steady_clock::duration ttl)
+{
+    // A zero time-to-live clears the cache
+    socket.set_option(trial::datagram::option::resolve_cache());
+    socket.set_option(trial::datagram::option::resolve_cache(ttl));
+}
+
+std::unique_ptr<trial::datagram::socket> make_socket(trial::net::io_context& io)
+{
+    std::unique_ptr<trial::datagram::socket> socket(
+        new trial::datagram::socket(trial::net::extension::get_executor(io),
+                                    trial::datagram::endpoint(boost::asio::ip::address_v4::loopback(), 0)));
+    socket->set_option(trial::datagram::option::address_family(trial::datagram::option::address_family::ipv4));
+    return socket;
+}
+
+// Connects to localhost and runs the io_context until the handler is done
+boost::system::error_code connect(trial::net::io_context& io,
+                                  trial::datagram::socket& socket,
+                                  const std::string& service)
+{
+    boost::system::error_code result = boost::asio::error::would_block;
+    socket.async_connect("localhost",
+                         service,
+                         [&result] (const boost::system::error_code& error)
+                         {
+                             result = error;
+                         });
+    io.restart();
+    io.run();
+    return result;
+}
+
+} // anonymous namespace
+
+int main()
+{
+    const std::string service = "7777";
+    const trial::datagram::endpoint remote(boost::asio::ip::address_v4::loopback(), 7777);
+
+    trial::net::io_context io;
+    trial::net::io_context other;
+    auto first = make_socket(io);
+    auto second = make_socket(io);
+
+    // Miss and hit
+    set_ttl(*first, std::chrono::seconds(60));
+    auto before = get_counters(*first);
+    check(!connect(io, *first, service), "first connect");
+    check(first->remote_endpoint() == remote, "first remote endpoint");
+    auto after = get_counters(*first);
+    check(after.misses == before.misses + 1, "miss on first lookup");
+    check(after.hits == before.hits, "no hit on first lookup");
+
+    before = after;
+    check(!connect(io, *second, service), "second connect");
+    check(second->remote_endpoint() == remote, "second remote endpoint");
+    after = get_counters(*first);
+    check(after.hits == before.hits + 1, "hit on second lookup");
+    check(after.misses == before.misses, "no miss on second lookup");
+
+    // Coalesced requests
+    set_ttl(*first, std::chrono::seconds(60));
+    before = get_counters(*first);
+    boost::system::error_code first_result = boost::asio::error::would_block;
+    boost::system::error_code second_result = boost::asio::error::would_block;
+    bool second_on_other = false;
+    first->async_connect("localhost",
+                         service,
+                         [&first_result] (const boost::system::error_code& error)
+                         {
+                             first_result = error;
+                         });
+    second->async_connect("localhost",
+                          service,
+                          boost::asio::bind_executor(
+                              other,
+                              [&second_result, &second_on_other, &other] (const boost::system::error_code& error)
+                              {
+                                  second_result = error;
+                                  second_on_other = other.get_executor().running_in_this_thread();
+                              }));
+    io.restart();
+    io.run();
+    check(!first_result, "first coalesced connect");
+    check(second_result == boost::asio::error::would_block, "coalesced handler waits for its executor");
+    other.run();
+    check(!second_result, "second coalesced connect");
+    check(second_on_other, "coalesced handler runs on its executor");
+    after = get_counters(*first);
+    check(after.misses == before.misses + 1, "one miss for coalesced lookups");
+    check(after.coalesced == before.coalesced + 1, "coalesced lookup");
+
+    // Expiry
+    set_ttl(*first, std::chrono::milliseconds(50));
+    before = get_counters(*first);
+    check(!connect(io, *first, service), "connect before expiry");
+    check(!connect(io, *second, service), "connect within time-to-live");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    check(!connect(io, *first, service), "connect after expiry");
+    after = get_counters(*first);
+    check(after.misses == before.misses + 2, "miss after expiry");
+    check(after.hits == before.hits + 1, "hit within time-to-live");
+
+    std::cout << after.hits << " hits, " << after.misses << " misses, "
+              << after.coalesced << " coalesced" << std::endl;
+    return (failures == 0) ? 0 : 1;
+}
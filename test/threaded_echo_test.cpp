@@ -0,0 +1,377 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Checks that the handlers of a socket are serialized by a strand when the
+// io_context is run by several threads.
+//
+// Every client sends a sequence of numbered datagrams and waits for each
+// echo before sending the next. Lost datagrams are retransmitted.
+//
+// Each server session binds its handlers to its own strand. The receive
+// handler starts the echo and the next receive before it returns, so the
+// send and receive completions race with it. The test fails if a handler of
+// a session is entered while another one is running, or if a session
+// receives a sequence number lower than one it has already received.
+//
+// With workers, the sessions run on executors of their own and receive
+// their datagrams via worker delivery.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <trial/net/io_context.hpp>
+#include <trial/datagram/acceptor.hpp>
+#include <trial/datagram/socket.hpp>
+
+// Violations detected by all sessions
+struct violations
+{
+    std::atomic<int> concurrent{0};
+    std::atomic<int> reordered{0};
+};
+
+class session : public std::enable_shared_from_this<session>
+{
+    using message_type = std::vector<char>;
+
+    // Detects a handler that is entered while another one is running
+    class entry_guard
+    {
+    public:
+        entry_guard(session& self)
+            : self(self)
+        {
+            if (self.busy.exchange(true))
+            {
+                ++self.found.concurrent;
+            }
+        }
+
+        ~entry_guard()
+        {
+            self.busy = false;
+        }
+
+    private:
+        session& self;
+    };
+
+public:
+    session(std::shared_ptr<trial::datagram::socket> socket,
+            violations& found)
+        : socket(socket),
+          strand(boost::asio::make_strand(trial::net::extension::get_executor(*socket))),
+          found(found)
+    {
+    }
+
+    void start()
+    {
+        do_receive();
+    }
+
+private:
+    void do_receive()
+    {
+        auto self(shared_from_this());
+        std::shared_ptr<message_type> message = std::make_shared<message_type>(1400);
+        socket->async_receive(boost::asio::buffer(*message),
+                              boost::asio::bind_executor(
+                                  strand,
+                                  [self, message] (boost::system::error_code error,
+                                                   std::size_t length)
+                                  {
+                                      entry_guard guard(*self);
+                                      if (!error)
+                                      {
+                                          self->process_receive(message, length);
+                                      }
+                                  }));
+    }
+
+    void process_receive(std::shared_ptr<message_type> message,
+                         std::size_t length)
+    {
+        int current = -1;
+        if (length >= sizeof(current))
+        {
+            std::memcpy(&current, message->data(), sizeof(current));
+        }
+        // Retransmissions may repeat, but never precede, a sequence number
+        if (current < sequence)
+        {
+            ++found.reordered;
+        }
+        sequence = current;
+
+        do_send(message, length);
+        do_receive();
+        // Widen the window for completions on other threads
+        std::this_thread::yield();
+    }
+
+    void do_send(std::shared_ptr<message_type> message,
+                 std::size_t length)
+    {
+        auto self(shared_from_this());
+        socket->async_send(boost::asio::buffer(*message, length),
+                           boost::asio::bind_executor(
+                               strand,
+                               [self, message] (boost::system::error_code,
+                                                std::size_t)
+                               {
+                                   entry_guard guard(*self);
+                                   std::this_thread::yield();
+                               }));
+    }
+
+private:
+    std::shared_ptr<trial::datagram::socket> socket;
+    boost::asio::strand<trial::net::executor> strand;
+    violations& found;
+    std::atomic<bool> busy{false};
+    int sequence = 0;
+};
+
+class server
+{
+public:
+    server(trial::net::io_context& io,
+           const trial::datagram::endpoint& local_endpoint,
+           std::vector<trial::net::executor> workers,
+           violations& found)
+        : acceptor(trial::net::extension::get_executor(io), local_endpoint),
+          workers(std::move(workers)),
+          found(found)
+    {
+        if (!this->workers.empty())
+        {
+            acceptor.set_option(trial::datagram::option::worker_delivery(true));
+        }
+        do_accept();
+    }
+
+    trial::datagram::endpoint local_endpoint() const
+    {
+        return acceptor.local_endpoint();
+    }
+
+    std::size_t worker_delivered() const
+    {
+        trial::datagram::option::worker_delivery option;
+        acceptor.get_option(option);
+        return option.delivered();
+    }
+
+private:
+    void do_accept()
+    {
+        auto executor = workers.empty()
+            ? trial::net::extension::get_executor(acceptor)
+            : workers[accepted++ % workers.size()];
+        auto socket = std::make_shared<trial::datagram::socket>(executor);
+        acceptor.async_accept(*socket,
+                              [this, socket] (boost::system::error_code error)
+                              {
+                                  if (!error)
+                                  {
+                                      std::make_shared<session>(socket, found)->start();
+                                      do_accept();
+                                  }
+                              });
+    }
+
+private:
+    trial::datagram::acceptor acceptor;
+    const std::vector<trial::net::executor> workers;
+    std::size_t accepted = 0;
+    violations& found;
+};
+
+class client : public std::enable_shared_from_this<client>
+{
+public:
+    client(trial::net::io_context& io,
+           const boost::asio::ip::udp::endpoint& server_endpoint,
+           int rounds,
+           std::atomic<int>& completed)
+        : strand(boost::asio::make_strand(io)),
+          socket(strand, boost::asio::ip::udp::endpoint(server_endpoint.address(), 0)),
+          timer(strand),
+          server_endpoint(server_endpoint),
+          rounds(rounds),
+          completed(completed)
+    {
+    }
+
+    void start()
+    {
+        do_receive();
+        do_send();
+    }
+
+private:
+    void do_send()
+    {
+        std::memcpy(output, &sequence, sizeof(sequence));
+        socket.send_to(boost::asio::buffer(output), server_endpoint);
+
+        // Retransmit if the echo does not arrive in time
+        auto self(shared_from_this());
+        const int current = sequence;
+        timer.expires_after(std::chrono::milliseconds(500));
+        timer.async_wait([self, current] (boost::system::error_code error)
+                         {
+                             if (!error && (self->sequence == current))
+                             {
+                                 self->do_send();
+                             }
+                         });
+    }
+
+    void do_receive()
+    {
+        auto self(shared_from_this());
+        socket.async_receive(boost::asio::buffer(input),
+                             [self] (boost::system::error_code error,
+                                     std::size_t length)
+                             {
+                                 if (error)
+                                     return;
+                                 self->process_receive(length);
+                             });
+    }
+
+    void process_receive(std::size_t length)
+    {
+        int echo = -1;
+        if (length == sizeof(output))
+        {
+            std::memcpy(&echo, input, sizeof(echo));
+        }
+        if (echo == sequence)
+        {
+            if (++sequence == rounds)
+            {
+                timer.cancel();
+                ++completed;
+                return;
+            }
+            do_send();
+        }
+        // Ignore duplicates caused by retransmission
+        do_receive();
+    }
+
+private:
+    // Serializes the socket and timer handlers of the client
+    boost::asio::strand<trial::net::io_context::executor_type> strand;
+    boost::asio::ip::udp::socket socket;
+    boost::asio::steady_timer timer;
+    boost::asio::ip::udp::endpoint server_endpoint;
+    const int rounds;
+    std::atomic<int>& completed;
+    int sequence = 0;
+    char output[64] = {};
+    char input[64];
+};
+
+int main(int argc, char *argv[])
+{
+    if ((argc != 4) && (argc != 5))
+    {
+        std::cerr << "Usage: " << argv[0] << " <threads> <clients> <rounds> [<workers>]" << std::endl;
+        return 1;
+    }
+    const auto thread_count = std::max(1, std::atoi(argv[1]));
+    const auto client_count = std::max(1, std::atoi(argv[2]));
+    const auto rounds = std::max(1, std::atoi(argv[3]));
+    const auto worker_count = (argc == 5) ? std::max(0, std::atoi(argv[4])) : 0;
+
+    // Each worker has its own io_context and thread. Sends that are pending
+    // on the main io_context hold work on the workers, so they outlive it.
+    std::vector<std::unique_ptr<trial::net::io_context>> worker_contexts;
+    trial::net::io_context io;
+    std::vector<trial::net::executor> workers;
+    for (int i = 0; i < worker_count; ++i)
+    {
+        worker_contexts.emplace_back(new trial::net::io_context);
+        workers.push_back(trial::net::extension::get_executor(*worker_contexts.back()));
+    }
+    violations found;
+    server s(io, trial::datagram::endpoint(boost::asio::ip::address_v4::loopback(), 0), workers, found);
+
+    std::atomic<int> completed(0);
+    for (int i = 0; i < client_count; ++i)
+    {
+        std::make_shared<client>(io, s.local_endpoint(), rounds, completed)->start();
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_count; ++i)
+    {
+        threads.emplace_back([&io, &completed, client_count]
+                             {
+                                 while ((completed < client_count) && !io.stopped())
+                                 {
+                                     io.run_for(std::chrono::milliseconds(100));
+                                 }
+                                 io.stop();
+                             });
+    }
+    // Workers run until the sessions are done
+    std::vector<std::thread> worker_threads;
+    std::vector<boost::asio::executor_work_guard<trial::net::io_context::executor_type>> worker_guards;
+    for (auto& context : worker_contexts)
+    {
+        auto worker = context.get();
+        worker_guards.push_back(boost::asio::make_work_guard(*worker));
+        worker_threads.emplace_back([worker] { worker->run(); });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    for (auto& context : worker_contexts)
+    {
+        context->stop();
+    }
+    for (auto& thread : worker_threads)
+    {
+        thread.join();
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    std::cout << completed << " of " << client_count << " clients completed "
+              << rounds << " rounds in " << elapsed.count() << " ms" << std::endl;
+    std::cout << found.concurrent << " concurrent handler entries, "
+              << found.reordered << " reordered datagrams" << std::endl;
+    const auto delivered = s.worker_delivered();
+    if (worker_count > 0)
+    {
+        std::cout << delivered << " datagrams delivered by " << worker_count << " workers" << std::endl;
+    }
+    const bool success = (completed == client_count) && (found.concurrent == 0) && (found.reordered == 0) &&
+        ((worker_count == 0) || (delivered > 0));
+    return success ? 0 : 1;
+}
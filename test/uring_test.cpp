@@ -0,0 +1,215 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2016 Bjorn Reese <breese@users.sourceforge.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Checks the io_uring backend over loopback.
+//
+// A socket with a small ring of provided buffers receives bursts that are
+// larger than the ring, so the multishot receive runs out of buffers and
+// must be re-armed after they are recycled. The datagrams must arrive in
+// order. The socket then sends to the peer, truncates a datagram that is
+// larger than a provided buffer, cancels a pending receive and receives
+// again, and is destroyed while a receive is pending.
+//
+// Exits with 77, which ctest reports as skipped, if io_uring is unavailable.
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <trial/net/io_context.hpp>
+#include <trial/datagram/socket.hpp>
+
+namespace
+{
+
+const int skipped = 77;
+const std::size_t ring_count = 8;
+const std::size_t ring_size = 256;
+
+int failures = 0;
+
+void check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        ++failures;
+        std::cerr << "FAIL: " << what << std::endl;
+    }
+}
+
+template <typename Condition>
+bool run_until(trial::net::io_context& io,
+               Condition condition)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    io.restart();
+    while (!condition())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        io.run_one_for(std::chrono::milliseconds(100));
+    }
+    return true;
+}
+
+void send_sequence(boost::asio::ip::udp::socket& peer,
+                   const trial::datagram::endpoint& remote,
+                   std::uint32_t first,
+                   std::uint32_t count)
+{
+    for (std::uint32_t sequence = first; sequence < first + count; ++sequence)
+    {
+        peer.send_to(boost::asio::buffer(&sequence, sizeof(sequence)), remote);
+    }
+}
+
+} // anonymous namespace
+
+int main()
+{
+    const trial::datagram::endpoint loopback(boost::asio::ip::address_v4::loopback(), 0);
+
+    trial::net::io_context io;
+    boost::asio::ip::udp::socket peer(io, loopback);
+    std::unique_ptr<trial::datagram::socket> socket;
+    try
+    {
+        socket.reset(new trial::datagram::socket(trial::net::extension::get_executor(io),
+                                                 loopback,
+                                                 trial::datagram::option::io_backend(trial::datagram::option::io_backend::uring,
+                                                                                     ring_count,
+                                                                                     ring_size)));
+    }
+    catch (const boost::system::system_error& ex)
+    {
+        std::cout << "io_uring unavailable: " << ex.code().message() << std::endl;
+        return skipped;
+    }
+    const auto local = socket->local_endpoint();
+    bool connected = false;
+    socket->async_connect(peer.local_endpoint(),
+                          [&connected] (const boost::system::error_code& error)
+                          {
+                              check(!error, "connect");
+                              connected = true;
+                          });
+    check(run_until(io, [&connected] { return connected; }), "connect completes");
+
+    // Bursts that exceed the provided buffers
+    const std::uint32_t bursts = 8;
+    const std::uint32_t burst_size = 3 * ring_count;
+    std::uint32_t expected = 0;
+    std::uint32_t received = 0;
+    for (std::uint32_t burst = 0; burst < bursts; ++burst)
+    {
+        send_sequence(peer, local, burst * burst_size, burst_size);
+        const std::uint32_t target = received + burst_size;
+        while (received < target)
+        {
+            bool done = false;
+            socket->async_receive(
+                [&done, &expected, &received] (const boost::system::error_code& error,
+                                               trial::datagram::buffer datagram)
+                {
+                    done = true;
+                    check(!error, "receive");
+                    std::uint32_t sequence = 0;
+                    if (datagram.size() == sizeof(sequence))
+                    {
+                        std::memcpy(&sequence, datagram.data(), sizeof(sequence));
+                    }
+                    check(sequence == expected, "receive order");
+                    expected = sequence + 1;
+                    ++received;
+                });
+            if (!run_until(io, [&done] { return done; }))
+            {
+                check(false, "receive completes");
+                break;
+            }
+        }
+    }
+    check(received == bursts * burst_size, "all datagrams received");
+
+    // Send
+    const std::string message = "uring";
+    std::size_t sent = 0;
+    socket->async_send(boost::asio::buffer(message),
+                       [&sent] (const boost::system::error_code& error, std::size_t length)
+                       {
+                           check(!error, "send");
+                           sent = length;
+                       });
+    check(run_until(io, [&sent] { return sent > 0; }), "send completes");
+    check(sent == message.size(), "send length");
+    std::vector<char> input(64);
+    trial::datagram::endpoint sender;
+    const auto length = peer.receive_from(boost::asio::buffer(input), sender);
+    check(std::string(input.data(), length) == message, "peer receives");
+    check(sender == local, "peer receives from local endpoint");
+
+    // Truncation is reported by the owned buffer
+    std::vector<char> oversized(2 * ring_size, 'x');
+    peer.send_to(boost::asio::buffer(oversized), local);
+    bool truncated = false;
+    socket->async_receive(
+        [&truncated] (const boost::system::error_code& error, trial::datagram::buffer datagram)
+        {
+            check(!error, "receive oversized");
+            truncated = datagram.truncated() && (datagram.size() == ring_size);
+        });
+    check(run_until(io, [&truncated] { return truncated; }), "oversized datagram truncated");
+
+    // Cancel, then receive again
+    bool cancel_done = false;
+    boost::system::error_code cancelled;
+    socket->async_receive(
+        [&cancel_done, &cancelled] (const boost::system::error_code& error, trial::datagram::buffer)
+        {
+            cancel_done = true;
+            cancelled = error;
+        });
+    io.restart();
+    io.poll();
+    socket->cancel();
+    check(run_until(io, [&cancel_done] { return cancel_done; }), "cancel completes");
+    check(cancelled == boost::asio::error::operation_aborted, "cancel aborts receive");
+    send_sequence(peer, local, 0, 1);
+    bool after_cancel = false;
+    socket->async_receive(
+        [&after_cancel] (const boost::system::error_code& error, trial::datagram::buffer datagram)
+        {
+            after_cancel = !error && (datagram.size() == sizeof(std::uint32_t));
+        });
+    check(run_until(io, [&after_cancel] { return after_cancel; }), "receive after cancel");
+
+    // Destroy with a pending receive, and then deliver a datagram to it
+    bool invoked = false;
+    socket->async_receive(
+        [&invoked] (const boost::system::error_code&, trial::datagram::buffer)
+        {
+            invoked = true;
+        });
+    io.restart();
+    io.poll();
+    socket.reset();
+    send_sequence(peer, local, 0, 1);
+    io.restart();
+    io.run_for(std::chrono::milliseconds(100));
+    check(!invoked, "no delivery after destruction");
+
+    std::cout << received << " datagrams received with " << ring_count << " provided buffers" << std::endl;
+    return (failures == 0) ? 0 : 1;
+}